@@ -776,7 +776,7 @@ int dladdr(const void* addr, Dl_info* info)
             info->dli_sname = "__dso_handle";
             info->dli_saddr = info->dli_fbase;
         }
-        else if ( ml->findClosestSymbol((long)addr, &(info->dli_sname), &symbolAddr) ) {
+        else if ( gAllImages.findClosestSymbol(ml, addr, &(info->dli_sname), &symbolAddr) ) {
             info->dli_saddr = (void*)(long)symbolAddr;
             // never return the mach_header symbol
             if ( info->dli_saddr == info->dli_fbase ) {
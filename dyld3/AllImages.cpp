@@ -183,6 +183,127 @@ void AllImages::withWriteLock(void (^work)())
 #endif
 }
 
+// Lookups which only need the list of loaded images read an immutable snapshot of _loadedImages
+// instead of taking _globalLock, so they never wait on a dlopen()/dlclose() in another thread.
+// A reader registers in one of two counters, selected by the current epoch.  Each time a writer publishes a
+// new snapshot it advances the epoch, so the counter older readers registered in drains.  A retired snapshot
+// is freed once each counter has been seen at zero after it was retired, because no reader which registers
+// after the swap can see it.
+// runs work() on the latest snapshot, which stays allocated until work() returns.  Returns false if nothing is published yet
+bool AllImages::withImageListSnapshot(void (^work)(const ImageListSnapshot* snapshot)) const
+{
+    uint64_t epoch;
+    while ( true ) {
+        epoch = _snapshotEpoch.load(std::memory_order_seq_cst);
+        _snapshotReaders[epoch & 1].fetch_add(1, std::memory_order_seq_cst);
+        if ( _snapshotEpoch.load(std::memory_order_seq_cst) == epoch )
+            break;
+        _snapshotReaders[epoch & 1].fetch_sub(1, std::memory_order_seq_cst);
+    }
+    const ImageListSnapshot* snapshot = _imageListSnapshot.load(std::memory_order_seq_cst);
+    if ( snapshot != nullptr )
+        work(snapshot);
+    _snapshotReaders[epoch & 1].fetch_sub(1, std::memory_order_release);
+    return (snapshot != nullptr);
+}
+
+void AllImages::withImageListSnapshot(void (^work)(const Array<LoadedImage>& images, uintptr_t lowestNonCached, uintptr_t highestNonCached)) const
+{
+    bool published = withImageListSnapshot(^(const ImageListSnapshot* snapshot) {
+        const Array<LoadedImage> images((LoadedImage*)snapshot->images(), snapshot->count, snapshot->count);
+        work(images, snapshot->lowestNonCached, snapshot->highestNonCached);
+    });
+
+    // nothing published yet, so fall back to the lock
+    if ( !published ) {
+        withReadLock(^{
+            work(_loadedImages.array(), _lowestNonCached, _highestNonCached);
+        });
+    }
+}
+
+void AllImages::withImageListSnapshot(void (^work)(const Array<LoadedImage>& images)) const
+{
+    withImageListSnapshot(^(const Array<LoadedImage>& images, uintptr_t lowestNonCached, uintptr_t highestNonCached) {
+        work(images);
+    });
+}
+
+// must be called with writeLock held, after any change to _loadedImages which snapshot readers need to see
+void AllImages::publishImageListSnapshot()
+{
+    const uintptr_t    imageCount = _loadedImages.count();
+    ImageListSnapshot* snapshot   = (ImageListSnapshot*)::malloc(sizeof(ImageListSnapshot) + (sizeof(LoadedImage) + sizeof(ClosestSymbolSlot))*imageCount);
+    snapshot->lowestNonCached  = _lowestNonCached;
+    snapshot->highestNonCached = _highestNonCached;
+    snapshot->count            = imageCount;
+    if ( imageCount != 0 )
+        ::memcpy((void*)snapshot->images(), &_loadedImages[0], sizeof(LoadedImage)*imageCount);
+
+    // dladdr() state is per image, sorted by address so lookups can binary search it
+    STACK_ALLOC_ARRAY(const MachOLoaded*, loadAddresses, imageCount);
+    for (const LoadedImage& li : _loadedImages)
+        loadAddresses.push_back(li.loadedAddress());
+    std::sort(loadAddresses.begin(), loadAddresses.end());
+    ClosestSymbolSlot* slots = snapshot->closestSymbolSlots();
+    for (uintptr_t i=0; i < imageCount; ++i) {
+        new (&slots[i]) ClosestSymbolSlot();
+        slots[i].loadAddress = loadAddresses[i];
+        slots[i].lookupCount.store(0, std::memory_order_relaxed);
+        slots[i].index.store(nullptr, std::memory_order_relaxed);
+        slots[i].carried = false;
+    }
+
+    // images still loaded keep their dladdr() state.  Both lists are sorted, so walk them together
+    const ImageListSnapshot* oldSnapshot = _imageListSnapshot.load(std::memory_order_seq_cst);
+    if ( oldSnapshot != nullptr ) {
+        ClosestSymbolSlot* oldSlots = oldSnapshot->closestSymbolSlots();
+        uintptr_t i = 0;
+        for (uintptr_t j=0; j < oldSnapshot->count; ++j) {
+            while ( (i < imageCount) && (slots[i].loadAddress < oldSlots[j].loadAddress) )
+                ++i;
+            if ( (i == imageCount) || (slots[i].loadAddress != oldSlots[j].loadAddress) )
+                continue;
+            // a reader may still publish an index in the old slot after this, in which case the old snapshot keeps it
+            const MachOLoaded::ClosestSymbolIndex* index = oldSlots[j].index.load(std::memory_order_acquire);
+            slots[i].lookupCount.store(oldSlots[j].lookupCount.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            slots[i].index.store(index, std::memory_order_relaxed);
+            oldSlots[j].carried = (index != nullptr);
+        }
+    }
+
+    oldSnapshot = _imageListSnapshot.exchange(snapshot, std::memory_order_seq_cst);
+    _snapshotEpoch.fetch_add(1, std::memory_order_seq_cst);
+    if ( oldSnapshot != nullptr )
+        _retiredSnapshots.push_back({ oldSnapshot, { false, false } });
+
+    // free any retired snapshots no reader can still be using
+    for (uintptr_t i=_retiredSnapshots.count(); i > 0; --i) {
+        RetiredSnapshot& retired = _retiredSnapshots[i-1];
+        for (int slot=0; slot < 2; ++slot) {
+            if ( _snapshotReaders[slot].load(std::memory_order_seq_cst) == 0 )
+                retired.drained[slot] = true;
+        }
+        if ( retired.drained[0] && retired.drained[1] ) {
+            freeImageListSnapshot(retired.snapshot);
+            _retiredSnapshots.erase(retired);
+        }
+    }
+}
+
+// Frees a snapshot and the dladdr() indexes which were not carried in to the next snapshot,
+// either because their image was unloaded or because a reader published them after the next snapshot was made
+void AllImages::freeImageListSnapshot(const ImageListSnapshot* snapshot)
+{
+    ClosestSymbolSlot* slots = snapshot->closestSymbolSlots();
+    for (uintptr_t i=0; i < snapshot->count; ++i) {
+        const MachOLoaded::ClosestSymbolIndex* index = slots[i].index.load(std::memory_order_acquire);
+        if ( (index != nullptr) && !slots[i].carried )
+            ::free((void*)index);
+    }
+    ::free((void*)snapshot);
+}
+
 void AllImages::withNotifiersLock(void (^work)()) const
 {
 #ifdef OS_UNFAIR_RECURSIVE_LOCK_INIT
@@ -271,6 +392,7 @@ void AllImages::addImages(const Array<LoadedImage>& newImages)
     // copy into _loadedImages
     withWriteLock(^(){
         _loadedImages.append(newImages);
+        publishImageListSnapshot();
     });
 }
 
@@ -322,7 +444,10 @@ void AllImages::runImageNotifiers(const Array<LoadedImage>& newImages)
     // if any image not in the shared cache added, recompute bounds
     for (const LoadedImage& li : newImages) {
         if ( !((MachOAnalyzer*)li.loadedAddress())->inDyldCache() ) {
-            recomputeBounds();
+            withWriteLock(^{
+                recomputeBounds();
+                publishImageListSnapshot();
+            });
             break;
         }
     }
@@ -499,6 +624,7 @@ void AllImages::removeImages(const Array<LoadedImage>& unloadImages)
             }
         }
         recomputeBounds();
+        publishImageListSnapshot();
     });
 
     // sync to old all image infos struct
@@ -548,7 +674,11 @@ void AllImages::recomputeBounds()
 
 uint32_t AllImages::count() const
 {
-    return (uint32_t)_loadedImages.count();
+    __block uint32_t result = 0;
+    withImageListSnapshot(^(const Array<LoadedImage>& images) {
+        result = (uint32_t)images.count();
+    });
+    return result;
 }
 
 bool AllImages::dyldCacheHasPath(const char* path) const
@@ -562,9 +692,9 @@ bool AllImages::dyldCacheHasPath(const char* path) const
 const char* AllImages::imagePathByIndex(uint32_t index) const
 {
     __block const char* result = nullptr;
-    withReadLock(^{
-        if ( index < _loadedImages.count() ) {
-            result = imagePath(_loadedImages[index].image());
+    withImageListSnapshot(^(const Array<LoadedImage>& images) {
+        if ( index < images.count() ) {
+            result = imagePath(images[index].image());
             return;
         }
     });
@@ -574,9 +704,9 @@ const char* AllImages::imagePathByIndex(uint32_t index) const
 const mach_header* AllImages::imageLoadAddressByIndex(uint32_t index) const
 {
    __block const mach_header* result = nullptr;
-    withReadLock(^{
-        if ( index < _loadedImages.count() ) {
-            result = _loadedImages[index].loadedAddress();
+    withImageListSnapshot(^(const Array<LoadedImage>& images) {
+        if ( index < images.count() ) {
+            result = images[index].loadedAddress();
             return;
         }
     });
@@ -586,8 +716,8 @@ const mach_header* AllImages::imageLoadAddressByIndex(uint32_t index) const
 bool AllImages::findImage(const mach_header* loadAddress, LoadedImage& foundImage) const
 {
     __block bool result = false;
-    withReadLock(^(){
-        for (const LoadedImage& li : _loadedImages) {
+    withImageListSnapshot(^(const Array<LoadedImage>& images) {
+        for (const LoadedImage& li : images) {
             if ( li.loadedAddress() == loadAddress ) {
                 foundImage = li;
                 result = true;
@@ -611,9 +741,9 @@ void AllImages::forEachImage(void (^handler)(const LoadedImage& loadedImage, boo
         return;
     }
 
-    withReadLock(^{
+    withImageListSnapshot(^(const Array<LoadedImage>& images) {
         bool stop = false;
-        for (const LoadedImage& li : _loadedImages) {
+        for (const LoadedImage& li : images) {
            handler(li, stop);
            if ( stop )
                break;
@@ -641,14 +771,8 @@ const char* AllImages::pathForImageMappedAt(const void* addr) const
         if ( addr < (void*)((uint8_t*)_dyldCacheAddress+_dyldCacheAddress->mappedSize()) ) {
             uint64_t cacheSlide        = (uint64_t)_dyldCacheAddress - _dyldCacheAddress->unslidLoadAddress();
             uint64_t unslidTargetAddr  = (uint64_t)addr - cacheSlide;
-            _dyldCacheAddress->forEachImageTextSegment(^(uint64_t loadAddressUnslid, uint64_t textSegmentSize, const unsigned char* dylibUUID, const char* installName, bool& stop) {
-                if ( (loadAddressUnslid <= unslidTargetAddr) && (unslidTargetAddr < loadAddressUnslid+textSegmentSize) ) {
-                    result = installName;
-                    stop   = true;
-                }
-            });
-            if ( result != nullptr )
-                return result;
+            if ( const dyld_cache_image_text_info* textInfo = _dyldCacheAddress->findImageTextContaining(unslidTargetAddr) )
+                return (char*)_dyldCacheAddress + textInfo->pathOffset;
         }
     }
 
@@ -660,6 +784,50 @@ const char* AllImages::pathForImageMappedAt(const void* addr) const
     return result;
 }
 
+bool AllImages::findClosestSymbol(const MachOLoaded* ml, const void* addr, const char** symbolName, uint64_t* symbolAddr)
+{
+    // being called during libSystem initialization, so can't allocate yet
+    if ( _initialImages != nullptr )
+        return ml->findClosestSymbol((long)addr, symbolName, symbolAddr);
+
+    // The first lookup in an image just walks its symbol table.  An image looked up in again
+    // (e.g. by a sampling profiler or crash reporter) gets a sorted index which later lookups binary search.
+    // None of this takes the lock, so dladdr() never waits on dlopen()
+    __block bool found   = false;
+    __block bool indexed = false;
+    withImageListSnapshot(^(const ImageListSnapshot* snapshot) {
+        ClosestSymbolSlot* slots = snapshot->closestSymbolSlots();
+        ClosestSymbolSlot* end   = &slots[snapshot->count];
+        ClosestSymbolSlot* slot  = std::lower_bound(slots, end, ml, [](const ClosestSymbolSlot& s, const MachOLoaded* value) {
+            return s.loadAddress < value;
+        });
+        if ( (slot == end) || (slot->loadAddress != ml) )
+            return;
+        const MachOLoaded::ClosestSymbolIndex* index = slot->index.load(std::memory_order_acquire);
+        if ( (index == nullptr) && (slot->lookupCount.fetch_add(1, std::memory_order_relaxed) != 0) ) {
+            // Several threads may build an index at once.  Only the first to publish it keeps it
+            if ( const MachOLoaded::ClosestSymbolIndex* newIndex = ml->makeClosestSymbolIndex() ) {
+                const MachOLoaded::ClosestSymbolIndex* expected = nullptr;
+                if ( slot->index.compare_exchange_strong(expected, newIndex, std::memory_order_acq_rel, std::memory_order_acquire) ) {
+                    index = newIndex;
+                }
+                else {
+                    ::free((void*)newIndex);
+                    index = expected;
+                }
+            }
+        }
+        if ( index != nullptr ) {
+            found   = index->findClosestSymbol((long)addr, symbolName, symbolAddr);
+            indexed = true;
+        }
+    });
+    if ( indexed )
+        return found;
+
+    return ml->findClosestSymbol((long)addr, symbolName, symbolAddr);
+}
+
 void AllImages::infoForImageMappedAt(const void* addr, void (^handler)(const LoadedImage& foundImage, uint8_t permissions)) const
 {
     __block uint8_t permissions;
@@ -674,8 +842,8 @@ void AllImages::infoForImageMappedAt(const void* addr, void (^handler)(const Loa
         return;
     }
 
-    withReadLock(^{
-        for (const LoadedImage& li : _loadedImages) {
+    withImageListSnapshot(^(const Array<LoadedImage>& images) {
+        for (const LoadedImage& li : images) {
             if ( li.image()->containsAddress(addr, li.loadedAddress(), &permissions) ) {
                 handler(li, permissions);
                 break;
@@ -711,23 +879,18 @@ bool AllImages::infoForImageMappedAt(const void* addr, const MachOLoaded** ml, u
         if ( addr < (void*)((uint8_t*)_dyldCacheAddress+_dyldCacheAddress->mappedSize()) ) {
             uint64_t cacheSlide        = (uint64_t)_dyldCacheAddress - _dyldCacheAddress->unslidLoadAddress();
             uint64_t unslidTargetAddr  = (uint64_t)addr - cacheSlide;
-            _dyldCacheAddress->forEachImageTextSegment(^(uint64_t loadAddressUnslid, uint64_t textSegmentSize, const unsigned char* dylibUUID, const char* installName, bool& stop) {
-                if ( (loadAddressUnslid <= unslidTargetAddr) && (unslidTargetAddr < loadAddressUnslid+textSegmentSize) ) {
-                    if ( ml != nullptr )
-                        *ml = (MachOLoaded*)(loadAddressUnslid + cacheSlide);
-                    if ( path != nullptr )
-                        *path = installName;
-                    if ( textSize != nullptr )
-                        *textSize = textSegmentSize;
-                    stop = true;
-                    result = true;
-                }
-            });
-            if ( result )
-                return result;
+            if ( const dyld_cache_image_text_info* textInfo = _dyldCacheAddress->findImageTextContaining(unslidTargetAddr) ) {
+                if ( ml != nullptr )
+                    *ml = (MachOLoaded*)(textInfo->loadAddress + cacheSlide);
+                if ( path != nullptr )
+                    *path = (char*)_dyldCacheAddress + textInfo->pathOffset;
+                if ( textSize != nullptr )
+                    *textSize = textInfo->textSegmentSize;
+                return true;
+            }
             // in shared cache, but not in a TEXT segment, do slow search of all loaded cache images
-             withReadLock(^{
-                for (const LoadedImage& li : _loadedImages) {
+             withImageListSnapshot(^(const Array<LoadedImage>& images) {
+                for (const LoadedImage& li : images) {
                     if ( ((MachOAnalyzer*)li.loadedAddress())->inDyldCache() ) {
                         uint8_t permissions;
                         if ( li.image()->containsAddress(addr, li.loadedAddress(), &permissions) ) {
@@ -778,8 +941,8 @@ void AllImages::infoForNonCachedImageMappedAt(const void* addr, void (^handler)(
         return;
     }
 
-    withReadLock(^{
-        for (const LoadedImage& li : _loadedImages) {
+    withImageListSnapshot(^(const Array<LoadedImage>& images) {
+        for (const LoadedImage& li : images) {
             if ( !((MachOAnalyzer*)li.loadedAddress())->inDyldCache() ) {
                 if ( li.image()->containsAddress(addr, li.loadedAddress(), &permissions) ) {
                     handler(li, permissions);
@@ -801,7 +964,11 @@ bool AllImages::immutableMemory(const void* addr, size_t length) const
     }
 
     // check to see if it is outside the range of any loaded image
-    if ( ((uintptr_t)addr < _lowestNonCached) || ((uintptr_t)addr+length > _highestNonCached) ) {
+    __block bool outsideImages = false;
+    withImageListSnapshot(^(const Array<LoadedImage>& images, uintptr_t lowestNonCached, uintptr_t highestNonCached) {
+        outsideImages = ((uintptr_t)addr < lowestNonCached) || ((uintptr_t)addr+length > highestNonCached);
+    });
+    if ( outsideImages ) {
         return false;
     }
 
@@ -867,8 +1034,8 @@ void* AllImages::interposeValue(void *value) const {
 
 void AllImages::infoForImageWithLoadAddress(const MachOLoaded* mh, void (^handler)(const LoadedImage& foundImage)) const
 {
-    withReadLock(^{
-        for (const LoadedImage& li : _loadedImages) {
+    withImageListSnapshot(^(const Array<LoadedImage>& images) {
+        for (const LoadedImage& li : images) {
             if ( li.loadedAddress() == mh ) {
                 handler(li);
                 break;
@@ -1779,11 +1946,17 @@ const MachOLoaded* AllImages::dlopen(Diagnostics& diag, const char* path, bool r
                     incRefCount(topLoadAddress);
                 log_apis("   dlopen: already loaded as '%s'\n", li.image()->path());
                 // if previously opened with RTLD_LOCAL, but now opened with RTLD_GLOBAL, unhide it
-                if ( !rtldLocal && li.hideFromFlatSearch() )
-                    li.setHideFromFlatSearch(false);
                 // if called with RTLD_NODELETE, mark it as never-unload
-                if ( rtldNoDelete )
-                    li.markLeaveMapped();
+                if ( (!rtldLocal && li.hideFromFlatSearch()) || (rtldNoDelete && !li.leaveMapped()) ) {
+                    LoadedImage* loadedImage = &li;
+                    withWriteLock(^{
+                        if ( !rtldLocal )
+                            loadedImage->setHideFromFlatSearch(false);
+                        if ( rtldNoDelete )
+                            loadedImage->markLeaveMapped();
+                        publishImageListSnapshot();
+                    });
+                }
 
                 // If we haven't run the initializers then we must be in a static init in a dlopen
                 if ( li.state() != LoadedImage::State::inited ) {
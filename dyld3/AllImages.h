@@ -89,6 +89,7 @@ public:
     void                        infoForNonCachedImageMappedAt(const void* addr, void (^handler)(const LoadedImage& foundImage, uint8_t permissions)) const;
     void                        infoForImageWithLoadAddress(const MachOLoaded*, void (^handler)(const LoadedImage& foundImage)) const;
     const char*                 pathForImageMappedAt(const void* addr) const;
+    bool                        findClosestSymbol(const MachOLoaded* ml, const void* addr, const char** symbolName, uint64_t* symbolAddr);
     const char*                 imagePathByIndex(uint32_t index) const;
     const mach_header*          imageLoadAddressByIndex(uint32_t index) const;
     bool                        immutableMemory(const void* addr, size_t length) const;
@@ -168,6 +169,31 @@ private:
         uintptr_t           refCount;
     };
 
+    // dladdr() state for one image, with its symbol index built on the second lookup and published with a compare-and-swap
+    struct ClosestSymbolSlot {
+        const MachOLoaded*                                      loadAddress;
+        std::atomic<uintptr_t>                                  lookupCount;
+        std::atomic<const MachOLoaded::ClosestSymbolIndex*>     index;
+        bool                                                    carried;    // index now belongs to the next snapshot
+    };
+
+    // Immutable copy of _loadedImages (and the bounds of non-cached images) read by lock-free lookups.
+    // The LoadedImage state bits in it may be stale, so anything which needs them must use _loadedImages.
+    struct ImageListSnapshot {
+        uintptr_t               lowestNonCached;
+        uintptr_t               highestNonCached;
+        uintptr_t               count;
+
+        const LoadedImage*      images() const             { return (LoadedImage*)&this[1]; }
+        // one per image, sorted by load address
+        ClosestSymbolSlot*      closestSymbolSlots() const { return (ClosestSymbolSlot*)&images()[count]; }
+    };
+
+    struct RetiredSnapshot {
+        const ImageListSnapshot*    snapshot;
+        bool                        drained[2];
+    };
+
     //
     // The ImmutableRanges structure is used to make dyld_is_memory_immutable()
     // fast and lock free.  The table contains just ranges that are immutable,
@@ -204,6 +230,11 @@ private:
     void                        breadthFirstRecurseDependents(Array<closure::ImageNum>& visited, const LoadedImage& nodeLi, bool& stop, void (^handler)(const LoadedImage& aLoadedImage, bool& stop)) const;
     void                        appendToImagesArray(const closure::ImageArray* newArray);
     void                        withReadLock(void (^work)()) const;
+    void                        withImageListSnapshot(void (^work)(const Array<LoadedImage>& images)) const;
+    void                        withImageListSnapshot(void (^work)(const Array<LoadedImage>& images, uintptr_t lowestNonCached, uintptr_t highestNonCached)) const;
+    bool                        withImageListSnapshot(void (^work)(const ImageListSnapshot* snapshot)) const;
+    void                        publishImageListSnapshot();
+    void                        freeImageListSnapshot(const ImageListSnapshot* snapshot);
     void                        withWriteLock(void (^work)());
     void                        withNotifiersLock(void (^work)()) const;
     bool                        findImage(const mach_header* loadAddress, LoadedImage& foundImage) const;
@@ -261,6 +292,10 @@ private:
     GrowableArray<LoadNotifyFunc, 4, 4>     _loadNotifiers2;
     GrowableArray<BulkLoadNotifier, 2, 2>   _loadBulkNotifiers;
     GrowableArray<DlopenCount, 4, 4>        _dlopenRefCounts;
+    GrowableArray<RetiredSnapshot, 4, 4>    _retiredSnapshots;
+    std::atomic<const ImageListSnapshot*>   _imageListSnapshot   = { nullptr };
+    std::atomic<uint64_t>                   _snapshotEpoch       = { 0 };
+    mutable std::atomic<uintptr_t>          _snapshotReaders[2]  = { { 0 }, { 0 } };
     GrowableArray<LoadedImage, 16>          _loadedImages;
 #if TARGET_OS_OSX
     uint64_t                                _nextObjectFileImageNum = 0;
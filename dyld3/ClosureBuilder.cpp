@@ -33,6 +33,9 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/sysctl.h>
+#if BUILDING_CACHE_BUILDER
+#include <dispatch/dispatch.h>
+#endif
 
 #include <mach-o/dyld_priv.h>
 
@@ -1601,6 +1604,18 @@ void ClosureBuilder::addFixupInfo(ImageWriter& writer, BuilderLoadedImage& forIm
     __block RebasePatternBuilder rebaseBuilder(rebaseEntries, forImage.loadAddress()->pointerSize());
     __block BindPatternBuilder bindBuilder(binds, forImage.loadAddress()->pointerSize());
 
+#if BUILDING_CACHE_BUILDER
+    if ( _resolvedDylibFixups != nullptr ) {
+        // applying fixups to dylibs in dyld cache, the targets were already found by resolveDylibFixups()
+        for (const ResolvedDylibFixup& fixup : _resolvedDylibFixups->fixups)
+            _dylibFixupHandler(forImage.loadAddress(), fixup.runtimeOffset, fixup.pmd, fixup.target);
+        for (const ResolvedDylibCachePatch& patch : _resolvedDylibFixups->cachePatches)
+            addWeakDefCachePatch(patch.cachedDylibIndex, patch.exportCacheOffset, patch.target);
+        _diag.copy(_resolvedDylibFixups->diag);
+        return;
+    }
+#endif
+
     const bool stompedLazyOpcodes = forImage.loadAddress()->hasStompedLazyOpcodes();
     WrappedMachO forImage_wmo(forImage.loadAddress(), this, (void*)&forImage);
     forImage_wmo.forEachFixup(_diag,
@@ -1705,6 +1720,31 @@ void ClosureBuilder::addFixupInfo(ImageWriter& writer, BuilderLoadedImage& forIm
 
 
 
+#if BUILDING_CACHE_BUILDER
+// Finds the target of every fixup in a dylib being built into the dyld cache, without applying any of them.
+// This only reads the dylibs, so can run on many dylibs at once.  addFixupInfo() later passes the
+// results to _dylibFixupHandler in the order found, exactly as if it had walked the fixups itself.
+void ClosureBuilder::resolveDylibFixups(BuilderLoadedImage& forImage, ResolvedDylibFixups& resolved)
+{
+    ResolvedDylibFixups* resolvedPtr = &resolved;
+    const bool stompedLazyOpcodes = forImage.loadAddress()->hasStompedLazyOpcodes();
+    WrappedMachO forImage_wmo(forImage.loadAddress(), this, (void*)&forImage);
+    forImage_wmo.forEachFixup(resolved.diag,
+        ^(uint64_t fixupLocRuntimeOffset, PointerMetaData pmd, const MachOAnalyzerSet::FixupTarget& target, bool& stop) {
+            if ( target.kind == MachOAnalyzerSet::FixupTarget::Kind::rebase ) {
+                // same filtering as addFixupInfo()
+                if ( target.isLazyBindRebase && !stompedLazyOpcodes )
+                    return;
+            }
+            resolvedPtr->fixups.push_back({ fixupLocRuntimeOffset, pmd, target });
+        },
+        ^(uint32_t cachedDylibIndex, uint32_t exportCacheOffset, const FixupTarget& target) {
+            resolvedPtr->cachePatches.push_back({ cachedDylibIndex, exportCacheOffset, target });
+        }
+    );
+}
+#endif
+
 void ClosureBuilder::addWeakDefCachePatch(uint32_t cachedDylibIndex, uint32_t exportCacheOffset, const FixupTarget& patchTarget)
 {
     // minimal closures don't need weak def patches, they are regenerated at launch
@@ -3677,9 +3717,39 @@ const ImageArray* ClosureBuilder::makeDyldCacheImageArray(const Array<CachedDyli
 
     // create an ImageWriter for each cached dylib
     STACK_ALLOC_ARRAY(ImageWriter, writers, _loadedImages.count());
-    for (BuilderLoadedImage& li : _loadedImages) {
-        writers.push_back(ImageWriter());
-        buildImage(writers.back(), li);
+#if BUILDING_CACHE_BUILDER
+    if ( _dylibFixupHandler ) {
+        // Finding the targets of binds is most of the work here, and only reads the dylibs, so do that in parallel
+        // a batch of dylibs at a time.  The fixups are then applied serially in the same order as before, which
+        // keeps the cache content identical to a serial build.
+        // Look up every exports trie first, as wmo_getExportsTrie() would otherwise cache them lazily from many threads.
+        for (BuilderLoadedImage& li : _loadedImages)
+            li.loadAddress()->hasExportTrie(li.exportsTrieOffset, li.exportsTrieSize);
+
+        const uintptr_t imageCount = _loadedImages.count();
+        const uintptr_t batchSize  = 64;
+        for (uintptr_t batchStart=0; batchStart < imageCount; batchStart += batchSize) {
+            const uintptr_t batchCount = std::min(batchSize, imageCount - batchStart);
+            ResolvedDylibFixups* resolved = new ResolvedDylibFixups[batchCount];
+            dispatch_apply(batchCount, DISPATCH_APPLY_AUTO, ^(size_t index) {
+                resolveDylibFixups(_loadedImages[batchStart + index], resolved[index]);
+            });
+            for (uintptr_t i=0; i < batchCount; ++i) {
+                _resolvedDylibFixups = &resolved[i];
+                writers.push_back(ImageWriter());
+                buildImage(writers.back(), _loadedImages[batchStart + i]);
+            }
+            _resolvedDylibFixups = nullptr;
+            delete[] resolved;
+        }
+    }
+    else
+#endif
+    {
+        for (BuilderLoadedImage& li : _loadedImages) {
+            writers.push_back(ImageWriter());
+            buildImage(writers.back(), li);
+        }
     }
 
     // add initializer order into each dylib
@@ -206,6 +206,32 @@ private:
     void                    addOperatorCachePatches(BuilderLoadedImage& forImage);
     void                    addWeakDefCachePatch(uint32_t cachedDylibIndex, uint32_t exportCacheOffset, const FixupTarget& patchTarget);
 
+#if BUILDING_CACHE_BUILDER
+    struct ResolvedDylibFixup
+    {
+        uint64_t            runtimeOffset;
+        PointerMetaData     pmd;
+        FixupTarget         target;
+    };
+
+    struct ResolvedDylibCachePatch
+    {
+        uint32_t            cachedDylibIndex;
+        uint32_t            exportCacheOffset;
+        FixupTarget         target;
+    };
+
+    // The fixups of one dylib being built into the dyld cache, found before buildImage() runs on it
+    struct ResolvedDylibFixups
+    {
+        Diagnostics                                 diag;
+        OverflowSafeArray<ResolvedDylibFixup>       fixups;
+        OverflowSafeArray<ResolvedDylibCachePatch>  cachePatches;
+    };
+
+    void                    resolveDylibFixups(BuilderLoadedImage& forImage, ResolvedDylibFixups& resolved);
+#endif
+
     struct HashCString {
         static size_t hash(const char* v);
     };
@@ -360,6 +386,9 @@ private:
     bool                                    _leaveRebasesAsOpcodes          = false;
     ImageNum                                _libDyldImageNum                = 0;
     ImageNum                                _libSystemImageNum              = 0;
+#if BUILDING_CACHE_BUILDER
+    const ResolvedDylibFixups*              _resolvedDylibFixups            = nullptr;  // fixups for the image addFixupInfo() is working on
+#endif
 };
 
 class VIS_HIDDEN RebasePatternBuilder
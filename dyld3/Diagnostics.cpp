@@ -22,6 +22,7 @@
  */
 
 #include <iostream>
+#include <algorithm>
 
 #include <stdint.h>
 #include <stdio.h>
@@ -53,6 +54,7 @@
 
 #if BUILDING_CACHE_BUILDER
   #include <dispatch/dispatch.h>
+  #include <Block.h>
   dispatch_queue_t sWarningQueue = dispatch_queue_create("com.apple.dyld.cache-builder.warnings", NULL);
 #endif
 
@@ -224,14 +226,44 @@ void Diagnostics::clearWarnings()
 }
 
 #if BUILDING_CACHE_BUILDER
+// User and system time used by all threads of the process so far, in microseconds.
+// This is process wide, as each phase spreads its work over dispatch worker threads.
+static uint64_t processCPUTime()
+{
+    struct rusage usage;
+    if ( getrusage(RUSAGE_SELF, &usage) != 0 )
+        return 0;
+    return ((uint64_t)usage.ru_utime.tv_sec + (uint64_t)usage.ru_stime.tv_sec) * 1000000
+            + (uint64_t)usage.ru_utime.tv_usec + (uint64_t)usage.ru_stime.tv_usec;
+}
+
+TimeRecorder::~TimeRecorder() {
+    if ( bytesProducedSampler != nullptr )
+        Block_release(bytesProducedSampler);
+}
+
+void TimeRecorder::setBytesProducedSampler(uint64_t (^sampler)()) {
+    if ( bytesProducedSampler != nullptr )
+        Block_release(bytesProducedSampler);
+    bytesProducedSampler = (sampler != nullptr) ? Block_copy(sampler) : nullptr;
+}
+
 void TimeRecorder::pushTimedSection() {
     openTimings.push_back(mach_absolute_time());
+    openCPUTimes.push_back(processCPUTime());
+    openBytesProduced.push_back((bytesProducedSampler != nullptr) ? bytesProducedSampler() : 0);
 }
 
 void TimeRecorder::recordTime(const char* format, ...) {
     uint64_t t = mach_absolute_time();
+    uint64_t cpuTime = processCPUTime();
+    uint64_t bytesProduced = (bytesProducedSampler != nullptr) ? bytesProducedSampler() : 0;
     uint64_t previousTime = openTimings.back();
+    uint64_t previousCPUTime = openCPUTimes.back();
+    uint64_t previousBytesProduced = openBytesProduced.back();
     openTimings.pop_back();
+    openCPUTimes.pop_back();
+    openBytesProduced.pop_back();
 
     char*   output_string = nullptr;
     va_list list;
@@ -240,23 +272,64 @@ void TimeRecorder::recordTime(const char* format, ...) {
     va_end(list);
 
     if (output_string != nullptr) {
+        // ru_maxrss is the high water mark for the process so far, in bytes
+        struct rusage usage;
+        uint64_t peakRSS = (getrusage(RUSAGE_SELF, &usage) == 0) ? (uint64_t)usage.ru_maxrss : 0;
+
+        // counters recorded in this section, or in sub-sections which didn't record a time of their own
+        const int depth = (int)openTimings.size();
+        Counters counters;
+        for (const PendingCounter& counter : pendingCounters) {
+            if ( counter.depth >= depth )
+                counters.push_back({ counter.name, counter.value });
+        }
+        pendingCounters.erase(std::remove_if(pendingCounters.begin(), pendingCounters.end(), [&](const PendingCounter& counter) {
+            return counter.depth >= depth;
+        }), pendingCounters.end());
+
         timings.push_back(TimingEntry {
             .time = t - previousTime,
+            .cpuTime = cpuTime - previousCPUTime,
+            .peakRSS = peakRSS,
+            // output can shrink, eg, when dylibs are evicted and the cache laid out again
+            .bytesProduced = (bytesProduced > previousBytesProduced) ? (bytesProduced - previousBytesProduced) : 0,
+            .bufferCommitted = bufferCommitted,
+            .bufferReserved = bufferReserved,
             .logMessage = std::string(output_string),
-            .depth = (int)openTimings.size()
+            .depth = depth,
+            .counters = std::move(counters)
         });
+        free(output_string);
     }
 
     openTimings.push_back(mach_absolute_time());
+    openCPUTimes.push_back(processCPUTime());
+    openBytesProduced.push_back((bytesProducedSampler != nullptr) ? bytesProducedSampler() : 0);
 }
 
 void TimeRecorder::popTimedSection() {
     openTimings.pop_back();
+    openCPUTimes.pop_back();
+    openBytesProduced.pop_back();
+}
+
+void TimeRecorder::recordCounter(const char* name, uint64_t value) {
+    pendingCounters.push_back({ name, value, (int)openTimings.size() });
+}
+
+void TimeRecorder::recordBufferUsage(uint64_t committed, uint64_t reserved) {
+    bufferCommitted = committed;
+    bufferReserved  = reserved;
 }
 
-static inline uint32_t absolutetime_to_milliseconds(uint64_t abstime)
+uint32_t absolutetime_to_milliseconds(uint64_t abstime)
 {
-    return (uint32_t)(abstime/1000/1000);
+    static mach_timebase_info_data_t timebaseInfo;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        mach_timebase_info(&timebaseInfo);
+    });
+    return (uint32_t)(abstime * timebaseInfo.numer / timebaseInfo.denom / 1000 / 1000);
 }
 
 void TimeRecorder::logTimings() {
@@ -264,10 +337,45 @@ void TimeRecorder::logTimings() {
         for (int i = 0 ; i < entry.depth ; i++) {
             std::cerr << "  ";
         }
-        std::cerr << "time to " << entry.logMessage << " " << absolutetime_to_milliseconds(entry.time) << "ms" << std::endl;
+        std::cerr << "time to " << entry.logMessage << " " << absolutetime_to_milliseconds(entry.time) << "ms"
+                  << " (process CPU " << (entry.cpuTime / 1000) << "ms, process peak RSS " << (entry.peakRSS / (1024 * 1024)) << "MB";
+        if ( entry.bytesProduced != 0 )
+            std::cerr << ", produced " << (entry.bytesProduced / 1024) << "KB";
+        if ( entry.bufferReserved != 0 ) {
+            std::cerr << ", buffer committed " << (entry.bufferCommitted / (1024 * 1024)) << "MB of "
+                      << (entry.bufferReserved / (1024 * 1024)) << "MB reserved";
+        }
+        std::cerr << ")" << std::endl;
+        for (const auto& counter : entry.counters) {
+            for (int i = 0 ; i <= entry.depth ; i++) {
+                std::cerr << "  ";
+            }
+            std::cerr << counter.first << ": " << counter.second << std::endl;
+        }
     }
+}
 
-    timings.clear();
+dyld3::json::Node TimeRecorder::timingsJSON() const {
+    dyld3::json::Node phasesNode;
+    for (const TimingEntry& entry : timings) {
+        dyld3::json::Node phaseNode;
+        phaseNode.map["name"]                 = dyld3::json::Node(entry.logMessage);
+        phaseNode.map["depth"]                = dyld3::json::Node((uint64_t)entry.depth);
+        phaseNode.map["wall-time-ms"]         = dyld3::json::Node((uint64_t)absolutetime_to_milliseconds(entry.time));
+        phaseNode.map["process-cpu-time-ms"]  = dyld3::json::Node(entry.cpuTime / 1000);
+        phaseNode.map["process-peak-rss"]     = dyld3::json::Node(entry.peakRSS);
+        phaseNode.map["bytes-produced"]       = dyld3::json::Node(entry.bytesProduced);
+        phaseNode.map["buffer-committed"]     = dyld3::json::Node(entry.bufferCommitted);
+        phaseNode.map["buffer-reserved"]      = dyld3::json::Node(entry.bufferReserved);
+        if ( !entry.counters.empty() ) {
+            dyld3::json::Node countersNode;
+            for (const auto& counter : entry.counters)
+                countersNode.map[counter.first] = dyld3::json::Node(counter.second);
+            phaseNode.map["counters"] = countersNode;
+        }
+        phasesNode.array.push_back(phaseNode);
+    }
+    return phasesNode;
 }
 #endif
 
@@ -32,6 +32,8 @@
 #include <string>
 #include <vector>
 #include <dispatch/dispatch.h>
+
+#include "JSON.h"
 #endif
 
 #include "Logging.h"
@@ -80,13 +82,16 @@ private:
 
 #if BUILDING_CACHE_BUILDER
 
+// Converts a mach_absolute_time() interval to milliseconds
+VIS_HIDDEN uint32_t absolutetime_to_milliseconds(uint64_t abstime);
+
 class VIS_HIDDEN TimeRecorder
 {
 public:
     // Call pushTimedSection(), then mark events with recordTime. Call popTimedSection() to stop the current timing session.
     // This is stack-based, so you can start a sub-timer with pushTimedSection() / recordTime / recordTime... / popTimedSection()
     // inside a first timed section.
-    // Call logTimings() to print everything.
+    // Call logTimings() to print everything, or timingsJSON() to get it in a machine readable form.
 
     // Start a new timed section.
     void pushTimedSection();
@@ -97,16 +102,59 @@ public:
     // Stop the current timed section and pop back one level.
     void popTimedSection();
 
+    // Records how much of a buffer is committed, out of the address space reserved for it.
+    // Timings recorded after this report the latest values.
+    void recordBufferUsage(uint64_t committed, uint64_t reserved);
+
+    // Records a count of something done in the current timed section, such as dylibs evicted.
+    // It is reported with the next recordTime() at this level or deeper.
+    void recordCounter(const char* name, uint64_t value);
+
+    // Sets a block which returns the bytes of output produced so far.  It is called at the start and end of
+    // each timed section, so each timing reports the bytes produced during it.
+    void setBytesProducedSampler(uint64_t (^sampler)());
+
     void logTimings();
+
+    // Every timing recorded so far, with its CPU time, memory use and counters.
+    // CPU time and peak RSS are for the whole process, so they include other work running at the same time,
+    // such as other caches built concurrently.  Per-thread CPU time would instead miss the worker threads
+    // the phases themselves fan out to.
+    dyld3::json::Node timingsJSON() const;
+
+    TimeRecorder() = default;
+    TimeRecorder(const TimeRecorder&) = delete;
+    TimeRecorder& operator=(const TimeRecorder&) = delete;
+    ~TimeRecorder();
 private:
+    typedef std::vector<std::pair<std::string, uint64_t>> Counters;
+
     struct TimingEntry {
         uint64_t time;
+        uint64_t cpuTime;
+        uint64_t peakRSS;
+        uint64_t bytesProduced;
+        uint64_t bufferCommitted;
+        uint64_t bufferReserved;
         std::string logMessage;
         int depth;
+        Counters counters;
+    };
+
+    struct PendingCounter {
+        std::string name;
+        uint64_t value;
+        int depth;
     };
 
     std::vector<uint64_t> openTimings;
+    std::vector<uint64_t> openCPUTimes;
+    std::vector<uint64_t> openBytesProduced;
     std::vector<TimingEntry> timings;
+    std::vector<PendingCounter> pendingCounters;
+    uint64_t bufferCommitted = 0;
+    uint64_t bufferReserved = 0;
+    uint64_t (^bytesProducedSampler)() = nullptr;
 };
 
 #endif /* BUILDING_CACHE_BUILDER */
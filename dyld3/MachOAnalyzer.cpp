@@ -61,7 +61,7 @@ const MachOAnalyzer* MachOAnalyzer::validMainExecutable(Diagnostics& diag, const
 
 bool MachOAnalyzer::loadFromBuffer(Diagnostics& diag, const closure::FileSystem& fileSystem,
                                    const char* path, const GradedArchs& archs, Platform platform,
-                                   closure::LoadedFileInfo& info)
+                                   closure::LoadedFileInfo& info, AlreadyValidated alreadyValidated)
 {
     // if fat, remap just slice needed
     bool fatButMissingSlice;
@@ -87,9 +87,10 @@ bool MachOAnalyzer::loadFromBuffer(Diagnostics& diag, const closure::FileSystem&
     }
 
     const MachOAnalyzer* mh = (MachOAnalyzer*)info.fileContent;
+    const bool skipValidation = (alreadyValidated != nullptr) && alreadyValidated(mh, info.sliceLen, info.isOSBinary);
 
     // validate is mach-o of requested arch and platform
-    if ( !mh->validMachOForArchAndPlatform(diag, (size_t)info.sliceLen, path, archs, platform, info.isOSBinary) ) {
+    if ( !skipValidation && !mh->validMachOForArchAndPlatform(diag, (size_t)info.sliceLen, path, archs, platform, info.isOSBinary) ) {
         fileSystem.unloadFile(info);
         return false;
     }
@@ -117,7 +118,8 @@ bool MachOAnalyzer::loadFromBuffer(Diagnostics& diag, const closure::FileSystem&
 
 
 closure::LoadedFileInfo MachOAnalyzer::load(Diagnostics& diag, const closure::FileSystem& fileSystem,
-                                            const char* path, const GradedArchs& archs, Platform platform, char realerPath[MAXPATHLEN])
+                                            const char* path, const GradedArchs& archs, Platform platform, char realerPath[MAXPATHLEN],
+                                            AlreadyValidated alreadyValidated)
 {
     // FIXME: This should probably be an assert, but if we happen to have a diagnostic here then something is wrong
     // above us and we should quickly return instead of doing unnecessary work.
@@ -139,7 +141,7 @@ closure::LoadedFileInfo MachOAnalyzer::load(Diagnostics& diag, const closure::Fi
     if (diag.hasError())
         diag.clearError();
 
-    bool loaded = loadFromBuffer(diag, fileSystem, path, archs, platform, info);
+    bool loaded = loadFromBuffer(diag, fileSystem, path, archs, platform, info, alreadyValidated);
     if (!loaded)
         return {};
     return info;
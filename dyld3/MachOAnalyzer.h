@@ -58,11 +58,16 @@ struct VIS_HIDDEN MachOAnalyzer : public MachOLoaded
         textAbsolute32,
     };
 
+    // Returns true if a slice with identical mach_header and load commands was already validated, so those checks can be skipped.
+    // LINKEDIT is still validated
+    typedef bool (^AlreadyValidated)(const MachOAnalyzer* mh, uint64_t sliceLen, bool isOSBinary);
+
     static bool loadFromBuffer(Diagnostics& diag, const closure::FileSystem& fileSystem,
                                const char* path, const GradedArchs& archs, Platform platform,
-                               closure::LoadedFileInfo& info);
+                               closure::LoadedFileInfo& info, AlreadyValidated alreadyValidated=nullptr);
     static closure::LoadedFileInfo load(Diagnostics& diag, const closure::FileSystem& fileSystem,
-                                        const char* logicalPath, const GradedArchs& archs, Platform platform, char realerPath[MAXPATHLEN]);
+                                        const char* logicalPath, const GradedArchs& archs, Platform platform, char realerPath[MAXPATHLEN],
+                                        AlreadyValidated alreadyValidated=nullptr);
     static const MachOAnalyzer*  validMainExecutable(Diagnostics& diag, const mach_header* mh, const char* path, uint64_t sliceLength,
                                                      const GradedArchs& archs, Platform platform);
 
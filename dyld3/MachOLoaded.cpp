@@ -682,6 +682,155 @@ bool MachOLoaded::findClosestSymbol(uint64_t address, const char** symbolName, u
     return false;
 }
 
+static int compareClosestSymbols(const void* l, const void* r)
+{
+    const MachOLoaded::ClosestSymbolIndex::Symbol* left  = (MachOLoaded::ClosestSymbolIndex::Symbol*)l;
+    const MachOLoaded::ClosestSymbolIndex::Symbol* right = (MachOLoaded::ClosestSymbolIndex::Symbol*)r;
+    if ( left->unslidAddr != right->unslidAddr )
+        return (left->unslidAddr < right->unslidAddr) ? -1 : 1;
+    if ( left->order != right->order )
+        return (left->order < right->order) ? -1 : 1;
+    return 0;
+}
+
+MachOLoaded::ClosestSymbolIndex* MachOLoaded::makeClosestSymbolIndex() const
+{
+    Diagnostics diag;
+    LinkEditInfo leInfo;
+    getLinkEditPointers(diag, leInfo);
+    if ( diag.hasError() )
+        return nullptr;
+    if ( (leInfo.symTab == nullptr) || (leInfo.dynSymTab == nullptr) )
+        return nullptr;
+
+    __block uint32_t sectionCount = 0;
+    forEachSection(^(const SectionInfo& sectInfo, bool malformedSectionRange, bool& stop) {
+        ++sectionCount;
+    });
+    const uint32_t maxSymbolCount = leInfo.dynSymTab->nextdefsym + leInfo.dynSymTab->nlocalsym;
+    size_t indexSize = sizeof(ClosestSymbolIndex) + sectionCount*sizeof(ClosestSymbolIndex::Section) + maxSymbolCount*sizeof(ClosestSymbolIndex::Symbol);
+    ClosestSymbolIndex* index = (ClosestSymbolIndex*)::malloc(indexSize);
+    if ( index == nullptr )
+        return nullptr;
+    index->slide           = leInfo.layout.slide;
+    index->stringPool      = (char*)getLinkEditContent(leInfo.layout, leInfo.symTab->stroff);
+    index->maxStringOffset = leInfo.symTab->strsize;
+    index->sectionCount    = sectionCount;
+    index->symbolCount     = 0;
+
+    // sections are recorded in order, so n_sect-1 is the index into this array
+    __block ClosestSymbolIndex::Section* sections = (ClosestSymbolIndex::Section*)index->sections();
+    __block uint32_t sectionIndex = 0;
+    forEachSection(^(const SectionInfo& sectInfo, bool malformedSectionRange, bool& stop) {
+        sections[sectionIndex].unslidAddr = sectInfo.sectAddr;
+        sections[sectionIndex].size       = sectInfo.sectSize;
+        ++sectionIndex;
+    });
+
+    // add the same symbols as the slow path, globals first then locals
+    ClosestSymbolIndex::Symbol* symbols = (ClosestSymbolIndex::Symbol*)index->symbols();
+    uint32_t symbolCount = 0;
+    const struct nlist* nlists = (struct nlist*)(getLinkEditContent(leInfo.layout, leInfo.symTab->symoff));
+    const uint32_t ranges[2][2] = { { leInfo.dynSymTab->iextdefsym, leInfo.dynSymTab->nextdefsym },
+                                    { leInfo.dynSymTab->ilocalsym,  leInfo.dynSymTab->nlocalsym  } };
+    for (int r=0; r < 2; ++r) {
+        const bool isLocal = (r == 1);
+        for (uint32_t i=ranges[r][0]; i < ranges[r][0]+ranges[r][1]; ++i) {
+            uint64_t n_value;
+            uint32_t n_strx;
+            uint8_t  n_type;
+            uint8_t  n_sect;
+            uint16_t n_desc;
+            if ( is64() ) {
+                const struct nlist_64* s = &((struct nlist_64*)nlists)[i];
+                n_value = s->n_value;
+                n_strx  = s->n_un.n_strx;
+                n_type  = s->n_type;
+                n_sect  = s->n_sect;
+                n_desc  = s->n_desc;
+            }
+            else {
+                const struct nlist* s = &nlists[i];
+                n_value = s->n_value;
+                n_strx  = s->n_un.n_strx;
+                n_type  = s->n_type;
+                n_sect  = s->n_sect;
+                n_desc  = s->n_desc;
+            }
+            if ( (n_type & N_TYPE) != N_SECT )
+                continue;
+            if ( isLocal && ((n_type & N_STAB) != 0) )
+                continue;
+            ClosestSymbolIndex::Symbol& sym = symbols[symbolCount];
+            sym.unslidAddr   = n_value;
+            sym.stringOffset = n_strx;
+            sym.order        = symbolCount;
+            sym.sectionNum   = n_sect;
+#if __arm__
+            sym.isThumb      = !is64() && (n_desc & N_ARM_THUMB_DEF);
+#else
+            (void)n_desc;
+            sym.isThumb      = false;
+#endif
+            ++symbolCount;
+        }
+    }
+    ::qsort(symbols, symbolCount, sizeof(ClosestSymbolIndex::Symbol), &compareClosestSymbols);
+    index->symbolCount = symbolCount;
+
+    return index;
+}
+
+bool MachOLoaded::ClosestSymbolIndex::findClosestSymbol(uint64_t address, const char** symbolName, uint64_t* symbolAddr) const
+{
+    uint64_t targetUnslidAddress = address - slide;
+
+    // find section number the address is in to validate n_sect.  Like the slow path, if the address
+    // is not in any section, symbols are matched against the last section
+    uint32_t targetSectionNum   = 0;
+    uint64_t targetSectionStart = 0;
+    for (uint32_t i=0; i < sectionCount; ++i) {
+        const Section& sect = sections()[i];
+        targetSectionNum = i+1;
+        if ( (sect.unslidAddr <= targetUnslidAddress) && (targetUnslidAddress < sect.unslidAddr+sect.size) ) {
+            targetSectionStart = sect.unslidAddr;
+            break;
+        }
+    }
+
+    // binary search for the first symbol after the address
+    const Symbol* syms = symbols();
+    uint32_t low  = 0;
+    uint32_t high = symbolCount;
+    while ( low < high ) {
+        uint32_t mid = low + (high - low)/2;
+        if ( syms[mid].unslidAddr <= targetUnslidAddress )
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    // walk back to the closest symbol in the target section.  For symbols at the same address, the
+    // earliest one the slow path would have visited wins
+    const Symbol* bestSymbol = nullptr;
+    for (uint32_t i=low; i > 0; --i) {
+        const Symbol& sym = syms[i-1];
+        if ( (bestSymbol != nullptr) && (sym.unslidAddr != bestSymbol->unslidAddr) )
+            break;
+        if ( sym.unslidAddr < targetSectionStart )
+            break;
+        if ( sym.sectionNum == targetSectionNum )
+            bestSymbol = &sym;
+    }
+    if ( bestSymbol == nullptr )
+        return false;
+
+    *symbolAddr = (bestSymbol->isThumb ? (bestSymbol->unslidAddr | 1) : bestSymbol->unslidAddr) + slide;
+    if ( bestSymbol->stringOffset < maxStringOffset )
+        *symbolName = &stringPool[bestSymbol->stringOffset];
+    return true;
+}
+
 const void* MachOLoaded::findSectionContent(const char* segName, const char* sectName, uint64_t& size) const
 {
     __block const void* result = nullptr;
@@ -57,6 +57,37 @@ struct VIS_HIDDEN MachOLoaded : public MachOFile
     // for dladdr()
     bool                findClosestSymbol(uint64_t unSlidAddr, const char** symbolName, uint64_t* symbolUnslidAddr) const;
 
+    // for dladdr() on images looked up repeatedly.  Holds the same symbols findClosestSymbol() considers,
+    // sorted by address, so that a lookup is a binary search instead of a walk of the whole symbol table.
+    struct ClosestSymbolIndex
+    {
+        struct Section {
+            uint64_t    unslidAddr;
+            uint64_t    size;
+        };
+        struct Symbol {
+            uint64_t    unslidAddr;
+            uint32_t    stringOffset;
+            uint32_t    order;          // order the slow path visits symbols in, used to break ties
+            uint8_t     sectionNum;
+            bool        isThumb;
+        };
+
+        bool            findClosestSymbol(uint64_t address, const char** symbolName, uint64_t* symbolAddr) const;
+
+        intptr_t        slide;
+        const char*     stringPool;
+        uint32_t        maxStringOffset;
+        uint32_t        sectionCount;
+        uint32_t        symbolCount;
+
+        const Section*  sections() const { return (Section*)&this[1]; }
+        const Symbol*   symbols() const  { return (Symbol*)&sections()[sectionCount]; }
+    };
+
+    // builds index in a malloc()ed buffer which the caller must free().  Returns nullptr if image has no symbol table
+    ClosestSymbolIndex* makeClosestSymbolIndex() const;
+
     // for _dyld_find_unwind_sections()
     const void*         findSectionContent(const char* segName, const char* sectName, uint64_t& size) const;
 
@@ -5013,11 +5013,6 @@ void AppCacheBuilder::setExtraPrelinkInfo(CFDictionaryRef dictionary) {
 }
 
 
-inline uint32_t absolutetime_to_milliseconds(uint64_t abstime)
-{
-    return (uint32_t)(abstime/1000/1000);
-}
-
 void AppCacheBuilder::buildAppCache(const std::vector<InputDylib>& dylibs)
 {
     uint64_t t1 = mach_absolute_time();
@@ -24,6 +24,8 @@
 
 #include <assert.h>
 
+#include <algorithm>
+
 #include "MachOFileAbstraction.hpp"
 #include "DyldSharedCache.h"
 #include "CacheBuilder.h"
@@ -103,23 +105,56 @@ void CacheBuilder::adjustAllImagesForNewSegmentLocations(uint64_t cacheBaseAddre
                                                          ASLR_Tracker& aslrTracker, LOH_Tracker* lohTracker,
                                                          const CacheBuilder::CacheCoalescedText* coalescedText)
 {
-    // Note this cannot to be done in parallel because the LOH Tracker and aslr tracker are not thread safe
-    __block bool badDylib = false;
+    // Each dylib only writes to its own segments, so the dylibs can be adjusted in parallel.
+    // The ASLR tracker is safe to use from many threads, but the LOH tracker is not, so each
+    // dylib gets its own LOH tracker and they are merged in to the real one at the end.
+    // Errors are also recorded per dylib, as the shared cache builder shares one Diagnostics
+    // between all dylibs
+    __block std::vector<std::pair<const DylibInfo*, Diagnostics*>> dylibs;
     forEachDylibInfo(^(const DylibInfo& dylib, Diagnostics& dylibDiag) {
-        if ( dylibDiag.hasError() )
+        dylibs.push_back({ &dylib, &dylibDiag });
+    });
+
+    __block std::vector<LOH_Tracker> dylibLOHTrackers(dylibs.size());
+    __block std::vector<Diagnostics> dylibDiags(dylibs.size());
+    dispatch_apply(dylibs.size(), DISPATCH_APPLY_AUTO, ^(size_t index) {
+        if ( dylibs[index].second->hasError() )
             return;
-        adjustDylibSegments(dylib, dylibDiag, cacheBaseAddress, aslrTracker,
-                            lohTracker, coalescedText);
-        if ( dylibDiag.hasError() )
-            badDylib = true;
+        adjustDylibSegments(*dylibs[index].first, dylibDiags[index], cacheBaseAddress, aslrTracker,
+                            (lohTracker != nullptr) ? &dylibLOHTrackers[index] : nullptr, coalescedText);
     });
 
+    bool badDylib = false;
+    for (size_t i = 0; i != dylibs.size(); ++i) {
+        Diagnostics& dylibDiag = *dylibs[i].second;
+        if ( dylibDiags[i].hasError() ) {
+            badDylib = true;
+            // Keep the first error, as we would have stopped there if we'd run serially
+            if ( dylibDiag.hasError() )
+                continue;
+        }
+        dylibDiag.copy(dylibDiags[i]);
+    }
+
+    if ( lohTracker != nullptr ) {
+        for (const LOH_Tracker& dylibLOHTracker : dylibLOHTrackers) {
+            for (const auto& targetAndInstructions : dylibLOHTracker)
+                (*lohTracker)[targetAndInstructions.first].insert(targetAndInstructions.second.begin(), targetAndInstructions.second.end());
+        }
+    }
+
     if ( badDylib && !_diagnostics.hasError() ) {
         _diagnostics.error("One or more binaries has an error which prevented linking.  See other errors.");
     }
 }
 
 
+CacheBuilder::ASLR_Tracker::ASLR_Tracker()
+{
+    for (os_unfair_lock& lock : _pageLocks)
+        lock = OS_UNFAIR_LOCK_INIT;
+}
+
 CacheBuilder::ASLR_Tracker::~ASLR_Tracker()
 {
     if ( _bitmap != nullptr )
@@ -135,7 +170,10 @@ void CacheBuilder::ASLR_Tracker::setDataRegion(const void* rwRegionStart, size_t
     _pageCount   = (unsigned)(rwRegionSize+_pageSize-1)/_pageSize;
     _regionStart = (uint8_t*)rwRegionStart;
     _regionEnd   = (uint8_t*)rwRegionStart + rwRegionSize;
-    _bitmap      = (bool*)calloc(_pageCount*(_pageSize/kMinimumFixupAlignment)*sizeof(bool), 1);
+    // one bit per slot, and each page is a whole number of 64-bit words
+    _bitmapWordCount = _pageCount*(_pageSize/kMinimumFixupAlignment)/64;
+    _bitmap      = (uint64_t*)calloc(_bitmapWordCount*sizeof(uint64_t), 1);
+    _pageSideTables.resize(_pageCount);
 #if BUILDING_APP_CACHE_UTIL
     size_t cacheLevelsSize = (_pageCount*(_pageSize/kMinimumFixupAlignment)*sizeof(uint8_t));
     _cacheLevels = (uint8_t*)malloc(cacheLevelsSize);
@@ -150,7 +188,9 @@ void CacheBuilder::ASLR_Tracker::add(void* loc, uint8_t level)
     uint8_t* p = (uint8_t*)loc;
     assert(p >= _regionStart);
     assert(p < _regionEnd);
-    _bitmap[(p-_regionStart)/kMinimumFixupAlignment] = true;
+    // Dylibs are adjusted in parallel and may share a bitmap word, so set the bit atomically
+    uint64_t slotIndex = (p-_regionStart)/kMinimumFixupAlignment;
+    __atomic_fetch_or(&_bitmap[slotIndex / 64], (1ULL << (slotIndex % 64)), __ATOMIC_RELAXED);
 
 #if BUILDING_APP_CACHE_UTIL
     if ( level != (uint8_t)~0U ) {
@@ -166,7 +206,8 @@ void CacheBuilder::ASLR_Tracker::remove(void* loc)
     uint8_t* p = (uint8_t*)loc;
     assert(p >= _regionStart);
     assert(p < _regionEnd);
-    _bitmap[(p-_regionStart)/kMinimumFixupAlignment] = false;
+    uint64_t slotIndex = (p-_regionStart)/kMinimumFixupAlignment;
+    __atomic_fetch_and(&_bitmap[slotIndex / 64], ~(1ULL << (slotIndex % 64)), __ATOMIC_RELAXED);
 }
 
 bool CacheBuilder::ASLR_Tracker::has(void* loc, uint8_t* level) const
@@ -177,7 +218,8 @@ bool CacheBuilder::ASLR_Tracker::has(void* loc, uint8_t* level) const
     assert(p >= _regionStart);
     assert(p < _regionEnd);
 
-    if ( _bitmap[(p-_regionStart)/kMinimumFixupAlignment] ) {
+    uint64_t slotIndex = (p-_regionStart)/kMinimumFixupAlignment;
+    if ( __atomic_load_n(&_bitmap[slotIndex / 64], __ATOMIC_RELAXED) & (1ULL << (slotIndex % 64)) ) {
 #if BUILDING_APP_CACHE_UTIL
         if ( level != nullptr ) {
             uint8_t levelValue = _cacheLevels[(p-_regionStart)/kMinimumFixupAlignment];
@@ -190,70 +232,170 @@ bool CacheBuilder::ASLR_Tracker::has(void* loc, uint8_t* level) const
     return false;
 }
 
+template <typename T>
+void CacheBuilder::ASLR_Tracker::setPageEntry(std::vector<PageEntry<T>>& entries, uint16_t offsetInPage, const T& value)
+{
+    // Fixups are mostly recorded in address order, so this is almost always an append
+    if ( entries.empty() || (entries.back().offsetInPage < offsetInPage) ) {
+        entries.push_back({ offsetInPage, value });
+        return;
+    }
+    auto pos = std::lower_bound(entries.begin(), entries.end(), offsetInPage,
+                                [](const PageEntry<T>& entry, uint16_t offset) { return entry.offsetInPage < offset; });
+    if ( (pos != entries.end()) && (pos->offsetInPage == offsetInPage) )
+        pos->value = value;
+    else
+        entries.insert(pos, { offsetInPage, value });
+}
+
+template <typename T>
+bool CacheBuilder::ASLR_Tracker::findPageEntry(const std::vector<PageEntry<T>>& entries, uint16_t offsetInPage, T& value)
+{
+    auto pos = std::lower_bound(entries.begin(), entries.end(), offsetInPage,
+                                [](const PageEntry<T>& entry, uint16_t offset) { return entry.offsetInPage < offset; });
+    if ( (pos == entries.end()) || (pos->offsetInPage != offsetInPage) )
+        return false;
+    value = pos->value;
+    return true;
+}
+
+template <typename T>
+void CacheBuilder::ASLR_Tracker::setSideTableEntry(void* loc, std::vector<PageEntry<T>> PageSideTables::*table, const T& value)
+{
+    uint8_t* p = (uint8_t*)loc;
+    if ( (p < _regionStart) || (p >= _regionEnd) ) {
+        const uint8_t* pageStart = (const uint8_t*)((uintptr_t)p & ~(uintptr_t)(_pageSize - 1));
+        os_unfair_lock_lock(&_outOfRegionLock);
+        setPageEntry(_outOfRegionSideTables[pageStart].*table, (uint16_t)(p - pageStart), value);
+        os_unfair_lock_unlock(&_outOfRegionLock);
+        return;
+    }
+
+    uint64_t regionOffset = p - _regionStart;
+    uint64_t pageIndex    = regionOffset / _pageSize;
+    os_unfair_lock& lock  = _pageLocks[pageIndex % kPageLockCount];
+    os_unfair_lock_lock(&lock);
+    std::unique_ptr<PageSideTables>& pageTables = _pageSideTables[pageIndex];
+    if ( !pageTables )
+        pageTables.reset(new PageSideTables());
+    setPageEntry((*pageTables).*table, (uint16_t)(regionOffset % _pageSize), value);
+    os_unfair_lock_unlock(&lock);
+}
+
+template <typename T>
+bool CacheBuilder::ASLR_Tracker::findSideTableEntry(void* loc, const std::vector<PageEntry<T>> PageSideTables::*table, T& value) const
+{
+    uint8_t* p = (uint8_t*)loc;
+    bool found = false;
+    if ( (p < _regionStart) || (p >= _regionEnd) ) {
+        const uint8_t* pageStart = (const uint8_t*)((uintptr_t)p & ~(uintptr_t)(_pageSize - 1));
+        os_unfair_lock_lock(&_outOfRegionLock);
+        auto pos = _outOfRegionSideTables.find(pageStart);
+        if ( pos != _outOfRegionSideTables.end() )
+            found = findPageEntry(pos->second.*table, (uint16_t)(p - pageStart), value);
+        os_unfair_lock_unlock(&_outOfRegionLock);
+        return found;
+    }
+
+    uint64_t regionOffset = p - _regionStart;
+    uint64_t pageIndex    = regionOffset / _pageSize;
+    os_unfair_lock& lock  = _pageLocks[pageIndex % kPageLockCount];
+    os_unfair_lock_lock(&lock);
+    const std::unique_ptr<PageSideTables>& pageTables = _pageSideTables[pageIndex];
+    if ( pageTables )
+        found = findPageEntry((*pageTables).*table, (uint16_t)(regionOffset % _pageSize), value);
+    os_unfair_lock_unlock(&lock);
+    return found;
+}
+
 void CacheBuilder::ASLR_Tracker::setHigh8(void* p, uint8_t high8)
 {
-    _high8Map[p] = high8;
+    setSideTableEntry(p, &PageSideTables::high8, high8);
 }
 
 void CacheBuilder::ASLR_Tracker::setAuthData(void* p, uint16_t diversity, bool hasAddrDiv, uint8_t key)
 {
-    _authDataMap[p] = {diversity, hasAddrDiv, key};
+    setSideTableEntry(p, &PageSideTables::authData, AuthData { diversity, hasAddrDiv, key });
 }
 
 void CacheBuilder::ASLR_Tracker::setRebaseTarget32(void*p, uint32_t targetVMAddr)
 {
-    _rebaseTarget32[p] = targetVMAddr;
+    setSideTableEntry(p, &PageSideTables::rebaseTarget32, targetVMAddr);
 }
 
 void CacheBuilder::ASLR_Tracker::setRebaseTarget64(void*p, uint64_t targetVMAddr)
 {
-    _rebaseTarget64[p] = targetVMAddr;
+    setSideTableEntry(p, &PageSideTables::rebaseTarget64, targetVMAddr);
 }
 
 bool CacheBuilder::ASLR_Tracker::hasHigh8(void* p, uint8_t* highByte) const
 {
-    auto pos = _high8Map.find(p);
-    if ( pos == _high8Map.end() )
-        return false;
-    *highByte = pos->second;
-    return true;
+    return findSideTableEntry(p, &PageSideTables::high8, *highByte);
 }
 
 bool CacheBuilder::ASLR_Tracker::hasAuthData(void* p, uint16_t* diversity, bool* hasAddrDiv, uint8_t* key) const
 {
-    auto pos = _authDataMap.find(p);
-    if ( pos == _authDataMap.end() )
+    AuthData authData;
+    if ( !findSideTableEntry(p, &PageSideTables::authData, authData) )
         return false;
-    *diversity  = pos->second.diversity;
-    *hasAddrDiv = pos->second.addrDiv;
-    *key        = pos->second.key;
+    *diversity  = authData.diversity;
+    *hasAddrDiv = authData.addrDiv;
+    *key        = authData.key;
     return true;
 }
 
 bool CacheBuilder::ASLR_Tracker::hasRebaseTarget32(void* p, uint32_t* vmAddr) const
 {
-    auto pos = _rebaseTarget32.find(p);
-    if ( pos == _rebaseTarget32.end() )
-        return false;
-    *vmAddr = pos->second;
-    return true;
+    return findSideTableEntry(p, &PageSideTables::rebaseTarget32, *vmAddr);
 }
 
 bool CacheBuilder::ASLR_Tracker::hasRebaseTarget64(void* p, uint64_t* vmAddr) const
 {
-    auto pos = _rebaseTarget64.find(p);
-    if ( pos == _rebaseTarget64.end() )
-        return false;
-    *vmAddr = pos->second;
-    return true;
+    return findSideTableEntry(p, &PageSideTables::rebaseTarget64, *vmAddr);
+}
+
+uint64_t CacheBuilder::ASLR_Tracker::memoryUsage() const
+{
+    __block uint64_t size = _bitmapWordCount * sizeof(uint64_t);
+    size += _pageSideTables.capacity() * sizeof(std::unique_ptr<PageSideTables>);
+    auto addPage = ^(const PageSideTables& tables) {
+        size += sizeof(PageSideTables);
+        size += tables.high8.capacity()          * sizeof(PageEntry<uint8_t>);
+        size += tables.authData.capacity()       * sizeof(PageEntry<AuthData>);
+        size += tables.rebaseTarget32.capacity() * sizeof(PageEntry<uint32_t>);
+        size += tables.rebaseTarget64.capacity() * sizeof(PageEntry<uint64_t>);
+    };
+    for (const std::unique_ptr<PageSideTables>& pageTables : _pageSideTables) {
+        if ( pageTables )
+            addPage(*pageTables);
+    }
+    for (const auto& pageAndTables : _outOfRegionSideTables)
+        addPage(pageAndTables.second);
+    return size;
+}
+
+uint64_t CacheBuilder::ASLR_Tracker::fixupCount() const
+{
+    uint64_t count = 0;
+    for (size_t i = 0; i != _bitmapWordCount; ++i)
+        count += __builtin_popcountll(_bitmap[i]);
+    return count;
 }
 
 std::vector<void*> CacheBuilder::ASLR_Tracker::getRebaseTargets() const {
-    std::vector<void*> targets;
-    for (const auto& target : _rebaseTarget32)
-        targets.push_back(target.first);
-    for (const auto& target : _rebaseTarget64)
-        targets.push_back(target.first);
+    __block std::vector<void*> targets;
+    auto addPage = ^(uint8_t* pageStart, const PageSideTables& tables) {
+        for (const PageEntry<uint32_t>& entry : tables.rebaseTarget32)
+            targets.push_back(pageStart + entry.offsetInPage);
+        for (const PageEntry<uint64_t>& entry : tables.rebaseTarget64)
+            targets.push_back(pageStart + entry.offsetInPage);
+    };
+    for (unsigned pageIndex = 0; pageIndex != _pageSideTables.size(); ++pageIndex) {
+        if ( _pageSideTables[pageIndex] )
+            addPage(_regionStart + ((uint64_t)pageIndex * _pageSize), *_pageSideTables[pageIndex]);
+    }
+    for (const auto& pageAndTables : _outOfRegionSideTables)
+        addPage((uint8_t*)pageAndTables.first, pageAndTables.second);
     return targets;
 }
 
@@ -28,9 +28,12 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <memory>
 #include <unordered_map>
 #include <unordered_set>
 
+#include <os/lock.h>
+
 #include "ClosureFileSystem.h"
 #include "DyldSharedCache.h"
 #include "Diagnostics.h"
@@ -169,7 +172,7 @@ public:
     class ASLR_Tracker
     {
     public:
-        ASLR_Tracker() = default;
+        ASLR_Tracker();
         ~ASLR_Tracker();
 
         ASLR_Tracker(ASLR_Tracker&&) = delete;
@@ -185,7 +188,7 @@ public:
         void        setRebaseTarget64(void*p, uint64_t targetVMAddr);
         void        remove(void* p);
         bool        has(void* loc, uint8_t* level = nullptr) const;
-        const bool* bitmap()        { return _bitmap; }
+        const uint64_t* bitmap()    { return _bitmap; }
         unsigned    dataPageCount() { return _pageCount; }
         unsigned    pageSize() const { return _pageSize; }
         void        disable()       { _enabled = false; };
@@ -194,10 +197,21 @@ public:
         bool        hasRebaseTarget32(void* p, uint32_t* vmAddr) const;
         bool        hasRebaseTarget64(void* p, uint64_t* vmAddr) const;
 
+        // Bytes used by the bitmap and side tables, for the verbose output
+        uint64_t    memoryUsage() const;
+
+        // Number of locations which need to be slid
+        uint64_t    fixupCount() const;
+
         // Get all the out of band rebase targets.  Used for the kernel collection builder
         // to emit the classic relocations
         std::vector<void*> getRebaseTargets() const;
 
+        // The bitmap has one bit per fixup slot.  Pages always start on a 64-bit word boundary
+        static bool bitmapHas(const uint64_t bitmap[], uint32_t slotIndex) {
+            return (bitmap[slotIndex / 64] & (1ULL << (slotIndex % 64))) != 0;
+        }
+
     private:
 
         enum {
@@ -212,7 +226,8 @@ public:
 
         uint8_t*     _regionStart    = nullptr;
         uint8_t*     _regionEnd      = nullptr;
-        bool*        _bitmap         = nullptr;
+        uint64_t*    _bitmap         = nullptr;
+        size_t       _bitmapWordCount = 0;
         unsigned     _pageCount      = 0;
         unsigned     _pageSize       = 4096;
         bool         _enabled        = true;
@@ -222,10 +237,40 @@ public:
             bool        addrDiv;
             uint8_t     key;
         };
-        std::unordered_map<void*, uint8_t>  _high8Map;
-        std::unordered_map<void*, AuthData> _authDataMap;
-        std::unordered_map<void*, uint32_t> _rebaseTarget32;
-        std::unordered_map<void*, uint64_t> _rebaseTarget64;
+
+        // Side tables are stored per page, sorted by offset in that page, so a lookup is a
+        // binary search over the few entries on one page instead of hashing a pointer.
+        template <typename T>
+        struct PageEntry {
+            uint16_t    offsetInPage;
+            T           value;
+        };
+        struct PageSideTables {
+            std::vector<PageEntry<uint8_t>>     high8;
+            std::vector<PageEntry<AuthData>>    authData;
+            std::vector<PageEntry<uint32_t>>    rebaseTarget32;
+            std::vector<PageEntry<uint64_t>>    rebaseTarget64;
+        };
+
+        // Pages are allocated lazily.  Dylibs may share a page, so updates take one of a
+        // set of locks striped by page index
+        enum { kPageLockCount = 64 };
+
+        template <typename T>
+        static void     setPageEntry(std::vector<PageEntry<T>>& entries, uint16_t offsetInPage, const T& value);
+        template <typename T>
+        static bool     findPageEntry(const std::vector<PageEntry<T>>& entries, uint16_t offsetInPage, T& value);
+        template <typename T>
+        void            setSideTableEntry(void* p, std::vector<PageEntry<T>> PageSideTables::*table, const T& value);
+        template <typename T>
+        bool            findSideTableEntry(void* p, const std::vector<PageEntry<T>> PageSideTables::*table, T& value) const;
+
+        std::vector<std::unique_ptr<PageSideTables>>    _pageSideTables;
+        mutable os_unfair_lock                          _pageLocks[kPageLockCount];
+
+        // Locations outside of the data region are rare, and are kept in a slower map
+        std::map<const uint8_t*, PageSideTables>        _outOfRegionSideTables;
+        mutable os_unfair_lock                          _outOfRegionLock = OS_UNFAIR_LOCK_INIT;
 
         // For kernel collections to work out which other collection a given
         // fixup is relative to
@@ -34,6 +34,7 @@
 #include <assert.h>
 #include <unistd.h>
 #include <dlfcn.h>
+#include <algorithm>
 
 #if BUILDING_CACHE_BUILDER
 #include <set>
@@ -423,22 +424,48 @@ void DyldSharedCache::forEachImageTextSegment(void (^handler)(uint64_t loadAddre
     }
 }
 
+const dyld_cache_image_text_info* DyldSharedCache::findImageTextContaining(uint64_t unslidAddr) const
+{
+    // check for old cache without imagesText array
+    if ( (header.mappingOffset <= __offsetof(dyld_cache_header, imagesTextOffset)) || (header.imagesTextCount == 0) )
+        return nullptr;
+
+    const dyld_cache_image_text_info* imagesText = (dyld_cache_image_text_info*)((char*)this + header.imagesTextOffset);
+    const dyld_cache_image_text_info* imagesTextEnd = &imagesText[header.imagesTextCount];
+    if ( (header.mappingOffset > __offsetof(dyld_cache_header, sharedRegionStart)) && header.imagesTextSorted ) {
+        // find first entry which starts after the address, then check the one before it
+        const dyld_cache_image_text_info* p = std::upper_bound(imagesText, imagesTextEnd, unslidAddr,
+                                                               [](uint64_t addr, const dyld_cache_image_text_info& info) {
+            return addr < info.loadAddress;
+        });
+        if ( p == imagesText )
+            return nullptr;
+        --p;
+        if ( unslidAddr < p->loadAddress+p->textSegmentSize )
+            return p;
+        return nullptr;
+    }
+
+    // older caches did not record if the table is sorted, so walk every entry
+    for (const dyld_cache_image_text_info* p=imagesText; p < imagesTextEnd; ++p) {
+        if ( (p->loadAddress <= unslidAddr) && (unslidAddr < p->loadAddress+p->textSegmentSize) )
+            return p;
+    }
+    return nullptr;
+}
+
 bool DyldSharedCache::addressInText(uint32_t cacheOffset, uint32_t* imageIndex) const
 {
     const dyld_cache_mapping_info* mappings = (dyld_cache_mapping_info*)((char*)this + header.mappingOffset);
     if ( cacheOffset > mappings[0].size )
         return false;
     uint64_t targetAddr = mappings[0].address + cacheOffset;
-    // walk imageText table and call callback for each entry
+    const dyld_cache_image_text_info* textInfo = findImageTextContaining(targetAddr);
+    if ( textInfo == nullptr )
+        return false;
     const dyld_cache_image_text_info* imagesText = (dyld_cache_image_text_info*)((char*)this + header.imagesTextOffset);
-    const dyld_cache_image_text_info* imagesTextEnd = &imagesText[header.imagesTextCount];
-    for (const dyld_cache_image_text_info* p=imagesText; p < imagesTextEnd; ++p) {
-        if ( (p->loadAddress <= targetAddr) && (targetAddr < p->loadAddress+p->textSegmentSize) ) {
-            *imageIndex = (uint32_t)(p-imagesText);
-            return true;
-        }
-    }
-    return false;
+    *imageIndex = (uint32_t)(textInfo-imagesText);
+    return true;
 }
 
 const char* DyldSharedCache::archName() const
@@ -533,6 +560,19 @@ bool DyldSharedCache::findMachHeaderImageIndex(const mach_header* mh, uint32_t&
     uintptr_t slide = (uintptr_t)this - (uintptr_t)(mappings[0].address);
     uint64_t unslidMh = (uintptr_t)mh - slide;
     const dyld_cache_image_info* dylibs = (dyld_cache_image_info*)((char*)this + header.imagesOffset);
+    if ( (header.mappingOffset > __offsetof(dyld_cache_header, sharedRegionStart)) && header.imagesTextSorted ) {
+        // only the dylibs are sorted.  Any aliases are after them and share a dylib's address
+        const dyld_cache_image_info* dylibsEnd = &dylibs[header.imagesTextCount];
+        const dyld_cache_image_info* p = std::lower_bound(dylibs, dylibsEnd, unslidMh,
+                                                          [](const dyld_cache_image_info& info, uint64_t addr) {
+            return info.address < addr;
+        });
+        if ( (p != dylibsEnd) && (p->address == unslidMh) ) {
+            imageIndex = (uint32_t)(p - dylibs);
+            return true;
+        }
+        return false;
+    }
     for (uint32_t i=0; i < header.imagesCount; ++i) {
         if ( dylibs[i].address == unslidMh ) {
             imageIndex = i;
@@ -921,6 +961,48 @@ std::string DyldSharedCache::generateJSONDependents() const {
     return stream.str();
 }
 
+std::vector<DyldSharedCache::PageTouch> DyldSharedCache::parsePageTouchProfile(Diagnostics& diag, const char* content, size_t length)
+{
+    const char* const whitespace = " \t\r";
+    std::vector<PageTouch> touches;
+    std::stringstream stream(std::string(content, length));
+    std::string line;
+    unsigned lineNumber = 0;
+    while ( std::getline(stream, line) ) {
+        ++lineNumber;
+        size_t commentStart = line.find('#');
+        if ( commentStart != std::string::npos )
+            line.erase(commentStart);
+        size_t lineEnd = line.find_last_not_of(whitespace);
+        if ( lineEnd == std::string::npos )
+            continue;
+        line.erase(lineEnd + 1);
+        line.erase(0, line.find_first_not_of(whitespace));
+
+        // install names may contain spaces, so split off the segment name and page offset from the end
+        size_t offsetStart  = line.find_last_of(whitespace);
+        size_t segmentEnd   = (offsetStart  == std::string::npos) ? std::string::npos : line.find_last_not_of(whitespace, offsetStart);
+        size_t segmentStart = (segmentEnd   == std::string::npos) ? std::string::npos : line.find_last_of(whitespace, segmentEnd);
+        size_t nameEnd      = (segmentStart == std::string::npos) ? std::string::npos : line.find_last_not_of(whitespace, segmentStart);
+        if ( nameEnd == std::string::npos ) {
+            diag.error("malformed page touch profile line %u: '%s'", lineNumber, line.c_str());
+            return {};
+        }
+        const char* offsetString = line.c_str() + offsetStart + 1;
+        char* offsetEnd = nullptr;
+        PageTouch touch;
+        touch.installName = line.substr(0, nameEnd + 1);
+        touch.segmentName = line.substr(segmentStart + 1, segmentEnd - segmentStart);
+        touch.pageOffset  = strtoull(offsetString, &offsetEnd, 0);
+        if ( (offsetEnd == offsetString) || (*offsetEnd != '\0') ) {
+            diag.error("malformed page offset on page touch profile line %u: '%s'", lineNumber, offsetString);
+            return {};
+        }
+        touches.push_back(touch);
+    }
+    return touches;
+}
+
 #endif
 
 #if !(BUILDING_LIBDYLD || BUILDING_DYLD)
@@ -1017,7 +1099,7 @@ const objc_opt::objc_opt_t* DyldSharedCache::objcOpt() const {
         return nullptr;
 
     const objc_opt::objc_opt_t* optObjCHeader = (const objc_opt::objc_opt_t*)objcROContent;
-    return optObjCHeader->version == objc_opt::VERSION ? optObjCHeader : nullptr;
+    return objc_opt::isSupportedVersion(optObjCHeader->version) ? optObjCHeader : nullptr;
 }
 
 const void* DyldSharedCache::objcOptPtrs() const {
@@ -54,6 +54,20 @@ class VIS_HIDDEN DyldSharedCache
 {
 public:
 
+#if !(BUILDING_LIBDYLD || BUILDING_DYLD)
+    // A page of a cache dylib's segment touched at launch, as recorded in a page touch profile
+    struct PageTouch
+    {
+        std::string     installName;
+        std::string     segmentName;
+        uint64_t        pageOffset;     // page aligned offset from the start of the segment
+    };
+
+    // Parses a page touch profile.  Each line is "<install name> <segment name> <page offset>", in the
+    // order the pages were first touched.  Blank lines and everything after a '#' are ignored.
+    static std::vector<PageTouch> parsePageTouchProfile(Diagnostics& diag, const char* content, size_t length);
+#endif
+
 #if BUILDING_CACHE_BUILDER
     enum CodeSigningDigestMode
     {
@@ -90,6 +104,18 @@ public:
         std::unordered_map<std::string, unsigned>   dirtyDataSegmentOrdering;
         dyld3::json::Node                           objcOptimizations;
         std::string                                 loggingPrefix;
+        // If set, a cache previously built by this builder.  Dylibs not in dylibOrdering keep their order from
+        // it, instead of being sorted by path, so that the layout stays stable across builds.
+        std::string                                 previousCachePath;
+        // If set, parts of the cache are written to outputFilePath as soon as they are final, instead of
+        // all at once after the build.  The file only appears at outputFilePath once it is complete.
+        bool                                        streamOutputFile = false;
+        // If set, a local directory where launch closures are saved.  Later builds reuse a saved closure
+        // if the cache, the executable and every file the closure loads are unchanged.
+        std::string                                 closureMemoDir;
+        // If set, the pages touched by representative launches.  Dylibs whose __TEXT is touched are laid out
+        // first, in the order they were touched, and touched __DATA_CONST segments are grouped together.
+        std::vector<PageTouch>                      pageTouchProfile;
     };
 
     struct MappedMachO
@@ -251,6 +277,12 @@ public:
     const char*         getCanonicalPath(const char* path) const;
 #endif
 
+    //
+    // Finds the dylib whose TEXT segment contains the unslid address.  Returns nullptr if none does.
+    // This is a binary search on caches whose image text table is sorted, otherwise a linear scan.
+    //
+    const dyld_cache_image_text_info* findImageTextContaining(uint64_t unslidAddr) const;
+
     //
     // Iterates over each text segment in the cache
     //
@@ -20,6 +20,8 @@
 #include <random>
 #include <map>
 
+#include <dispatch/dispatch.h>
+
 namespace IMPCaches {
 
 std::string ClassData::description() const
@@ -1528,6 +1530,11 @@ IMPCachesBuilder::IMPCachesBuilder(std::vector<CacheBuilder::DylibInfo>& allDyli
         metaclassHierarchiesToFlatten.insert("OS_object");
         classHierarchiesToFlatten.insert("OS_object");
     }
+
+    const dyld3::json::Node* searchRunsNode = dyld3::json::getOptionalValue(diag, optimizerConfiguration, "searchRuns");
+    if (searchRunsNode != nullptr) {
+        searchRuns = (unsigned)std::max<int64_t>(1, dyld3::json::parseRequiredInt(diag, *searchRunsNode));
+    }
 }
 
 struct BacktrackingState {
@@ -1670,12 +1677,13 @@ static void resetToSnapshot(std::vector<BacktrackingState>& backtrackingStack, s
     }
 }
 
-/// Finds a shift and mask for each class, and start assigning the bits of the selector addresses
-int IMPCachesBuilder::findShiftsAndMasks() {
-    // Always seed the random number generator with 0 to get reproducibility.
+/// Finds a shift and mask for each class in allClasses, and start assigning the bits of the selector addresses.
+/// Returns the number of classes that we could not place.
+static int searchShiftsAndMasks(Diagnostics& diagnostics, std::vector<IMPCaches::ClassData*>& allClasses, unsigned seed) {
+    // Always seed the random number generator with the same value to get reproducibility.
     // Note: in overflow scenarios, findShiftsAndMasks can be called more than once,
     // so make sure to always use the same value when we enter this method.
-    std::minstd_rand randomNumberGenerator(0);
+    std::minstd_rand randomNumberGenerator(seed);
     
     // This is a backtracking algorithm, so we need a stack to store our state
     // (It goes too deep to do it recursively)
@@ -1707,9 +1715,6 @@ int IMPCachesBuilder::findShiftsAndMasks() {
 
     // Go through all the classes and find a shift and mask for each,
     // backtracking if needed.
-    std::vector<IMPCaches::ClassData*> allClasses;
-    fillAllClasses(allClasses);
-    
     int numberOfDroppedClasses = 0;
 
     while (currentClassIndex < allClasses.size()) {
@@ -1726,12 +1731,12 @@ int IMPCachesBuilder::findShiftsAndMasks() {
 
         if (!c->shouldGenerateImpCache) {
             // We have decided to drop this one before, so don't waste time.
-            dropClass(_diagnostics, currentClassIndex, numberOfDroppedClasses, backtrackingStack, randomNumberGenerator, allClasses, "we have dropped it before");
+            dropClass(diagnostics, currentClassIndex, numberOfDroppedClasses, backtrackingStack, randomNumberGenerator, allClasses, "we have dropped it before");
             continue;
         }
 
         if (c->isPartOfDuplicateSet) {
-            dropClass(_diagnostics, currentClassIndex, numberOfDroppedClasses, backtrackingStack, randomNumberGenerator, allClasses, "it is part of a duplicate set");
+            dropClass(diagnostics, currentClassIndex, numberOfDroppedClasses, backtrackingStack, randomNumberGenerator, allClasses, "it is part of a duplicate set");
             continue;
         }
 
@@ -1770,7 +1775,7 @@ int IMPCachesBuilder::findShiftsAndMasks() {
             typename IMPCaches::ClassData::PlacementAttempt::Result result = c->applyAttempt(attempts[operationIndex], randomNumberGenerator);
             if (result.success) {
                 if (currentClassIndex % 1000 == 0) {
-                    _diagnostics.verbose("[IMP Caches] Placed %lu / %lu classes\n", currentClassIndex, allClasses.size());
+                    diagnostics.verbose("[IMP Caches] Placed %lu / %lu classes\n", currentClassIndex, allClasses.size());
                 }
 
                 //fprintf(stderr, "%lu / %lu: placed %s with operation %d/%lu (%s)\n", currentClassIndex, allClasses.size(), c->description().c_str(), operationIndex, attempts.size(), attempts[operationIndex].description().c_str());
@@ -1808,10 +1813,10 @@ int IMPCachesBuilder::findShiftsAndMasks() {
                 }
 #endif
 
-                _diagnostics.verbose("*** SNAPSHOT: successfully reset to snapshot of size %lu\n", bestSolutionSnapshot.size());
+                diagnostics.verbose("*** SNAPSHOT: successfully reset to snapshot of size %lu\n", bestSolutionSnapshot.size());
 
                 currentClassIndex = backtrackingStack.size();
-                dropClass(_diagnostics, currentClassIndex, numberOfDroppedClasses, backtrackingStack, randomNumberGenerator, allClasses, "it's too difficult to place");
+                dropClass(diagnostics, currentClassIndex, numberOfDroppedClasses, backtrackingStack, randomNumberGenerator, allClasses, "it's too difficult to place");
 
                 // FIXME: we should consider resetting backtrackingLength to the value it had when we snapshotted here (the risk makes this not worth trying at this point in the release).
 
@@ -1819,7 +1824,7 @@ int IMPCachesBuilder::findShiftsAndMasks() {
                 continue;
             } else {
                 if (currentClassIndex > bestSolutionSnapshot.size()) {
-                    _diagnostics.verbose("*** SNAPSHOT *** %lu / %lu (%s)\n", currentClassIndex, allClasses.size(), c->description().c_str());
+                    diagnostics.verbose("*** SNAPSHOT *** %lu / %lu (%s)\n", currentClassIndex, allClasses.size(), c->description().c_str());
                     bestSolutionSnapshot = backtrackingStack;
 
 #if 0
@@ -1832,7 +1837,7 @@ int IMPCachesBuilder::findShiftsAndMasks() {
 #endif
                 }
 
-                _diagnostics.verbose("%lu / %lu (%s): backtracking\n", currentClassIndex, allClasses.size(), c->description().c_str());
+                diagnostics.verbose("%lu / %lu (%s): backtracking\n", currentClassIndex, allClasses.size(), c->description().c_str());
                 assert(currentClassIndex != 0); // Backtracked all the way to the beginning, no solution
 
                 for (unsigned long j = 0 ; j < backtrackingLength ; j++) {
@@ -1846,12 +1851,98 @@ int IMPCachesBuilder::findShiftsAndMasks() {
     }
     
     if (numberOfDroppedClasses > 0) {
-        _diagnostics.verbose("Dropped %d classes that were too difficult to place\n", numberOfDroppedClasses);
+        diagnostics.verbose("Dropped %d classes that were too difficult to place\n", numberOfDroppedClasses);
     }
     
     return numberOfDroppedClasses;
 }
 
+/// Finds a shift and mask for each class, and start assigning the bits of the selector addresses
+int IMPCachesBuilder::findShiftsAndMasks() {
+    std::vector<IMPCaches::ClassData*> allClasses;
+    fillAllClasses(allClasses);
+
+    if ( searchRuns <= 1 )
+        return searchShiftsAndMasks(_diagnostics, allClasses, 0);
+
+    // Run several searches with different seeds in parallel, each on its own copy of the classes
+    // and of the selectors they use, and keep the one which dropped the fewest classes.
+    // The search only changes the shift and mask of each class and the in progress address of each
+    // selector, so that is all we need to copy back from the winner.
+    std::vector<IMPCaches::Selector*> allSelectors;
+    std::unordered_map<const IMPCaches::Selector*, size_t> selectorIndexes;
+    for (const IMPCaches::ClassData* c : allClasses) {
+        for (const IMPCaches::ClassData::Method& m : c->methods) {
+            if ( selectorIndexes.insert({ m.selector, allSelectors.size() }).second )
+                allSelectors.push_back(m.selector);
+        }
+    }
+
+    struct SearchRun {
+        std::vector<IMPCaches::ClassData>   classes;
+        std::vector<IMPCaches::Selector>    selectors;
+        int                                 droppedClasses  = 0;
+        size_t                              impCachesSize   = 0;
+    };
+    __block std::vector<SearchRun> runs(searchRuns);
+    const std::vector<IMPCaches::ClassData*>* allClassesPtr = &allClasses;
+    const std::vector<IMPCaches::Selector*>* allSelectorsPtr = &allSelectors;
+    const std::unordered_map<const IMPCaches::Selector*, size_t>* selectorIndexesPtr = &selectorIndexes;
+    dispatch_apply(runs.size(), DISPATCH_APPLY_AUTO, ^(size_t runIndex) {
+        SearchRun& run = runs[runIndex];
+        run.selectors.reserve(allSelectorsPtr->size());
+        for (const IMPCaches::Selector* selector : *allSelectorsPtr)
+            run.selectors.push_back(*selector);
+        run.classes.reserve(allClassesPtr->size());
+        std::vector<IMPCaches::ClassData*> runClasses;
+        for (const IMPCaches::ClassData* c : *allClassesPtr) {
+            run.classes.push_back(*c);
+            IMPCaches::ClassData& runClass = run.classes.back();
+            for (IMPCaches::ClassData::Method& m : runClass.methods)
+                m.selector = &run.selectors[selectorIndexesPtr->at(m.selector)];
+            runClasses.push_back(&runClass);
+        }
+
+        Diagnostics runDiagnostics;
+        run.droppedClasses = searchShiftsAndMasks(runDiagnostics, runClasses, (unsigned)runIndex);
+        for (const IMPCaches::ClassData* c : runClasses) {
+            if ( c->shouldGenerateImpCache )
+                run.impCachesSize += c->sizeInSharedCache();
+        }
+    });
+
+    // Ties go to the lowest seed, so that the result only depends on the configuration
+    size_t bestRunIndex = 0;
+    for (size_t i = 0; i != runs.size(); ++i) {
+        const SearchRun& run = runs[i];
+        _diagnostics.verbose("[IMP Caches] search %lu: dropped %d classes, IMP caches size %lu\n", i, run.droppedClasses, run.impCachesSize);
+        const SearchRun& best = runs[bestRunIndex];
+        if ( std::tie(run.droppedClasses, run.impCachesSize) < std::tie(best.droppedClasses, best.impCachesSize) )
+            bestRunIndex = i;
+    }
+    _diagnostics.verbose("[IMP Caches] using search %lu of %lu\n", bestRunIndex, runs.size());
+
+    const SearchRun& best = runs[bestRunIndex];
+    for (size_t i = 0; i != allClasses.size(); ++i) {
+        IMPCaches::ClassData* c = allClasses[i];
+        const IMPCaches::ClassData& bestClass = best.classes[i];
+        c->shift                                        = bestClass.shift;
+        c->neededBits                                   = bestClass.neededBits;
+        c->shouldGenerateImpCache                       = bestClass.shouldGenerateImpCache;
+        c->droppedBecauseFlatteningSuperclassWasDropped = bestClass.droppedBecauseFlatteningSuperclassWasDropped;
+    }
+    for (size_t i = 0; i != allSelectors.size(); ++i) {
+        allSelectors[i]->inProgressBucketIndex  = best.selectors[i].inProgressBucketIndex;
+        allSelectors[i]->fixedBitsMask          = best.selectors[i].fixedBitsMask;
+    }
+
+    if (best.droppedClasses > 0) {
+        _diagnostics.verbose("Dropped %d classes that were too difficult to place\n", best.droppedClasses);
+    }
+
+    return best.droppedClasses;
+}
+
 void IMPCachesBuilder::fillAllClasses(std::vector<IMPCaches::ClassData*> & allClasses) {
     for (const CacheBuilder::DylibInfo & d : dylibs) {
         typedef typename decltype(d.impCachesClassData)::value_type classpair;
@@ -1931,6 +2022,8 @@ void IMPCachesBuilder::fillAllMethods(std::vector<IMPCaches::Selector*> & allMet
 void IMPCachesBuilder::buildPerfectHashes(IMPCaches::HoleMap& holeMap, Diagnostics& diag) {
     _timeRecorder.pushTimedSection();
     int droppedClasses = findShiftsAndMasks();
+    _timeRecorder.recordCounter("IMP cache searches", searchRuns);
+    _timeRecorder.recordCounter("IMP cache classes dropped", droppedClasses);
     _timeRecorder.recordTime("find shifts and masks");
     
     if (droppedClasses > 0) {
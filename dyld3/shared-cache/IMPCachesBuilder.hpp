@@ -71,6 +71,10 @@ public:
     std::unordered_set<std::string_view> metaclassHierarchiesToFlatten;
     std::unordered_set<std::string_view> classHierarchiesToFlatten;
 
+    // Number of differently seeded searches for shifts and masks to run in parallel. The one
+    // which drops the fewest classes, then has the smallest caches, is used.
+    unsigned searchRuns = 1;
+
     /// All the dylibs the algorith, works on.
     std::vector<CacheBuilder::DylibInfo> & dylibs;
 
@@ -24,6 +24,7 @@
 
 #define OBJC_IMAGE_SUPPORTS_GC (1<<1)
 #define OBJC_IMAGE_REQUIRES_GC (1<<2)
+#define OBJC_IMAGE_HAS_CATEGORY_CLASS_PROPERTIES (1<<6)
 
 template <typename P>
 struct objc_image_info {
@@ -34,6 +35,7 @@ struct objc_image_info {
     
     bool supportsGCFlagSet()    INLINE { return getFlags() & OBJC_IMAGE_SUPPORTS_GC; }
     bool requiresGCFlagSet()    INLINE { return getFlags() & OBJC_IMAGE_REQUIRES_GC; }
+    bool hasCategoryClassPropertiesFlagSet() INLINE { return getFlags() & OBJC_IMAGE_HAS_CATEGORY_CLASS_PROPERTIES; }
     
     void setFlag(uint32_t bits) INLINE { uint32_t old = P::E::get32(flags); P::E::set32(flags, old | bits); }
     void setOptimizedByDyld() INLINE { setFlag(1<<3); }
@@ -398,6 +398,29 @@ public:
         P::E::set32(entsize, getEntsize() | getFlags() | relativeMethodSelectorsAreDirectFlag);
     }
 
+    static uint32_t relativeByteSizeForCount(uint32_t c) {
+        return byteSizeForCount(c, sizeof(objc_method_small_t<P>));
+    }
+
+    // Lays out an empty relative method list in buf.  The names will be offsets directly to the selectors.
+    static objc_method_list_t<P>* newRelativeMethodList(void* buf, uint32_t newCount) {
+        objc_method_list_t<P>* mlist = (objc_method_list_t<P>*)buf;
+        P::E::set32(mlist->entsize, (uint32_t)sizeof(objc_method_small_t<P>) | relativeMethodFlag | relativeMethodSelectorsAreDirectFlag);
+        P::E::set32(mlist->count, newCount);
+        return mlist;
+    }
+
+    // Copies method i of another relative method list in to slot j of this one.  Both lists must
+    // already be using offsets directly to the selectors.
+    void copyRelativeMethod(ContentAccessor* cache, uint32_t j, objc_method_list_t<P>* other, uint32_t i) {
+        assert(usesRelativeMethods() && other->usesRelativeMethods());
+        const objc_method_small_t<P>* from = (const objc_method_small_t<P>*)other->get(i);
+        objc_method_small_t<P>* to = (objc_method_small_t<P>*)get(j);
+        to->setName(cache, from->getName(cache, true), true);
+        to->setTypes(cache, from->getTypes(cache));
+        to->setIMP(cache, from->getIMP(cache));
+    }
+
     void sortMethods(ContentAccessor* cache, pint_t *typelist, bool isOffsetToSel) {
         if ( usesRelativeMethods() ) {
             // At this point we assume we are using offsets directly to selectors.  This
@@ -697,6 +720,15 @@ public:
         return new (buf) objc_property_list_t<P>(newCount, newEntsize);
     }
 
+    // Lays out a property list in space the cache builder has already allocated
+    static objc_property_list_t<P>* newPropertyList(void* buf, uint32_t newCount) {
+        return new (buf) objc_property_list_t<P>(newCount);
+    }
+
+    void setProperty(uint32_t i, const objc_property_t<P>* prop) {
+        *(objc_property_t<P>*)get(i) = *prop;
+    }
+
     void operator delete(void * p) { 
         ::free(p); 
     }
@@ -852,6 +884,11 @@ public:
         return new (buf) objc_protocol_list_t<P>(newCount);
     }
 
+    // Lays out a protocol list in space the cache builder has already allocated
+    static objc_protocol_list_t<P>* newProtocolList(void* buf, pint_t newCount) {
+        return new (buf) objc_protocol_list_t<P>((uint32_t)newCount);
+    }
+
     void operator delete(void * p) { 
         ::free(p); 
     }
@@ -884,8 +921,36 @@ class objc_class_data_t {
     pint_t baseProperties;
 
 public:
-    bool isMetaClass() { return P::E::get32(flags) & (1 << 0); }
-    bool isRootClass() { return P::E::get32(flags) & (1 << 1); }
+    // Values for flags.  These are libobjc's RO_ flags (objc-runtime-new.h), apart from the ones
+    // the shared cache builder claims for itself, which must not overlap any libobjc flag.
+    enum : uint32_t {
+        RO_META                         = (1 << 0),
+        RO_ROOT                         = (1 << 1),
+        RO_HAS_CXX_STRUCTORS            = (1 << 2),
+        RO_HIDDEN                       = (1 << 4),
+        RO_EXCEPTION                    = (1 << 5),
+        RO_HAS_SWIFT_INITIALIZER        = (1 << 6),
+        RO_IS_ARC                       = (1 << 7),
+        RO_HAS_CXX_DTOR_ONLY            = (1 << 8),
+        RO_HAS_WEAK_WITHOUT_ARC         = (1 << 9),
+        RO_FORBIDS_ASSOCIATED_OBJECTS   = (1 << 10),
+
+        // Claimed by the shared cache builder: the categories on this class were merged in to
+        // its base lists, and so have been removed from __objc_catlist.
+        RO_PREATTACHED_CATEGORIES       = (1 << 28),
+
+        RO_FROM_BUNDLE                  = (1 << 29),
+        RO_FUTURE                       = (1 << 30),
+        RO_REALIZED                     = (1U << 31),
+    };
+
+    bool isMetaClass() { return P::E::get32(flags) & RO_META; }
+    bool isRootClass() { return P::E::get32(flags) & RO_ROOT; }
+
+    void setHasPreattachedCategories() {
+        assert((P::E::get32(flags) & RO_PREATTACHED_CATEGORIES) == 0);
+        P::E::set32(flags, P::E::get32(flags) | RO_PREATTACHED_CATEGORIES);
+    }
 
     uint32_t getInstanceStart() { return P::E::get32(instanceStart); }
     void setInstanceStart(uint32_t newStart) { P::E::set32(instanceStart, newStart); }
@@ -950,6 +1015,8 @@ public:
     // Low bit marks Swift classes.
     objc_class_data_t<P> *getData(ContentAccessor* cache) const { return (objc_class_data_t<P> *)cache->contentForVMAddr(P::getP(data & ~0x3LL)); }
 
+    bool isSwift() const { return (P::getP(data) & 0x3LL) != 0; }
+
     objc_class_t<P> *getVTable(ContentAccessor* cache) const { return (objc_class_t<P> *)cache->contentForVMAddr(P::getP(vtable)); }
 
     pint_t* getVTableAddress() { return &vtable; }
@@ -1005,6 +1072,7 @@ class objc_category_t {
     pint_t classMethods;
     pint_t protocols;
     pint_t instanceProperties;
+    pint_t classProperties;     // only present if the image info has OBJC_IMAGE_HAS_CATEGORY_CLASS_PROPERTIES
 
 public:
 
@@ -1020,6 +1088,8 @@ public:
  
     objc_property_list_t<P> *getInstanceProperties(ContentAccessor* cache) const { return (objc_property_list_t<P> *)cache->contentForVMAddr(P::getP(instanceProperties)); }
 
+    bool hasClassProperties() const { return P::getP(classProperties) != 0; }
+
     void getPointers(std::set<void*>& pointersToRemove) {
         pointersToRemove.insert(&name);
         pointersToRemove.insert(&cls);
@@ -1268,7 +1338,56 @@ public:
     }
 };
 
-// Update selector references. The visitor performs recording and uniquing.
+// Gather selector references without changing them. The visitor performs recording.
+template <typename P, typename V>
+class SelectorCollector {
+
+    typedef typename P::uint_t pint_t;
+
+    V& mVisitor;
+
+    friend class MethodListWalker<P, SelectorCollector<P,V> >;
+    void visitMethodList(ContentAccessor* cache, objc_method_list_t<P> *mlist)
+    {
+        // Relative method list names are still offsets to selRefs
+        for (uint32_t m = 0; m < mlist->getCount(); m++) {
+            mVisitor.visit(mlist->getName(cache, m, false));
+        }
+    }
+
+    void visitProtocolMethodList(ContentAccessor* cache, objc_method_list_t<P> *mlist, pint_t *types)
+    {
+        visitMethodList(cache, mlist);
+    }
+
+public:
+
+    SelectorCollector(V& visitor) : mVisitor(visitor) { }
+
+    // Visits the same references, in the same order, as SelectorOptimizer::optimize()
+    void collect(ContentAccessor* cache, const macho_header<P>* header)
+    {
+        // method lists in classes, categories, and protocols
+        MethodListWalker<P, SelectorCollector<P,V> > mw(*this);
+        mw.walk(cache, header);
+
+        // @selector references
+        PointerSection<P, const char *>
+            selrefs(cache, header, "__DATA", "__objc_selrefs");
+        for (pint_t i = 0; i < selrefs.count(); i++) {
+            mVisitor.visit(selrefs.getVMAddress(i));
+        }
+
+        // message references
+        ArraySection<P, objc_message_ref_t<P> >
+            msgrefs(cache, header, "__DATA", "__objc_msgrefs");
+        for (pint_t i = 0; i < msgrefs.count(); i++) {
+            mVisitor.visit(msgrefs.get(i).getName());
+        }
+    }
+};
+
+// Update selector references. The visitor performs uniquing.
 template <typename P, typename V>
 class SelectorOptimizer {
 
@@ -1303,16 +1422,9 @@ class SelectorOptimizer {
 
 public:
 
-    SelectorOptimizer(V& visitor, bool& relativeMethodListSelectorsAreDirect) : mVisitor(visitor) {
-        // This pass requires that relative method lists are initially indirected via the selector
-        // ref.  After this pass runs we'll use relative offsets to the selectors themselves
-        assert(!relativeMethodListSelectorsAreDirect);
-        relativeMethodListSelectorsAreDirect = true;
-    }
-
-    void visitCoalescedStrings(const CacheBuilder::CacheCoalescedText& coalescedText) {
-        mVisitor.visitCoalescedStrings(coalescedText);
-    }
+    // This pass requires that relative method lists are initially indirected via the selector
+    // ref.  After this pass runs we'll use relative offsets to the selectors themselves
+    SelectorOptimizer(V& visitor) : mVisitor(visitor) { }
 
     void optimize(ContentAccessor* cache, const macho_header<P>* header)
     {
@@ -1341,8 +1453,8 @@ public:
         }
     }
 
-    bool isSelectorRefAddress(pint_t vmAddr) const {
-        return selectorRefVMAddrs.count(vmAddr);
+    const std::set<pint_t>& selectorRefAddresses() const {
+        return selectorRefVMAddrs;
     }
 };
 
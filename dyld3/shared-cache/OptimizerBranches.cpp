@@ -30,6 +30,8 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <mach/mach_time.h>
+#include <dispatch/dispatch.h>
 #include <CommonCrypto/CommonDigest.h>
 
 #include <string>
@@ -44,7 +46,6 @@
 #include "DyldSharedCache.h"
 #include "CacheBuilder.h"
 
-static const bool verbose = false;
 
 
 
@@ -57,7 +58,8 @@ public:
                                           const char* dylibID, Diagnostics& diags);
     void                    buildStubMap(const std::unordered_set<std::string>& neverStubEliminate);
     void                    optimizeStubs();
-    void                    optimizeCallSites(std::unordered_map<uint64_t, uint64_t>& targetAddrToOptStubAddr);
+    void                    optimizeDirectCallSites();
+    void                    optimizeCallSitesThroughStubs(std::unordered_map<uint64_t, uint64_t>& targetAddrToOptStubAddr);
     const char*             dylibID() { return _dylibID; }
     const uint8_t*          exportsTrie() {
         if ( _dyldInfo != nullptr )
@@ -87,8 +89,13 @@ private:
     typedef typename P::uint_t pint_t;
     typedef typename P::E E;
 
+    // A call site whose final target is out of branch range.  Whether it can use another
+    // dylib's optimized stub depends on the images before it, so these are handled in order.
+    struct CallSiteToStub { uint64_t callSiteAddr; uint64_t stubAddr; uint64_t finalTargetAddr; };
+
     void                    forEachCallSiteToAStub(CallSiteHandler);
-    void                    optimizeArm64CallSites(std::unordered_map<uint64_t, uint64_t>& targetAddrToOptStubAddr);
+    void                    optimizeArm64CallSites();
+    void                    optimizeArm64CallSitesThroughStubs(std::unordered_map<uint64_t, uint64_t>& targetAddrToOptStubAddr);
     void                    optimizeArm64Stubs();
 #if SUPPORT_ARCH_arm64e
     void                    optimizeArm64eStubs();
@@ -96,7 +103,8 @@ private:
 #if SUPPORT_ARCH_arm64_32
     void                    optimizeArm64_32Stubs();
 #endif
-    void                    optimizeArmCallSites(std::unordered_map<uint64_t, uint64_t>& targetAddrToOptStubAddr);
+    void                    optimizeArmCallSites();
+    void                    optimizeArmCallSitesThroughStubs(std::unordered_map<uint64_t, uint64_t>& targetAddrToOptStubAddr);
     void                    optimizeArmStubs();
     uint64_t                lazyPointerAddrFromArm64Stub(const uint8_t* stubInstructions, uint64_t stubVMAddr);
 #if SUPPORT_ARCH_arm64e
@@ -142,6 +150,7 @@ private:
     std::unordered_map<pint_t, pint_t>      _lpAddrToTargetAddr;
     std::unordered_map<pint_t, const char*> _targetAddrToName;
     std::unordered_set<uint64_t>            _stubsToOptimize;
+    std::vector<CallSiteToStub>             _callSitesToStubs;
 };
 
 
@@ -580,7 +589,7 @@ uint32_t StubOptimizer<P>::setDisplacementInThumbBranch(uint32_t instruction,  u
 
 
 template <typename P>
-void StubOptimizer<P>::optimizeArmCallSites(std::unordered_map<uint64_t, uint64_t>& targetAddrToOptStubAddr)
+void StubOptimizer<P>::optimizeArmCallSites()
 {
     forEachCallSiteToAStub([&](uint8_t kind, uint64_t callSiteAddr, uint64_t stubAddr, uint32_t& instruction) -> bool {
         if ( kind == DYLD_CACHE_ADJ_V2_THUMB_BR22 ) {
@@ -620,27 +629,8 @@ void StubOptimizer<P>::optimizeArmCallSites(std::unordered_map<uint64_t, uint64_
                 return true;
             }
 
-            // try to re-use an existing optimized stub
-            const auto& pos3 = targetAddrToOptStubAddr.find(finalTargetAddr);
-            if ( pos3 != targetAddrToOptStubAddr.end() ) {
-                uint64_t existingStub = pos3->second;
-                if ( existingStub != stubAddr ) {
-                    int64_t deltaToOptStub = existingStub - (callSiteAddr + 4);
-                    if ( (deltaToOptStub > -b16MegLimit) && (deltaToOptStub < b16MegLimit) ) {
-                        bool targetIsThumb = (existingStub & 1);
-                        instruction = setDisplacementInThumbBranch(instruction, (uint32_t)callSiteAddr, (int32_t)deltaToOptStub, targetIsThumb);
-                        if (_diagnostics.hasError())
-                            return false;
-                        _branchToReUsedOptimizedStubCount++;
-                        return true;
-                    }
-                }
-            }
-
-            // leave as BL to stub, but optimize the stub
-            _stubsToOptimize.insert(stubAddr);
-            targetAddrToOptStubAddr[finalTargetAddr] = stubAddr;
-            _branchToOptimizedStubCount++;
+            // needs an optimized stub, which is decided later in image order
+            _callSitesToStubs.push_back({ callSiteAddr, stubAddr, finalTargetAddr });
             return false;
         }
         else if ( kind == DYLD_CACHE_ADJ_V2_ARM_BR24 ) {
@@ -649,8 +639,37 @@ void StubOptimizer<P>::optimizeArmCallSites(std::unordered_map<uint64_t, uint64_
 
         return false;
     });
-    if (_diagnostics.hasError())
-        return;
+}
+
+
+template <typename P>
+void StubOptimizer<P>::optimizeArmCallSitesThroughStubs(std::unordered_map<uint64_t, uint64_t>& targetAddrToOptStubAddr)
+{
+    for (const CallSiteToStub& site : _callSitesToStubs) {
+        // try to re-use an existing optimized stub
+        const auto& pos = targetAddrToOptStubAddr.find(site.finalTargetAddr);
+        if ( pos != targetAddrToOptStubAddr.end() ) {
+            uint64_t existingStub = pos->second;
+            if ( existingStub != site.stubAddr ) {
+                int64_t deltaToOptStub = existingStub - (site.callSiteAddr + 4);
+                if ( (deltaToOptStub > -b16MegLimit) && (deltaToOptStub < b16MegLimit) ) {
+                    uint32_t* instrPtr = (uint32_t*)((uint8_t*)(long)site.callSiteAddr + _cacheSlide);
+                    bool targetIsThumb = (existingStub & 1);
+                    uint32_t instruction = setDisplacementInThumbBranch(E::get32(*instrPtr), (uint32_t)site.callSiteAddr, (int32_t)deltaToOptStub, targetIsThumb);
+                    if (_diagnostics.hasError())
+                        return;
+                    E::set32(*instrPtr, instruction);
+                    _branchToReUsedOptimizedStubCount++;
+                    continue;
+                }
+            }
+        }
+
+        // leave as BL to stub, but optimize the stub
+        _stubsToOptimize.insert(site.stubAddr);
+        targetAddrToOptStubAddr[site.finalTargetAddr] = site.stubAddr;
+        _branchToOptimizedStubCount++;
+    }
 }
 
 
@@ -781,7 +800,7 @@ void StubOptimizer<P>::optimizeArm64_32Stubs()
 
 
 template <typename P>
-void StubOptimizer<P>::optimizeArm64CallSites(std::unordered_map<uint64_t, uint64_t>& targetAddrToOptStubAddr)
+void StubOptimizer<P>::optimizeArm64CallSites()
 {
     forEachCallSiteToAStub([&](uint8_t kind, uint64_t callSiteAddr, uint64_t stubAddr, uint32_t& instruction) -> bool {
         if ( kind != DYLD_CACHE_ADJ_V2_ARM64_BR26 )
@@ -818,43 +837,98 @@ void StubOptimizer<P>::optimizeArm64CallSites(std::unordered_map<uint64_t, uint6
             return true;
         }
 
+        // needs an optimized stub, which is decided later in image order
+        _callSitesToStubs.push_back({ callSiteAddr, stubAddr, finalTargetAddr });
+        return false;
+    });
+}
+
+
+template <typename P>
+void StubOptimizer<P>::optimizeArm64CallSitesThroughStubs(std::unordered_map<uint64_t, uint64_t>& targetAddrToOptStubAddr)
+{
+    for (const CallSiteToStub& site : _callSitesToStubs) {
         // try to re-use an existing optimized stub
-        const auto& pos3 = targetAddrToOptStubAddr.find((pint_t)finalTargetAddr);
-        if ( pos3 != targetAddrToOptStubAddr.end() ) {
-            uint64_t existingStub = pos3->second;
-            if ( existingStub != stubAddr ) {
-                int64_t deltaToOptStub = existingStub - callSiteAddr;
+        const auto& pos = targetAddrToOptStubAddr.find((pint_t)site.finalTargetAddr);
+        if ( pos != targetAddrToOptStubAddr.end() ) {
+            uint64_t existingStub = pos->second;
+            if ( existingStub != site.stubAddr ) {
+                int64_t deltaToOptStub = existingStub - site.callSiteAddr;
                 if ( (deltaToOptStub > -b128MegLimit) && (deltaToOptStub < b128MegLimit) ) {
+                    uint32_t* instrPtr = (uint32_t*)((uint8_t*)(long)site.callSiteAddr + _cacheSlide);
+                    uint32_t instruction = E::get32(*instrPtr);
                     instruction = (instruction & 0xFC000000) | ((deltaToOptStub >> 2) & 0x03FFFFFF);
+                    E::set32(*instrPtr, instruction);
                     _branchToReUsedOptimizedStubCount++;
-                    return true;
+                    continue;
                 }
             }
         }
 
         // leave as BL to stub, but optimize the stub
-        _stubsToOptimize.insert(stubAddr);
-        targetAddrToOptStubAddr[(pint_t)finalTargetAddr] = (pint_t)stubAddr;
+        _stubsToOptimize.insert(site.stubAddr);
+        targetAddrToOptStubAddr[(pint_t)site.finalTargetAddr] = (pint_t)site.stubAddr;
         _branchToOptimizedStubCount++;
-        return false;
-    });
-    if (_diagnostics.hasError())
-        return;
+    }
 }
 
 
+// Rewrites every call site whose final target is within branch range.  This only touches
+// this image, so can be run on all images in parallel.
 template <typename P>
-void StubOptimizer<P>::optimizeCallSites(std::unordered_map<uint64_t, uint64_t>& targetAddrToOptStubAddr)
+void StubOptimizer<P>::optimizeDirectCallSites()
 {
     if ( _textSection == NULL )
         return;
     if ( _stubSection == NULL )
         return;
 
+    switch ( _mh->cputype() ) {
+        case CPU_TYPE_ARM64:
+#if SUPPORT_ARCH_arm64_32
+        case CPU_TYPE_ARM64_32:
+#endif
+            optimizeArm64CallSites();
+            break;
+        case CPU_TYPE_ARM:
+            optimizeArmCallSites();
+            break;
+    }
+}
+
+
+// Routes the remaining call sites through an optimized stub, re-using one from an earlier
+// image when it is in range.  Must be called on each image in order.
+template <typename P>
+void StubOptimizer<P>::optimizeCallSitesThroughStubs(std::unordered_map<uint64_t, uint64_t>& targetAddrToOptStubAddr)
+{
+    if ( _diagnostics.hasError() )
+        return;
+
+    switch ( _mh->cputype() ) {
+        case CPU_TYPE_ARM64:
+#if SUPPORT_ARCH_arm64_32
+        case CPU_TYPE_ARM64_32:
+#endif
+            optimizeArm64CallSitesThroughStubs(targetAddrToOptStubAddr);
+            break;
+        case CPU_TYPE_ARM:
+            optimizeArmCallSitesThroughStubs(targetAddrToOptStubAddr);
+            break;
+    }
+}
+
+
+template <typename P>
+void StubOptimizer<P>::optimizeStubs()
+{
+    if ( _textSection == NULL )
+        return;
+    if ( _stubSection == NULL )
+        return;
 
     switch ( _mh->cputype() ) {
         case CPU_TYPE_ARM64:
-            optimizeArm64CallSites(targetAddrToOptStubAddr);
 #if SUPPORT_ARCH_arm64e
             if (cpuSubtype() == CPU_SUBTYPE_ARM64E)
                 optimizeArm64eStubs();
@@ -864,26 +938,18 @@ void StubOptimizer<P>::optimizeCallSites(std::unordered_map<uint64_t, uint64_t>&
             break;
 #if SUPPORT_ARCH_arm64_32
         case CPU_TYPE_ARM64_32:
-            optimizeArm64CallSites(targetAddrToOptStubAddr);
             optimizeArm64_32Stubs();
             break;
 #endif
         case CPU_TYPE_ARM:
-            optimizeArmCallSites(targetAddrToOptStubAddr);
             optimizeArmStubs();
             break;
     }
-    if ( verbose ) {
-        _diagnostics.verbose("dylib has %6u BLs to %4u stubs. Changed %5u, %5u, %5u BLs to use direct branch, optimized stub, neighbor's optimized stub. "
-                             "%5u stubs left interposable, %4u stubs optimized. path=%s\n",
-                            _branchToStubCount, _stubCount, _branchOptimizedToDirectCount, _branchToOptimizedStubCount, _branchToReUsedOptimizedStubCount,
-                            _stubsLeftInterposable, _stubOptimizedCount, _dylibID);
-    }
-
 }
 
+// Returns the number of call sites changed to not go through their stub
 template <typename P>
-void bypassStubs(std::vector<std::pair<const mach_header*, const char*>> images,
+uint64_t bypassStubs(std::vector<std::pair<const mach_header*, const char*>> images,
                  const std::string& archName,
                  int64_t cacheSlide, uint64_t cacheUnslidAddr,
                  const DyldSharedCache* dyldCache,
@@ -893,12 +959,14 @@ void bypassStubs(std::vector<std::pair<const mach_header*, const char*>> images,
     std::unordered_map<uint64_t, uint64_t> targetAddrToOptStubAddr;
     diags.verbose("Stub elimination optimization:\n");
 
-    // construct a StubOptimizer for each image
+    // construct a StubOptimizer for each image.  Each gets its own Diagnostics so that
+    // images can be processed in parallel.  They are merged back in image order at the end
     __block std::vector<StubOptimizer<P>*> optimizers;
-    for (std::pair<const mach_header*, const char*> image : images) {
+    std::vector<Diagnostics>               imageDiags(images.size());
+    for (size_t i=0; i < images.size(); ++i) {
         optimizers.push_back(new StubOptimizer<P>(cacheSlide, cacheUnslidAddr, archName,
-                                                  (macho_header<P>*)image.first, image.second,
-                                                  diags));
+                                                  (macho_header<P>*)images[i].first, images[i].second,
+                                                  imageDiags[i]));
     }
 
     // build set of functions to never stub-eliminate because tools may need to override them
@@ -918,7 +986,7 @@ void bypassStubs(std::vector<std::pair<const mach_header*, const char*>> images,
                 std::vector<ExportInfoTrie::Entry> exports;
                 if ( !ExportInfoTrie::parseTrie(exportsStart, exportsEnd, exports) ) {
                     diags.error("malformed exports trie in %s", op->dylibID());
-                    return;
+                    return 0;
                 }
                 for(const ExportInfoTrie::Entry& entry : exports) {
                     neverStubEliminate.insert(entry.name);
@@ -929,25 +997,57 @@ void bypassStubs(std::vector<std::pair<const mach_header*, const char*>> images,
 #endif
 
     // build maps of stubs-to-lp and lp-to-target
-    for (StubOptimizer<P>* op : optimizers)
-        op->buildStubMap(neverStubEliminate);
+    uint64_t t1 = mach_absolute_time();
+    const std::unordered_set<std::string>* neverStubEliminatePtr = &neverStubEliminate;
+    dispatch_apply(optimizers.size(), DISPATCH_APPLY_AUTO, ^(size_t index) {
+        optimizers[index]->buildStubMap(*neverStubEliminatePtr);
+    });
 
-    // optimize call sites to by-pass stubs or jump through island
+    // change call sites to branch directly to their target when in range
+    uint64_t t2 = mach_absolute_time();
+    dispatch_apply(optimizers.size(), DISPATCH_APPLY_AUTO, ^(size_t index) {
+        optimizers[index]->optimizeDirectCallSites();
+    });
+
+    // the rest jump through an island.  Which stub is used as the island for a target depends
+    // on the images processed before, so this is done serially in image order
+    uint64_t t3 = mach_absolute_time();
     for (StubOptimizer<P>* op : optimizers)
-        op->optimizeCallSites(targetAddrToOptStubAddr);
+        op->optimizeCallSitesThroughStubs(targetAddrToOptStubAddr);
+
+    // optimize the stubs used as islands
+    uint64_t t4 = mach_absolute_time();
+    dispatch_apply(optimizers.size(), DISPATCH_APPLY_AUTO, ^(size_t index) {
+        optimizers[index]->optimizeStubs();
+    });
+    uint64_t t5 = mach_absolute_time();
 
-    // write total optimization info
+    // write per-image and total optimization info
     uint32_t callSiteCount = 0;
     uint32_t callSiteDirectOptCount = 0;
-    for (StubOptimizer<P>* op : optimizers) {
+    uint64_t callSiteOptCount = 0;
+    for (size_t i=0; i < optimizers.size(); ++i) {
+        StubOptimizer<P>* op = optimizers[i];
+        diags.copy(imageDiags[i]);
+        diags.verbose("  dylib has %6u BLs to %4u stubs. Changed %5u, %5u, %5u BLs to use direct branch, optimized stub, neighbor's optimized stub. "
+                      "%5u stubs left interposable, %4u stubs optimized. path=%s\n",
+                      op->_branchToStubCount, op->_stubCount, op->_branchOptimizedToDirectCount, op->_branchToOptimizedStubCount,
+                      op->_branchToReUsedOptimizedStubCount, op->_stubsLeftInterposable, op->_stubOptimizedCount, op->dylibID());
         callSiteCount           += op->_branchToStubCount;
         callSiteDirectOptCount  += op->_branchOptimizedToDirectCount;
+        callSiteOptCount        += op->_branchOptimizedToDirectCount + op->_branchToOptimizedStubCount + op->_branchToReUsedOptimizedStubCount;
     }
     diags.verbose("  cache contains %u call sites of which %u were direct bound\n", callSiteCount, callSiteDirectOptCount);
+    diags.verbose("  time to build stub maps: %ums\n", absolutetime_to_milliseconds(t2-t1));
+    diags.verbose("  time to bind call sites directly: %ums\n", absolutetime_to_milliseconds(t3-t2));
+    diags.verbose("  time to bind call sites through islands: %ums\n", absolutetime_to_milliseconds(t4-t3));
+    diags.verbose("  time to optimize stubs: %ums\n", absolutetime_to_milliseconds(t5-t4));
 
     // clean up
     for (StubOptimizer<P>* op : optimizers)
         delete op;
+
+    return callSiteOptCount;
 }
 
 void CacheBuilder::optimizeAwayStubs(const std::vector<std::pair<const mach_header*, const char*>>& images,
@@ -959,22 +1059,25 @@ void CacheBuilder::optimizeAwayStubs(const std::vector<std::pair<const mach_head
     std::string archName = _options.archs->name();
 #if SUPPORT_ARCH_arm64_32
     if ( startsWith(archName, "arm64_32") ) {
-        bypassStubs<Pointer32<LittleEndian> >(images, archName, cacheSlide, cacheUnslidAddr,
-                                              dyldCache, neverStubEliminateSymbols,
-                                              _diagnostics);
+        uint64_t callSiteOptCount = bypassStubs<Pointer32<LittleEndian> >(images, archName, cacheSlide, cacheUnslidAddr,
+                                                                           dyldCache, neverStubEliminateSymbols,
+                                                                           _diagnostics);
+        _timeRecorder.recordCounter("call sites optimized", callSiteOptCount);
         return;
     }
 #endif
     if ( startsWith(archName, "arm64") ) {
-        bypassStubs<Pointer64<LittleEndian> >(images, archName, cacheSlide, cacheUnslidAddr,
-                                              dyldCache, neverStubEliminateSymbols,
-                                              _diagnostics);
+        uint64_t callSiteOptCount = bypassStubs<Pointer64<LittleEndian> >(images, archName, cacheSlide, cacheUnslidAddr,
+                                                                           dyldCache, neverStubEliminateSymbols,
+                                                                           _diagnostics);
+        _timeRecorder.recordCounter("call sites optimized", callSiteOptCount);
         return;
     }
     if ( archName == "armv7k" ) {
-        bypassStubs<Pointer32<LittleEndian> >(images, archName, cacheSlide, cacheUnslidAddr,
-                                              dyldCache, neverStubEliminateSymbols,
-                                              _diagnostics);
+        uint64_t callSiteOptCount = bypassStubs<Pointer32<LittleEndian> >(images, archName, cacheSlide, cacheUnslidAddr,
+                                                                           dyldCache, neverStubEliminateSymbols,
+                                                                           _diagnostics);
+        _timeRecorder.recordCounter("call sites optimized", callSiteOptCount);
         return;
     }
     // no stub optimization done for other arches
@@ -33,8 +33,12 @@
 #include <fstream>
 #include <string>
 #include <algorithm>
+#include <functional>
 #include <unordered_map>
 #include <unordered_set>
+#include <queue>
+
+#include <dispatch/dispatch.h>
 
 #include "MachOFileAbstraction.hpp"
 #include "Trie.hpp"
@@ -47,55 +51,132 @@
 
 namespace {
 
+static size_t hashString(const char* str)
+{
+    // FNV-1a
+    size_t hash = 0xcbf29ce484222325ULL;
+    for (const uint8_t* s = (const uint8_t*)str; *s != '\0'; ++s) {
+        hash ^= *s;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+struct HashCString {
+    size_t operator()(const char* str) const { return hashString(str); }
+};
+
+struct EqualCString {
+    bool operator()(const char* s1, const char* s2) const { return (strcmp(s1, s2) == 0); }
+};
+
+// Builds a string pool of all symbol names, uniqued and sorted, and sets the string offset of each symbol.
+// Each dylib adds its strings to its own lists, one per shard (by hash), so the lists can be filled in
+// parallel.  The strings are then uniqued in shards in parallel, and the sorted shards merged, so the
+// pool is the same no matter how many threads built it.
 template <typename P>
 class SortedStringPool
 {
+    static const uint32_t ShardCount = 64;
+
 public:
-    // add a string and symbol table entry index to be updated later
-    void add(uint32_t symbolIndex, const char* symbolName) {
-        _map[symbolName].push_back({ symbolIndex, false });
-    }
+    class DylibStrings
+    {
+    public:
+        // add a string and symbol table entry index to be updated later
+        void add(uint32_t symbolIndex, const char* symbolName) {
+            size_t hash = hashString(symbolName);
+            _shardEntries[hash % ShardCount].push_back({ symbolName, symbolIndex });
+        }
 
-    // add a string and symbol table entry index to be updated later
-    void addIndirect(uint32_t symbolIndex, const char* symbolName) {
-        _map[symbolName].push_back({ symbolIndex, true });
+    private:
+        friend class SortedStringPool;
+        struct Entry { const char* name; uint32_t symbolIndex; };
+        std::vector<Entry> _shardEntries[ShardCount];
+    };
+
+                    SortedStringPool(size_t dylibCount) : _dylibStrings(dylibCount) { }
+
+    DylibStrings&   dylibStrings(size_t dylibIndex) { return _dylibStrings[dylibIndex]; }
+
+    // unique and sort all strings added, and assign each its offset in the pool
+    void layout() {
+        // unique strings in each shard
+        dispatch_apply(ShardCount, DISPATCH_APPLY_AUTO, ^(size_t shardIndex) {
+            Shard& shard = _shards[shardIndex];
+            for (const DylibStrings& dylibStrings : _dylibStrings) {
+                for (const typename DylibStrings::Entry& entry : dylibStrings._shardEntries[shardIndex]) {
+                    if ( shard.offsets.insert({ entry.name, 0 }).second )
+                        shard.sortedNames.push_back(entry.name);
+                }
+            }
+            std::sort(shard.sortedNames.begin(), shard.sortedNames.end(), [](const char* a, const char* b) {
+                return (strcmp(a, b) < 0);
+            });
+            shard.sortedOffsets.resize(shard.sortedNames.size());
+        });
+
+        // merge the sorted shards to assign offsets in sorted order
+        typedef std::pair<uint32_t, uint32_t> ShardAndIndex;
+        auto greater = [&](const ShardAndIndex& a, const ShardAndIndex& b) {
+            return (strcmp(_shards[a.first].sortedNames[a.second], _shards[b.first].sortedNames[b.second]) > 0);
+        };
+        std::priority_queue<ShardAndIndex, std::vector<ShardAndIndex>, decltype(greater)> heap(greater);
+        for (uint32_t shardIndex=0; shardIndex < ShardCount; ++shardIndex) {
+            if ( !_shards[shardIndex].sortedNames.empty() )
+                heap.push({ shardIndex, 0 });
+        }
+        uint32_t poolOffset = 1; // tradition for start of pool to be empty string
+        while ( !heap.empty() ) {
+            ShardAndIndex top = heap.top();
+            heap.pop();
+            Shard& shard = _shards[top.first];
+            shard.sortedOffsets[top.second] = poolOffset;
+            poolOffset += (uint32_t)strlen(shard.sortedNames[top.second]) + 1;
+            if ( top.second + 1 < shard.sortedNames.size() )
+                heap.push({ top.first, top.second + 1 });
+        }
+        _size = poolOffset;
     }
 
     // copy sorted strings to buffer and update all symbol's string offsets
     uint32_t copyPoolAndUpdateOffsets(char* dstStringPool, macho_nlist<P>* symbolTable) {
-        // walk sorted list of strings
-        dstStringPool[0] = '\0'; // tradition for start of pool to be empty string
-        uint32_t poolOffset = 1;
-        for (auto& entry : _map) {
-            const std::string& symName = entry.first;
-            // append string to pool
-            strcpy(&dstStringPool[poolOffset], symName.c_str());
-            //  set each string offset of each symbol using it
-            for (std::pair<uint32_t, bool> symbolIndexAndIndirect : entry.second) {
-                if ( symbolIndexAndIndirect.second ) {
-                    // Indirect
-                    symbolTable[symbolIndexAndIndirect.first].set_n_value(poolOffset);
-                } else {
-                    symbolTable[symbolIndexAndIndirect.first].set_n_strx(poolOffset);
-                }
+        dstStringPool[0] = '\0';
+        dispatch_apply(ShardCount, DISPATCH_APPLY_AUTO, ^(size_t shardIndex) {
+            Shard& shard = _shards[shardIndex];
+            for (size_t i=0; i < shard.sortedNames.size(); ++i) {
+                strcpy(&dstStringPool[shard.sortedOffsets[i]], shard.sortedNames[i]);
+                shard.offsets[shard.sortedNames[i]] = shard.sortedOffsets[i];
             }
-            poolOffset += symName.size() + 1;
-        }
+        });
+        //  set each string offset of each symbol using it
+        dispatch_apply(_dylibStrings.size(), DISPATCH_APPLY_AUTO, ^(size_t dylibIndex) {
+            for (uint32_t shardIndex=0; shardIndex < ShardCount; ++shardIndex) {
+                const Shard& shard = _shards[shardIndex];
+                for (const typename DylibStrings::Entry& entry : _dylibStrings[dylibIndex]._shardEntries[shardIndex])
+                    symbolTable[entry.symbolIndex].set_n_strx(shard.offsets.find(entry.name)->second);
+            }
+        });
         // return size of pool
-        return poolOffset;
+        return _size;
     }
 
-    size_t size() {
-        size_t size = 1;
-        for (auto& entry : _map) {
-            size += (entry.first.size() + 1);
-        }
-        return size;
+    // size of pool, only valid after layout()
+    uint32_t size() const {
+        return _size;
     }
 
-
 private:
-    std::map<std::string, std::vector<std::pair<uint32_t, bool>>> _map;
+    struct Shard
+    {
+        std::unordered_map<const char*, uint32_t, HashCString, EqualCString>    offsets;
+        std::vector<const char*>                                                sortedNames;
+        std::vector<uint32_t>                                                   sortedOffsets;
+    };
+
+    std::vector<DylibStrings>   _dylibStrings;
+    Shard                       _shards[ShardCount];
+    uint32_t                    _size = 1;
 };
 
 
@@ -113,6 +194,8 @@ struct LocalSymbolInfo
 template <typename P>
 class LinkeditOptimizer {
 public:
+    typedef typename SortedStringPool<P>::DylibStrings DylibStrings;
+
                     LinkeditOptimizer(const void* containerBuffer, macho_header<P>* mh, const char* dylibID,
                                       Diagnostics& diag);
 
@@ -123,14 +206,25 @@ public:
     void            copyLazyBindingInfo(uint8_t* newLinkEditContent, uint32_t& offset);
     void            copyBindingInfo(uint8_t* newLinkEditContent, uint32_t& offset);
     void            copyExportInfo(uint8_t* newLinkEditContent, uint32_t& offset);
-    void            copyExportedSymbols(uint8_t* newLinkEditContent, SortedStringPool<P>& stringPool, uint32_t& offset, uint32_t& symbolIndex);
-    void            copyImportedSymbols(uint8_t* newLinkEditContent, SortedStringPool<P>& stringPool, uint32_t& offset, uint32_t& symbolIndex);
-    void            copyLocalSymbols(uint8_t* newLinkEditContent, SortedStringPool<P>& stringPool, uint32_t& offset, uint32_t& symbolIndex,
-                                     bool redact, std::vector<LocalSymbolInfo>& localSymbolInfos,
-                                     std::vector<macho_nlist<P>>& unmappedLocalSymbols, SortedStringPool<P>& localSymbolsStringPool);
+    void            copyExportedSymbols(uint8_t* newLinkEditContent, DylibStrings& strings, uint32_t& offset, uint32_t& symbolIndex);
+    void            copyImportedSymbols(uint8_t* newLinkEditContent, DylibStrings& strings, uint32_t& offset, uint32_t& symbolIndex);
+    void            copyLocalSymbols(uint8_t* newLinkEditContent, DylibStrings& strings, uint32_t& offset, uint32_t& symbolIndex,
+                                     bool redact, LocalSymbolInfo& localInfo, macho_nlist<P>* unmappedLocalSymbols,
+                                     uint32_t& unmappedSymbolIndex, DylibStrings& localSymbolsStrings);
     void            copyFunctionStarts(uint8_t* newLinkEditContent, uint32_t& offset);
     void            copyDataInCode(uint8_t* newLinkEditContent, uint32_t& offset);
     void            copyIndirectSymbolTable(uint8_t* newLinkEditContent, uint32_t& offset);
+
+    // sizes of what the copy methods above will add to the merged LINKEDIT
+    uint32_t        weakBindingInfoSize();
+    uint32_t        lazyBindingInfoSize();
+    uint32_t        bindingInfoSize();
+    uint32_t        exportInfoSize();
+    uint32_t        functionStartsSize();
+    uint32_t        dataInCodeSize();
+    uint32_t        indirectSymbolTableSize();
+    void            countSymbols(bool redact, uint32_t& localCount, uint32_t& unmappedLocalCount,
+                                 uint32_t& exportedCount, uint32_t& importedCount);
     void            updateLoadCommands(uint32_t linkeditStartOffset, uint64_t mergedLinkeditAddr, uint64_t newLinkeditSize,
                                        uint32_t sharedSymbolTableStartOffset, uint32_t sharedSymbolTableCount,
                                        uint32_t sharedSymbolStringsOffset, uint32_t sharedSymbolStringsSize);
@@ -162,6 +256,11 @@ private:
 
     typedef typename P::uint_t pint_t;
     typedef typename P::E E;
+    typedef std::function<void(const macho_nlist<P>* entry, uint32_t oldSymbolIndex, const char* name)> SymbolHandler;
+
+    void                                    forEachLocalSymbol(SymbolHandler);
+    void                                    forEachExportedSymbol(SymbolHandler);
+    void                                    forEachImportedSymbol(SymbolHandler);
 
     macho_header<P>*                        _mh;
     const void*                             _containerBuffer;
@@ -551,19 +650,65 @@ void LinkeditOptimizer<P>::copyDataInCode(uint8_t* newLinkEditContent, uint32_t&
 
 
 template <typename P>
-void LinkeditOptimizer<P>::copyLocalSymbols(uint8_t* newLinkEditContent, SortedStringPool<P>& stringPool, uint32_t& offset, uint32_t& symbolIndex,
-                                            bool redact, std::vector<LocalSymbolInfo>& localSymbolInfos,
-                                            std::vector<macho_nlist<P>>& unmappedLocalSymbols, SortedStringPool<P>& localSymbolsStringPool)
+uint32_t LinkeditOptimizer<P>::weakBindingInfoSize()
 {
-    localSymbolInfos.push_back(LocalSymbolInfo());
+    if ( _dyldInfo == nullptr )
+        return 0;
+    return _dyldInfo->weak_bind_size();
+}
 
-    LocalSymbolInfo& localInfo = localSymbolInfos.back();
-    localInfo.dylibOffset = (uint32_t)(((uint8_t*)_mh) - (uint8_t*)_containerBuffer);
-    localInfo.nlistStartIndex = (uint32_t)unmappedLocalSymbols.size();
-    localInfo.nlistCount = 0;
-    _newLocalSymbolsStartIndex = symbolIndex;
-    _newLocalSymbolCount = 0;
+template <typename P>
+uint32_t LinkeditOptimizer<P>::lazyBindingInfoSize()
+{
+    if ( _dyldInfo == nullptr )
+        return 0;
+    return _dyldInfo->lazy_bind_size();
+}
+
+template <typename P>
+uint32_t LinkeditOptimizer<P>::bindingInfoSize()
+{
+    if ( _dyldInfo == nullptr )
+        return 0;
+    return _dyldInfo->bind_size();
+}
 
+template <typename P>
+uint32_t LinkeditOptimizer<P>::exportInfoSize()
+{
+    if ( (_dyldInfo == nullptr) && (_exportTrieCmd == nullptr) )
+        return 0;
+    return _exportTrieCmd ? _exportTrieCmd->datasize() : _dyldInfo->export_size();
+}
+
+template <typename P>
+uint32_t LinkeditOptimizer<P>::functionStartsSize()
+{
+    if ( _functionStartsCmd == nullptr )
+        return 0;
+    return _functionStartsCmd->datasize();
+}
+
+template <typename P>
+uint32_t LinkeditOptimizer<P>::dataInCodeSize()
+{
+    if ( _dataInCodeCmd == nullptr )
+        return 0;
+    return _dataInCodeCmd->datasize();
+}
+
+template <typename P>
+uint32_t LinkeditOptimizer<P>::indirectSymbolTableSize()
+{
+    if ( _dynSymTabCmd == nullptr )
+        return 0;
+    return _dynSymTabCmd->nindirectsyms() * sizeof(uint32_t);
+}
+
+
+template <typename P>
+void LinkeditOptimizer<P>::forEachLocalSymbol(SymbolHandler handler)
+{
     switch (_stripMode) {
         case CacheBuilder::DylibStripMode::stripNone:
         case CacheBuilder::DylibStripMode::stripExports:
@@ -580,43 +725,19 @@ void LinkeditOptimizer<P>::copyLocalSymbols(uint8_t* newLinkEditContent, SortedS
     const macho_nlist<P>* const symbolTable = (macho_nlist<P>*)(&_linkeditBias[_symTabCmd->symoff()]);
     const macho_nlist<P>* const firstExport = &symbolTable[_dynSymTabCmd->ilocalsym()];
     const macho_nlist<P>* const lastExport  = &symbolTable[_dynSymTabCmd->ilocalsym()+_dynSymTabCmd->nlocalsym()];
-    for (const macho_nlist<P>* entry = firstExport; entry < lastExport; ++entry) {
+    uint32_t oldSymbolIndex = _dynSymTabCmd->ilocalsym();
+    for (const macho_nlist<P>* entry = firstExport; entry < lastExport; ++entry, ++oldSymbolIndex) {
         if ( (entry->n_type() & N_TYPE) != N_SECT)
             continue;
          if ( (entry->n_type() & N_STAB) != 0)
             continue;
-        const char* name = &strings[entry->n_strx()];
-        macho_nlist<P>* newSymbolEntry = (macho_nlist<P>*)&newLinkEditContent[offset];
-        *newSymbolEntry = *entry;
-        if ( redact ) {
-            // if removing local symbols, change __text symbols to "<redacted>" so backtraces don't have bogus names
-            if ( entry->n_sect() == 1 ) {
-                stringPool.add(symbolIndex, "<redacted>");
-                ++symbolIndex;
-                offset += sizeof(macho_nlist<P>);
-            }
-            // copy local symbol to unmmapped locals area
-            localSymbolsStringPool.add((uint32_t)unmappedLocalSymbols.size(), name);
-            unmappedLocalSymbols.push_back(*entry);
-            unmappedLocalSymbols.back().set_n_strx(0);
-        }
-        else {
-            stringPool.add(symbolIndex, name);
-            ++symbolIndex;
-            offset += sizeof(macho_nlist<P>);
-       }
+        handler(entry, oldSymbolIndex, &strings[entry->n_strx()]);
     }
-    _newLocalSymbolCount = symbolIndex - _newLocalSymbolsStartIndex;
-    localInfo.nlistCount = (uint32_t)unmappedLocalSymbols.size() - localInfo.nlistStartIndex;
 }
 
-
 template <typename P>
-void LinkeditOptimizer<P>::copyExportedSymbols(uint8_t* newLinkEditContent, SortedStringPool<P>& stringPool, uint32_t& offset, uint32_t& symbolIndex)
+void LinkeditOptimizer<P>::forEachExportedSymbol(SymbolHandler handler)
 {
-    _newExportedSymbolsStartIndex = symbolIndex;
-    _newExportedSymbolCount = 0;
-
     switch (_stripMode) {
         case CacheBuilder::DylibStripMode::stripNone:
         case CacheBuilder::DylibStripMode::stripLocals:
@@ -642,23 +763,13 @@ void LinkeditOptimizer<P>::copyExportedSymbols(uint8_t* newLinkEditContent, Sort
             continue;
         if ( strncmp(name, "$ld$", 4) == 0 )
             continue;
-        macho_nlist<P>* newSymbolEntry = (macho_nlist<P>*)&newLinkEditContent[offset];
-        *newSymbolEntry = *entry;
-        newSymbolEntry->set_n_strx(0);
-        stringPool.add(symbolIndex, name);
-        _oldToNewSymbolIndexes[oldSymbolIndex] = symbolIndex - _newLocalSymbolsStartIndex;
-        ++symbolIndex;
-        offset += sizeof(macho_nlist<P>);
+        handler(entry, oldSymbolIndex, name);
     }
-    _newExportedSymbolCount = symbolIndex - _newExportedSymbolsStartIndex;
 }
 
 template <typename P>
-void LinkeditOptimizer<P>::copyImportedSymbols(uint8_t* newLinkEditContent, SortedStringPool<P>& stringPool, uint32_t& offset, uint32_t& symbolIndex)
+void LinkeditOptimizer<P>::forEachImportedSymbol(SymbolHandler handler)
 {
-    _newImportedSymbolsStartIndex = symbolIndex;
-    _newImportedSymbolCount = 0;
-
     if ( _dynSymTabCmd == nullptr )
         return;
 
@@ -679,15 +790,110 @@ void LinkeditOptimizer<P>::copyImportedSymbols(uint8_t* newLinkEditContent, Sort
     for (const macho_nlist<P>* entry = firstImport; entry < lastImport; ++entry, ++oldSymbolIndex) {
         if ( (entry->n_type() & N_TYPE) != N_UNDF)
             continue;
-        const char* name = &strings[entry->n_strx()];
+        handler(entry, oldSymbolIndex, &strings[entry->n_strx()]);
+    }
+}
+
+template <typename P>
+void LinkeditOptimizer<P>::countSymbols(bool redact, uint32_t& localCount, uint32_t& unmappedLocalCount,
+                                        uint32_t& exportedCount, uint32_t& importedCount)
+{
+    localCount         = 0;
+    unmappedLocalCount = 0;
+    exportedCount      = 0;
+    importedCount      = 0;
+    forEachLocalSymbol([&](const macho_nlist<P>* entry, uint32_t oldSymbolIndex, const char* name) {
+        if ( redact ) {
+            if ( entry->n_sect() == 1 )
+                ++localCount;
+            ++unmappedLocalCount;
+        }
+        else {
+            ++localCount;
+        }
+    });
+    forEachExportedSymbol([&](const macho_nlist<P>* entry, uint32_t oldSymbolIndex, const char* name) {
+        ++exportedCount;
+    });
+    forEachImportedSymbol([&](const macho_nlist<P>* entry, uint32_t oldSymbolIndex, const char* name) {
+        ++importedCount;
+    });
+}
+
+
+template <typename P>
+void LinkeditOptimizer<P>::copyLocalSymbols(uint8_t* newLinkEditContent, DylibStrings& strings, uint32_t& offset, uint32_t& symbolIndex,
+                                            bool redact, LocalSymbolInfo& localInfo, macho_nlist<P>* unmappedLocalSymbols,
+                                            uint32_t& unmappedSymbolIndex, DylibStrings& localSymbolsStrings)
+{
+    localInfo.dylibOffset = (uint32_t)(((uint8_t*)_mh) - (uint8_t*)_containerBuffer);
+    localInfo.nlistStartIndex = unmappedSymbolIndex;
+    localInfo.nlistCount = 0;
+    _newLocalSymbolsStartIndex = symbolIndex;
+    _newLocalSymbolCount = 0;
+
+    forEachLocalSymbol([&](const macho_nlist<P>* entry, uint32_t oldSymbolIndex, const char* name) {
+        // only write entries which are kept, as the next slot may belong to another dylib being copied in parallel
+        macho_nlist<P>* newSymbolEntry = (macho_nlist<P>*)&newLinkEditContent[offset];
+        if ( redact ) {
+            // if removing local symbols, change __text symbols to "<redacted>" so backtraces don't have bogus names
+            if ( entry->n_sect() == 1 ) {
+                *newSymbolEntry = *entry;
+                strings.add(symbolIndex, "<redacted>");
+                ++symbolIndex;
+                offset += sizeof(macho_nlist<P>);
+            }
+            // copy local symbol to unmmapped locals area
+            localSymbolsStrings.add(unmappedSymbolIndex, name);
+            unmappedLocalSymbols[unmappedSymbolIndex] = *entry;
+            unmappedLocalSymbols[unmappedSymbolIndex].set_n_strx(0);
+            ++unmappedSymbolIndex;
+        }
+        else {
+            *newSymbolEntry = *entry;
+            strings.add(symbolIndex, name);
+            ++symbolIndex;
+            offset += sizeof(macho_nlist<P>);
+       }
+    });
+    _newLocalSymbolCount = symbolIndex - _newLocalSymbolsStartIndex;
+    localInfo.nlistCount = unmappedSymbolIndex - localInfo.nlistStartIndex;
+}
+
+
+template <typename P>
+void LinkeditOptimizer<P>::copyExportedSymbols(uint8_t* newLinkEditContent, DylibStrings& strings, uint32_t& offset, uint32_t& symbolIndex)
+{
+    _newExportedSymbolsStartIndex = symbolIndex;
+    _newExportedSymbolCount = 0;
+
+    forEachExportedSymbol([&](const macho_nlist<P>* entry, uint32_t oldSymbolIndex, const char* name) {
         macho_nlist<P>* newSymbolEntry = (macho_nlist<P>*)&newLinkEditContent[offset];
         *newSymbolEntry = *entry;
         newSymbolEntry->set_n_strx(0);
-        stringPool.add(symbolIndex, name);
+        strings.add(symbolIndex, name);
         _oldToNewSymbolIndexes[oldSymbolIndex] = symbolIndex - _newLocalSymbolsStartIndex;
         ++symbolIndex;
         offset += sizeof(macho_nlist<P>);
-    }
+    });
+    _newExportedSymbolCount = symbolIndex - _newExportedSymbolsStartIndex;
+}
+
+template <typename P>
+void LinkeditOptimizer<P>::copyImportedSymbols(uint8_t* newLinkEditContent, DylibStrings& strings, uint32_t& offset, uint32_t& symbolIndex)
+{
+    _newImportedSymbolsStartIndex = symbolIndex;
+    _newImportedSymbolCount = 0;
+
+    forEachImportedSymbol([&](const macho_nlist<P>* entry, uint32_t oldSymbolIndex, const char* name) {
+        macho_nlist<P>* newSymbolEntry = (macho_nlist<P>*)&newLinkEditContent[offset];
+        *newSymbolEntry = *entry;
+        newSymbolEntry->set_n_strx(0);
+        strings.add(symbolIndex, name);
+        _oldToNewSymbolIndexes[oldSymbolIndex] = symbolIndex - _newLocalSymbolsStartIndex;
+        ++symbolIndex;
+        offset += sizeof(macho_nlist<P>);
+    });
     _newImportedSymbolCount = symbolIndex - _newImportedSymbolsStartIndex;
 }
 
@@ -719,100 +925,168 @@ void LinkeditOptimizer<P>::mergeLinkedits(CacheBuilder& builder,
     // allocate space for new linkedit data
     uint64_t totalUnoptLinkeditsSize = builder._readOnlyRegion.sizeInUse - builder._nonLinkEditReadOnlySize;
     uint8_t* newLinkEdit = (uint8_t*)calloc(totalUnoptLinkeditsSize, 1);
-    SortedStringPool<P> stringPool;
+    const size_t dylibCount = optimizers.size();
+    __block SortedStringPool<P> stringPool(dylibCount);
+    __block SortedStringPool<P> localSymbolsStringPool(dylibCount);
     uint32_t offset = 0;
 
     builder._diagnostics.verbose("Merged LINKEDIT:\n");
 
-    // copy weak binding info
-    uint32_t startWeakBindInfosOffset = offset;
-    for (LinkeditOptimizer<P>* op : optimizers) {
+    bool unmapLocals = ( builder._options.localSymbolMode == DyldSharedCache::LocalSymbolsMode::unmap );
+
+    // Each dylib's pieces are laid out in the merged LINKEDIT in the same order as if copied one dylib at a time.
+    // First compute the sizes and so the start of each piece, then copy all dylibs in parallel
+    struct DylibLayout
+    {
+        bool        hasChainedFixups;
+        uint32_t    weakBindingInfoOffset;
+        uint32_t    exportInfoOffset;
+        uint32_t    bindingInfoOffset;
+        uint32_t    lazyBindingInfoOffset;
+        uint32_t    symbolsOffset;
+        uint32_t    functionStartsOffset;
+        uint32_t    dataInCodeOffset;
+        uint32_t    indirectSymbolTableOffset;
+        uint32_t    symbolIndex;
+        uint32_t    unmappedSymbolIndex;
+        uint32_t    localSymbolCount;
+        uint32_t    unmappedLocalSymbolCount;
+        uint32_t    exportedSymbolCount;
+        uint32_t    importedSymbolCount;
+    };
+    __block std::vector<DylibLayout> layouts(dylibCount);
+    LinkeditOptimizer<P>* const* optimizersArray = optimizers.data();
+    dispatch_apply(dylibCount, DISPATCH_APPLY_AUTO, ^(size_t index) {
+        LinkeditOptimizer<P>* op = optimizersArray[index];
+        DylibLayout& layout = layouts[index];
         // Skip chained fixups as the in-place linked list isn't valid any more
-        const dyld3::MachOFile* mf = (dyld3::MachOFile*)op->machHeader();
-        if (!mf->hasChainedFixups())
-            op->copyWeakBindingInfo(newLinkEdit, offset);
+        layout.hasChainedFixups = ((dyld3::MachOFile*)op->machHeader())->hasChainedFixups();
+        op->countSymbols(unmapLocals, layout.localSymbolCount, layout.unmappedLocalSymbolCount,
+                         layout.exportedSymbolCount, layout.importedSymbolCount);
+    });
+
+    // weak binding info
+    uint32_t startWeakBindInfosOffset = offset;
+    for (size_t i=0; i < dylibCount; ++i) {
+        layouts[i].weakBindingInfoOffset = offset;
+        if ( !layouts[i].hasChainedFixups )
+            offset += optimizers[i]->weakBindingInfoSize();
     }
     builder._diagnostics.verbose("  weak bindings size:      %5uKB\n", (uint32_t)(offset-startWeakBindInfosOffset)/1024);
 
-    // copy export info
+    // export info
     uint32_t startExportInfosOffset = offset;
-    for (LinkeditOptimizer<P>* op : optimizers) {
-        op->copyExportInfo(newLinkEdit, offset);
+    for (size_t i=0; i < dylibCount; ++i) {
+        layouts[i].exportInfoOffset = offset;
+        offset += optimizers[i]->exportInfoSize();
     }
     builder._diagnostics.verbose("  exports info size:       %5uKB\n", (uint32_t)(offset-startExportInfosOffset)/1024);
 
     // in theory, an optimized cache can drop the binding info
     if ( true ) {
-        // copy binding info
+        // binding info
         uint32_t startBindingsInfosOffset = offset;
-        for (LinkeditOptimizer<P>* op : optimizers) {
-            // Skip chained fixups as the in-place linked list isn't valid any more
-            const dyld3::MachOFile* mf = (dyld3::MachOFile*)op->machHeader();
-            if (!mf->hasChainedFixups())
-                op->copyBindingInfo(newLinkEdit, offset);
+        for (size_t i=0; i < dylibCount; ++i) {
+            layouts[i].bindingInfoOffset = offset;
+            if ( !layouts[i].hasChainedFixups )
+                offset += optimizers[i]->bindingInfoSize();
         }
         builder._diagnostics.verbose("  bindings size:           %5uKB\n", (uint32_t)(offset-startBindingsInfosOffset)/1024);
 
-       // copy lazy binding info
+        // lazy binding info
         uint32_t startLazyBindingsInfosOffset = offset;
-        for (LinkeditOptimizer<P>* op : optimizers) {
-            // Skip chained fixups as the in-place linked list isn't valid any more
-            const dyld3::MachOFile* mf = (dyld3::MachOFile*)op->machHeader();
-            if (!mf->hasChainedFixups())
-                op->copyLazyBindingInfo(newLinkEdit, offset);
+        for (size_t i=0; i < dylibCount; ++i) {
+            layouts[i].lazyBindingInfoOffset = offset;
+            if ( !layouts[i].hasChainedFixups )
+                offset += optimizers[i]->lazyBindingInfoSize();
         }
         builder._diagnostics.verbose("  lazy bindings size:      %5uKB\n", (offset-startLazyBindingsInfosOffset)/1024);
     }
 
-    bool unmapLocals = ( builder._options.localSymbolMode == DyldSharedCache::LocalSymbolsMode::unmap );
-
-    // copy symbol table entries
-    std::vector<macho_nlist<P>> unmappedLocalSymbols;
-    if ( unmapLocals )
-        unmappedLocalSymbols.reserve(0x01000000);
-    std::vector<LocalSymbolInfo> localSymbolInfos;
-        localSymbolInfos.reserve(optimizers.size());
-    SortedStringPool<P> localSymbolsStringPool;
+    // symbol table entries
     uint32_t symbolIndex = 0;
+    uint32_t unmappedSymbolIndex = 0;
     const uint32_t sharedSymbolTableStartOffset = offset;
     uint32_t sharedSymbolTableExportsCount = 0;
     uint32_t sharedSymbolTableImportsCount = 0;
-    for (LinkeditOptimizer<P>* op : optimizers) {
-         op->copyLocalSymbols(newLinkEdit, stringPool, offset, symbolIndex, unmapLocals,
-                             localSymbolInfos, unmappedLocalSymbols, localSymbolsStringPool);
-        uint32_t x = symbolIndex;
-        op->copyExportedSymbols(newLinkEdit, stringPool, offset, symbolIndex);
-        sharedSymbolTableExportsCount += (symbolIndex-x);
-        uint32_t y = symbolIndex;
-        op->copyImportedSymbols(newLinkEdit, stringPool, offset, symbolIndex);
-        sharedSymbolTableImportsCount += (symbolIndex-y);
+    for (size_t i=0; i < dylibCount; ++i) {
+        DylibLayout& layout = layouts[i];
+        layout.symbolsOffset = offset;
+        layout.symbolIndex = symbolIndex;
+        layout.unmappedSymbolIndex = unmappedSymbolIndex;
+        uint32_t symbolCount = layout.localSymbolCount + layout.exportedSymbolCount + layout.importedSymbolCount;
+        symbolIndex += symbolCount;
+        unmappedSymbolIndex += layout.unmappedLocalSymbolCount;
+        offset += symbolCount * sizeof(macho_nlist<P>);
+        sharedSymbolTableExportsCount += layout.exportedSymbolCount;
+        sharedSymbolTableImportsCount += layout.importedSymbolCount;
     }
     uint32_t sharedSymbolTableCount = symbolIndex;
     const uint32_t sharedSymbolTableEndOffset = offset;
 
-    // copy function starts
+    // function starts
     uint32_t startFunctionStartsOffset = offset;
-    for (LinkeditOptimizer<P>* op : optimizers) {
-        op->copyFunctionStarts(newLinkEdit, offset);
+    for (size_t i=0; i < dylibCount; ++i) {
+        layouts[i].functionStartsOffset = offset;
+        offset += optimizers[i]->functionStartsSize();
     }
     builder._diagnostics.verbose("  function starts size:    %5uKB\n", (offset-startFunctionStartsOffset)/1024);
 
-    // copy data-in-code info
+    // data-in-code info
     uint32_t startDataInCodeOffset = offset;
-    for (LinkeditOptimizer<P>* op : optimizers) {
-        op->copyDataInCode(newLinkEdit, offset);
+    for (size_t i=0; i < dylibCount; ++i) {
+        layouts[i].dataInCodeOffset = offset;
+        offset += optimizers[i]->dataInCodeSize();
     }
     builder._diagnostics.verbose("  data in code size:       %5uKB\n", (offset-startDataInCodeOffset)/1024);
 
-    // copy indirect symbol tables
-    for (LinkeditOptimizer<P>* op : optimizers) {
-        op->copyIndirectSymbolTable(newLinkEdit, offset);
+    // indirect symbol tables
+    for (size_t i=0; i < dylibCount; ++i) {
+        layouts[i].indirectSymbolTableOffset = offset;
+        offset += optimizers[i]->indirectSymbolTableSize();
     }
     // if indirect table has odd number of entries, end will not be 8-byte aligned
     if ( (offset % sizeof(typename P::uint_t)) != 0 )
         offset += 4;
 
+    // copy every dylib's pieces to their precomputed offsets
+    __block std::vector<LocalSymbolInfo> localSymbolInfos(dylibCount);
+    __block std::vector<macho_nlist<P>> unmappedLocalSymbols(unmappedSymbolIndex);
+    macho_nlist<P>* unmappedLocalSymbolsStart = unmappedLocalSymbols.data();
+    dispatch_apply(dylibCount, DISPATCH_APPLY_AUTO, ^(size_t index) {
+        LinkeditOptimizer<P>* op = optimizersArray[index];
+        const DylibLayout& layout = layouts[index];
+        uint32_t pieceOffset;
+        if ( !layout.hasChainedFixups ) {
+            pieceOffset = layout.weakBindingInfoOffset;
+            op->copyWeakBindingInfo(newLinkEdit, pieceOffset);
+        }
+        pieceOffset = layout.exportInfoOffset;
+        op->copyExportInfo(newLinkEdit, pieceOffset);
+        if ( !layout.hasChainedFixups ) {
+            pieceOffset = layout.bindingInfoOffset;
+            op->copyBindingInfo(newLinkEdit, pieceOffset);
+            pieceOffset = layout.lazyBindingInfoOffset;
+            op->copyLazyBindingInfo(newLinkEdit, pieceOffset);
+        }
+        pieceOffset = layout.symbolsOffset;
+        uint32_t dylibSymbolIndex = layout.symbolIndex;
+        uint32_t dylibUnmappedSymbolIndex = layout.unmappedSymbolIndex;
+        op->copyLocalSymbols(newLinkEdit, stringPool.dylibStrings(index), pieceOffset, dylibSymbolIndex, unmapLocals,
+                             localSymbolInfos[index], unmappedLocalSymbolsStart, dylibUnmappedSymbolIndex,
+                             localSymbolsStringPool.dylibStrings(index));
+        op->copyExportedSymbols(newLinkEdit, stringPool.dylibStrings(index), pieceOffset, dylibSymbolIndex);
+        op->copyImportedSymbols(newLinkEdit, stringPool.dylibStrings(index), pieceOffset, dylibSymbolIndex);
+        pieceOffset = layout.functionStartsOffset;
+        op->copyFunctionStarts(newLinkEdit, pieceOffset);
+        pieceOffset = layout.dataInCodeOffset;
+        op->copyDataInCode(newLinkEdit, pieceOffset);
+        pieceOffset = layout.indirectSymbolTableOffset;
+        op->copyIndirectSymbolTable(newLinkEdit, pieceOffset);
+    });
+
     // copy string pool
+    stringPool.layout();
     uint32_t sharedSymbolStringsOffset = offset;
     uint32_t sharedSymbolStringsSize = stringPool.copyPoolAndUpdateOffsets((char*)&newLinkEdit[sharedSymbolStringsOffset], (macho_nlist<P>*)&newLinkEdit[sharedSymbolTableStartOffset]);
     offset += sharedSymbolStringsSize;
@@ -832,6 +1106,7 @@ void LinkeditOptimizer<P>::mergeLinkedits(CacheBuilder& builder,
         const uint32_t entriesOffset = sizeof(dyld_cache_local_symbols_info);
         const uint32_t entriesCount  = (uint32_t)localSymbolInfos.size();
         const uint32_t nlistOffset   = (uint32_t)align(entriesOffset + entriesCount * sizeof(dyld_cache_local_symbols_info), 4); // 16-byte align start
+        localSymbolsStringPool.layout();
         const uint32_t nlistCount    = (uint32_t)unmappedLocalSymbols.size();
         const uint32_t stringsSize   = (uint32_t)localSymbolsStringPool.size();
         const uint32_t stringsOffset = nlistOffset + nlistCount * sizeof(macho_nlist<P>);
@@ -29,6 +29,7 @@
 #include <mach-o/loader.h>
 #include <mach-o/fat.h>
 #include <assert.h>
+#include <dispatch/dispatch.h>
 
 #include "DyldSharedCache.h"
 #include "Diagnostics.h"
@@ -192,7 +193,9 @@ public:
         P::setP(_base[index], value);
     }
 
-    void removeNulls() {
+    // Compacts the non-null entries to the start of the section and shrinks it.  The slots
+    // left at the end no longer need to be slid.
+    void removeNulls(CacheBuilder::ASLR_Tracker& aslrTracker) {
         pint_t shift = 0;
         for (pint_t i = 0; i < _count; i++) {
             pint_t value = _base[i];
@@ -203,6 +206,10 @@ public:
             }
         }
         _count -= shift;
+        for (pint_t i = _count; i < _count + shift; i++) {
+            _base[i] = 0;
+            aslrTracker.remove(&_base[i]);
+        }
         const_cast<macho_section<P>*>(_section)->set_size(_count * sizeof(pint_t));
     }
 
@@ -210,7 +217,7 @@ private:
     ContentAccessor* const         _cache;
     const macho_section<P>* const  _section;
     pint_t* const                  _base;
-    pint_t const                   _count;
+    pint_t                         _count;
 };
 
 
@@ -255,44 +262,82 @@ namespace {
 
 
 template <typename P>
-class ObjCSelectorUniquer
+class ObjCSelectorCollector
 {
 public:
     typedef typename P::uint_t  pint_t;
 
-    ObjCSelectorUniquer(ContentAccessor* cache) : _cache(cache) { }
+    ObjCSelectorCollector(ContentAccessor* cache) : _cache(cache) { }
 
+    // Records the first reference to each selector in this dylib.  Nothing is changed, so
+    // dylibs can be collected in parallel.
     pint_t visit(pint_t oldValue)
     {
-        _count++;
         const char *s = (const char *)_cache->contentForVMAddr(oldValue);
-        oldValue = (pint_t)_cache->vmAddrForOnDiskVMAddr(oldValue);
-        objc_opt::string_map::iterator element = 
-            _selectorStrings.insert(objc_opt::string_map::value_type(s, oldValue)).first;
-        return (pint_t)element->second;
+        if ( _seen.insert(s).second )
+            _selectors.push_back({ s, _cache->vmAddrForOnDiskVMAddr(oldValue) });
+        return oldValue;
     }
 
-    void visitCoalescedStrings(const CacheBuilder::CacheCoalescedText& coalescedText) {
-        const CacheBuilder::CacheCoalescedText::StringSection& methodNames = coalescedText.getSectionData("__objc_methname");
-        for (const auto& stringAndOffset : methodNames.stringsToOffsets) {
-            uint64_t vmAddr = methodNames.bufferVMAddr + stringAndOffset.second;
-            _selectorStrings[stringAndOffset.first.data()] = vmAddr;
-        }
+    const std::vector<std::pair<const char*, uint64_t>>& selectors() const {
+        return _selectors;
     }
 
-    objc_opt::string_map& strings() { 
-        return _selectorStrings;
+private:
+    std::unordered_set<const char*, objc_opt::hashstr, objc_opt::eqstr> _seen;
+    std::vector<std::pair<const char*, uint64_t>>                        _selectors;
+    ContentAccessor*                                                     _cache;
+};
+
+
+template <typename P>
+class ObjCSelectorUniquer
+{
+public:
+    typedef typename P::uint_t  pint_t;
+
+    ObjCSelectorUniquer(ContentAccessor* cache, const objc_opt::string_map& selectorStrings)
+        : _cache(cache), _selectorStrings(selectorStrings) { }
+
+    // Every selector was added to the map by mergeSelectors(), so this only reads the map
+    // and dylibs can be uniqued in parallel.
+    pint_t visit(pint_t oldValue)
+    {
+        _count++;
+        const char *s = (const char *)_cache->contentForVMAddr(oldValue);
+        objc_opt::string_map::const_iterator element = _selectorStrings.find(s);
+        assert(element != _selectorStrings.end());
+        return (pint_t)element->second;
     }
 
     size_t count() const { return _count; }
 
 private:
-    objc_opt::string_map    _selectorStrings;
-    ContentAccessor*        _cache;
-    size_t                  _count = 0;
+    ContentAccessor*                _cache;
+    const objc_opt::string_map&     _selectorStrings;
+    size_t                          _count = 0;
 };
 
 
+// The canonical address of each selector is its coalesced string if there is one, otherwise the
+// first reference to it in dylib order.  This is the same as uniquing the dylibs one at a time.
+template <typename P>
+static void mergeSelectors(const CacheBuilder::CacheCoalescedText& coalescedText,
+                           const std::vector<ObjCSelectorCollector<P>*>& collectors,
+                           objc_opt::string_map& selectorStrings)
+{
+    const CacheBuilder::CacheCoalescedText::StringSection& methodNames = coalescedText.getSectionData("__objc_methname");
+    for (const auto& stringAndOffset : methodNames.stringsToOffsets) {
+        uint64_t vmAddr = methodNames.bufferVMAddr + stringAndOffset.second;
+        selectorStrings[stringAndOffset.first.data()] = vmAddr;
+    }
+    for (const ObjCSelectorCollector<P>* collector : collectors) {
+        for (const auto& selectorAndVMAddr : collector->selectors())
+            selectorStrings.insert(objc_opt::string_map::value_type(selectorAndVMAddr.first, selectorAndVMAddr.second));
+    }
+}
+
+
 template <typename P>
 class ClassListBuilder
 {
@@ -897,6 +942,264 @@ public:
 };
 
 
+// Merges the categories on a class in to the class's own method, property and protocol lists,
+// and removes them from __objc_catlist, so libobjc has nothing to attach when the image is mapped.
+// Only categories in the same dylib as their class are attached.  Those are always loaded with
+// the class, and a root of that dylib replaces the class and its categories together.
+template <typename P>
+class CategoryAttacher
+{
+    typedef typename P::uint_t pint_t;
+
+    struct Category {
+        objc_category_t<P>*     cat;
+        pint_t                  catlistIndex;
+    };
+
+    struct ClassCategories {
+        size_t                  dylibIndex;
+        bool                    canAttach;
+        std::vector<Category>   categories;     // in __objc_catlist order
+    };
+
+    std::vector<const macho_header<P>*>                         _dylibs;
+    std::unordered_map<objc_class_t<P>*, size_t>                _classDylibs;
+    // Classes in the order their first category was found, so the cache is the same every time
+    std::vector<objc_class_t<P>*>                               _classOrder;
+    std::unordered_map<objc_class_t<P>*, ClassCategories>       _classCategories;
+    size_t                                                      _attachedClassCount = 0;
+    size_t                                                      _attachedCategoryCount = 0;
+    size_t                                                      _noRoomClassCount = 0;
+
+    static bool canMergeMethodList(objc_method_list_t<P>* mlist) {
+        // Pointer based method lists would need to be slid, so merged copies of them would be dirty
+        return (mlist == nullptr) || mlist->usesRelativeMethods();
+    }
+
+    static bool canMergePropertyList(objc_property_list_t<P>* plist) {
+        return (plist == nullptr) || (plist->getEntsize() == sizeof(objc_property_t<P>));
+    }
+
+    static bool canAttachTo(ContentAccessor* cache, objc_class_t<P>* cls) {
+        if ( cls->isSwift() )
+            return false;
+        objc_class_t<P>* metaclass = cls->getIsa(cache);
+        return canMergeMethodList(cls->getMethodList(cache))
+            && canMergeMethodList(metaclass->getMethodList(cache))
+            && canMergePropertyList(cls->getPropertyList(cache));
+    }
+
+    static bool canAttachCategory(ContentAccessor* cache, objc_category_t<P>* cat, bool hasClassProperties,
+                          const std::unordered_set<objc_category_t<P>*>& loadCategories) {
+        // libobjc still calls +load on the categories in __objc_nlcatlist
+        if ( loadCategories.count(cat) != 0 )
+            return false;
+        // Class properties would need merging in to the metaclass
+        if ( hasClassProperties && cat->hasClassProperties() )
+            return false;
+        return canMergeMethodList(cat->getInstanceMethods(cache))
+            && canMergeMethodList(cat->getClassMethods(cache))
+            && canMergePropertyList(cat->getInstanceProperties(cache));
+    }
+
+    static objc_method_list_t<P>* categoryMethods(ContentAccessor* cache, objc_category_t<P>* cat, bool classMethods) {
+        return classMethods ? cat->getClassMethods(cache) : cat->getInstanceMethods(cache);
+    }
+
+    // Later categories override earlier ones, and all categories override the class
+    objc_method_list_t<P>* mergeMethodLists(ContentAccessor* cache, const ClassCategories& classCats, bool classMethods,
+                                            objc_method_list_t<P>* baseList, uint32_t count, uint8_t*& rodest)
+    {
+        objc_method_list_t<P>* merged = objc_method_list_t<P>::newRelativeMethodList(rodest, count);
+        rodest += objc_method_list_t<P>::relativeByteSizeForCount(count);
+
+        uint32_t next = 0;
+        for (auto it = classCats.categories.rbegin(); it != classCats.categories.rend(); ++it) {
+            if ( objc_method_list_t<P>* mlist = categoryMethods(cache, it->cat, classMethods) ) {
+                for (uint32_t i = 0; i < mlist->getCount(); i++)
+                    merged->copyRelativeMethod(cache, next++, mlist, i);
+            }
+        }
+        if ( baseList ) {
+            for (uint32_t i = 0; i < baseList->getCount(); i++)
+                merged->copyRelativeMethod(cache, next++, baseList, i);
+        }
+        // The sort is stable, so the first method with a given selector is still the one that wins
+        merged->sortMethods(cache, nullptr, true);
+        return merged;
+    }
+
+public:
+
+    // Finds every category in the cache, and which of the classes they are on can have them attached
+    void addDylibs(ContentAccessor* cache, const std::vector<const macho_header<P>*>& dylibs)
+    {
+        _dylibs = dylibs;
+        for (size_t dylibIndex = 0; dylibIndex != _dylibs.size(); ++dylibIndex) {
+            PointerSection<P, objc_class_t<P>*> classList(cache, _dylibs[dylibIndex], "__DATA", "__objc_classlist");
+            for (pint_t i = 0; i < classList.count(); i++) {
+                if ( objc_class_t<P>* cls = classList.get(i) )
+                    _classDylibs[cls] = dylibIndex;
+            }
+        }
+
+        for (size_t dylibIndex = 0; dylibIndex != _dylibs.size(); ++dylibIndex) {
+            const macho_header<P>* header = _dylibs[dylibIndex];
+            bool hasClassProperties = false;
+            if ( const macho_section<P>* imageInfoSection = header->getSection("__DATA", "__objc_imageinfo") ) {
+                objc_image_info<P>* info = (objc_image_info<P>*)cache->contentForVMAddr(imageInfoSection->addr());
+                hasClassProperties = info->hasCategoryClassPropertiesFlagSet();
+            }
+
+            std::unordered_set<objc_category_t<P>*> loadCategories;
+            PointerSection<P, objc_category_t<P>*> nlcats(cache, header, "__DATA", "__objc_nlcatlist");
+            for (pint_t i = 0; i < nlcats.count(); i++)
+                loadCategories.insert(nlcats.get(i));
+
+            PointerSection<P, objc_category_t<P>*> cats(cache, header, "__DATA", "__objc_catlist");
+            for (pint_t i = 0; i < cats.count(); i++) {
+                objc_category_t<P>* cat = cats.get(i);
+                if ( cat == nullptr )
+                    continue;
+                // Categories on missing weak classes are never attached
+                objc_class_t<P>* cls = cat->getClass(cache);
+                if ( cls == nullptr )
+                    continue;
+                auto classIt = _classDylibs.find(cls);
+                if ( classIt == _classDylibs.end() )
+                    continue;
+
+                auto inserted = _classCategories.insert({ cls, ClassCategories{ classIt->second, true, {} } });
+                ClassCategories& classCats = inserted.first->second;
+                if ( inserted.second ) {
+                    _classOrder.push_back(cls);
+                    classCats.canAttach = canAttachTo(cache, cls);
+                }
+                classCats.categories.push_back({ cat, i });
+                if ( (classCats.dylibIndex != dylibIndex) || !canAttachCategory(cache, cat, hasClassProperties, loadCategories) )
+                    classCats.canAttach = false;
+            }
+        }
+    }
+
+    // This is SAFE: each class is only changed once all of its new lists have been written, and
+    // a class that doesn't fit keeps its categories for libobjc to attach.
+    void attach(ContentAccessor* cache,
+                uint8_t*& rwdest, size_t& rwremaining,
+                uint8_t*& rodest, size_t& roremaining,
+                CacheBuilder::ASLR_Tracker& aslrTracker)
+    {
+        std::set<size_t> changedDylibs;
+        for (objc_class_t<P>* cls : _classOrder) {
+            const ClassCategories& classCats = _classCategories.at(cls);
+            if ( !classCats.canAttach )
+                continue;
+            objc_class_t<P>* metaclass = cls->getIsa(cache);
+
+            // Work out how much space the merged lists need before changing anything
+            objc_method_list_t<P>* baseMethods = cls->getMethodList(cache);
+            objc_method_list_t<P>* baseClassMethods = metaclass->getMethodList(cache);
+            objc_protocol_list_t<P>* baseProtocols = cls->getProtocolList(cache);
+            objc_property_list_t<P>* baseProperties = cls->getPropertyList(cache);
+            uint32_t methodCount = baseMethods ? baseMethods->getCount() : 0;
+            uint32_t classMethodCount = baseClassMethods ? baseClassMethods->getCount() : 0;
+            pint_t protocolCount = baseProtocols ? baseProtocols->getCount() : 0;
+            uint32_t propertyCount = baseProperties ? baseProperties->getCount() : 0;
+            bool mergeMethods = false, mergeClassMethods = false, mergeProtocols = false, mergeProperties = false;
+            for (const Category& category : classCats.categories) {
+                if ( objc_method_list_t<P>* mlist = category.cat->getInstanceMethods(cache) ) {
+                    methodCount += mlist->getCount();
+                    mergeMethods = true;
+                }
+                if ( objc_method_list_t<P>* mlist = category.cat->getClassMethods(cache) ) {
+                    classMethodCount += mlist->getCount();
+                    mergeClassMethods = true;
+                }
+                if ( objc_protocol_list_t<P>* protolist = category.cat->getProtocols(cache) ) {
+                    protocolCount += protolist->getCount();
+                    mergeProtocols = true;
+                }
+                if ( objc_property_list_t<P>* plist = category.cat->getInstanceProperties(cache) ) {
+                    propertyCount += plist->getCount();
+                    mergeProperties = true;
+                }
+            }
+            size_t rorequired = (mergeMethods ? objc_method_list_t<P>::relativeByteSizeForCount(methodCount) : 0)
+                              + (mergeClassMethods ? objc_method_list_t<P>::relativeByteSizeForCount(classMethodCount) : 0);
+            size_t rwrequired = (mergeProtocols ? objc_protocol_list_t<P>::byteSizeForCount(protocolCount) : 0)
+                              + (mergeProperties ? objc_property_list_t<P>::byteSizeForCount(propertyCount) : 0);
+            if ( (rorequired > roremaining) || (rwrequired > rwremaining) ) {
+                _noRoomClassCount++;
+                continue;
+            }
+            roremaining -= rorequired;
+            rwremaining -= rwrequired;
+
+            if ( mergeMethods ) {
+                cls->setMethodList(cache, mergeMethodLists(cache, classCats, false, baseMethods, methodCount, rodest));
+                cls->addMethodListPointer(cache, aslrTracker);
+            }
+            if ( mergeClassMethods ) {
+                metaclass->setMethodList(cache, mergeMethodLists(cache, classCats, true, baseClassMethods, classMethodCount, rodest));
+                metaclass->addMethodListPointer(cache, aslrTracker);
+            }
+            if ( mergeProtocols ) {
+                objc_protocol_list_t<P>* merged = objc_protocol_list_t<P>::newProtocolList(rwdest, protocolCount);
+                rwdest += objc_protocol_list_t<P>::byteSizeForCount(protocolCount);
+                pint_t next = 0;
+                for (auto it = classCats.categories.rbegin(); it != classCats.categories.rend(); ++it) {
+                    if ( objc_protocol_list_t<P>* protolist = it->cat->getProtocols(cache) ) {
+                        for (pint_t i = 0; i < protolist->getCount(); i++)
+                            merged->setVMAddress(next++, protolist->getVMAddress(i));
+                    }
+                }
+                for (pint_t i = 0; baseProtocols && (i < baseProtocols->getCount()); i++)
+                    merged->setVMAddress(next++, baseProtocols->getVMAddress(i));
+                objc_protocol_list_t<P>::addPointers((uint8_t*)merged, aslrTracker);
+                cls->setProtocolList(cache, merged);
+                cls->addProtocolListPointer(cache, aslrTracker);
+            }
+            if ( mergeProperties ) {
+                objc_property_list_t<P>* merged = objc_property_list_t<P>::newPropertyList(rwdest, propertyCount);
+                rwdest += objc_property_list_t<P>::byteSizeForCount(propertyCount);
+                uint32_t next = 0;
+                for (auto it = classCats.categories.rbegin(); it != classCats.categories.rend(); ++it) {
+                    if ( objc_property_list_t<P>* plist = it->cat->getInstanceProperties(cache) ) {
+                        for (uint32_t i = 0; i < plist->getCount(); i++)
+                            merged->setProperty(next++, (objc_property_t<P>*)plist->get(i));
+                    }
+                }
+                for (uint32_t i = 0; baseProperties && (i < baseProperties->getCount()); i++)
+                    merged->setProperty(next++, (objc_property_t<P>*)baseProperties->get(i));
+                objc_property_list_t<P>::addPointers((uint8_t*)merged, aslrTracker);
+                cls->setPropertyList(cache, merged);
+                cls->addPropertyListPointer(cache, aslrTracker);
+            }
+
+            cls->getData(cache)->setHasPreattachedCategories();
+            metaclass->getData(cache)->setHasPreattachedCategories();
+
+            PointerSection<P, objc_category_t<P>*> cats(cache, _dylibs[classCats.dylibIndex], "__DATA", "__objc_catlist");
+            for (const Category& category : classCats.categories)
+                cats.setVMAddress(category.catlistIndex, 0);
+            changedDylibs.insert(classCats.dylibIndex);
+
+            _attachedClassCount++;
+            _attachedCategoryCount += classCats.categories.size();
+        }
+
+        for (size_t dylibIndex : changedDylibs) {
+            PointerSection<P, objc_category_t<P>*> cats(cache, _dylibs[dylibIndex], "__DATA", "__objc_catlist");
+            cats.removeNulls(aslrTracker);
+        }
+    }
+
+    size_t attachedClassCount() const { return _attachedClassCount; }
+    size_t attachedCategoryCount() const { return _attachedCategoryCount; }
+    size_t noRoomClassCount() const { return _noRoomClassCount; }
+};
+
+
 static int percent(size_t num, size_t denom) {
     if (denom)
         return (int)(num / (double)denom * 100);
@@ -1074,10 +1377,19 @@ void doOptimizeObjC(DyldSharedCache* cache, bool forProduction, CacheBuilder::AS
     if ( optImpCachesPointerSection == nullptr ) {
         diag.warning("libobjc's magical shared cache offsets list section missing (metadata not optimized)");
     }
+
+    // libobjc's own section says which version of the tables it can read.  Only build the
+    // smaller displacement hash tables for a libobjc that knows how to look them up, and
+    // stamp them with the version that says so, so older readers don't take them for Jenkins tables.
+    const objc_opt::objc_opt_t* libobjcROHeader = (const objc_opt::objc_opt_t*)cacheAccessor.contentForVMAddr(optROSection->addr());
+    const uint32_t libobjcVersion = E::get32(libobjcROHeader->version);
+    const uint32_t stringHashKind = (libobjcVersion >= objc_opt::DISPLACEMENT_HASH_VERSION) ? objc_opt::DisplacementHash : objc_opt::JenkinsHash;
+    const uint32_t optVersion = (stringHashKind == objc_opt::DisplacementHash) ? objc_opt::DISPLACEMENT_HASH_VERSION : objc_opt::VERSION;
+
     // point optROData into space allocated in dyld cache
     uint8_t* optROData = objcReadOnlyBuffer + objcReadOnlyBufferSizeUsed;
     size_t optRORemaining = objcReadOnlyBufferSizeAllocated - objcReadOnlyBufferSizeUsed;
-    *((uint32_t*)optROData) = objc_opt::VERSION;
+    *((uint32_t*)optROData) = optVersion;
     if ( optROData == nullptr ) {
         diag.warning("libobjc's read-only section has bad content");
         return;
@@ -1092,7 +1404,7 @@ void doOptimizeObjC(DyldSharedCache* cache, bool forProduction, CacheBuilder::AS
     objc_opt::objc_opt_t* optROHeader = (objc_opt::objc_opt_t *)optROData;
     optROData += headerSize;
     optRORemaining -= headerSize;
-    if (E::get32(optROHeader->version) != objc_opt::VERSION) {
+    if (E::get32(optROHeader->version) != optVersion) {
         diag.warning("libobjc's read-only section version is unrecognized (metadata not optimized)");
         return;
     }
@@ -1157,7 +1469,6 @@ void doOptimizeObjC(DyldSharedCache* cache, bool forProduction, CacheBuilder::AS
     // Heuristic: choose selectors from libraries with more selector cstring data first.
     // This tries to localize selector cstring memory.
     //
-    ObjCSelectorUniquer<P> uniq(&cacheAccessor);
     std::vector<const macho_header<P>*> sizeSortedDylibs = objcDylibs;
     std::sort(sizeSortedDylibs.begin(), sizeSortedDylibs.end(),  [](const macho_header<P>* lmh, const macho_header<P>* rmh) -> bool {
         // Sort a select few heavy hitters first.
@@ -1208,19 +1519,55 @@ void doOptimizeObjC(DyldSharedCache* cache, bool forProduction, CacheBuilder::AS
     // Eventually we'll update them to offsets directly to the selector string.
     bool relativeMethodListSelectorsAreDirect = false;
 
-    SelectorOptimizer<P, ObjCSelectorUniquer<P> > selOptimizer(uniq, relativeMethodListSelectorsAreDirect);
-    selOptimizer.visitCoalescedStrings(coalescedText);
-    for (const macho_header<P>* mh : sizeSortedDylibs) {
-        LegacySelectorUpdater<P, ObjCSelectorUniquer<P>>::update(&cacheAccessor, mh, uniq);
-        selOptimizer.optimize(&cacheAccessor, mh);
+    // Collect the selectors each dylib references, in parallel
+    ContentAccessor* cacheAccessorPtr = &cacheAccessor;
+    std::vector<ObjCSelectorCollector<P>*> selectorCollectors;
+    for (size_t i = 0; i != sizeSortedDylibs.size(); ++i)
+        selectorCollectors.push_back(new ObjCSelectorCollector<P>(&cacheAccessor));
+    dispatch_apply(sizeSortedDylibs.size(), DISPATCH_APPLY_AUTO, ^(size_t index) {
+        ObjCSelectorCollector<P>& collector = *selectorCollectors[index];
+        LegacySelectorUpdater<P, ObjCSelectorCollector<P>>::update(cacheAccessorPtr, sizeSortedDylibs[index], collector);
+        SelectorCollector<P, ObjCSelectorCollector<P>> selCollector(collector);
+        selCollector.collect(cacheAccessorPtr, sizeSortedDylibs[index]);
+    });
+
+    // Pick the canonical address of each selector, in dylib order so the result is the same every time
+    objc_opt::string_map selectorStrings;
+    mergeSelectors<P>(coalescedText, selectorCollectors, selectorStrings);
+    for (ObjCSelectorCollector<P>* collector : selectorCollectors)
+        delete collector;
+
+    // Point every selector reference and method list at the canonical selectors, in parallel
+    assert(!relativeMethodListSelectorsAreDirect);
+    std::vector<ObjCSelectorUniquer<P>*> uniquers;
+    std::vector<SelectorOptimizer<P, ObjCSelectorUniquer<P>>*> selOptimizers;
+    for (size_t i = 0; i != sizeSortedDylibs.size(); ++i) {
+        uniquers.push_back(new ObjCSelectorUniquer<P>(&cacheAccessor, selectorStrings));
+        selOptimizers.push_back(new SelectorOptimizer<P, ObjCSelectorUniquer<P>>(*uniquers.back()));
+    }
+    dispatch_apply(sizeSortedDylibs.size(), DISPATCH_APPLY_AUTO, ^(size_t index) {
+        LegacySelectorUpdater<P, ObjCSelectorUniquer<P>>::update(cacheAccessorPtr, sizeSortedDylibs[index], *uniquers[index]);
+        selOptimizers[index]->optimize(cacheAccessorPtr, sizeSortedDylibs[index]);
+    });
+    relativeMethodListSelectorsAreDirect = true;
+
+    // The LOH pass below needs to know which addresses are selector references
+    std::set<pint_t> selectorRefVMAddrs;
+    size_t selectorRefCount = 0;
+    for (size_t i = 0; i != sizeSortedDylibs.size(); ++i) {
+        const std::set<pint_t>& dylibSelectorRefs = selOptimizers[i]->selectorRefAddresses();
+        selectorRefVMAddrs.insert(dylibSelectorRefs.begin(), dylibSelectorRefs.end());
+        selectorRefCount += uniquers[i]->count();
+        delete selOptimizers[i];
+        delete uniquers[i];
     }
 
-    diag.verbose("  uniqued  %6lu selectors\n", uniq.strings().size());
-    diag.verbose("  updated  %6lu selector references\n", uniq.count());
+    diag.verbose("  uniqued  %6lu selectors\n", selectorStrings.size());
+    diag.verbose("  updated  %6lu selector references\n", selectorRefCount);
 
     uint64_t seloptVMAddr = cacheAccessor.vmAddrForContent(optROData);
     objc_opt::objc_selopt_t *selopt = new(optROData) objc_opt::objc_selopt_t;
-    err = selopt->write(seloptVMAddr, optRORemaining, uniq.strings());
+    err = selopt->write(seloptVMAddr, optRORemaining, selectorStrings, stringHashKind);
     if (err) {
         diag.warning("%s", err);
         return;
@@ -1280,7 +1627,7 @@ void doOptimizeObjC(DyldSharedCache* cache, bool forProduction, CacheBuilder::AS
     uint64_t clsoptVMAddr = cacheAccessor.vmAddrForContent(optROData);
     objc_opt::objc_clsopt_t *clsopt = new(optROData) objc_opt::objc_clsopt_t;
     err = clsopt->write(clsoptVMAddr, optRORemaining, 
-                        classes.classNames(), classes.classes(), false);
+                        classes.classNames(), classes.classes(), false, stringHashKind);
     if (err) {
         diag.warning("%s", err);
         return;
@@ -1361,7 +1708,7 @@ void doOptimizeObjC(DyldSharedCache* cache, bool forProduction, CacheBuilder::AS
     objc_opt::objc_protocolopt2_t *protocolopt = new (optROData) objc_opt::objc_protocolopt2_t;
     err = protocolopt->write(protocoloptVMAddr, optRORemaining,
                              protocolOptimizer.protocolNames(),
-                             protocolOptimizer.protocolsAndHeaders(), false);
+                             protocolOptimizer.protocolsAndHeaders(), false, stringHashKind);
     if (err) {
         diag.warning("%s", err);
         return;
@@ -1450,6 +1797,26 @@ void doOptimizeObjC(DyldSharedCache* cache, bool forProduction, CacheBuilder::AS
         aslrTracker.add(&impCachePointers->inlinedSelectorsVMAddrEnd);        
     }
 
+
+    //
+    // Attach categories to classes in the same dylib.
+    //
+    // This is SAFE: the merged lists are what libobjc would have built, and libobjc
+    // still attaches any category left in __objc_catlist.
+    // This must be done AFTER uniquing protocols and building IMP caches, which
+    // read the categories from __objc_catlist.
+    timeRecorder.pushTimedSection();
+    CategoryAttacher<P> categoryAttacher;
+    categoryAttacher.addDylibs(&cacheAccessor, sizeSortedDylibs);
+    categoryAttacher.attach(&cacheAccessor, optRWData, optRWRemaining, optROData, optRORemaining, aslrTracker);
+    timeRecorder.recordTime("attach categories");
+    timeRecorder.popTimedSection();
+
+    diag.verbose("  attached % 6ld categories to % 6ld classes\n",
+                 categoryAttacher.attachedCategoryCount(), categoryAttacher.attachedClassCount());
+    if ( categoryAttacher.noRoomClassCount() != 0 )
+        diag.verbose("  no room to attach categories to % 6ld classes\n", categoryAttacher.noRoomClassCount());
+
     // Collect flags.
     uint32_t headerFlags = 0;
     if (forProduction) {
@@ -1490,7 +1857,8 @@ void doOptimizeObjC(DyldSharedCache* cache, bool forProduction, CacheBuilder::AS
                   roSize, objcReadOnlyBufferSizeAllocated, percent(roSize, objcReadOnlyBufferSizeAllocated));
     diag.verbose("  %lu/%llu bytes (%d%%) used in shared cache read/write optimization region\n",
                   rwSize, objcReadWriteBufferSizeAllocated, percent(rwSize, objcReadWriteBufferSizeAllocated));
-    diag.verbose("  wrote objc metadata optimization version %d\n", objc_opt::VERSION);
+    diag.verbose("  wrote objc metadata optimization version %d (%s string hash tables)\n", optVersion,
+                 (stringHashKind == objc_opt::DisplacementHash) ? "displacement" : "Jenkins");
 
     // Add segments to libobjc.dylib that cover cache builder allocated r/o and r/w regions
     addObjcSegments<P>(diag, cache, libobjcMH, objcReadOnlyBuffer, objcReadOnlyBufferSizeAllocated, objcReadWriteBuffer, objcReadWriteBufferSizeAllocated, objcRwFileOffset);
@@ -1504,7 +1872,7 @@ void doOptimizeObjC(DyldSharedCache* cache, bool forProduction, CacheBuilder::AS
 
         for (auto& targetAndInstructions : lohTracker) {
             uint64_t targetVMAddr = targetAndInstructions.first;
-            if (!selOptimizer.isSelectorRefAddress((pint_t)targetVMAddr))
+            if (selectorRefVMAddrs.count((pint_t)targetVMAddr) == 0)
                 continue;
 
             std::set<void*>& instructions = targetAndInstructions.second;
@@ -1656,16 +2024,146 @@ static uint32_t hashTableSize(uint32_t maxElements, uint32_t perElementData)
 
 // The goal here is to allocate space in the dyld shared cache (while it is being laid out) that will contain
 // the objc structures that previously were in the __objc_opt_ro section.
-uint32_t SharedCacheBuilder::computeReadOnlyObjC(uint32_t selRefCount, uint32_t classDefCount, uint32_t protocolDefCount)
+// Merged method lists for classes with attached categories also go here, sized by computeCategoryAttachSizes().
+uint32_t SharedCacheBuilder::computeReadOnlyObjC(uint32_t selRefCount, uint32_t classDefCount, uint32_t protocolDefCount, uint32_t categoryAttachSize)
 {
-    return 0xA000 + hashTableSize(selRefCount, 5) + hashTableSize(classDefCount, 12) + hashTableSize(protocolDefCount, 8);
+    return 0xA000 + hashTableSize(selRefCount, 5) + hashTableSize(classDefCount, 12) + hashTableSize(protocolDefCount, 8)
+         + categoryAttachSize;
 }
 
-// Space to replace the __objc_opt_rw section.
-uint32_t SharedCacheBuilder::computeReadWriteObjC(uint32_t imageCount, uint32_t protocolDefCount)
+// Space to replace the __objc_opt_rw section, plus merged property and protocol lists.
+uint32_t SharedCacheBuilder::computeReadWriteObjC(uint32_t imageCount, uint32_t protocolDefCount, uint32_t categoryAttachSize)
 {
     uint8_t pointerSize = _archLayout->is64 ? 8 : 4;
     return 8*imageCount
          + protocolDefCount*12*pointerSize
-         + (int)_impCachesBuilder->inlinedSelectors.size() * pointerSize;
+         + (int)_impCachesBuilder->inlinedSelectors.size() * pointerSize
+         + categoryAttachSize;
+}
+
+// Works out the size of the lists CategoryAttacher merges for each class with categories in its own dylib.
+// A merged list holds the class's own list as well as its categories', so both are counted.  Categories on
+// classes in other dylibs are never attached, so they need no space.  This is still an upper bound, as
+// CategoryAttacher may turn down a class for other reasons, such as a +load method or a pointer based list.
+template <typename P>
+static void categoryAttachSizes(const std::vector<CacheBuilder::DylibInfo>& dylibs, uint32_t& readOnlySize, uint32_t& readWriteSize)
+{
+    struct ClassLists {
+        uint64_t    methodsVMAddr;
+        uint64_t    protocolsVMAddr;
+        uint64_t    propertiesVMAddr;
+        uint64_t    metaclassVMAddr;
+        bool        isSwift;
+    };
+    struct AttachedLists {
+        uint32_t    methodCount         = 0;
+        uint32_t    classMethodCount    = 0;
+        uint32_t    protocolCount       = 0;
+        uint32_t    propertyCount       = 0;
+        bool        mergeMethods        = false;
+        bool        mergeClassMethods   = false;
+        bool        mergeProtocols      = false;
+        bool        mergeProperties     = false;
+    };
+
+    __block std::vector<std::pair<uint64_t, uint64_t>> dylibSizes(dylibs.size());
+    dispatch_apply(dylibs.size(), DISPATCH_APPLY_AUTO, ^(size_t index) {
+        const dyld3::MachOAnalyzer* ma = dylibs[index].input->mappedFile.mh;
+        if ( !ma->hasObjC() )
+            return;
+        const uint32_t pointerSize = ma->pointerSize();
+        const dyld3::MachOAnalyzer::VMAddrConverter vmAddrConverter = ma->makeVMAddrConverter(false);
+        auto methodCount = [&](uint64_t listVMAddr) {
+            __block uint32_t count = 0;
+            ma->forEachObjCMethod(listVMAddr, vmAddrConverter, ^(uint64_t, const dyld3::MachOAnalyzer::ObjCMethod&) {
+                count++;
+            });
+            return count;
+        };
+        auto protocolCount = [&](uint64_t listVMAddr) {
+            __block uint32_t count = 0;
+            ma->forEachObjCProtocol(listVMAddr, vmAddrConverter, ^(uint64_t, const dyld3::MachOAnalyzer::ObjCProtocol&) {
+                count++;
+            });
+            return count;
+        };
+        auto propertyCount = [&](uint64_t listVMAddr) {
+            __block uint32_t count = 0;
+            ma->forEachObjCProperty(listVMAddr, vmAddrConverter, ^(uint64_t, const dyld3::MachOAnalyzer::ObjCProperty&) {
+                count++;
+            });
+            return count;
+        };
+
+        // A malformed dylib just gets less space, and keeps whichever categories don't fit
+        Diagnostics diag;
+        __block std::unordered_map<uint64_t, ClassLists> classes;
+        ma->forEachObjCClass(diag, vmAddrConverter, ^(Diagnostics& classDiag, uint64_t classVMAddr, uint64_t classSuperclassVMAddr,
+                                                      uint64_t classDataVMAddr, const dyld3::MachOAnalyzer::ObjCClassInfo& objcClass, bool isMetaClass) {
+            classes[classVMAddr] = { objcClass.baseMethodsVMAddr(pointerSize), objcClass.baseProtocolsVMAddr(pointerSize),
+                                     objcClass.basePropertiesVMAddr(pointerSize), objcClass.isaVMAddr,
+                                     objcClass.isSwiftLegacy || objcClass.isSwiftStable };
+        });
+
+        __block std::unordered_map<uint64_t, AttachedLists> attached;
+        ma->forEachObjCCategory(diag, vmAddrConverter, ^(Diagnostics& catDiag, uint64_t categoryVMAddr, const dyld3::MachOAnalyzer::ObjCCategory& objcCategory) {
+            // a category on a class in another dylib binds to it, so won't be found here
+            auto classIt = classes.find(objcCategory.clsVMAddr);
+            if ( (classIt == classes.end()) || classIt->second.isSwift )
+                return;
+            AttachedLists& lists = attached[objcCategory.clsVMAddr];
+            if ( objcCategory.instanceMethodsVMAddr != 0 ) {
+                lists.methodCount += methodCount(objcCategory.instanceMethodsVMAddr);
+                lists.mergeMethods = true;
+            }
+            if ( objcCategory.classMethodsVMAddr != 0 ) {
+                lists.classMethodCount += methodCount(objcCategory.classMethodsVMAddr);
+                lists.mergeClassMethods = true;
+            }
+            if ( objcCategory.protocolsVMAddr != 0 ) {
+                lists.protocolCount += protocolCount(objcCategory.protocolsVMAddr);
+                lists.mergeProtocols = true;
+            }
+            if ( objcCategory.instancePropertiesVMAddr != 0 ) {
+                lists.propertyCount += propertyCount(objcCategory.instancePropertiesVMAddr);
+                lists.mergeProperties = true;
+            }
+        });
+
+        uint64_t roSize = 0;
+        uint64_t rwSize = 0;
+        for (const auto& classAndLists : attached) {
+            const ClassLists&    cls   = classes.at(classAndLists.first);
+            const AttachedLists& lists = classAndLists.second;
+            if ( lists.mergeMethods )
+                roSize += objc_method_list_t<P>::relativeByteSizeForCount(lists.methodCount + methodCount(cls.methodsVMAddr));
+            if ( lists.mergeClassMethods ) {
+                auto metaclassIt = classes.find(cls.metaclassVMAddr);
+                uint32_t baseClassMethodCount = (metaclassIt != classes.end()) ? methodCount(metaclassIt->second.methodsVMAddr) : 0;
+                roSize += objc_method_list_t<P>::relativeByteSizeForCount(lists.classMethodCount + baseClassMethodCount);
+            }
+            if ( lists.mergeProtocols )
+                rwSize += objc_protocol_list_t<P>::byteSizeForCount(lists.protocolCount + protocolCount(cls.protocolsVMAddr));
+            if ( lists.mergeProperties )
+                rwSize += objc_property_list_t<P>::byteSizeForCount(lists.propertyCount + propertyCount(cls.propertiesVMAddr));
+        }
+        dylibSizes[index] = { roSize, rwSize };
+    });
+
+    uint64_t roTotal = 0;
+    uint64_t rwTotal = 0;
+    for (const auto& sizes : dylibSizes) {
+        roTotal += sizes.first;
+        rwTotal += sizes.second;
+    }
+    readOnlySize  = (uint32_t)roTotal;
+    readWriteSize = (uint32_t)rwTotal;
+}
+
+void SharedCacheBuilder::computeCategoryAttachSizes(uint32_t& readOnlySize, uint32_t& readWriteSize)
+{
+    if ( _archLayout->is64 )
+        categoryAttachSizes<Pointer64<LittleEndian>>(_sortedDylibs, readOnlySize, readWriteSize);
+    else
+        categoryAttachSizes<Pointer32<LittleEndian>>(_sortedDylibs, readOnlySize, readWriteSize);
 }
@@ -29,12 +29,15 @@
 #include <sys/param.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <mach/mach.h>
 #include <mach/mach_vm.h>
 #include <mach/mach_time.h>
 #include <mach/shared_region.h>
 #include <apfs/apfs_fsctl.h>
+#include <array>
 #include <iostream>
+#include <queue>
 
 #include <CommonCrypto/CommonHMAC.h>
 #include <CommonCrypto/CommonDigest.h>
@@ -51,6 +54,7 @@
 #include "IMPCachesBuilder.hpp"
 
 #include "FileUtils.h"
+#include "JSONWriter.h"
 #include "StringUtils.h"
 #include "Trie.hpp"
 
@@ -368,10 +372,138 @@ const char* const SharedCacheBuilder::_s_neverStubEliminateSymbols[] = {
 };
 
 
-inline uint32_t absolutetime_to_milliseconds(uint64_t abstime)
-{
-    return (uint32_t)(abstime/1000/1000);
-}
+// Process wide record of the input slices which have already been parsed.  Every cache configuration
+// built by this process (each arch, development and customer, or each JSON manifest) loads the same
+// files, so each slice only needs to be validated and checked for cache eligibility once.
+// Entries are matched on the bytes of the mach_header and load commands, a digest of LINKEDIT, and
+// the path, so another mapping of the same file is found, but a different file at the same path is not.
+class InputSliceCache {
+public:
+    typedef std::array<uint8_t, CC_SHA256_DIGEST_LENGTH> Digest;
+
+    // The answer to one of the MachOFile eligibility checks, along with the reasons it gave
+    struct Check {
+        int8_t                      result          = -1;   // -1 if not computed yet
+        std::string                 path;
+        std::vector<std::string>    failureReasons;
+    };
+
+    struct Entry {
+        std::vector<uint8_t>        headerAndLoadCommands;
+        Digest                      linkeditDigest;
+        Check                       canBePlacedInDyldCache;
+        Check                       canHavePrecomputedDlopenClosure;
+    };
+
+    InputSliceCache() {
+        queue = dispatch_queue_create("com.apple.dyld.cache.input-slices", DISPATCH_QUEUE_SERIAL);
+    }
+
+    // Returns true if a slice with the same mach_header and load commands was already validated.
+    // Those checks can then be skipped, but LINKEDIT still needs validating as it isn't compared here.
+    bool hasHeaderAndLoadCommands(const std::string& key, const dyld3::MachOAnalyzer* ma, uint64_t sliceLen) {
+        __block bool result = false;
+        dispatch_sync(queue, ^{
+            auto it = entries.find(key);
+            if ( it == entries.end() )
+                return;
+            for (const std::unique_ptr<Entry>& entry : it->second) {
+                if ( matchesHeaderAndLoadCommands(*entry, ma, sliceLen) ) {
+                    result = true;
+                    return;
+                }
+            }
+        });
+        return result;
+    }
+
+    // Returns the entry for a slice identical to this validated one, or nullptr
+    Entry* find(const std::string& key, const dyld3::MachOAnalyzer* ma, uint64_t sliceLen, const Digest& linkeditDigest) {
+        __block Entry* result = nullptr;
+        const Digest* digestPtr = &linkeditDigest;
+        dispatch_sync(queue, ^{
+            auto it = entries.find(key);
+            if ( it == entries.end() )
+                return;
+            for (const std::unique_ptr<Entry>& entry : it->second) {
+                if ( matchesHeaderAndLoadCommands(*entry, ma, sliceLen) && (entry->linkeditDigest == *digestPtr) ) {
+                    result = entry.get();
+                    return;
+                }
+            }
+        });
+        return result;
+    }
+
+    // Records a slice which passed validation
+    Entry* add(const std::string& key, const dyld3::MachOAnalyzer* ma, const Digest& linkeditDigest) {
+        __block Entry* result = nullptr;
+        const uint8_t* start = (const uint8_t*)ma;
+        const uint8_t* end   = start + ma->machHeaderSize() + ma->sizeofcmds;
+        const Digest* digestPtr = &linkeditDigest;
+        dispatch_sync(queue, ^{
+            Entry* entry = new Entry();
+            entry->headerAndLoadCommands.assign(start, end);
+            entry->linkeditDigest = *digestPtr;
+            entries[key].emplace_back(entry);
+            result = entry;
+        });
+        return result;
+    }
+
+    // Digest of the LINKEDIT of a slice which has been loaded and validated
+    static Digest linkeditDigest(const dyld3::MachOAnalyzer* ma) {
+        Digest digest = {};
+        Diagnostics diag;
+        dyld3::MachOAnalyzer::LinkEditInfo leInfo;
+        ma->getLinkEditPointers(diag, leInfo);
+        if ( diag.noError() ) {
+            const uint8_t* linkeditStart = (const uint8_t*)(leInfo.layout.linkeditUnslidVMAddr + leInfo.layout.slide);
+            CC_SHA256(linkeditStart, leInfo.layout.linkeditFileSize, digest.data());
+        }
+        return digest;
+    }
+
+    // Runs an eligibility check, or replays its earlier answer for the same path
+    bool runCheck(Check& check, const char* path, void (^failureReason)(const char*),
+                  bool (^compute)(void (^failureReason)(const char*))) {
+        Check* checkPtr = &check;
+        __block bool known  = false;
+        __block bool result = false;
+        __block std::vector<std::string> reasons;
+        dispatch_sync(queue, ^{
+            if ( (checkPtr->result != -1) && (checkPtr->path == path) ) {
+                known   = true;
+                result  = (checkPtr->result != 0);
+                reasons = checkPtr->failureReasons;
+            }
+        });
+        if ( !known ) {
+            result = compute(^(const char* msg) {
+                reasons.push_back(msg);
+            });
+            dispatch_sync(queue, ^{
+                checkPtr->result         = result ? 1 : 0;
+                checkPtr->path           = path;
+                checkPtr->failureReasons = reasons;
+            });
+        }
+        for (const std::string& reason : reasons)
+            failureReason(reason.c_str());
+        return result;
+    }
+
+private:
+    static bool matchesHeaderAndLoadCommands(const Entry& entry, const dyld3::MachOAnalyzer* ma, uint64_t sliceLen) {
+        const std::vector<uint8_t>& bytes = entry.headerAndLoadCommands;
+        return (bytes.size() <= sliceLen) && (memcmp(bytes.data(), ma, bytes.size()) == 0);
+    }
+
+    std::unordered_map<std::string, std::vector<std::unique_ptr<Entry>>> entries;
+    dispatch_queue_t                                                      queue;
+};
+
+static InputSliceCache sInputSliceCache;
 
 // Handles building a list of input files to the SharedCacheBuilder itself.
 class CacheInputBuilder {
@@ -390,11 +522,12 @@ public:
         std::map<std::string, uint64_t> dylibInstallNameMap;
         for (CacheBuilder::InputFile& inputFile : inputFiles) {
             char realerPath[MAXPATHLEN];
-            dyld3::closure::LoadedFileInfo loadedFileInfo = dyld3::MachOAnalyzer::load(inputFile.diag, fileSystem, inputFile.path, reqArchs, reqPlatform, realerPath);
+            InputSliceCache::Entry* sliceEntry = nullptr;
+            dyld3::closure::LoadedFileInfo loadedFileInfo = loadSlice(inputFile.diag, inputFile.path, reqPlatform, realerPath, sliceEntry);
             if ( (reqPlatform == dyld3::Platform::macOS) && inputFile.diag.hasError() ) {
                 // Try again with iOSMac
                 inputFile.diag.clearError();
-                loadedFileInfo = dyld3::MachOAnalyzer::load(inputFile.diag, fileSystem, inputFile.path, reqArchs, dyld3::Platform::iOSMac, realerPath);
+                loadedFileInfo = loadSlice(inputFile.diag, inputFile.path, dyld3::Platform::iOSMac, realerPath, sliceEntry);
             }
             const dyld3::MachOAnalyzer* ma = (const dyld3::MachOAnalyzer*)loadedFileInfo.fileContent;
             if (ma == nullptr) {
@@ -428,13 +561,13 @@ public:
                     }
                 }
 
-                if (!ma->canBePlacedInDyldCache(dylibPath, ^(const char* msg) {
+                if (!sInputSliceCache.runCheck(sliceEntry->canBePlacedInDyldCache, dylibPath, ^(const char* msg) {
                     inputFile.diag.warning("Dylib located at '%s' cannot be placed in cache because: %s", inputFile.path, msg);
+                }, ^(void (^failureReason)(const char*)) {
+                    return ma->canBePlacedInDyldCache(dylibPath, failureReason);
                 })) {
 
-                    if (!ma->canHavePrecomputedDlopenClosure(inputFile.path, ^(const char* msg) {
-                        inputFile.diag.verbose("Dylib located at '%s' cannot prebuild dlopen closure in cache because: %s", inputFile.path, msg);
-                    }) ) {
+                    if (!canHavePrecomputedDlopenClosure(sliceEntry, ma, inputFile)) {
                         fileSystem.unloadFile(loadedFileInfo);
                         continue;
                     }
@@ -468,9 +601,7 @@ public:
                 }
             } else if (ma->isBundle()) {
 
-                if (!ma->canHavePrecomputedDlopenClosure(inputFile.path, ^(const char* msg) {
-                    inputFile.diag.verbose("Dylib located at '%s' cannot prebuild dlopen closure in cache because: %s", inputFile.path, msg);
-                }) ) {
+                if (!canHavePrecomputedDlopenClosure(sliceEntry, ma, inputFile)) {
                     fileSystem.unloadFile(loadedFileInfo);
                     continue;
                 }
@@ -491,8 +622,45 @@ public:
         }
     }
 
+    // Number of slices loaded, and how many of those were validated by an earlier cache build in this process
+    uint32_t loadedSliceCount() const { return loadedSlices; }
+    uint32_t reusedSliceCount() const { return reusedSlices; }
+
 private:
 
+    // Loads the slice of the file for the requested archs.  The mach_header and load commands aren't validated again
+    // if another cache build already validated them, but LINKEDIT always is.  The earlier eligibility check answers
+    // are only reused if LINKEDIT is also the same.
+    dyld3::closure::LoadedFileInfo loadSlice(Diagnostics& diag, const char* path, dyld3::Platform platform,
+                                             char realerPath[MAXPATHLEN], InputSliceCache::Entry*& sliceEntry) {
+        __block std::string key;
+        dyld3::closure::LoadedFileInfo info = dyld3::MachOAnalyzer::load(diag, fileSystem, path, reqArchs, platform, realerPath,
+                                                                         ^(const dyld3::MachOAnalyzer* ma, uint64_t sliceLen, bool isOSBinary) {
+            key = std::string(path) + ":" + reqArchs.name() + ":" + std::to_string((int)platform) + ":" + std::to_string(sliceLen) + (isOSBinary ? ":os" : "");
+            return sInputSliceCache.hasHeaderAndLoadCommands(key, ma, sliceLen);
+        });
+        if ( info.fileContent == nullptr )
+            return info;
+        ++loadedSlices;
+        const dyld3::MachOAnalyzer* ma = (const dyld3::MachOAnalyzer*)info.fileContent;
+        InputSliceCache::Digest linkeditDigest = InputSliceCache::linkeditDigest(ma);
+        sliceEntry = sInputSliceCache.find(key, ma, info.sliceLen, linkeditDigest);
+        if ( sliceEntry != nullptr )
+            ++reusedSlices;
+        else
+            sliceEntry = sInputSliceCache.add(key, ma, linkeditDigest);
+        return info;
+    }
+
+    bool canHavePrecomputedDlopenClosure(InputSliceCache::Entry* sliceEntry, const dyld3::MachOAnalyzer* ma, CacheBuilder::InputFile& inputFile) {
+        CacheBuilder::InputFile* inputFilePtr = &inputFile;
+        return sInputSliceCache.runCheck(sliceEntry->canHavePrecomputedDlopenClosure, inputFile.path, ^(const char* msg) {
+            inputFilePtr->diag.verbose("Dylib located at '%s' cannot prebuild dlopen closure in cache because: %s", inputFilePtr->path, msg);
+        }, ^(void (^failureReason)(const char*)) {
+            return ma->canHavePrecomputedDlopenClosure(inputFilePtr->path, failureReason);
+        });
+    }
+
     static bool platformExcludesExecutablePath_macOS(const std::string& path) {
         // We no longer support ROSP, so skip all paths which start with the special prefix
         if ( startsWith(path, "/System/Library/Templates/Data/") )
@@ -552,6 +720,8 @@ private:
     const dyld3::closure::FileSystem&                   fileSystem;
     const dyld3::GradedArchs&                           reqArchs;
     dyld3::Platform                                     reqPlatform;
+    uint32_t                                            loadedSlices = 0;
+    uint32_t                                            reusedSlices = 0;
 };
 
 SharedCacheBuilder::SharedCacheBuilder(const DyldSharedCache::CreateOptions& options,
@@ -575,6 +745,13 @@ SharedCacheBuilder::SharedCacheBuilder(const DyldSharedCache::CreateOptions& opt
     }
 }
 
+SharedCacheBuilder::~SharedCacheBuilder()
+{
+    waitForCodeSignPrehashing();
+    if ( _previousCache != nullptr )
+        vm_deallocate(mach_task_self(), (vm_address_t)_previousCache, (vm_size_t)_previousCacheVMSize);
+}
+
 static void verifySelfContained(const dyld3::closure::FileSystem& fileSystem,
                                 std::vector<CacheBuilder::LoadedMachO>& dylibsToCache,
                                 std::vector<CacheBuilder::LoadedMachO>& otherDylibs,
@@ -773,6 +950,8 @@ void SharedCacheBuilder::build(std::vector<CacheBuilder::InputFile>& inputFiles,
     std::vector<LoadedMachO> executables;
     std::vector<LoadedMachO> couldNotLoadFiles;
     cacheInputBuilder.loadMachOs(inputFiles, dylibsToCache, otherDylibs, executables, couldNotLoadFiles);
+    _diagnostics.verbose("reused %u of %u input slices already parsed by other cache builds\n",
+                         cacheInputBuilder.reusedSliceCount(), cacheInputBuilder.loadedSliceCount());
 
     verifySelfContained(_fileSystem, dylibsToCache, otherDylibs, couldNotLoadFiles);
 
@@ -914,17 +1093,35 @@ void SharedCacheBuilder::build(const std::vector<LoadedMachO>& dylibs,
         return;
     }
 
+    // each phase reports how much the cache grew while it ran
+    _timeRecorder.setBytesProducedSampler(^{
+        return cacheSizeInUse();
+    });
     _timeRecorder.pushTimedSection();
 
+    // dylibs not in the order file keep their order from the previous cache, so that the layout is stable
+    std::unordered_map<std::string, unsigned> sortOrder = _options.dylibOrdering;
+    if ( !_options.previousCachePath.empty() ) {
+        mapPreviousCache();
+        if ( _previousCache != nullptr )
+            addPreviousCacheOrdering(dylibs, sortOrder);
+    }
+
+    // a page touch profile moves the dylibs launches touch to the start of the cache, next to each other
+    if ( !_options.pageTouchProfile.empty() )
+        addPageTouchProfileOrdering(sortOrder);
+
     // make copy of dylib list and sort
-    makeSortedDylibs(dylibs, _options.dylibOrdering);
+    makeSortedDylibs(dylibs, sortOrder);
 
-    // allocate space used by largest possible cache plus room for LINKEDITS before optimization
+    // reserve address space for largest possible cache plus room for LINKEDITS before optimization.
+    // None of it is accessible until assignSegmentAddresses() commits the ranges the regions are laid out in
     _allocatedBufferSize = _archLayout->sharedMemorySize * 1.50;
     if ( vm_allocate(mach_task_self(), &_fullAllocatedBuffer, _allocatedBufferSize, VM_FLAGS_ANYWHERE) != 0 ) {
         _diagnostics.error("could not allocate buffer");
         return;
     }
+    ::vm_protect(mach_task_self(), _fullAllocatedBuffer, _allocatedBufferSize, false, VM_PROT_NONE);
 
     _timeRecorder.recordTime("sort dylibs");
 
@@ -977,24 +1174,32 @@ void SharedCacheBuilder::build(const std::vector<LoadedMachO>& dylibs,
         for (DylibInfo& dylib : _sortedDylibs)
             dylib.cacheLocation.clear();
         _dataRegions.clear();
+
         _coalescedText.clear();
-        
+
         // Re-generate the hole map to remove any cruft that was added when parsing the coalescable text the first time.
-        // Always clear the hole map, even if IMP caches are off, as it is used by the text coalescer
+        // Always clear the hole map, even if IMP caches are off, as it is used by the text coalescer.
+        // Parsing again also drops the strings and selectors only the evicted dylibs used
         selectorAddressIntervals.clear();
         if (impCachesSuccess) _impCachesBuilder->computeLowBits(selectorAddressIntervals);
-        
+
         parseCoalescableSegments(selectorMap, selectorAddressIntervals);
         processSelectorStrings(osExecutables, selectorAddressIntervals);
         assignSegmentAddresses();
 
         _diagnostics.verbose("cache overflow, evicted %lu leaf dylibs\n", evictionCount);
     }
+    _timeRecorder.recordCounter("dylibs evicted", _evictions.size());
     markPaddingInaccessible();
 
+    // the layout is final, so regions can be written out as they are completed
+    if ( _options.streamOutputFile && !_options.outputFilePath.empty() )
+        beginStreamingFile(_options.outputFilePath);
+
      // copy all segments into cache
 
     unsigned long wastedSelectorsSpace = selectorAddressIntervals.totalHoleSize();
+    _timeRecorder.recordCounter("selector hole bytes", wastedSelectorsSpace);
     if (wastedSelectorsSpace > 0) {
         _diagnostics.verbose("Selector placement for IMP caches wasted %lu bytes\n", wastedSelectorsSpace);
         if (log) {
@@ -1070,6 +1275,15 @@ void SharedCacheBuilder::build(const std::vector<LoadedMachO>& dylibs,
         });
         optimizeLinkedit(&_localSymbolsRegion, images);
     }
+    releaseLinkeditStaging();
+
+    // The merged LINKEDIT and the local symbols are final now.  Everything added to the read-only region
+    // from here on is appended after them, so start hashing their pages for the code signature.
+    prehashCodeSignPages(_readOnlyRegion.buffer, _nonLinkEditReadOnlySize, _readOnlyRegion.sizeInUse);
+    if ( _localSymbolsRegion.sizeInUse != 0 )
+        prehashCodeSignPages(_localSymbolsRegion.buffer, 0, _localSymbolsRegion.sizeInUse);
+    const uint64_t mergedLinkeditEnd = _readOnlyRegion.sizeInUse;
+    streamToFile(_readOnlyRegion.buffer, _nonLinkEditReadOnlySize, mergedLinkeditEnd, _readOnlyRegion.cacheFileOffset);
 
     // copy ImageArray to end of read-only region
     addImageArray();
@@ -1129,9 +1343,19 @@ void SharedCacheBuilder::build(const std::vector<LoadedMachO>& dylibs,
 
     _timeRecorder.recordTime("emit constant objects");
 
+    // Stub elimination, LINKEDIT optimization and constant objects were the last writers to the cached dylibs' __TEXT.
+    // Only the cache header in front of the first dylib is still updated, so hash the rest while slide info is built.
+    if ( !_sortedDylibs.empty() ) {
+        uint64_t firstDylibOffset = _sortedDylibs.front().cacheLocation[0].dstSegment - _readExecuteRegion.buffer;
+        prehashCodeSignPages(_readExecuteRegion.buffer, firstDylibOffset, _readExecuteRegion.sizeInUse);
+        streamToFile(_readExecuteRegion.buffer, firstDylibOffset, _readExecuteRegion.sizeInUse, _readExecuteRegion.cacheFileOffset);
+    }
+
     // fill in slide info at start of region[2]
     // do this last because it modifies pointers in DATA segments
     if ( _options.cacheSupportsASLR ) {
+        _timeRecorder.recordCounter("fixups", _aslrTracker.fixupCount());
+        _timeRecorder.recordCounter("slide info pages", _aslrTracker.dataPageCount());
 #if SUPPORT_ARCH_arm64e
         if ( strcmp(_archLayout->archName, "arm64e") == 0 )
             writeSlideInfoV3(_aslrTracker.bitmap(), _aslrTracker.dataPageCount());
@@ -1148,6 +1372,7 @@ void SharedCacheBuilder::build(const std::vector<LoadedMachO>& dylibs,
     }
 
     _timeRecorder.recordTime("compute slide info");
+    _diagnostics.verbose("ASLR tracker used %lluKB for %u data pages\n", _aslrTracker.memoryUsage() / 1024, _aslrTracker.dataPageCount());
 
     // last sanity check on size
     if ( cacheOverflowAmount() != 0 ) {
@@ -1155,6 +1380,17 @@ void SharedCacheBuilder::build(const std::vector<LoadedMachO>& dylibs,
         return;
     }
 
+    // Slide info was the last writer to the DATA regions and the rest of the read-only region,
+    // so only the header and the code signature are left for writeFile()
+    for (const Region& dataRegion : _dataRegions)
+        streamToFile(dataRegion.buffer, 0, dataRegion.sizeInUse, dataRegion.cacheFileOffset);
+    streamToFile(_readOnlyRegion.buffer, 0, _nonLinkEditReadOnlySize, _readOnlyRegion.cacheFileOffset);
+    streamToFile(_readOnlyRegion.buffer, mergedLinkeditEnd, _readOnlyRegion.sizeInUse, _readOnlyRegion.cacheFileOffset);
+    if ( _localSymbolsRegion.sizeInUse != 0 )
+        streamToFile(_localSymbolsRegion.buffer, 0, _localSymbolsRegion.sizeInUse, dyldCache->header.localSymbolsOffset);
+
+    _timeRecorder.recordBufferUsage(committedBufferSize(), _allocatedBufferSize);
+
     // codesignature is part of file, but is not mapped
     codeSign();
     if ( _diagnostics.hasError() )
@@ -1181,6 +1417,13 @@ const std::set<const dyld3::MachOAnalyzer*> SharedCacheBuilder::evictions()
 
 void SharedCacheBuilder::deleteBuffer()
 {
+    // Background code signature hashing may still be reading the buffers
+    waitForCodeSignPrehashing();
+    _codeSignPrehashes.clear();
+
+    // A cache file still being streamed was never completed, and its writes may still be reading the buffers
+    abortStreamingFile();
+
     // Cache buffer
     if ( _allocatedBufferSize != 0 ) {
         vm_deallocate(mach_task_self(), _fullAllocatedBuffer, _allocatedBufferSize);
@@ -1235,6 +1478,93 @@ void SharedCacheBuilder::makeSortedDylibs(const std::vector<LoadedMachO>& dylibs
     });
 }
 
+// mmap() the previous cache file laid out like it would be at runtime, so that its images can be listed
+void SharedCacheBuilder::mapPreviousCache()
+{
+    const char* path = _options.previousCachePath.c_str();
+    int fd = ::open(path, O_RDONLY);
+    if ( fd < 0 ) {
+        _diagnostics.verbose("no previous cache at '%s' to take the dylib order from\n", path);
+        return;
+    }
+
+    uint8_t firstPage[4096];
+    const dyld_cache_header* header = (dyld_cache_header*)firstPage;
+    if ( (::pread(fd, firstPage, sizeof(firstPage), 0) != sizeof(firstPage))
+        || (strncmp(header->magic, "dyld_v1", 7) != 0)
+        || (header->mappingCount < 3)
+        || (header->mappingOffset + (header->mappingCount * sizeof(dyld_cache_mapping_info)) > sizeof(firstPage)) ) {
+        _diagnostics.verbose("previous cache '%s' is not a valid dyld cache, ignoring it\n", path);
+        ::close(fd);
+        return;
+    }
+
+    const dyld_cache_mapping_info* mappings    = (dyld_cache_mapping_info*)(firstPage + header->mappingOffset);
+    const dyld_cache_mapping_info* lastMapping = &mappings[header->mappingCount - 1];
+    uint64_t vmSize = lastMapping->address + lastMapping->size - mappings[0].address;
+    vm_address_t result;
+    if ( ::vm_allocate(mach_task_self(), &result, (vm_size_t)vmSize, VM_FLAGS_ANYWHERE) != KERN_SUCCESS ) {
+        ::close(fd);
+        return;
+    }
+    for (uint32_t i = 0; i < header->mappingCount; ++i) {
+        void* mapped = ::mmap((void*)(result + mappings[i].address - mappings[0].address), (size_t)mappings[i].size,
+                              PROT_READ, MAP_FIXED | MAP_PRIVATE, fd, mappings[i].fileOffset);
+        if ( mapped == MAP_FAILED ) {
+            _diagnostics.verbose("could not map previous cache '%s', ignoring it\n", path);
+            vm_deallocate(mach_task_self(), result, (vm_size_t)vmSize);
+            ::close(fd);
+            return;
+        }
+    }
+    ::close(fd);
+
+    const DyldSharedCache* previousCache = (DyldSharedCache*)result;
+    if ( strcmp(previousCache->archName(), _archLayout->archName) != 0 ) {
+        _diagnostics.verbose("previous cache '%s' is for %s, ignoring it\n", path, previousCache->archName());
+        vm_deallocate(mach_task_self(), result, (vm_size_t)vmSize);
+        return;
+    }
+    _previousCache       = previousCache;
+    _previousCacheVMSize = vmSize;
+}
+
+void SharedCacheBuilder::addPreviousCacheOrdering(const std::vector<LoadedMachO>& dylibs, std::unordered_map<std::string, unsigned>& sortOrder) const
+{
+    // The previous cache lists its dylibs by install name, but the order is looked up by runtime path, and
+    // on macOS the two can differ.  So find the runtime path of each install name in this build's inputs
+    __block std::unordered_map<std::string, std::string> installNameToRuntimePath;
+    for (const LoadedMachO& dylib : dylibs)
+        installNameToRuntimePath[dylib.mappedFile.mh->installName()] = dylib.mappedFile.runtimePath;
+
+    // The order file always wins.  Dylibs it doesn't list would otherwise be sorted by path, so instead they
+    // keep their order from the previous cache, after all the ordered dylibs.  New dylibs still go last, by path
+    __block unsigned index = 0;
+    for (const auto& pathAndOrder : sortOrder)
+        index = std::max(index, pathAndOrder.second + 1);
+    _previousCache->forEachImage(^(const mach_header* mh, const char* installName) {
+        auto pos = installNameToRuntimePath.find(installName);
+        if ( pos != installNameToRuntimePath.end() )
+            sortOrder.insert({ pos->second, index++ });
+    });
+}
+
+void SharedCacheBuilder::addPageTouchProfileOrdering(std::unordered_map<std::string, unsigned>& sortOrder)
+{
+    // Dylibs whose __TEXT was touched go first, in the order they were first touched.  The rest keep their
+    // existing order after them
+    std::unordered_map<std::string, unsigned> newSortOrder;
+    for (const DyldSharedCache::PageTouch& touch : _options.pageTouchProfile) {
+        if ( touch.segmentName == "__TEXT" )
+            newSortOrder.insert({ touch.installName, (unsigned)newSortOrder.size() });
+    }
+    const unsigned hotDylibCount = (unsigned)newSortOrder.size();
+    for (const auto& pathAndOrder : sortOrder)
+        newSortOrder.insert({ pathAndOrder.first, hotDylibCount + pathAndOrder.second });
+    sortOrder = std::move(newSortOrder);
+    _diagnostics.verbose("page touch profile orders %u dylibs first\n", hotDylibCount);
+}
+
 struct DylibAndSize
 {
     const CacheBuilder::LoadedMachO*    input;
@@ -1274,86 +1604,97 @@ uint64_t SharedCacheBuilder::cacheOverflowAmount()
 
 size_t SharedCacheBuilder::evictLeafDylibs(uint64_t reductionTarget, std::vector<const LoadedMachO*>& overflowDylibs)
 {
-    // build a reverse map of all dylib dependencies
-    __block std::map<std::string, std::set<std::string>> references;
-    std::map<std::string, std::set<std::string>>* referencesPtr = &references;
-    for (const DylibInfo& dylib : _sortedDylibs) {
-        // Esnure we have an entry (even if it is empty)
-        if (references.count(dylib.input->mappedFile.mh->installName()) == 0) {
-            references[dylib.input->mappedFile.mh->installName()] = std::set<std::string>();
-        };
-        dylib.input->mappedFile.mh->forEachDependentDylib(^(const char* loadPath, bool isWeak, bool isReExport, bool isUpward, uint32_t compatVersion, uint32_t curVersion, bool &stop) {
-            references[loadPath].insert(dylib.input->mappedFile.mh->installName());
+    // give each dylib an integer ID (its index in _sortedDylibs) so the dependency graph is just arrays
+    const uint32_t dylibCount = (uint32_t)_sortedDylibs.size();
+    std::unordered_map<std::string_view, uint32_t> installNameToID;
+    installNameToID.reserve(dylibCount);
+    for (uint32_t i=0; i < dylibCount; ++i)
+        installNameToID[_sortedDylibs[i].input->mappedFile.mh->installName()] = i;
+
+    // For each dylib, find the cached dylibs it depends on, and count how many dylibs depend on it
+    std::vector<std::vector<uint32_t>> dependencies(dylibCount);
+    std::vector<uint32_t>              dependentCounts(dylibCount, 0);
+    for (uint32_t i=0; i < dylibCount; ++i) {
+        std::vector<uint32_t>* depsPtr = &dependencies[i];
+        const std::unordered_map<std::string_view, uint32_t>* installNameToIDPtr = &installNameToID;
+        _sortedDylibs[i].input->mappedFile.mh->forEachDependentDylib(^(const char* loadPath, bool isWeak, bool isReExport, bool isUpward, uint32_t compatVersion, uint32_t curVersion, bool &stop) {
+            const auto& it = installNameToIDPtr->find(loadPath);
+            if ( it != installNameToIDPtr->end() )
+                depsPtr->push_back(it->second);
         });
-    }
+        // a dylib listed twice only counts as one reference
+        std::sort(dependencies[i].begin(), dependencies[i].end());
+        dependencies[i].erase(std::unique(dependencies[i].begin(), dependencies[i].end()), dependencies[i].end());
+        for (uint32_t dep : dependencies[i])
+            ++dependentCounts[dep];
+    }
+
+    // Size each dylib by what it contributes to the layout that overflowed, which is after its strings were
+    // coalesced.  Count it the same way cacheOverflowAmount() does, so that evicting up to the reduction target is
+    // enough to fit.  When the regions are contiguous, that scales LINKEDIT by how much we expect it to shrink.
+    // Otherwise, only the region that overflowed matters.
+    uint64_t linkeditPercent = 100;
+    if ( !_archLayout->sharedRegionsAreDiscontiguous && (_readOnlyRegion.sizeInUse == _readOnlyRegion.bufferSize) )
+        linkeditPercent = (_options.localSymbolMode == DyldSharedCache::LocalSymbolsMode::unmap) ? 37 : 80;
+    auto inRegion = [](const Region& region, uint64_t vmAddr) {
+        return (vmAddr >= region.unslidLoadAddress) && (vmAddr < region.unslidLoadAddress + region.bufferSize);
+    };
+    auto inOverflowingRegion = [&](uint64_t vmAddr) {
+        if ( !_archLayout->sharedRegionsAreDiscontiguous )
+            return true;
+        if ( _readExecuteRegion.sizeInUse > DISCONTIGUOUS_RX_SIZE )
+            return inRegion(_readExecuteRegion, vmAddr);
+        if ( dataRegionsTotalSize() > DISCONTIGUOUS_RW_SIZE )
+            return std::any_of(_dataRegions.begin(), _dataRegions.end(), [&](const Region& region) { return inRegion(region, vmAddr); });
+        return inRegion(_readOnlyRegion, vmAddr);
+    };
 
-    // Find the sizes of all the dylibs
-    std::vector<DylibAndSize> dylibsToSort;
-    std::vector<DylibAndSize> sortedDylibs;
+    // Find the sizes and order file ranks of all the dylibs.  Dylibs not in the order file go first
+    std::vector<DylibAndSize> dylibSizes;
+    std::vector<uint64_t>     dylibOrders;
+    dylibSizes.reserve(dylibCount);
+    dylibOrders.reserve(dylibCount);
     for (const DylibInfo& dylib : _sortedDylibs) {
         const char* installName = dylib.input->mappedFile.mh->installName();
-        __block uint64_t segsSize = 0;
-        dylib.input->mappedFile.mh->forEachSegment(^(const dyld3::MachOFile::SegmentInfo& info, bool& stop) {
-            if ( strcmp(info.segName, "__LINKEDIT") != 0 )
-                segsSize += info.vmSize;
-        });
-        dylibsToSort.push_back({ dylib.input, installName, segsSize });
+        uint64_t segsSize = 0;
+        for (const SegmentMappingInfo& segment : dylib.cacheLocation) {
+            if ( !inOverflowingRegion(segment.dstCacheUnslidAddress) )
+                continue;
+            if ( strcmp(segment.segName, "__LINKEDIT") != 0 )
+                segsSize += segment.dstCacheSegmentSize;
+            else
+                segsSize += (uint64_t)segment.dstCacheSegmentSize * linkeditPercent / 100;
+        }
+        dylibSizes.push_back({ dylib.input, installName, segsSize });
+        const auto& j = _options.dylibOrdering.find(dylib.input->mappedFile.runtimePath);
+        dylibOrders.push_back((j != _options.dylibOrdering.end()) ? j->second : UINT64_MAX);
     }
 
-    // Build an ordered list of what to remove. At each step we do following
-    // 1) Find all dylibs that nothing else depends on
+    // Evict in the following order:
+    // 1) Only dylibs that nothing else still in the cache depends on can be evicted
     // 2a) If any of those dylibs are not in the order select the largest one of them
     // 2b) If all the leaf dylibs are in the order file select the last dylib that appears last in the order file
-    // 3) Remove all entries to the removed file from the reverse dependency map
-    // 4) Go back to one and repeat until there are no more evictable dylibs
-    // This results in us always choosing the locally optimal selection, and then taking into account how that impacts
-    // the dependency graph for subsequent selections
-
-    bool candidateFound = true;
-    while (candidateFound) {
-        candidateFound = false;
-        DylibAndSize candidate;
-        uint64_t candidateOrder = 0;
-        for(const auto& dylib : dylibsToSort) {
-            const auto& i = referencesPtr->find(dylib.installName);
-            assert(i != referencesPtr->end());
-            if (!i->second.empty()) {
-                continue;
-            }
-            const auto& j = _options.dylibOrdering.find(dylib.input->mappedFile.runtimePath);
-            uint64_t order = 0;
-            if (j != _options.dylibOrdering.end()) {
-                order = j->second;
-            } else {
-                // Not in the order file, set order sot it goes to the front of the list
-                order = UINT64_MAX;
-            }
-            if (order > candidateOrder ||
-                (order == UINT64_MAX && candidate.size < dylib.size)) {
-                    // The new file is either a lower priority in the order file
-                    // or the same priority as the candidate but larger
-                    candidate = dylib;
-                    candidateOrder = order;
-                    candidateFound = true;
-            }
-        }
-        if (candidateFound) {
-            sortedDylibs.push_back(candidate);
-            referencesPtr->erase(candidate.installName);
-            for (auto& dependent : references) {
-                (void)dependent.second.erase(candidate.installName);
-            }
-            auto j = std::find_if(dylibsToSort.begin(), dylibsToSort.end(), [&candidate](const DylibAndSize& dylib) {
-                return (strcmp(candidate.installName, dylib.installName) == 0);
-            });
-            if (j != dylibsToSort.end()) {
-                dylibsToSort.erase(j);
-            }
-        }
+    // 3) Once evicted, the dylibs it depends on have one less dependent, and may now be leaves
+    // The leaves are kept in a heap, so each step is logarithmic instead of a rescan of all dylibs.
+    auto evictFirst = [&](uint32_t a, uint32_t b) {
+        if ( dylibOrders[a] != dylibOrders[b] )
+            return dylibOrders[a] < dylibOrders[b];
+        if ( (dylibOrders[a] == UINT64_MAX) && (dylibSizes[a].size != dylibSizes[b].size) )
+            return dylibSizes[a].size < dylibSizes[b].size;
+        // ties go to whichever is first in the cache
+        return a > b;
+    };
+    std::priority_queue<uint32_t, std::vector<uint32_t>, decltype(evictFirst)> leafDylibs(evictFirst);
+    for (uint32_t i=0; i < dylibCount; ++i) {
+        if ( dependentCounts[i] == 0 )
+            leafDylibs.push(i);
     }
 
-     // build set of dylibs that if removed will allow cache to build
-    for (DylibAndSize& dylib : sortedDylibs) {
+    // evict leaves until the cache is small enough
+    while ( !leafDylibs.empty() ) {
+        uint32_t dylibID = leafDylibs.top();
+        leafDylibs.pop();
+        const DylibAndSize& dylib = dylibSizes[dylibID];
         if ( _options.verbose )
             _diagnostics.warning("to prevent cache overflow, not caching %s", dylib.installName);
         _evictions.insert(dylib.input->mappedFile.mh);
@@ -1362,6 +1703,10 @@ size_t SharedCacheBuilder::evictLeafDylibs(uint64_t reductionTarget, std::vector
         if ( dylib.size > reductionTarget )
             break;
         reductionTarget -= dylib.size;
+        for (uint32_t dep : dependencies[dylibID]) {
+            if ( --dependentCounts[dep] == 0 )
+                leafDylibs.push(dep);
+        }
     }
 
     // prune _sortedDylibs
@@ -1554,6 +1899,17 @@ void SharedCacheBuilder::writeCacheHeader()
         ++textImages;
     }
 
+    // record if the text table can be binary searched.  Dylibs are laid out in sorted order, so this should always be true
+    bool imagesTextSorted = true;
+    const dyld_cache_image_text_info* sortedTextImages = (dyld_cache_image_text_info*)(_readExecuteRegion.buffer + dyldCacheHeader->imagesTextOffset);
+    for (uint64_t i=1; i < dyldCacheHeader->imagesTextCount; ++i) {
+        if ( sortedTextImages[i].loadAddress < (sortedTextImages[i-1].loadAddress + sortedTextImages[i-1].textSegmentSize) ) {
+            imagesTextSorted = false;
+            break;
+        }
+    }
+    dyldCacheHeader->imagesTextSorted = imagesTextSorted;
+
     // make sure header did not overflow into first mapped image
     const dyld_cache_image_info* firstImage = (dyld_cache_image_info*)(_readExecuteRegion.buffer + dyldCacheHeader->imagesOffset);
     assert(stringOffset <= (firstImage->address - mappings[0].address));
@@ -1653,7 +2009,7 @@ void SharedCacheBuilder::parseCoalescableSegments(IMPCaches::SelectorMap& select
 }
 
 // This is the new method which will put all __DATA* mappings in to a their own mappings
-void SharedCacheBuilder::assignMultipleDataSegmentAddresses(uint64_t& addr, uint32_t totalProtocolDefCount) {
+void SharedCacheBuilder::assignMultipleDataSegmentAddresses(uint64_t& addr, uint32_t totalProtocolDefCount, uint32_t categoryAttachReadWriteSize) {
     uint64_t nextRegionFileOffset = _readExecuteRegion.sizeInUse;
 
     const size_t dylibCount = _sortedDylibs.size();
@@ -1678,6 +2034,29 @@ void SharedCacheBuilder::assignMultipleDataSegmentAddresses(uint64_t& addr, uint
              return _sortedDylibs[a].input->mappedFile.runtimePath < _sortedDylibs[b].input->mappedFile.runtimePath;
     });
 
+    // Order the __DATA_CONST segments touched in the page touch profile first, in the order they were first touched,
+    // so that launches dirty fewer pages when binding them.  The rest stay in dylib order.
+    BLOCK_ACCCESSIBLE_ARRAY(uint32_t, dataConstSortIndexes, dylibCount);
+    for (size_t i=0; i < dylibCount; ++i)
+        dataConstSortIndexes[i] = (uint32_t)i;
+    if ( !_options.pageTouchProfile.empty() ) {
+        std::unordered_map<std::string, uint32_t> firstTouch;
+        for (const DyldSharedCache::PageTouch& touch : _options.pageTouchProfile) {
+            if ( (touch.segmentName == "__DATA_CONST") || (touch.segmentName == "__OBJC_CONST") || (touch.segmentName == "__AUTH_CONST") )
+                firstTouch.insert({ touch.installName, (uint32_t)firstTouch.size() });
+        }
+        std::stable_sort(&dataConstSortIndexes[0], &dataConstSortIndexes[dylibCount], [&](const uint32_t& a, const uint32_t& b) {
+            const auto& touchA = firstTouch.find(_sortedDylibs[a].input->mappedFile.runtimePath);
+            const auto& touchB = firstTouch.find(_sortedDylibs[b].input->mappedFile.runtimePath);
+            bool foundA = (touchA != firstTouch.end());
+            bool foundB = (touchB != firstTouch.end());
+            if ( foundA && foundB )
+                return touchA->second < touchB->second;
+            return foundA && !foundB;
+        });
+        _diagnostics.verbose("page touch profile orders %lu __DATA_CONST segments first\n", firstTouch.size());
+    }
+
     bool supportsAuthFixups = false;
 
     // This tracks which segments contain authenticated data, even if their name isn't __AUTH*
@@ -1895,6 +2274,8 @@ void SharedCacheBuilder::assignMultipleDataSegmentAddresses(uint64_t& addr, uint
             size_t dylibIndex = unsortedDylibIndex;
             if ( (onlyType == SegmentType::dataDirty) || (onlyType == SegmentType::authDirty) )
                 dylibIndex = dirtyDataSortIndexes[dylibIndex];
+            else if ( (onlyType == SegmentType::dataConst) || (onlyType == SegmentType::authConst) )
+                dylibIndex = dataConstSortIndexes[dylibIndex];
 
             DylibInfo& dylib = _sortedDylibs[dylibIndex];
             const std::vector<SegmentType>& dylibSegmentTypes = segmentTypes[dylibIndex];
@@ -2026,7 +2407,7 @@ void SharedCacheBuilder::assignMultipleDataSegmentAddresses(uint64_t& addr, uint
 
         if ( dataRegion.addObjCRW ) {
             // reserve space for objc r/w optimization tables
-            _objcReadWriteBufferSizeAllocated = align(computeReadWriteObjC((uint32_t)_sortedDylibs.size(), totalProtocolDefCount), 14);
+            _objcReadWriteBufferSizeAllocated = align(computeReadWriteObjC((uint32_t)_sortedDylibs.size(), totalProtocolDefCount, categoryAttachReadWriteSize), 14);
             addr = align(addr, 4); // objc r/w section contains pointer and must be at least pointer align
             _objcReadWriteBuffer = region.buffer + (addr - region.unslidLoadAddress);
             _objcReadWriteFileOffset = (uint32_t)((_objcReadWriteBuffer - region.buffer) + region.cacheFileOffset);
@@ -2159,11 +2540,18 @@ void SharedCacheBuilder::assignSegmentAddresses()
         totalProtocolDefCount   += info.protocolDefCount;
     }
 
+    // space for the lists merged when attaching categories, so that every class that can have them attached fits
+    uint32_t categoryAttachReadOnlySize  = 0;
+    uint32_t categoryAttachReadWriteSize = 0;
+    computeCategoryAttachSizes(categoryAttachReadOnlySize, categoryAttachReadWriteSize);
+    _diagnostics.verbose("Reserving %u bytes read-only and %u bytes read-write for attaching categories\n",
+                         categoryAttachReadOnlySize, categoryAttachReadWriteSize);
+
     // now that shared cache coalesces all selector strings, use that better count
     uint32_t coalescedSelectorCount = (uint32_t)_coalescedText.objcMethNames.stringsToOffsets.size();
     if ( coalescedSelectorCount > totalSelectorRefCount )
         totalSelectorRefCount = coalescedSelectorCount;
-    addr += align(computeReadOnlyObjC(totalSelectorRefCount, totalClassDefCount, totalProtocolDefCount), 14);
+    addr += align(computeReadOnlyObjC(totalSelectorRefCount, totalClassDefCount, totalProtocolDefCount, categoryAttachReadOnlySize), 14);
 
     size_t impCachesSize = _impCachesBuilder->totalIMPCachesSize();
     size_t alignedImpCachesSize = align(impCachesSize, 14);
@@ -2185,7 +2573,7 @@ void SharedCacheBuilder::assignSegmentAddresses()
         addr = align((addr + _archLayout->sharedRegionPadding), _archLayout->sharedRegionAlignP2);
 
     // __DATA*
-    assignMultipleDataSegmentAddresses(addr, totalProtocolDefCount);
+    assignMultipleDataSegmentAddresses(addr, totalProtocolDefCount, categoryAttachReadWriteSize);
 
     // start read-only region
     if ( _archLayout->sharedRegionsAreDiscontiguous )
@@ -2292,6 +2680,8 @@ void SharedCacheBuilder::assignSegmentAddresses()
             return a.srcSegmentIndex < b.srcSegmentIndex;
         });
     }
+
+    commitRegionBuffers();
 }
 
 // Return the total size of the data regions, including padding between them.
@@ -2318,6 +2708,12 @@ uint64_t SharedCacheBuilder::dataRegionsSizeInUse() const {
     return size;
 }
 
+// Bytes of cache content laid out so far, across all regions
+uint64_t SharedCacheBuilder::cacheSizeInUse() const {
+    return _readExecuteRegion.sizeInUse + dataRegionsSizeInUse() + _readOnlyRegion.sizeInUse
+         + _localSymbolsRegion.sizeInUse + _codeSignatureRegion.sizeInUse;
+}
+
 // Return the earliest data region by address
 const CacheBuilder::Region* SharedCacheBuilder::firstDataRegion() const {
     const Region* firstRegion = nullptr;
@@ -2717,6 +3113,14 @@ void SharedCacheBuilder::addClosures(const std::vector<LoadedMachO>& osExecutabl
     osExecutablesDiags.resize(osExecutables.size());
     osExecutablesClosures.resize(osExecutables.size());
 
+    // closures from earlier builds are reused if neither the cache nor any of the files they load have changed
+    std::string closureMemoKey;
+    if ( !_options.closureMemoDir.empty() ) {
+        ::mkdir(_options.closureMemoDir.c_str(), S_IRWXU|S_IRGRP|S_IXGRP|S_IROTH|S_IXOTH);
+        closureMemoKey = closureMemoCacheKey();
+    }
+    __block uint32_t memoizedClosureCount = 0;
+
     dispatch_apply(osExecutables.size(), DISPATCH_APPLY_AUTO, ^(size_t index) {
         const LoadedMachO& loadedMachO = osExecutables[index];
         // don't pre-build closures for staged apps into dyld cache, since they won't run from that location
@@ -2732,13 +3136,26 @@ void SharedCacheBuilder::addClosures(const std::vector<LoadedMachO>& osExecutabl
             return;
         }
 
+        bool issetuid = false;
+        if ( this->_options.platform == dyld3::Platform::macOS || dyld3::MachOFile::isSimulatorPlatform(this->_options.platform) )
+            _fileSystem.fileExists(loadedMachO.loadedFileInfo.path, nullptr, nullptr, &issetuid, nullptr);
+
+        std::string memoPath;
+        if ( !closureMemoKey.empty() ) {
+            memoPath = closureMemoPath(closureMemoKey, loadedMachO, issetuid);
+            if ( !memoPath.empty() ) {
+                if ( const dyld3::closure::LaunchClosure* memoizedClosure = loadMemoizedClosure(memoPath) ) {
+                    osExecutablesClosures[index] = memoizedClosure;
+                    __atomic_fetch_add(&memoizedClosureCount, 1, __ATOMIC_RELAXED);
+                    return;
+                }
+            }
+        }
+
         dyld3::closure::PathOverrides pathOverrides;
         dyld3::RootsChecker rootsChecker;
         dyld3::closure::ClosureBuilder builder(dyld3::closure::kFirstLaunchClosureImageNum, _fileSystem, rootsChecker, dyldCache, false, *_options.archs, pathOverrides,
                                                dyld3::closure::ClosureBuilder::AtPath::all, false, nullptr, _options.platform, nullptr);
-        bool issetuid = false;
-        if ( this->_options.platform == dyld3::Platform::macOS || dyld3::MachOFile::isSimulatorPlatform(this->_options.platform) )
-            _fileSystem.fileExists(loadedMachO.loadedFileInfo.path, nullptr, nullptr, &issetuid, nullptr);
         const dyld3::closure::LaunchClosure* mainClosure = builder.makeLaunchClosure(loadedMachO.loadedFileInfo, issetuid);
         if ( builder.diagnostics().hasError() ) {
            osExecutablesDiags[index].error("%s", builder.diagnostics().errorMessage().c_str());
@@ -2746,8 +3163,12 @@ void SharedCacheBuilder::addClosures(const std::vector<LoadedMachO>& osExecutabl
         else {
             assert(mainClosure != nullptr);
             osExecutablesClosures[index] = mainClosure;
+            if ( !memoPath.empty() )
+                saveMemoizedClosure(memoPath, mainClosure);
         }
     });
+    if ( !closureMemoKey.empty() )
+        _diagnostics.verbose("reused %u of %lu launch closures from %s\n", memoizedClosureCount, osExecutables.size(), _options.closureMemoDir.c_str());
 
     std::map<std::string, const dyld3::closure::LaunchClosure*> closures;
     for (uint64_t i = 0, e = osExecutables.size(); i != e; ++i) {
@@ -2840,6 +3261,191 @@ void SharedCacheBuilder::addClosures(const std::vector<LoadedMachO>& osExecutabl
     _readOnlyRegion.sizeInUse = align(_readOnlyRegion.sizeInUse, 14);
 }
 
+// Header of each file in CreateOptions::closureMemoDir.  The file name is the memo key, and the closure follows the header.
+struct ClosureMemoHeader {
+    char        magic[16];
+    uint32_t    formatVersion;
+    uint32_t    closureSize;
+};
+
+static const char kClosureMemoMagic[16] = "dyld_closure_v1";
+
+// Returns a digest of everything in this cache that launch closures depend on
+std::string SharedCacheBuilder::closureMemoCacheKey() const
+{
+    const DyldSharedCache* dyldCache = (DyldSharedCache*)_readExecuteRegion.buffer;
+    CC_SHA256_CTX sha256Context;
+    CC_SHA256_Init(&sha256Context);
+
+    const uint32_t formatVersion = dyld3::closure::kFormatVersion;
+    const uint32_t platform      = (uint32_t)_options.platform;
+    const uint32_t onDisk        = dyldCache->header.dylibsExpectedOnDisk;
+    CC_SHA256_Update(&sha256Context, &formatVersion, sizeof(formatVersion));
+    CC_SHA256_Update(&sha256Context, &platform, sizeof(platform));
+    CC_SHA256_Update(&sha256Context, &onDisk, sizeof(onDisk));
+    CC_SHA256_Update(&sha256Context, _options.archs->name(), (CC_LONG)strlen(_options.archs->name()));
+
+    // the cached dylibs' Images record their cdHashes and where each of their segments is in the cache.
+    // Hash the copy addImageArray() made in the read-only region, as _imageArray is freed by now
+    const uint8_t* imageArray = _readOnlyRegion.buffer + (dyldCache->header.dylibsImageArrayAddr - _readOnlyRegion.unslidLoadAddress);
+    CC_SHA256_Update(&sha256Context, imageArray, (CC_LONG)dyldCache->header.dylibsImageArraySize);
+
+    // closures also record offsets in to the selector, class and protocol tables in libobjc
+    uint32_t objcImageIndex;
+    if ( dyldCache->hasImagePath("/usr/lib/libobjc.A.dylib", objcImageIndex) ) {
+        uint64_t mTime;
+        uint64_t inode;
+        const dyld3::MachOAnalyzer* objcMA = (const dyld3::MachOAnalyzer*)dyldCache->getIndexedImageEntry(objcImageIndex, mTime, inode);
+        int64_t slide = objcMA->getSlide();
+        CC_SHA256_CTX* contextPtr = &sha256Context;
+        objcMA->forEachSection(^(const dyld3::MachOAnalyzer::SectionInfo& info, bool malformedSectionRange, bool& stop) {
+            if ( malformedSectionRange || (strcmp(info.segInfo.segName, "__TEXT") != 0) || (strcmp(info.sectName, "__objc_opt_ro") != 0) )
+                return;
+            CC_SHA256_Update(contextPtr, (const uint8_t*)(info.sectAddr + slide), (CC_LONG)info.sectSize);
+            stop = true;
+        });
+    }
+
+    uint8_t digest[CC_SHA256_DIGEST_LENGTH];
+    CC_SHA256_Final(digest, &sha256Context);
+    return std::string((const char*)digest, sizeof(digest));
+}
+
+// Returns the path in CreateOptions::closureMemoDir for the executable's closure, or "" if the executable has no cdHash
+std::string SharedCacheBuilder::closureMemoPath(const std::string& cacheKey, const LoadedMachO& executable, bool issetuid) const
+{
+    __block std::string cdHashes;
+    executable.mappedFile.mh->forEachCDHash(^(const uint8_t cdHash[20]) {
+        cdHashes.append((const char*)cdHash, 20);
+    });
+    if ( cdHashes.empty() )
+        return "";
+
+    const std::string& path = executable.mappedFile.runtimePath;
+    const uint8_t setuid = issetuid ? 1 : 0;
+    CC_SHA256_CTX sha256Context;
+    CC_SHA256_Init(&sha256Context);
+    CC_SHA256_Update(&sha256Context, cacheKey.data(), (CC_LONG)cacheKey.size());
+    CC_SHA256_Update(&sha256Context, path.c_str(), (CC_LONG)path.size() + 1);
+    CC_SHA256_Update(&sha256Context, &setuid, sizeof(setuid));
+    CC_SHA256_Update(&sha256Context, cdHashes.data(), (CC_LONG)cdHashes.size());
+    uint8_t digest[CC_SHA256_DIGEST_LENGTH];
+    CC_SHA256_Final(digest, &sha256Context);
+
+    char digestString[CC_SHA256_DIGEST_LENGTH*2+1];
+    bytesToHex(digest, sizeof(digest), digestString);
+    return _options.closureMemoDir + "/" + digestString;
+}
+
+// Returns a closure from an earlier build if every file it loads is unchanged, otherwise nullptr
+const dyld3::closure::LaunchClosure* SharedCacheBuilder::loadMemoizedClosure(const std::string& memoPath) const
+{
+    int fd = ::open(memoPath.c_str(), O_RDONLY);
+    if ( fd == -1 )
+        return nullptr;
+
+    const dyld3::closure::LaunchClosure* closure = nullptr;
+    ClosureMemoHeader header;
+    if ( (::pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header))
+        && (memcmp(header.magic, kClosureMemoMagic, sizeof(header.magic)) == 0)
+        && (header.formatVersion == dyld3::closure::kFormatVersion) ) {
+        vm_address_t buffer = 0;
+        if ( ::vm_allocate(mach_task_self(), &buffer, header.closureSize, VM_FLAGS_ANYWHERE) == KERN_SUCCESS ) {
+            if ( (::pread(fd, (void*)buffer, header.closureSize, sizeof(header)) == (ssize_t)header.closureSize)
+                && (((const dyld3::closure::LaunchClosure*)buffer)->size() == header.closureSize) )
+                closure = (const dyld3::closure::LaunchClosure*)buffer;
+            else
+                ::vm_deallocate(mach_task_self(), buffer, header.closureSize);
+        }
+    }
+    ::close(fd);
+
+    if ( (closure != nullptr) && !memoizedClosureIsCurrent(closure) ) {
+        closure->deallocate();
+        closure = nullptr;
+    }
+    return closure;
+}
+
+// The memo key covers the cache and the executable, so check everything else the closure depends on
+bool SharedCacheBuilder::memoizedClosureIsCurrent(const dyld3::closure::LaunchClosure* closure) const
+{
+    __block bool current = true;
+    const dyld3::closure::ImageNum topImageNum = closure->topImageNum();
+    closure->images()->forEachImage(^(const dyld3::closure::Image* image, bool& stop) {
+        // files must still have the inode and mtime recorded in the closure
+        uint64_t inode;
+        uint64_t mtime;
+        if ( image->hasFileModTimeAndInode(inode, mtime) ) {
+            uint64_t currentInode = 0;
+            uint64_t currentMtime = 0;
+            if ( !_fileSystem.fileExists(image->path(), &currentInode, &currentMtime) || (currentInode != inode) || (currentMtime != mtime) ) {
+                current = false;
+                stop = true;
+                return;
+            }
+        }
+        if ( image->imageNum() == topImageNum )
+            return;
+
+        // dependents must still have the same cdHash
+        __block std::string recordedCDHash;
+        image->forEachCDHash(^(const uint8_t cdHash[20], bool& stopCDHash) {
+            recordedCDHash.assign((const char*)cdHash, 20);
+            stopCDHash = true;
+        });
+        __block bool matched = false;
+        if ( !recordedCDHash.empty() ) {
+            Diagnostics loadDiag;
+            char realerPath[MAXPATHLEN];
+            dyld3::closure::LoadedFileInfo info = dyld3::MachOAnalyzer::load(loadDiag, _fileSystem, image->path(), *_options.archs, _options.platform, realerPath);
+            const dyld3::MachOAnalyzer* ma = (const dyld3::MachOAnalyzer*)info.fileContent;
+            if ( ma != nullptr ) {
+                ma->forEachCDHash(^(const uint8_t cdHash[20]) {
+                    if ( memcmp(cdHash, recordedCDHash.data(), 20) == 0 )
+                        matched = true;
+                });
+                _fileSystem.unloadFile(info);
+            }
+        }
+        if ( !matched ) {
+            current = false;
+            stop = true;
+        }
+    });
+    if ( !current )
+        return false;
+
+    // files which were missing or skipped must not have appeared or changed
+    closure->forEachMustBeMissingFile(^(const char* path, bool& stop) {
+        if ( _fileSystem.fileExists(path) ) {
+            current = false;
+            stop = true;
+        }
+    });
+    closure->forEachSkipIfExistsFile(^(const dyld3::closure::LaunchClosure::SkippedFile& file, bool& stop) {
+        uint64_t inode = 0;
+        uint64_t mtime = 0;
+        if ( !_fileSystem.fileExists(file.path, &inode, &mtime) || (inode != file.inode) || (mtime != file.mtime) ) {
+            current = false;
+            stop = true;
+        }
+    });
+    return current;
+}
+
+void SharedCacheBuilder::saveMemoizedClosure(const std::string& memoPath, const dyld3::closure::LaunchClosure* closure) const
+{
+    std::vector<uint8_t> contents(sizeof(ClosureMemoHeader) + closure->size());
+    ClosureMemoHeader* header = (ClosureMemoHeader*)contents.data();
+    memcpy(header->magic, kClosureMemoMagic, sizeof(header->magic));
+    header->formatVersion = dyld3::closure::kFormatVersion;
+    header->closureSize   = (uint32_t)closure->size();
+    memcpy(&contents[sizeof(ClosureMemoHeader)], closure, closure->size());
+    // the memo is only an optimization, so failing to save to it is not an error
+    (void)safeSave(contents.data(), contents.size(), memoPath);
+}
+
 void SharedCacheBuilder::emitContantObjects() {
     if ( _coalescedText.cfStrings.bufferSize == 0 )
         return;
@@ -2990,75 +3596,205 @@ bool SharedCacheBuilder::writeCache(void (^cacheSizeCallback)(uint64_t size), bo
 }
 
 
-void SharedCacheBuilder::writeFile(const std::string& path)
+// Creates a temporary file next to path.  The cache is written to it and then renamed over path.
+int SharedCacheBuilder::openTempCacheFile(const std::string& path, std::string& tempPath)
 {
     std::string pathTemplate = path + "-XXXXXX";
     size_t templateLen = strlen(pathTemplate.c_str())+2;
     BLOCK_ACCCESSIBLE_ARRAY(char, pathTemplateSpace, templateLen);
     strlcpy(pathTemplateSpace, pathTemplate.c_str(), templateLen);
     int fd = mkstemp(pathTemplateSpace);
-    if ( fd != -1 ) {
-        auto cacheSizeCallback = ^(uint64_t size) {
-            // set final cache file size (may help defragment file)
-            ::ftruncate(fd, size);
-        };
-        auto copyCallback = ^(const uint8_t* src, uint64_t size, uint64_t dstOffset) {
-            uint64_t writtenSize = pwrite(fd, src, size, dstOffset);
-            return writtenSize == size;
-        };
+    if ( fd == -1 ) {
+        _diagnostics.error("could not open file %s", pathTemplateSpace);
+        return -1;
+    }
+    tempPath = pathTemplateSpace;
+    // <rdar://problem/55370916> TOCTOU: verify path is still a realpath (not changed)
+    char realTempPath[MAXPATHLEN];
+    if ( ::fcntl(fd, F_GETPATH, realTempPath) == 0 ) {
+        size_t tempPathLen = strlen(realTempPath);
+        if ( tempPathLen > 7 )
+            realTempPath[tempPathLen-7] = '\0'; // remove trailing -xxxxxx
+        if ( path != realTempPath ) {
+            _diagnostics.error("output file path changed from: '%s' to: '%s'", path.c_str(), realTempPath);
+            ::close(fd);
+            return -1;
+        }
+    }
+    else {
+        _diagnostics.error("unable to fcntl(fd, F_GETPATH) on output file");
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Renames the temporary file from openTempCacheFile() to path if the whole cache was written to it
+void SharedCacheBuilder::installTempCacheFile(int fd, const std::string& tempPath, const std::string& path, bool fullyWritten)
+{
+    if ( fullyWritten ) {
+        ::fchmod(fd, S_IRUSR|S_IRGRP|S_IROTH); // mkstemp() makes file "rw-------", switch it to "r--r--r--"
         // <rdar://problem/55370916> TOCTOU: verify path is still a realpath (not changed)
-        char tempPath[MAXPATHLEN];
-        if ( ::fcntl(fd, F_GETPATH, tempPath) == 0 ) {
-            size_t tempPathLen = strlen(tempPath);
-            if ( tempPathLen > 7 )
-                tempPath[tempPathLen-7] = '\0'; // remove trailing -xxxxxx
-            if ( path != tempPath ) {
-                _diagnostics.error("output file path changed from: '%s' to: '%s'", path.c_str(), tempPath);
-                ::close(fd);
+        // For MRM bringup, dyld installs symlinks from:
+        //   dyld_shared_cache_x86_64 -> ../../../../System/Library/dyld/dyld_shared_cache_x86_64
+        //   dyld_shared_cache_x86_64h -> ../../../../System/Library/dyld/dyld_shared_cache_x86_64h
+        // We don't want to follow that symlink when we install the cache, but instead write over it
+        auto lastSlash = path.find_last_of("/");
+        if ( lastSlash != std::string::npos ) {
+            std::string directoryPath = path.substr(0, lastSlash);
+
+            char resolvedPath[PATH_MAX];
+            ::realpath(directoryPath.c_str(), resolvedPath);
+            // Note: if the target cache file does not already exist, realpath() will return NULL, but still fill in the path buffer
+            if ( directoryPath != resolvedPath ) {
+                _diagnostics.error("output directory file path changed from: '%s' to: '%s'", directoryPath.c_str(), resolvedPath);
                 return;
             }
         }
-        else {
-            _diagnostics.error("unable to fcntl(fd, F_GETPATH) on output file");
+        if ( ::rename(tempPath.c_str(), path.c_str()) == 0) {
             ::close(fd);
-            return;
-        }
-        bool fullyWritten = writeCache(cacheSizeCallback, copyCallback);
-        if ( fullyWritten ) {
-            ::fchmod(fd, S_IRUSR|S_IRGRP|S_IROTH); // mkstemp() makes file "rw-------", switch it to "r--r--r--"
-            // <rdar://problem/55370916> TOCTOU: verify path is still a realpath (not changed)
-            // For MRM bringup, dyld installs symlinks from:
-            //   dyld_shared_cache_x86_64 -> ../../../../System/Library/dyld/dyld_shared_cache_x86_64
-            //   dyld_shared_cache_x86_64h -> ../../../../System/Library/dyld/dyld_shared_cache_x86_64h
-            // We don't want to follow that symlink when we install the cache, but instead write over it
-            auto lastSlash = path.find_last_of("/");
-            if ( lastSlash != std::string::npos ) {
-                std::string directoryPath = path.substr(0, lastSlash);
-
-                char resolvedPath[PATH_MAX];
-                ::realpath(directoryPath.c_str(), resolvedPath);
-                // Note: if the target cache file does not already exist, realpath() will return NULL, but still fill in the path buffer
-                if ( directoryPath != resolvedPath ) {
-                    _diagnostics.error("output directory file path changed from: '%s' to: '%s'", directoryPath.c_str(), resolvedPath);
-                    return;
-                }
-            }
-            if ( ::rename(pathTemplateSpace, path.c_str()) == 0) {
-                ::close(fd);
-                return; // success
-            } else {
-                _diagnostics.error("could not rename file '%s' to: '%s'", pathTemplateSpace, path.c_str());
-            }
-        }
-        else {
-            _diagnostics.error("could not write file %s", pathTemplateSpace);
+            return; // success
+        } else {
+            _diagnostics.error("could not rename file '%s' to: '%s'", tempPath.c_str(), path.c_str());
         }
-        ::close(fd);
-        ::unlink(pathTemplateSpace);
     }
     else {
-        _diagnostics.error("could not open file %s", pathTemplateSpace);
+        _diagnostics.error("could not write file %s", tempPath.c_str());
     }
+    ::close(fd);
+    ::unlink(tempPath.c_str());
+}
+
+void SharedCacheBuilder::writeFile(const std::string& path)
+{
+    // Most of the cache may already have been written while it was being built
+    if ( (_streamFd != -1) && (path == _streamPath) ) {
+        int         fd       = _streamFd;
+        std::string tempPath = _streamTempPath;
+        bool fullyWritten = finishStreamingFile();
+        installTempCacheFile(fd, tempPath, path, fullyWritten);
+        return;
+    }
+
+    std::string tempPath;
+    int fd = openTempCacheFile(path, tempPath);
+    if ( fd == -1 )
+        return;
+    auto cacheSizeCallback = ^(uint64_t size) {
+        // set final cache file size (may help defragment file)
+        ::ftruncate(fd, size);
+    };
+    auto copyCallback = ^(const uint8_t* src, uint64_t size, uint64_t dstOffset) {
+        uint64_t writtenSize = pwrite(fd, src, size, dstOffset);
+        return writtenSize == size;
+    };
+    bool fullyWritten = writeCache(cacheSizeCallback, copyCallback);
+    installTempCacheFile(fd, tempPath, path, fullyWritten);
+}
+
+// Start writing the cache to a temporary file next to path.  Regions are streamed to it
+// with streamToFile() as they become final, and writeFile(path) fills in the rest.
+void SharedCacheBuilder::beginStreamingFile(const std::string& path)
+{
+    _streamFd = openTempCacheFile(path, _streamTempPath);
+    if ( _streamFd == -1 )
+        return;
+    _streamPath   = path;
+    _streamFailed = false;
+    _streamedRanges.clear();
+    _streamQueue  = dispatch_queue_create("com.apple.dyld.cache.stream", DISPATCH_QUEUE_SERIAL);
+    _streamGroup  = dispatch_group_create();
+}
+
+// Write [startOffset, endOffset) of a region to the output file in the background.
+// The caller guarantees that nothing in this range is written again before the cache is written out.
+// Partial pages at either end are left for writeFile() to write.
+void SharedCacheBuilder::streamToFile(const uint8_t* regionBuffer, uint64_t startOffset, uint64_t endOffset, uint64_t regionFileOffset)
+{
+    if ( _streamFd == -1 )
+        return;
+
+    const uint16_t pageSize = _archLayout->csPageSize;
+    startOffset = align(startOffset, __builtin_ctz(pageSize));
+    endOffset   = endOffset & ~((uint64_t)pageSize - 1);
+    if ( endOffset <= startOffset )
+        return;
+
+    StreamedRange range;
+    range.fileOffset = regionFileOffset + startOffset;
+    range.size       = endOffset - startOffset;
+    _streamedRanges.push_back(range);
+
+    const int      fd  = _streamFd;
+    const uint8_t* src = regionBuffer + startOffset;
+    dispatch_group_async(_streamGroup, _streamQueue, ^{
+        uint64_t writtenSize = pwrite(fd, src, range.size, range.fileOffset);
+        if ( writtenSize != range.size )
+            _streamFailed = true;
+    });
+}
+
+// Waits for all streamed writes, then writes the parts of the cache which were not streamed,
+// such as the header and the code signature.  Returns true if the whole cache is now in the file.
+bool SharedCacheBuilder::finishStreamingFile()
+{
+    dispatch_group_wait(_streamGroup, DISPATCH_TIME_FOREVER);
+    dispatch_release(_streamGroup);
+    dispatch_release(_streamQueue);
+    _streamGroup = nullptr;
+    _streamQueue = nullptr;
+    const int fd = _streamFd;
+    _streamFd = -1;
+
+    std::sort(_streamedRanges.begin(), _streamedRanges.end(), [](const StreamedRange& a, const StreamedRange& b) {
+        return a.fileOffset < b.fileOffset;
+    });
+
+    auto cacheSizeCallback = ^(uint64_t size) {
+        ::ftruncate(fd, size);
+    };
+    auto copyCallback = ^(const uint8_t* src, uint64_t size, uint64_t dstOffset) {
+        // only write the gaps between the ranges already in the file
+        uint64_t dstEnd = dstOffset + size;
+        uint64_t cursor = dstOffset;
+        bool     result = true;
+        for (const StreamedRange& range : _streamedRanges) {
+            uint64_t rangeEnd = range.fileOffset + range.size;
+            if ( rangeEnd <= cursor )
+                continue;
+            if ( range.fileOffset >= dstEnd )
+                break;
+            if ( range.fileOffset > cursor ) {
+                uint64_t gapSize = range.fileOffset - cursor;
+                result &= (pwrite(fd, src + (cursor - dstOffset), gapSize, cursor) == gapSize);
+            }
+            cursor = std::min(rangeEnd, dstEnd);
+        }
+        if ( cursor < dstEnd ) {
+            uint64_t gapSize = dstEnd - cursor;
+            result &= (pwrite(fd, src + (cursor - dstOffset), gapSize, cursor) == gapSize);
+        }
+        return result;
+    };
+    bool fullyWritten = writeCache(cacheSizeCallback, copyCallback) && !_streamFailed;
+    _streamedRanges.clear();
+    return fullyWritten;
+}
+
+// Discards a partially streamed file, eg, if the build failed
+void SharedCacheBuilder::abortStreamingFile()
+{
+    if ( _streamFd == -1 )
+        return;
+    dispatch_group_wait(_streamGroup, DISPATCH_TIME_FOREVER);
+    dispatch_release(_streamGroup);
+    dispatch_release(_streamQueue);
+    _streamGroup = nullptr;
+    _streamQueue = nullptr;
+    ::close(_streamFd);
+    ::unlink(_streamTempPath.c_str());
+    _streamFd = -1;
+    _streamedRanges.clear();
 }
 
 void SharedCacheBuilder::writeBuffer(uint8_t*& buffer, uint64_t& bufferSize) {
@@ -3092,6 +3828,20 @@ std::string SharedCacheBuilder::getMapFileJSONBuffer(const std::string& cacheDis
     return cache->generateJSONMap(cacheDisposition.c_str());
 }
 
+std::string SharedCacheBuilder::getTelemetryJSONBuffer() const
+{
+    dyld3::json::Node telemetryNode;
+    telemetryNode.map["version"]    = dyld3::json::Node((uint64_t)1);
+    telemetryNode.map["arch"]       = dyld3::json::Node(_archLayout->archName);
+    telemetryNode.map["platform"]   = dyld3::json::Node(dyld3::MachOFile::platformName(_options.platform));
+    telemetryNode.map["cache-size"] = dyld3::json::Node(cacheSizeInUse());
+    telemetryNode.map["phases"]     = _timeRecorder.timingsJSON();
+
+    std::stringstream stream;
+    dyld3::json::printJSON(telemetryNode, 0, stream);
+    return stream.str();
+}
+
 void SharedCacheBuilder::markPaddingInaccessible()
 {
     // region between RX and RW
@@ -3107,6 +3857,56 @@ void SharedCacheBuilder::markPaddingInaccessible()
 }
 
 
+// The cache buffer is only reserved address space.  Make the ranges the regions were just laid out in
+// accessible.  Pages are not backed by memory until touched, so this costs nothing until segments are copied in.
+void SharedCacheBuilder::commitRegionBuffers()
+{
+    // after evicting dylibs the cache is laid out again, so drop access to ranges only the last layout used
+    ::vm_protect(mach_task_self(), _fullAllocatedBuffer, _allocatedBufferSize, false, VM_PROT_NONE);
+
+    auto commit = [&](const Region& region) {
+        vm_address_t start = trunc_page((vm_address_t)region.buffer);
+        vm_address_t end   = round_page((vm_address_t)region.buffer + region.bufferSize);
+        if ( ::vm_protect(mach_task_self(), start, end - start, false, VM_PROT_READ | VM_PROT_WRITE) != KERN_SUCCESS )
+            _diagnostics.error("could not commit %lluMB of cache buffer", (uint64_t)(end - start)/1024/1024);
+    };
+    commit(_readExecuteRegion);
+    for (const Region& region : _dataRegions)
+        commit(region);
+    commit(_readOnlyRegion);
+
+    _timeRecorder.recordBufferUsage(committedBufferSize(), _allocatedBufferSize);
+}
+
+// The unoptimized LINKEDITs were staged after the merged LINKEDIT.  Those pages are dirty but no longer needed,
+// so replace them with fresh zero-fill pages.  The range stays usable for the ImageArray and closures added later.
+void SharedCacheBuilder::releaseLinkeditStaging()
+{
+    vm_address_t start = round_page((vm_address_t)_readOnlyRegion.buffer + _readOnlyRegion.sizeInUse);
+    vm_address_t end   = trunc_page((vm_address_t)_readOnlyRegion.buffer + _readOnlyRegion.bufferSize);
+    if ( end <= start )
+        return;
+    void* result = ::mmap((void*)start, end - start, PROT_READ | PROT_WRITE, MAP_FIXED | MAP_ANON | MAP_PRIVATE, -1, 0);
+    if ( result == MAP_FAILED ) {
+        // not fatal, the cache just keeps using more memory than it needs to
+        _diagnostics.verbose("could not release LINKEDIT staging area, errno=%d\n", errno);
+        return;
+    }
+    _diagnostics.verbose("released %lluMB of LINKEDIT staging area\n", (uint64_t)(end - start)/1024/1024);
+    _timeRecorder.recordBufferUsage(committedBufferSize(), _allocatedBufferSize);
+}
+
+// Bytes of the cache buffer which may be backed by memory, ie, what each region currently uses
+uint64_t SharedCacheBuilder::committedBufferSize() const
+{
+    uint64_t size = round_page(_readExecuteRegion.sizeInUse);
+    for (const Region& region : _dataRegions)
+        size += round_page(region.sizeInUse);
+    size += round_page(_readOnlyRegion.sizeInUse);
+    return size;
+}
+
+
 void SharedCacheBuilder::forEachCacheDylib(void (^callback)(const std::string& path)) {
     for (const DylibInfo& dylibInfo : _sortedDylibs)
         callback(dylibInfo.dylibID);
@@ -3193,12 +3993,9 @@ void SharedCacheBuilder::fipsSign()
     CCHmac(kCCHmacAlgSHA256, &hmac_key, 1, textLocation, textSize, (void*)hashStoreLocation); // store hash directly into hashStoreLocation
 }
 
-void SharedCacheBuilder::codeSign()
+bool SharedCacheBuilder::codeSigningDigests(uint8_t& hashType, uint8_t& hashSize, uint32_t& digestFormat, bool& agile)
 {
-    uint8_t  dscHashType;
-    uint8_t  dscHashSize;
-    uint32_t dscDigestFormat;
-    bool agile = false;
+    agile = false;
 
     // select which codesigning hash
     switch (_options.codeSigningDigestMode) {
@@ -3209,20 +4006,105 @@ void SharedCacheBuilder::codeSign()
         case DyldSharedCache::SHA1only:
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wdeprecated-declarations"
-            dscHashType     = CS_HASHTYPE_SHA1;
-            dscHashSize     = CS_HASH_SIZE_SHA1;
-            dscDigestFormat = kCCDigestSHA1;
+            hashType     = CS_HASHTYPE_SHA1;
+            hashSize     = CS_HASH_SIZE_SHA1;
+            digestFormat = kCCDigestSHA1;
 #pragma clang diagnostic pop
-            break;
+            return true;
         case DyldSharedCache::SHA256only:
-            dscHashType     = CS_HASHTYPE_SHA256;
-            dscHashSize     = CS_HASH_SIZE_SHA256;
-            dscDigestFormat = kCCDigestSHA256;
-            break;
-        default:
-            _diagnostics.error("codeSigningDigestMode has unknown, unexpected value %d, bailing out.",
-                               _options.codeSigningDigestMode);
-            return;
+            hashType     = CS_HASHTYPE_SHA256;
+            hashSize     = CS_HASH_SIZE_SHA256;
+            digestFormat = kCCDigestSHA256;
+            return true;
+    }
+    return false;
+}
+
+// Hashes one code signing page.  For agile signatures both the SHA1 and SHA256 digests are
+// fed from the same small chunk while it is still in L1, so each page is only streamed in once.
+static void hashCodeSignPage(uint32_t digestFormat, bool agile, const uint8_t* page, uint16_t pageSize,
+                             uint8_t* hash, uint8_t* hash256)
+{
+    if ( !agile ) {
+        CCDigest(digestFormat, page, pageSize, hash);
+        return;
+    }
+
+    // agile signatures are always SHA1 for the main code directory plus SHA256 for the alternate
+    const uint16_t chunkSize = 1024;
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+    assert(digestFormat == kCCDigestSHA1);
+    CC_SHA1_CTX   sha1Context;
+    CC_SHA256_CTX sha256Context;
+    CC_SHA1_Init(&sha1Context);
+    CC_SHA256_Init(&sha256Context);
+    for (uint32_t offset = 0; offset < pageSize; offset += chunkSize) {
+        CC_LONG len = std::min<uint32_t>(chunkSize, pageSize - offset);
+        CC_SHA1_Update(&sha1Context, page + offset, len);
+        CC_SHA256_Update(&sha256Context, page + offset, len);
+    }
+    CC_SHA1_Final(hash, &sha1Context);
+    CC_SHA256_Final(hash256, &sha256Context);
+#pragma clang diagnostic pop
+}
+
+// Start hashing the code signing pages in [startOffset, endOffset) of a region in the background.
+// The caller guarantees that nothing in this range is written again before the cache is signed.
+// Partial pages at either end are left for codeSign() to hash.
+void SharedCacheBuilder::prehashCodeSignPages(const uint8_t* regionBuffer, uint64_t startOffset, uint64_t endOffset)
+{
+    uint8_t  hashType;
+    uint8_t  hashSize;
+    uint32_t digestFormat;
+    bool     agile;
+    if ( !codeSigningDigests(hashType, hashSize, digestFormat, agile) )
+        return;
+
+    const uint16_t pageSize = _archLayout->csPageSize;
+    startOffset = align(startOffset, __builtin_ctz(pageSize));
+    endOffset   = endOffset & ~((uint64_t)pageSize - 1);
+    if ( endOffset <= startOffset )
+        return;
+
+    CodeSignPrehash* prehash = new CodeSignPrehash();
+    prehash->start     = regionBuffer + startOffset;
+    prehash->pageCount = (endOffset - startOffset) / pageSize;
+    prehash->hashes.resize(prehash->pageCount * hashSize);
+    if ( agile )
+        prehash->hashes256.resize(prehash->pageCount * CS_HASH_SIZE_SHA256);
+    _codeSignPrehashes.emplace_back(prehash);
+
+    if ( _codeSignPrehashGroup == nullptr )
+        _codeSignPrehashGroup = dispatch_group_create();
+    dispatch_group_async(_codeSignPrehashGroup, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
+        dispatch_apply(prehash->pageCount, DISPATCH_APPLY_AUTO, ^(size_t i) {
+            hashCodeSignPage(digestFormat, agile, prehash->start + (i * pageSize), pageSize,
+                             &prehash->hashes[i * hashSize], agile ? &prehash->hashes256[i * CS_HASH_SIZE_SHA256] : nullptr);
+        });
+    });
+}
+
+void SharedCacheBuilder::waitForCodeSignPrehashing()
+{
+    if ( _codeSignPrehashGroup == nullptr )
+        return;
+    dispatch_group_wait(_codeSignPrehashGroup, DISPATCH_TIME_FOREVER);
+    dispatch_release(_codeSignPrehashGroup);
+    _codeSignPrehashGroup = nullptr;
+}
+
+void SharedCacheBuilder::codeSign()
+{
+    uint8_t  dscHashType;
+    uint8_t  dscHashSize;
+    uint32_t dscDigestFormat;
+    bool     agile;
+
+    if ( !codeSigningDigests(dscHashType, dscHashSize, dscDigestFormat, agile) ) {
+        _diagnostics.error("codeSigningDigestMode has unknown, unexpected value %d, bailing out.",
+                           _options.codeSigningDigestMode);
+        return;
     }
 
     std::string cacheIdentifier = "com.apple.dyld.cache.";
@@ -3415,22 +4297,49 @@ void SharedCacheBuilder::codeSign()
         for (const SlotRange& slotRange : regionSlots) {
             if ( (i >= slotRange.start) && (i < slotRange.end) ) {
                 const uint8_t* code = slotRange.buffer + ((i - slotRange.start) * pageSize);
-
-                CCDigest(dscDigestFormat, code, pageSize, hashSlot + (i * dscHashSize));
-
-                if ( agile ) {
-                    CCDigest(kCCDigestSHA256, code, pageSize, hash256Slot + (i * CS_HASH_SIZE_SHA256));
-                }
+                hashCodeSignPage(dscDigestFormat, agile, code, pageSize,
+                                 hashSlot + (i * dscHashSize), agile ? hash256Slot + (i * CS_HASH_SIZE_SHA256) : nullptr);
                 return;
             }
         }
         assert(0 && "Out of range slot");
     };
 
+    // Any pages hashed early were not written after they were hashed, so only the remaining (dirty) pages need hashing now
+    waitForCodeSignPrehashing();
+    auto findPrehash = ^(size_t i, const CodeSignPrehash*& prehash, uint64_t& pageIndex) {
+        for (const SlotRange& slotRange : regionSlots) {
+            if ( (i >= slotRange.start) && (i < slotRange.end) ) {
+                const uint8_t* code = slotRange.buffer + ((i - slotRange.start) * pageSize);
+                for (const std::unique_ptr<CodeSignPrehash>& range : _codeSignPrehashes) {
+                    if ( (code >= range->start) && (code < range->start + (range->pageCount * pageSize)) ) {
+                        prehash   = range.get();
+                        pageIndex = (code - range->start) / pageSize;
+                        return true;
+                    }
+                }
+                return false;
+            }
+        }
+        return false;
+    };
+
     // compute hashes
+    __block uint32_t prehashedPageCount = 0;
     dispatch_apply(slotCount, DISPATCH_APPLY_AUTO, ^(size_t i) {
+        const CodeSignPrehash* prehash = nullptr;
+        uint64_t               pageIndex = 0;
+        if ( findPrehash(i, prehash, pageIndex) ) {
+            memcpy(hashSlot + (i * dscHashSize), &prehash->hashes[pageIndex * dscHashSize], dscHashSize);
+            if ( agile )
+                memcpy(hash256Slot + (i * CS_HASH_SIZE_SHA256), &prehash->hashes256[pageIndex * CS_HASH_SIZE_SHA256], CS_HASH_SIZE_SHA256);
+            __atomic_fetch_add(&prehashedPageCount, 1, __ATOMIC_RELAXED);
+            return;
+        }
         codeSignPage(i);
     });
+    _codeSignPrehashes.clear();
+    _diagnostics.verbose("code signature: %u of %u pages hashed early\n", prehashedPageCount, slotCount);
 
     // Now that we have a code signature, compute a cache UUID by hashing the code signature blob
     {
@@ -3602,7 +4511,7 @@ bool SharedCacheBuilder::makeRebaseChainV2(uint8_t* pageContent, uint16_t lastLo
 
 
 template <typename P>
-void SharedCacheBuilder::addPageStartsV2(uint8_t* pageContent, const bool bitmap[], const dyld_cache_slide_info2* info,
+void SharedCacheBuilder::addPageStartsV2(uint8_t* pageContent, const uint64_t bitmap[], const dyld_cache_slide_info2* info,
                                          std::vector<uint16_t>& pageStarts, std::vector<uint16_t>& pageExtras)
 {
     typedef typename P::uint_t     pint_t;
@@ -3616,7 +4525,7 @@ void SharedCacheBuilder::addPageStartsV2(uint8_t* pageContent, const bool bitmap
     uint16_t lastLocationOffset = 0xFFFF;
     for(uint32_t i=0; i < pageSize/4; ++i) {
         unsigned offset = i*4;
-        if ( bitmap[i] ) {
+        if ( ASLR_Tracker::bitmapHas(bitmap, i) ) {
             if ( startValue == DYLD_CACHE_SLIDE_PAGE_ATTR_NO_REBASE ) {
                 // found first rebase location in page
                 startValue = i;
@@ -3653,7 +4562,7 @@ void SharedCacheBuilder::addPageStartsV2(uint8_t* pageContent, const bool bitmap
 }
 
 template <typename P>
-void SharedCacheBuilder::writeSlideInfoV2(const bool bitmapForAllDataRegions[], unsigned dataPageCountForAllDataRegions)
+void SharedCacheBuilder::writeSlideInfoV2(const uint64_t bitmapForAllDataRegions[], unsigned dataPageCountForAllDataRegions)
 {
     typedef typename P::uint_t    pint_t;
     typedef typename P::E         E;
@@ -3678,12 +4587,12 @@ void SharedCacheBuilder::writeSlideInfoV2(const bool bitmapForAllDataRegions[],
         std::vector<uint16_t> pageExtras;
         pageStarts.reserve(dataPageCount);
 
-        const size_t bitmapEntriesPerPage = (sizeof(bool)*(pageSize/4));
+        const size_t bitmapEntriesPerPage = (pageSize/4)/64;
         uint8_t* pageContent = dataRegion.buffer;
         unsigned numPagesFromFirstDataRegion = (uint32_t)(dataRegion.buffer - firstDataRegionBuffer) / pageSize;
         assert((numPagesFromFirstDataRegion + dataPageCount) <= dataPageCountForAllDataRegions);
-        const bool* bitmapForRegion = (const bool*)bitmapForAllDataRegions + (bitmapEntriesPerPage * numPagesFromFirstDataRegion);
-        const bool* bitmapForPage = bitmapForRegion;
+        const uint64_t* bitmapForRegion = bitmapForAllDataRegions + (bitmapEntriesPerPage * numPagesFromFirstDataRegion);
+        const uint64_t* bitmapForPage = bitmapForRegion;
         for (unsigned i=0; i < dataPageCount; ++i) {
             //warning("page[%d]", i);
             addPageStartsV2<P>(pageContent, bitmapForPage, info, pageStarts, pageExtras);
@@ -3691,7 +4600,7 @@ void SharedCacheBuilder::writeSlideInfoV2(const bool bitmapForAllDataRegions[],
                 return;
             }
             pageContent += pageSize;
-            bitmapForPage += (sizeof(bool)*(pageSize/4));
+            bitmapForPage += bitmapEntriesPerPage;
         }
 
         // fill in computed info
@@ -3820,7 +4729,7 @@ bool SharedCacheBuilder::makeRebaseChainV4(uint8_t* pageContent, uint16_t lastLo
 
 
 template <typename P>
-void SharedCacheBuilder::addPageStartsV4(uint8_t* pageContent, const bool bitmap[], const dyld_cache_slide_info4* info,
+void SharedCacheBuilder::addPageStartsV4(uint8_t* pageContent, const uint64_t bitmap[], const dyld_cache_slide_info4* info,
                                          std::vector<uint16_t>& pageStarts, std::vector<uint16_t>& pageExtras)
 {
     typedef typename P::uint_t     pint_t;
@@ -3834,7 +4743,7 @@ void SharedCacheBuilder::addPageStartsV4(uint8_t* pageContent, const bool bitmap
     uint16_t lastLocationOffset = 0xFFFF;
     for(uint32_t i=0; i < pageSize/4; ++i) {
         unsigned offset = i*4;
-        if ( bitmap[i] ) {
+        if ( ASLR_Tracker::bitmapHas(bitmap, i) ) {
             if ( startValue == DYLD_CACHE_SLIDE4_PAGE_NO_REBASE ) {
                 // found first rebase location in page
                 startValue = i;
@@ -3873,7 +4782,7 @@ void SharedCacheBuilder::addPageStartsV4(uint8_t* pageContent, const bool bitmap
 
 
 template <typename P>
-void SharedCacheBuilder::writeSlideInfoV4(const bool bitmapForAllDataRegions[], unsigned dataPageCountForAllDataRegions)
+void SharedCacheBuilder::writeSlideInfoV4(const uint64_t bitmapForAllDataRegions[], unsigned dataPageCountForAllDataRegions)
 {
     typedef typename P::uint_t    pint_t;
     typedef typename P::E         E;
@@ -3897,19 +4806,19 @@ void SharedCacheBuilder::writeSlideInfoV4(const bool bitmapForAllDataRegions[],
         std::vector<uint16_t> pageStarts;
         std::vector<uint16_t> pageExtras;
         pageStarts.reserve(dataPageCount);
-        const size_t bitmapEntriesPerPage = (sizeof(bool)*(pageSize/4));
+        const size_t bitmapEntriesPerPage = (pageSize/4)/64;
         uint8_t* pageContent = dataRegion.buffer;
         unsigned numPagesFromFirstDataRegion = (uint32_t)(dataRegion.buffer - firstDataRegionBuffer) / pageSize;
         assert((numPagesFromFirstDataRegion + dataPageCount) <= dataPageCountForAllDataRegions);
-        const bool* bitmapForRegion = (const bool*)bitmapForAllDataRegions + (bitmapEntriesPerPage * numPagesFromFirstDataRegion);
-        const bool* bitmapForPage = bitmapForRegion;
+        const uint64_t* bitmapForRegion = bitmapForAllDataRegions + (bitmapEntriesPerPage * numPagesFromFirstDataRegion);
+        const uint64_t* bitmapForPage = bitmapForRegion;
         for (unsigned i=0; i < dataPageCount; ++i) {
             addPageStartsV4<P>(pageContent, bitmapForPage, info, pageStarts, pageExtras);
             if ( _diagnostics.hasError() ) {
                 return;
             }
             pageContent += pageSize;
-            bitmapForPage += (sizeof(bool)*(pageSize/4));
+            bitmapForPage += bitmapEntriesPerPage;
         }
         // fill in computed info
         info->page_starts_offset = sizeof(dyld_cache_slide_info4);
@@ -4036,13 +4945,13 @@ void SharedCacheBuilder::setPointerContentV3(dyld3::MachOLoaded::ChainedFixupPoi
     }
 }
 
-uint16_t SharedCacheBuilder::pageStartV3(uint8_t* pageContent, uint32_t pageSize, const bool bitmap[])
+uint16_t SharedCacheBuilder::pageStartV3(uint8_t* pageContent, uint32_t pageSize, const uint64_t bitmap[])
 {
     const int maxPerPage = pageSize / 4;
     uint16_t result = DYLD_CACHE_SLIDE_V3_PAGE_ATTR_NO_REBASE;
     dyld3::MachOLoaded::ChainedFixupPointerOnDisk* lastLoc = nullptr;
     for (int i=0; i < maxPerPage; ++i) {
-        if ( bitmap[i] ) {
+        if ( ASLR_Tracker::bitmapHas(bitmap, i) ) {
             if ( result == DYLD_CACHE_SLIDE_V3_PAGE_ATTR_NO_REBASE ) {
                 // found first rebase location in page
                 result = i * 4;
@@ -4063,7 +4972,7 @@ uint16_t SharedCacheBuilder::pageStartV3(uint8_t* pageContent, uint32_t pageSize
 }
 
 
-void SharedCacheBuilder::writeSlideInfoV3(const bool bitmapForAllDataRegions[], unsigned dataPageCountForAllDataRegions)
+void SharedCacheBuilder::writeSlideInfoV3(const uint64_t bitmapForAllDataRegions[], unsigned dataPageCountForAllDataRegions)
 {
     const uint32_t  pageSize = _aslrTracker.pageSize();
     const uint8_t*  firstDataRegionBuffer = firstDataRegion()->buffer;
@@ -4081,12 +4990,12 @@ void SharedCacheBuilder::writeSlideInfoV3(const bool bitmapForAllDataRegions[],
         info->auth_value_add    = _archLayout->sharedMemoryStart;
 
         // fill in per-page starts
-        const size_t bitmapEntriesPerPage = (sizeof(bool)*(pageSize/4));
+        const size_t bitmapEntriesPerPage = (pageSize/4)/64;
         uint8_t* pageContent = dataRegion.buffer;
         unsigned numPagesFromFirstDataRegion = (uint32_t)(dataRegion.buffer - firstDataRegionBuffer) / pageSize;
         assert((numPagesFromFirstDataRegion + dataPageCount) <= dataPageCountForAllDataRegions);
-        const bool* bitmapForRegion = (const bool*)bitmapForAllDataRegions + (bitmapEntriesPerPage * numPagesFromFirstDataRegion);
-        const bool* bitmapForPage = bitmapForRegion;
+        const uint64_t* bitmapForRegion = bitmapForAllDataRegions + (bitmapEntriesPerPage * numPagesFromFirstDataRegion);
+        const uint64_t* bitmapForPage = bitmapForRegion;
         //for (unsigned i=0; i < dataPageCount; ++i) {
         dispatch_apply(dataPageCount, DISPATCH_APPLY_AUTO, ^(size_t i) {
             info->page_starts[i] = pageStartV3(pageContent + (i * pageSize), pageSize, bitmapForPage + (i * bitmapEntriesPerPage));
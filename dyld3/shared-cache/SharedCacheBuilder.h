@@ -33,6 +33,7 @@
 class SharedCacheBuilder : public CacheBuilder {
 public:
     SharedCacheBuilder(const DyldSharedCache::CreateOptions& options, const dyld3::closure::FileSystem& fileSystem);
+    ~SharedCacheBuilder();
 
     void                                        build(std::vector<InputFile>& inputFiles,
                                                       std::vector<DyldSharedCache::FileAlias>& aliases);
@@ -50,6 +51,7 @@ public:
     void                                        writeMapFile(const std::string& path);
     std::string                                 getMapFileBuffer() const;
     std::string                                 getMapFileJSONBuffer(const std::string& cacheDisposition) const;
+    std::string                                 getTelemetryJSONBuffer() const;
     void                                        deleteBuffer();
     const std::set<std::string>                 warnings();
     const std::set<const dyld3::MachOAnalyzer*> evictions();
@@ -67,18 +69,18 @@ private:
 
     void        writeSlideInfoV1();
 
-    template <typename P> void writeSlideInfoV2(const bool bitmap[], unsigned dataPageCount);
+    template <typename P> void writeSlideInfoV2(const uint64_t bitmap[], unsigned dataPageCount);
     template <typename P> bool makeRebaseChainV2(uint8_t* pageContent, uint16_t lastLocationOffset, uint16_t newOffset, const struct dyld_cache_slide_info2* info);
-    template <typename P> void addPageStartsV2(uint8_t* pageContent, const bool bitmap[], const struct dyld_cache_slide_info2* info,
+    template <typename P> void addPageStartsV2(uint8_t* pageContent, const uint64_t bitmap[], const struct dyld_cache_slide_info2* info,
                                              std::vector<uint16_t>& pageStarts, std::vector<uint16_t>& pageExtras);
 
-    void        writeSlideInfoV3(const bool bitmap[], unsigned dataPageCoun);
-    uint16_t    pageStartV3(uint8_t* pageContent, uint32_t pageSize, const bool bitmap[]);
+    void        writeSlideInfoV3(const uint64_t bitmap[], unsigned dataPageCoun);
+    uint16_t    pageStartV3(uint8_t* pageContent, uint32_t pageSize, const uint64_t bitmap[]);
     void        setPointerContentV3(dyld3::MachOLoaded::ChainedFixupPointerOnDisk* loc, uint64_t targetVMAddr, size_t next);
 
-    template <typename P> void writeSlideInfoV4(const bool bitmap[], unsigned dataPageCount);
+    template <typename P> void writeSlideInfoV4(const uint64_t bitmap[], unsigned dataPageCount);
     template <typename P> bool makeRebaseChainV4(uint8_t* pageContent, uint16_t lastLocationOffset, uint16_t newOffset, const struct dyld_cache_slide_info4* info);
-    template <typename P> void addPageStartsV4(uint8_t* pageContent, const bool bitmap[], const struct dyld_cache_slide_info4* info,
+    template <typename P> void addPageStartsV4(uint8_t* pageContent, const uint64_t bitmap[], const struct dyld_cache_slide_info4* info,
                                              std::vector<uint16_t>& pageStarts, std::vector<uint16_t>& pageExtras);
 
     struct ArchLayout
@@ -103,10 +105,11 @@ private:
     void        processSelectorStrings(const std::vector<LoadedMachO>& executables, IMPCaches::HoleMap& selectorsHoleMap);
     void        parseCoalescableSegments(IMPCaches::SelectorMap& selectorMap, IMPCaches::HoleMap& selectorsHoleMap);
     void        assignSegmentAddresses();
-    void        assignMultipleDataSegmentAddresses(uint64_t& addr, uint32_t totalProtocolDefCount);
+    void        assignMultipleDataSegmentAddresses(uint64_t& addr, uint32_t totalProtocolDefCount, uint32_t categoryAttachReadWriteSize);
 
     uint64_t    dataRegionsTotalSize() const;
     uint64_t    dataRegionsSizeInUse() const;
+    uint64_t    cacheSizeInUse() const;
 
     // Return the earliest data region by address
     const Region* firstDataRegion() const;
@@ -117,7 +120,23 @@ private:
     uint64_t    cacheOverflowAmount();
     size_t      evictLeafDylibs(uint64_t reductionTarget, std::vector<const LoadedMachO*>& overflowDylibs);
 
+    // stable dylib order from CreateOptions::previousCachePath
+    void        mapPreviousCache();
+    void        addPreviousCacheOrdering(const std::vector<LoadedMachO>& dylibs, std::unordered_map<std::string, unsigned>& sortOrder) const;
+
+    // profile guided layout from CreateOptions::pageTouchProfile
+    void        addPageTouchProfileOrdering(std::unordered_map<std::string, unsigned>& sortOrder);
+
     void        fipsSign();
+    bool        codeSigningDigests(uint8_t& hashType, uint8_t& hashSize, uint32_t& digestFormat, bool& agile);
+    void        prehashCodeSignPages(const uint8_t* regionBuffer, uint64_t startOffset, uint64_t endOffset);
+    void        waitForCodeSignPrehashing();
+    void        beginStreamingFile(const std::string& path);
+    void        streamToFile(const uint8_t* regionBuffer, uint64_t startOffset, uint64_t endOffset, uint64_t regionFileOffset);
+    bool        finishStreamingFile();
+    void        abortStreamingFile();
+    int         openTempCacheFile(const std::string& path, std::string& tempPath);
+    void        installTempCacheFile(int fd, const std::string& tempPath, const std::string& path, bool fullyWritten);
     void        codeSign();
     uint64_t    pathHash(const char* path);
     void        writeCacheHeader();
@@ -126,14 +145,23 @@ private:
     void        buildImageArray(std::vector<DyldSharedCache::FileAlias>& aliases);
     void        addOtherImageArray(const std::vector<LoadedMachO>&, std::vector<const LoadedMachO*>& overflowDylibs);
     void        addClosures(const std::vector<LoadedMachO>&);
+    std::string closureMemoCacheKey() const;
+    std::string closureMemoPath(const std::string& cacheKey, const LoadedMachO& executable, bool issetuid) const;
+    const dyld3::closure::LaunchClosure* loadMemoizedClosure(const std::string& memoPath) const;
+    bool        memoizedClosureIsCurrent(const dyld3::closure::LaunchClosure* closure) const;
+    void        saveMemoizedClosure(const std::string& memoPath, const dyld3::closure::LaunchClosure* closure) const;
     void        markPaddingInaccessible();
+    void        commitRegionBuffers();
+    void        releaseLinkeditStaging();
+    uint64_t    committedBufferSize() const;
 
     bool        writeCache(void (^cacheSizeCallback)(uint64_t size), bool (^copyCallback)(const uint8_t* src, uint64_t size, uint64_t dstOffset));
 
     // implemented in OptimizerObjC.cpp
     void        optimizeObjC(bool impCachesSuccess, const std::vector<const IMPCaches::Selector*> & inlinedSelectors);
-    uint32_t    computeReadOnlyObjC(uint32_t selRefCount, uint32_t classDefCount, uint32_t protocolDefCount);
-    uint32_t    computeReadWriteObjC(uint32_t imageCount, uint32_t protocolDefCount);
+    uint32_t    computeReadOnlyObjC(uint32_t selRefCount, uint32_t classDefCount, uint32_t protocolDefCount, uint32_t categoryAttachSize);
+    uint32_t    computeReadWriteObjC(uint32_t imageCount, uint32_t protocolDefCount, uint32_t categoryAttachSize);
+    void        computeCategoryAttachSizes(uint32_t& readOnlySize, uint32_t& readWriteSize);
 
     void        emitContantObjects();
 
@@ -141,6 +169,21 @@ private:
 
     typedef uint64_t                                                CacheOffset;
 
+    // Page hashes computed in the background for a range of the cache which will not be written again.
+    // codeSign() copies these instead of rehashing the pages.
+    struct CodeSignPrehash {
+        const uint8_t*          start       = nullptr;
+        uint64_t                pageCount   = 0;
+        std::vector<uint8_t>    hashes;
+        std::vector<uint8_t>    hashes256;
+    };
+
+    // A range of the output file which was already written by streamToFile()
+    struct StreamedRange {
+        uint64_t                fileOffset  = 0;
+        uint64_t                size        = 0;
+    };
+
     std::vector<DylibInfo>                      _sortedDylibs;
     std::vector<Region>                         _dataRegions; // 1 or more __DATA regions.
     UnmappedRegion                              _codeSignatureRegion;
@@ -166,6 +209,17 @@ private:
     std::unordered_map<CacheOffset, std::vector<dyld_cache_patchable_location>> _exportsToUses;
     std::unordered_map<CacheOffset, std::string>                                _exportsToName;
     IMPCaches::IMPCachesBuilder* _impCachesBuilder;
+    const DyldSharedCache*                      _previousCache                          = nullptr;
+    uint64_t                                    _previousCacheVMSize                    = 0;
+    std::vector<std::unique_ptr<CodeSignPrehash>> _codeSignPrehashes;
+    dispatch_group_t                            _codeSignPrehashGroup                   = nullptr;
+    int                                         _streamFd                               = -1;
+    std::string                                 _streamPath;
+    std::string                                 _streamTempPath;
+    dispatch_queue_t                            _streamQueue                            = nullptr;
+    dispatch_group_t                            _streamGroup                            = nullptr;
+    bool                                        _streamFailed                           = false;
+    std::vector<StreamedRange>                  _streamedRanges;
 };
 
 
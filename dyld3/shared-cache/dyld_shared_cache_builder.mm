@@ -284,6 +284,8 @@ static FileFlags stringToFileFlags(Diagnostics& diags, const std::string& str) {
         return DirtyDataOrderFile;
     if (str == "ObjCOptimizationsFile")
         return ObjCOptimizationsFile;
+    if (str == "PageTouchProfileFile")
+        return PageTouchProfileFile;
     return NoFlags;
 }
 
@@ -308,6 +310,8 @@ struct SharedCacheBuilderOptions {
     std::list<std::string>      baselineCacheMapPaths;
     bool                        baselineCopyRoots = false;
     bool                        emitMapFiles = false;
+    bool                        emitTelemetry = false;
+    std::string                 closureMemoDir;
     std::set<std::string>       cmdLineArchs;
 };
 
@@ -406,6 +410,34 @@ static ssize_t write64(int fildes, const void *buf, size_t nbyte)
     return total;
 }
 
+// Writes a map or telemetry file with the same permissions as the caches
+static bool writeJSONFile(const std::string& path, std::string_view jsonData) {
+    std::string pathTemplate = path + "-XXXXXX";
+    size_t templateLen = strlen(pathTemplate.c_str())+2;
+    char pathTemplateSpace[templateLen];
+    strlcpy(pathTemplateSpace, pathTemplate.c_str(), templateLen);
+    int fd = mkstemp(pathTemplateSpace);
+    if ( fd == -1 ) {
+        fprintf(stderr, "ERROR: could not open file %s\n", pathTemplateSpace);
+        return false;
+    }
+    ::ftruncate(fd, jsonData.size());
+    uint64_t writtenSize = write64(fd, jsonData.data(), jsonData.size());
+    if ( writtenSize == jsonData.size() ) {
+        ::fchmod(fd, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH); // mkstemp() makes file "rw-------", switch it to "rw-r--r--"
+        if ( ::rename(pathTemplateSpace, path.c_str()) == 0) {
+            ::close(fd);
+            return true;
+        }
+    }
+    else {
+        fprintf(stderr, "ERROR: could not write file %s\n", pathTemplateSpace);
+    }
+    ::close(fd);
+    ::unlink(pathTemplateSpace);
+    return false;
+}
+
 static bool writeMRMResults(bool cacheBuildSuccess, MRMSharedCacheBuilder* sharedCacheBuilder, const SharedCacheBuilderOptions& options) {
     if (!cacheBuildSuccess) {
         uint64_t errorCount = 0;
@@ -506,32 +538,8 @@ static bool writeMRMResults(bool cacheBuildSuccess, MRMSharedCacheBuilder* share
                     continue;
 
                 const std::string path = options.dstRoot + "/System/Library/dyld/" + result.loggingPrefix + ".json";
-                std::string pathTemplate = path + "-XXXXXX";
-                size_t templateLen = strlen(pathTemplate.c_str())+2;
-                char pathTemplateSpace[templateLen];
-                strlcpy(pathTemplateSpace, pathTemplate.c_str(), templateLen);
-                int fd = mkstemp(pathTemplateSpace);
-                if ( fd != -1 ) {
-                    ::ftruncate(fd, jsonData.size());
-                    uint64_t writtenSize = write64(fd, jsonData.data(), jsonData.size());
-                    if ( writtenSize == jsonData.size() ) {
-                        ::fchmod(fd, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH); // mkstemp() makes file "rw-------", switch it to "rw-r--r--"
-                        if ( ::rename(pathTemplateSpace, path.c_str()) == 0) {
-                            ::close(fd);
-                            continue; // success
-                        }
-                    }
-                    else {
-                        fprintf(stderr, "ERROR: could not write file %s\n", pathTemplateSpace);
-                        cacheBuildSuccess = false;
-                    }
-                    ::close(fd);
-                    ::unlink(pathTemplateSpace);
-                }
-                else {
-                    fprintf(stderr, "ERROR: could not open file %s\n", pathTemplateSpace);
+                if ( !writeJSONFile(path, jsonData) )
                     cacheBuildSuccess = false;
-                }
             }
         }
 
@@ -541,6 +549,30 @@ static bool writeMRMResults(bool cacheBuildSuccess, MRMSharedCacheBuilder* share
         }
     }
 
+    // Emit the build telemetry next to the map files
+    if ( options.emitTelemetry && !options.dstRoot.empty() ) {
+        uint64_t cacheResultCount = 0;
+        if (const CacheResult* const* cacheResults = getCacheResults(sharedCacheBuilder, &cacheResultCount)) {
+            for (uint64_t i = 0, e = cacheResultCount; i != e; ++i) {
+                const CacheResult& result = *(cacheResults[i]);
+                if ( (result.version < 2) || (result.telemetryJSON == nullptr) )
+                    continue;
+                std::string_view jsonData = result.telemetryJSON;
+                if ( jsonData.empty() )
+                    continue;
+
+                const std::string path = options.dstRoot + "/System/Library/dyld/" + result.loggingPrefix + ".telemetry.json";
+                if ( !writeJSONFile(path, jsonData) )
+                    cacheBuildSuccess = false;
+            }
+        }
+
+        // Give up if we couldn't write the telemetry
+        if (!cacheBuildSuccess) {
+            return false;
+        }
+    }
+
     return true;
 }
 
@@ -609,7 +641,7 @@ static void buildCacheFromJSONManifest(Diagnostics& diags, const SharedCacheBuil
     }
 
     // Parse the rest of the options node.
-    BuildOptions_v2 buildOptions;
+    BuildOptions_v3 buildOptions;
     buildOptions.version                            = dyld3::json::parseRequiredInt(diags, dyld3::json::getRequiredValue(diags, buildOptionsNode, "version"));
     buildOptions.updateName                         = dyld3::json::parseRequiredString(diags, dyld3::json::getRequiredValue(diags, buildOptionsNode, "updateName")).c_str();
     buildOptions.deviceName                         = dyld3::json::parseRequiredString(diags, dyld3::json::getRequiredValue(diags, buildOptionsNode, "deviceName")).c_str();
@@ -626,6 +658,13 @@ static void buildCacheFromJSONManifest(Diagnostics& diags, const SharedCacheBuil
         buildOptions.optimizeForSize                = dyld3::json::parseRequiredBool(diags, dyld3::json::getRequiredValue(diags, buildOptionsNode, "optimizeForSize"));
     }
 
+    // closureMemoDir was added in version 3, and comes from the command line instead of the manifest
+    buildOptions.closureMemoDir = nullptr;
+    if ( !options.closureMemoDir.empty() ) {
+        buildOptions.version        = std::max<uint64_t>(buildOptions.version, 3);
+        buildOptions.closureMemoDir = options.closureMemoDir.c_str();
+    }
+
     if (diags.hasError())
         return;
 
@@ -722,6 +761,7 @@ static void buildCacheFromJSONManifest(Diagnostics& diags, const SharedCacheBuil
             case DylibOrderFile:
             case DirtyDataOrderFile:
             case ObjCOptimizationsFile:
+            case PageTouchProfileFile:
                 buildPath = "." + buildPath;
                 break;
         }
@@ -972,6 +1012,10 @@ int main(int argc, const char* argv[])
                     std::string path = realPath(argv[++i]);
                     if ( !path.empty() )
                         options.baselineCacheMapPaths.push_back(path);
+                } else if (strcmp(arg, "-emit_telemetry") == 0) {
+                    options.emitTelemetry = true;
+                } else if (strcmp(arg, "-closure_memo_dir") == 0) {
+                    options.closureMemoDir = argv[++i];
                 } else if (strcmp(arg, "-arch") == 0) {
                     if ( ++i < argc ) {
                         options.cmdLineArchs.insert(argv[i]);
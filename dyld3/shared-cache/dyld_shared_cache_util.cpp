@@ -131,7 +131,8 @@ enum Mode {
     modeObjCSelectors,
     modeExtract,
     modePatchTable,
-    modeListDylibsWithSection
+    modeListDylibsWithSection,
+    modeReplayProfile
 };
 
 struct Options {
@@ -140,6 +141,7 @@ struct Options {
     const char*     extractionDir;
     const char*     segmentName;
     const char*     sectionName;
+    const char*     profilePath;
     bool            printUUIDs;
     bool            printVMAddrs;
     bool            printDylibVersions;
@@ -148,7 +150,7 @@ struct Options {
 
 
 void usage() {
-    fprintf(stderr, "Usage: dyld_shared_cache_util -list [ -uuid ] [-vmaddr] | -dependents <dylib-path> [ -versions ] | -linkedit | -map | -slide_info | -verbose_slide_info | -info | -extract <dylib-dir>  [ shared-cache-file ] \n");
+    fprintf(stderr, "Usage: dyld_shared_cache_util -list [ -uuid ] [-vmaddr] | -dependents <dylib-path> [ -versions ] | -linkedit | -map | -slide_info | -verbose_slide_info | -info | -extract <dylib-dir> | -replay_profile <page-touch-profile>  [ shared-cache-file ] \n");
 }
 
 static void checkMode(Mode mode) {
@@ -385,6 +387,71 @@ static void findImageAndSegment(const DyldSharedCache* dyldCache, const std::vec
     *found = *lowIt;
 }
 
+// Counts the distinct cache pages the launches recorded in a page touch profile would fault in with this cache's layout
+static int replayPageTouchProfile(const DyldSharedCache* dyldCache, const char* profilePath)
+{
+    int fd = ::open(profilePath, O_RDONLY);
+    if ( fd < 0 ) {
+        fprintf(stderr, "Error: failed to open page touch profile at %s\n", profilePath);
+        return 1;
+    }
+    struct stat statbuf;
+    if ( ::fstat(fd, &statbuf) != 0 ) {
+        fprintf(stderr, "Error: stat failed for page touch profile at %s\n", profilePath);
+        ::close(fd);
+        return 1;
+    }
+    std::string content((size_t)statbuf.st_size, '\0');
+    if ( ::pread(fd, &content[0], content.size(), 0) != (ssize_t)content.size() ) {
+        fprintf(stderr, "Error: failed to read page touch profile at %s\n", profilePath);
+        ::close(fd);
+        return 1;
+    }
+    ::close(fd);
+
+    Diagnostics diag;
+    std::vector<DyldSharedCache::PageTouch> profile = DyldSharedCache::parsePageTouchProfile(diag, content.data(), content.size());
+    if ( diag.hasError() ) {
+        fprintf(stderr, "Error: %s\n", diag.errorMessage().c_str());
+        return 1;
+    }
+
+    // Find where each dylib's segments are in this cache
+    struct SegmentRange {
+        uint64_t    vmAddr;
+        uint64_t    vmSize;
+    };
+    __block std::map<std::pair<std::string, std::string>, SegmentRange> segmentRanges;
+    dyldCache->forEachImage(^(const mach_header* mh, const char* installName) {
+        const dyld3::MachOAnalyzer* ma = (const dyld3::MachOAnalyzer*)mh;
+        ma->forEachSegment(^(const dyld3::MachOAnalyzer::SegmentInfo& info, bool& stop) {
+            segmentRanges[{ installName, info.segName }] = { info.vmAddr, info.vmSize };
+        });
+    });
+
+    const uint64_t pageSize = (strncmp(dyldCache->archName(), "arm64", 5) == 0) ? 0x4000 : 0x1000;
+    std::set<uint64_t>                          touchedPages;
+    std::map<std::string, std::set<uint64_t>>   touchedPagesBySegment;
+    uint64_t unresolvedCount = 0;
+    for (const DyldSharedCache::PageTouch& touch : profile) {
+        auto pos = segmentRanges.find({ touch.installName, touch.segmentName });
+        if ( (pos == segmentRanges.end()) || (touch.pageOffset >= pos->second.vmSize) ) {
+            fprintf(stderr, "Warning: %s %s+0x%llX is not in the cache\n", touch.installName.c_str(), touch.segmentName.c_str(), touch.pageOffset);
+            ++unresolvedCount;
+            continue;
+        }
+        uint64_t page = (pos->second.vmAddr + touch.pageOffset) / pageSize;
+        touchedPages.insert(page);
+        touchedPagesBySegment[touch.segmentName].insert(page);
+    }
+
+    printf("pages touched: %lu (%lu byte pages)\n", touchedPages.size(), (unsigned long)pageSize);
+    for (const auto& segmentAndPages : touchedPagesBySegment)
+        printf("  %-16s %lu\n", segmentAndPages.first.c_str(), segmentAndPages.second.size());
+    printf("profile entries: %lu, unresolved: %llu\n", profile.size(), unresolvedCount);
+    return 0;
+}
+
 
 int main (int argc, const char* argv[]) {
 
@@ -398,6 +465,7 @@ int main (int argc, const char* argv[]) {
     options.printInodes = false;
     options.dependentsOfPath = NULL;
     options.extractionDir = NULL;
+    options.profilePath = NULL;
 
     bool printStrings = false;
     bool printExports = false;
@@ -516,6 +584,16 @@ int main (int argc, const char* argv[]) {
             else if (strcmp(opt, "-patch_table") == 0) {
                 options.mode = modePatchTable;
             }
+            else if (strcmp(opt, "-replay_profile") == 0) {
+                checkMode(options.mode);
+                options.mode = modeReplayProfile;
+                options.profilePath = argv[++i];
+                if ( i >= argc ) {
+                    fprintf(stderr, "Error: option -replay_profile requires a page touch profile argument\n");
+                    usage();
+                    exit(1);
+                }
+            }
             else if (strcmp(opt, "-list_dylibs_with_section") == 0) {
                 options.mode = modeListDylibsWithSection;
                 options.segmentName = argv[++i];
@@ -1400,6 +1478,9 @@ int main (int argc, const char* argv[]) {
     else if ( options.mode == modeExtract ) {
         return dyld_shared_cache_extract_dylibs(sharedCachePath, options.extractionDir);
     }
+    else if ( options.mode == modeReplayProfile ) {
+        return replayPageTouchProfile(dyldCache, options.profilePath);
+    }
     else if ( options.mode == modeObjCImpCaches ) {
         if (sharedCachePath == nullptr) {
             fprintf(stderr, "Cannot emit imp caches with live cache.  Run again with the path to the cache file\n");
@@ -1786,6 +1867,7 @@ int main (int argc, const char* argv[]) {
             case modeObjCClasses:
             case modeObjCSelectors:
             case modeExtract:
+            case modeReplayProfile:
                 break;
         }
     }
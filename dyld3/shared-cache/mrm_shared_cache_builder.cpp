@@ -35,10 +35,10 @@
 
 
 static const uint64_t kMinBuildVersion = 1; //The minimum version BuildOptions struct we can support
-static const uint64_t kMaxBuildVersion = 2; //The maximum version BuildOptions struct we can support
+static const uint64_t kMaxBuildVersion = 3; //The maximum version BuildOptions struct we can support
 
 static const uint32_t MajorVersion = 1;
-static const uint32_t MinorVersion = 2;
+static const uint32_t MinorVersion = 3;
 
 namespace dyld3 {
 namespace closure {
@@ -205,6 +205,7 @@ struct BuildInstance {
     uint8_t*                                        cacheData       = nullptr;
     uint64_t                                        cacheSize       = 0;
     std::string                                     jsonMap;
+    std::string                                     telemetryJSON;
     std::string                                     macOSMap;       // For compatibility with update_dyld_shared_cache's .map file
     std::string                                     macOSMapPath;   // Owns the string for the path
     std::string                                     cdHash;         // Owns the data for the cdHash
@@ -233,6 +234,7 @@ struct MRMSharedCacheBuilder {
 
     std::string dylibOrderFileData;
     std::string dirtyDataOrderFileData;
+    std::string pageTouchProfileFileData;
     void* objcOptimizationsFileData;
     size_t objcOptimizationsFileLength;
 
@@ -400,6 +402,10 @@ bool addFile(struct MRMSharedCacheBuilder* builder, const char* path, uint8_t* d
                 builder->objcOptimizationsFileLength = size;
                 success = true;
                 return;
+            case PageTouchProfileFile:
+                builder->pageTouchProfileFileData = std::string((char*)data, size);
+                success = true;
+                return;
             default:
                 builder->error("unknown file flags value");
                 break;
@@ -482,6 +488,15 @@ static bool optimizeDyldDlopens(const BuildOptions_v1* options) {
     return !v2->optimizeForSize;
 }
 
+static std::string closureMemoDir(const BuildOptions_v1* options) {
+    // Only newer clients can give us a directory to memoize launch closures in
+    if ( options->version < 3 )
+        return "";
+
+    const BuildOptions_v3* v3 = (const BuildOptions_v3*)options;
+    return (v3->closureMemoDir != nullptr) ? v3->closureMemoDir : "";
+}
+
 static DyldSharedCache::CodeSigningDigestMode platformCodeSigningDigestMode(Platform platform) {
     switch (platform) {
         case Platform::unknown:
@@ -578,12 +593,21 @@ bool runSharedCacheBuilder(struct MRMSharedCacheBuilder* builder) {
                 case FileFlags::DylibOrderFile:
                 case FileFlags::DirtyDataOrderFile:
                 case FileFlags::ObjCOptimizationsFile:
+                case FileFlags::PageTouchProfileFile:
                     builder->error("Order files should not be in the file system");
                     return;
             }
             inputFiles.emplace_back((SharedCacheBuilder::InputFile){ path, state });
         });
 
+        Diagnostics profileDiag;
+        __block std::vector<DyldSharedCache::PageTouch> pageTouchProfile;
+        pageTouchProfile = DyldSharedCache::parsePageTouchProfile(profileDiag, builder->pageTouchProfileFileData.data(), builder->pageTouchProfileFileData.size());
+        if ( profileDiag.hasError() ) {
+            builder->error("%s", profileDiag.errorMessage().c_str());
+            return;
+        }
+
         auto addCacheConfiguration = ^(bool isOptimized) {
             for (uint64_t i = 0; i != builder->options->numArchs; ++i) {
                 // HACK: Skip i386 for macOS
@@ -602,6 +626,7 @@ bool runSharedCacheBuilder(struct MRMSharedCacheBuilder* builder) {
                 options->optimizeStubs = isOptimized;
                 options->optimizeDyldDlopens = optimizeDyldDlopens(builder->options);
                 options->optimizeDyldLaunches = true;
+                options->closureMemoDir = closureMemoDir(builder->options);
                 options->codeSigningDigestMode = platformCodeSigningDigestMode(builder->options->platform);
                 options->dylibsRemovedDuringMastering = true;
                 options->inodesAreSameAsRuntime = false;
@@ -614,6 +639,7 @@ bool runSharedCacheBuilder(struct MRMSharedCacheBuilder* builder) {
                 options->dylibOrdering = parseOrderFile(builder->dylibOrderFileData);
                 options->dirtyDataSegmentOrdering = parseOrderFile(builder->dirtyDataOrderFileData);
                 options->objcOptimizations = parseObjcOptimizationsFile(diag, builder->objcOptimizationsFileData, builder->objcOptimizationsFileLength);
+                options->pageTouchProfile = pageTouchProfile;
 
                 auto cacheBuilder = std::make_unique<SharedCacheBuilder>(*options.get(), builder->fileSystem);
                 builder->builders.emplace_back((BuildInstance) { std::move(options), std::move(cacheBuilder), inputFiles });
@@ -668,6 +694,7 @@ bool runSharedCacheBuilder(struct MRMSharedCacheBuilder* builder) {
             if (cacheBuilder->errorMessage().empty()) {
                 cacheBuilder->writeBuffer(buildInstance.cacheData, buildInstance.cacheSize);
                 buildInstance.jsonMap = cacheBuilder->getMapFileJSONBuffer(builder->options->deviceName);
+                buildInstance.telemetryJSON = cacheBuilder->getTelemetryJSONBuffer();
                 if ( buildInstance.options->platform == dyld3::Platform::macOS ) {
                     // For compatibility with update_dyld_shared_cache, put a .map file next to the shared cache
                     buildInstance.macOSMap = cacheBuilder->getMapFileBuffer();
@@ -705,7 +732,7 @@ bool runSharedCacheBuilder(struct MRMSharedCacheBuilder* builder) {
         // First push file results for each of the shared caches we built
         for (auto& buildInstance : builder->builders) {
             CacheResult cacheBuildResult;
-            cacheBuildResult.version                = 1;
+            cacheBuildResult.version                = 2;
             cacheBuildResult.loggingPrefix          = buildInstance.options->loggingPrefix.c_str();
             cacheBuildResult.deviceConfiguration    = buildInstance.options->loggingPrefix.c_str();
             cacheBuildResult.warnings               = buildInstance.warnings.empty() ? nullptr : buildInstance.warnings.data();
@@ -714,6 +741,7 @@ bool runSharedCacheBuilder(struct MRMSharedCacheBuilder* builder) {
             cacheBuildResult.numErrors              = buildInstance.errors.size();
             cacheBuildResult.uuidString             = buildInstance.uuid.c_str();
             cacheBuildResult.mapJSON                = buildInstance.jsonMap.c_str();
+            cacheBuildResult.telemetryJSON          = buildInstance.telemetryJSON.c_str();
 
             builder->cacheResultStorage.emplace_back(cacheBuildResult);
 
@@ -68,6 +68,7 @@ enum FileFlags
     DylibOrderFile                              = 100,
     DirtyDataOrderFile                          = 101,
     ObjCOptimizationsFile                       = 102,
+    PageTouchProfileFile                        = 103,
 };
 
 struct BuildOptions_v1
@@ -99,6 +100,24 @@ struct BuildOptions_v2
     bool                                        optimizeForSize;
 };
 
+// This is available when getVersion() returns 1.3 or higher
+struct BuildOptions_v3
+{
+    uint64_t                                    version;                        // Future proofing, set to 3
+    const char *                                updateName;                     // BuildTrain+UpdateNumber
+    const char *                                deviceName;
+    enum Disposition                            disposition;                    // Internal, Customer, etc.
+    enum Platform                               platform;                       // Enum: unknown, macOS, iOS, ...
+    const char **                               archs;
+    uint64_t                                    numArchs;
+    bool                                        verboseDiagnostics;
+    bool                                        isLocallyBuiltCache;
+    // Added in v2
+    bool                                        optimizeForSize;
+    // Added in v3
+    const char *                                closureMemoDir;                 // Local directory to reuse launch closures from, or NULL
+};
+
 enum FileBehavior
 {
     AddFile                                     = 0,        // New file: uid, gid, mode, data, cdhash fields must be set
@@ -121,7 +140,7 @@ struct FileResult
 
 struct CacheResult
 {
-    uint64_t                                    version;            // Future proofing, set to 1
+    uint64_t                                    version;            // Future proofing, set to 2
     const char*                                 loggingPrefix;      // needed?
     const char*                                 deviceConfiguration;
     const char **                               warnings;           // should this be per-result?
@@ -130,6 +149,8 @@ struct CacheResult
     uint64_t                                    numErrors;
     const char*                                 uuidString;
     const char*                                 mapJSON;
+    // Added in version 2
+    const char*                                 telemetryJSON;      // Time, memory and counters for each phase of the build
 };
 
 struct MRMSharedCacheBuilder;
@@ -682,6 +682,8 @@ int main(int argc, const char* argv[], const char* envp[])
         options.evictLeafDylibsOnOverflow    = true;
         options.dylibOrdering                = parseOrderFile(dylibOrderFileContent);
         options.dirtyDataSegmentOrdering     = parseOrderFile(dirtyDataOrderFileContent);
+        options.previousCachePath            = force ? "" : outFile;
+        options.streamOutputFile             = true;
         DyldSharedCache::CreateResults results = DyldSharedCache::create(options, fileSystem, fileSet.dylibsForCache, fileSet.otherDylibsAndBundles, fileSet.mainExecutables);
         
         // print any warnings
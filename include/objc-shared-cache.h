@@ -104,6 +104,7 @@ Source is http://burtleburtle.net/bob/c/perfect.c
 
 #define SELOPT_DEBUG 0
 
+#define S16(x) x = little_endian ? OSSwapHostToLittleInt16(x) : OSSwapHostToBigInt16(x)
 #define S32(x) x = little_endian ? OSSwapHostToLittleInt32(x) : OSSwapHostToBigInt32(x)
 #define S64(x) x = little_endian ? OSSwapHostToLittleInt64(x) : OSSwapHostToBigInt64(x)
 
@@ -112,6 +113,12 @@ namespace objc_opt {
 typedef int32_t objc_stringhash_offset_t;
 typedef uint8_t objc_stringhash_check_t;
 
+// Values for objc_stringhash_t::hashKind
+enum : uint32_t {
+    JenkinsHash      = 0,   // hash is (val>>shift) ^ scramble[tab[val&mask]]
+    DisplacementHash = 1    // hash is a displaced slot in the key's partition (VERSION 16 and later)
+};
+
 static uint64_t lookup8( uint8_t *k, size_t length, uint64_t level);
 
 #if defined(SELOPT_WRITE) || defined(CLOSURE_SELOPT_WRITE)
@@ -133,6 +140,23 @@ struct __attribute__((packed)) perfect_hash {
     ~perfect_hash() { }
 };
 
+#ifdef SELOPT_WRITE
+
+// Displacement hash code is at the end of this file.
+
+struct displacement_hash {
+    uint32_t capacity;
+    uint32_t occupied;
+    uint32_t partitions;
+    uint32_t buckets;   // per partition
+    uint64_t salt;
+
+    dyld3::OverflowSafeArray<uint32_t> partitionBases; // count == partitions+1
+    dyld3::OverflowSafeArray<uint16_t> displacements;  // count == partitions*buckets
+};
+
+#endif // defined(SELOPT_WRITE)
+
 struct eqstr {
     bool operator()(const char* s1, const char* s2) const {
         return strcmp(s1, s2) == 0;
@@ -163,6 +187,7 @@ typedef std::unordered_multimap<const char *, std::pair<uint64_t, uint64_t>, has
 typedef std::unordered_multimap<const char *, std::pair<uint64_t, uint64_t>, hashstr, eqstr> class_map;
 
 static void make_perfect(const string_map& strings, perfect_hash& phash);
+static void make_displacement_hash(const string_map& strings, displacement_hash& dhash);
 
 #endif // defined(SELOPT_WRITE)
 
@@ -175,8 +200,8 @@ struct __attribute__((packed)) objc_stringhash_t {
     uint32_t occupied;
     uint32_t shift;
     uint32_t mask;
-    uint32_t unused1;  // was zero
-    uint32_t unused2;  // alignment pad
+    uint32_t hashKind;    // JenkinsHash (always zero before VERSION 16) or DisplacementHash
+    uint32_t partitions;  // DisplacementHash only, otherwise alignment pad
     uint64_t salt;
 
     uint32_t scramble[256];
@@ -184,15 +209,76 @@ struct __attribute__((packed)) objc_stringhash_t {
     // uint8_t checkbytes[capacity];  /* check byte for each string */
     // int32_t offsets[capacity];     /* offsets from &capacity to cstrings */
 
-    objc_stringhash_check_t *checkbytes() { return (objc_stringhash_check_t *)&tab[mask+1]; }
-    const objc_stringhash_check_t *checkbytes() const { return (const objc_stringhash_check_t *)&tab[mask+1]; }
+    // DisplacementHash tables leave shift and scramble zero, and tab instead holds
+    // uint32_t partitionBases[partitions+1];        /* first slot of each partition */
+    // uint16_t displacements[partitions*(mask+1)];  /* mask+1 buckets per partition (even, not power-of-2) */
+
+    size_t tabSize() const
+    {
+        if (hashKind == DisplacementHash) {
+            return (partitions+1) * sizeof(uint32_t) + partitions * (mask+1) * sizeof(uint16_t);
+        }
+        return mask+1;
+    }
+
+    uint32_t *partitionBases() { return (uint32_t *)&tab[0]; }
+    const uint32_t *partitionBases() const { return (const uint32_t *)&tab[0]; }
+
+    uint16_t *displacements() { return (uint16_t *)&partitionBases()[partitions+1]; }
+    const uint16_t *displacements() const { return (const uint16_t *)&partitionBases()[partitions+1]; }
+
+    objc_stringhash_check_t *checkbytes() { return (objc_stringhash_check_t *)&tab[tabSize()]; }
+    const objc_stringhash_check_t *checkbytes() const { return (const objc_stringhash_check_t *)&tab[tabSize()]; }
 
     objc_stringhash_offset_t *offsets() { return (objc_stringhash_offset_t *)&checkbytes()[capacity]; }
     const objc_stringhash_offset_t *offsets() const { return (const objc_stringhash_offset_t *)&checkbytes()[capacity]; }
 
+    // The high half of the key's hash picks its partition, and the low half its
+    // bucket in that partition.  About 60% of keys go to the first 30% of buckets,
+    // so the biggest buckets are placed while the partition is still mostly empty.
+    static uint32_t displacementPartition(uint64_t val, uint32_t partitions)
+    {
+        return (uint32_t)(((val >> 32) * partitions) >> 32);
+    }
+
+    static uint32_t displacementBucket(uint64_t val, uint32_t buckets)
+    {
+        uint32_t denseBuckets = buckets * 3 / 10;
+        uint64_t low = (uint32_t)val;
+        if ((uint8_t)(val >> 32) < 153) {
+            return (uint32_t)((low * denseBuckets) >> 32);
+        }
+        return denseBuckets + (uint32_t)((low * (buckets - denseBuckets)) >> 32);
+    }
+
+    // The bucket's displacement is mixed into the whole 64-bit hash, so keys
+    // that share a bucket move independently of each other as it changes.
+    static uint32_t displacementSlot(uint64_t val, uint16_t displacement, uint32_t slots)
+    {
+        uint64_t x = val ^ (displacement * 0x9e3779b97f4a7c15ULL);
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        x *= 0xc4ceb9fe1a85ec53ULL;
+        x ^= x >> 33;
+        return (uint32_t)(((x >> 32) * slots) >> 32);
+    }
+
+    uint32_t displacementHash(uint64_t val) const
+    {
+        const uint32_t *bases = partitionBases();
+        uint32_t partition = displacementPartition(val, partitions);
+        uint32_t bucket = partition * (mask+1) + displacementBucket(val, mask+1);
+        uint32_t base = bases[partition];
+        return base + displacementSlot(val, displacements()[bucket], bases[partition+1] - base);
+    }
+
     uint32_t hash(const char *key, size_t keylen) const
     {
         uint64_t val = lookup8((uint8_t*)key, keylen, salt);
+        if (hashKind == DisplacementHash) {
+            return displacementHash(val);
+        }
         uint32_t index = (uint32_t)(val>>shift) ^ scramble[tab[val&mask]];
         return index;
     }
@@ -252,7 +338,7 @@ struct __attribute__((packed)) objc_stringhash_t {
     size_t size() 
     {
         return sizeof(objc_stringhash_t) 
-            + mask+1 
+            + tabSize()
             + capacity * sizeof(objc_stringhash_check_t) 
             + capacity * sizeof(objc_stringhash_offset_t);
     }
@@ -263,6 +349,17 @@ struct __attribute__((packed)) objc_stringhash_t {
         for (uint32_t i = 0; i < 256; i++) {
             S32(scramble[i]);
         }
+        if (hashKind == DisplacementHash) {
+            // but partition bases and displacements are not
+            uint32_t *bases = partitionBases();
+            for (uint32_t i = 0; i < partitions+1; i++) {
+                S32(bases[i]);
+            }
+            uint16_t *d = displacements();
+            for (uint32_t i = 0; i < partitions*(mask+1); i++) {
+                S16(d[i]);
+            }
+        }
         objc_stringhash_offset_t *o = offsets();
         for (uint32_t i = 0; i < capacity; i++) {
             S32(o[i]);
@@ -272,10 +369,13 @@ struct __attribute__((packed)) objc_stringhash_t {
         S32(occupied);
         S32(shift);
         S32(mask);
+        S32(hashKind);
+        S32(partitions);
         S64(salt);
     }
 
-    const char *write(uint64_t base, size_t remaining, string_map& strings)
+    const char *write(uint64_t base, size_t remaining, string_map& strings,
+                      uint32_t kind = JenkinsHash)
     {        
         if (sizeof(objc_stringhash_t) > remaining) {
             return "selector section too small (metadata not optimized)";
@@ -286,39 +386,70 @@ struct __attribute__((packed)) objc_stringhash_t {
             return NULL;
         }
         
-        perfect_hash phash;
-        make_perfect(strings, phash);
-        if (phash.capacity == 0) {
-            return "perfect hash failed (metadata not optimized)";
-        }
+        if (kind == DisplacementHash) {
+            displacement_hash dhash;
+            make_displacement_hash(strings, dhash);
+            if (dhash.capacity == 0) {
+                return "perfect hash failed (metadata not optimized)";
+            }
 
-        // Set header
-        capacity = phash.capacity;
-        occupied = phash.occupied;
-        shift = phash.shift;
-        mask = phash.mask;
-        unused1 = 0;
-        unused2 = 0;
-        salt = phash.salt;
+            // Set header
+            capacity = dhash.capacity;
+            occupied = dhash.occupied;
+            shift = 0;
+            mask = dhash.buckets - 1;
+            hashKind = DisplacementHash;
+            partitions = dhash.partitions;
+            salt = dhash.salt;
+
+            if (size() > remaining) {
+                return "selector section too small (metadata not optimized)";
+            }
 
-        if (size() > remaining) {
-            return "selector section too small (metadata not optimized)";
-        }
-        
-        // Set hash data
-        for (uint32_t i = 0; i < 256; i++) {
-            scramble[i] = phash.scramble[i];
+            // Set hash data
+            bzero(scramble, sizeof(scramble));
+            for (uint32_t i = 0; i < dhash.partitions+1; i++) {
+                partitionBases()[i] = dhash.partitionBases[i];
+            }
+            for (uint32_t i = 0; i < dhash.partitions*dhash.buckets; i++) {
+                displacements()[i] = dhash.displacements[i];
+            }
         }
-        for (uint32_t i = 0; i < phash.mask+1; i++) {
-            tab[i] = phash.tab[i];
+        else {
+            perfect_hash phash;
+            make_perfect(strings, phash);
+            if (phash.capacity == 0) {
+                return "perfect hash failed (metadata not optimized)";
+            }
+
+            // Set header
+            capacity = phash.capacity;
+            occupied = phash.occupied;
+            shift = phash.shift;
+            mask = phash.mask;
+            hashKind = JenkinsHash;
+            partitions = 0;
+            salt = phash.salt;
+
+            if (size() > remaining) {
+                return "selector section too small (metadata not optimized)";
+            }
+
+            // Set hash data
+            for (uint32_t i = 0; i < 256; i++) {
+                scramble[i] = phash.scramble[i];
+            }
+            for (uint32_t i = 0; i < phash.mask+1; i++) {
+                tab[i] = phash.tab[i];
+            }
         }
         
         // Set offsets to 0
-        for (uint32_t i = 0; i < phash.capacity; i++) {
+        for (uint32_t i = 0; i < capacity; i++) {
             offsets()[i] = 0;
         }
         // Set checkbytes to 0
-        for (uint32_t i = 0; i < phash.capacity; i++) {
+        for (uint32_t i = 0; i < capacity; i++) {
             checkbytes()[i] = 0;
         }
         
@@ -522,10 +653,11 @@ struct objc_clsopt_t : objc_stringhash_t {
     }
     
     const char *write(uint64_t base, size_t remaining, 
-                      string_map& strings, class_map& classes, bool verbose)
+                      string_map& strings, class_map& classes, bool verbose,
+                      uint32_t kind = JenkinsHash)
     {
         const char *err;
-        err = objc_stringhash_t::write(base, remaining, strings);
+        err = objc_stringhash_t::write(base, remaining, strings, kind);
         if (err) return err;
    
         if (sizeWithoutDups() > remaining) {
@@ -655,10 +787,10 @@ struct objc_protocolopt_t : objc_stringhash_t {
 
     const char *write(uint64_t base, size_t remaining,
                       string_map& strings, legacy_protocol_map& protocols,
-                      bool verbose)
+                      bool verbose, uint32_t kind = JenkinsHash)
     {
         const char *err;
-        err = objc_stringhash_t::write(base, remaining, strings);
+        err = objc_stringhash_t::write(base, remaining, strings, kind);
         if (err) return err;
 
         if (size() > remaining) {
@@ -742,6 +874,17 @@ struct objc_clsopt_t;
 // lldb and Symbolication read these structures. Inform them of any changes.
 enum { VERSION = 15 };
 
+// A libobjc that advertises this version or later in its __objc_opt_ro section
+// can also read DisplacementHash string tables.  A cache with those tables is
+// stamped with this version, so VERSION readers don't take them for Jenkins
+// tables.  Everything else is laid out as for VERSION.
+enum { DISPLACEMENT_HASH_VERSION = 16 };
+
+static inline bool isSupportedVersion(uint32_t version)
+{
+    return (version == VERSION) || (version == DISPLACEMENT_HASH_VERSION);
+}
+
 // Values for objc_opt_t::flags
 enum : uint32_t {
     IsProduction = (1 << 0),               // never set in development cache
@@ -1589,6 +1732,227 @@ make_perfect(const string_map& strings, perfect_hash& phash)
     make_perfect(keys, phash);
 }
 
+/*
+------------------------------------------------------------------------------
+This generates a DisplacementHash, the "hash and displace" minimal perfect
+hash of Belazzougui, Botelho and Dietzfelbinger ("Hash, displace, and
+compress", ESA 2009) with the skewed buckets of Pibiri and Trani's PTHash.
+
+Each key's lookup8() value picks a partition, and a bucket within that
+partition.  Every bucket gets a 16-bit displacement, chosen so that all of its
+keys land in distinct free slots of the partition.  Buckets are placed biggest
+first, trying displacements 0, 1, 2, ... until one fits, so the result only
+depends on the keys and the salt.  Partitions never share slots, so they are
+placed in parallel.
+
+The table needs about 3.2 bits per key on top of its slots, and the slots are
+only 1% more than the keys instead of the next power of 2.  Lookup is still a
+single probe, using one partition base and one displacement.
+------------------------------------------------------------------------------
+*/
+
+#define DISPLACEMENT_KEYS_PER_BUCKET    5      /* average keys per bucket */
+#define DISPLACEMENT_KEYS_PER_PARTITION 32768  /* average keys per partition */
+#define DISPLACEMENT_RETRY_SALT         4      /* salts to try at each load */
+
+/* place every bucket of one partition, return FALSE if some bucket doesn't fit */
+static int place_partition(const ub8 *vals, ub4 nkeys, ub4 buckets, ub4 slots, ub2 *displacements)
+// const ub8 *vals;                  /* input, lookup8() of the partition's keys */
+// ub4        nkeys;                         /* input, number of keys in vals */
+// ub4        buckets;                   /* input, number of buckets in partition */
+// ub4        slots;                       /* input, number of slots in partition */
+// ub2       *displacements;            /* output, displacement for each bucket */
+{
+    dyld3::OverflowSafeArray<ub4> bucketStart;   /* bucket b has sorted[bucketStart[b]..bucketStart[b+1]-1] */
+    dyld3::OverflowSafeArray<ub4> bucketNext;
+    dyld3::OverflowSafeArray<ub8> sorted;
+    dyld3::OverflowSafeArray<ub4> sizeStart;     /* buckets of size s are order[sizeStart[s]..] */
+    dyld3::OverflowSafeArray<ub4> order;         /* buckets, biggest first */
+    dyld3::OverflowSafeArray<ub1> taken;         /* slots already used */
+    dyld3::OverflowSafeArray<ub4> trial;         /* slots of the bucket being placed */
+    ub4 i, b, maxsize;
+
+    /* sort the keys by bucket */
+    bucketStart.resize(buckets+1);
+    bucketNext.resize(buckets);
+    bzero(bucketStart.begin(), sizeof(ub4)*(buckets+1));
+    for (i = 0; i < nkeys; i++) {
+        ++bucketStart[objc_stringhash_t::displacementBucket(vals[i], buckets)+1];
+    }
+    maxsize = 0;
+    for (b = 0; b < buckets; b++) {
+        if (bucketStart[b+1] > maxsize) maxsize = bucketStart[b+1];
+        bucketStart[b+1] += bucketStart[b];
+        bucketNext[b] = bucketStart[b];
+    }
+    sorted.resize(nkeys);
+    for (i = 0; i < nkeys; i++) {
+        sorted[bucketNext[objc_stringhash_t::displacementBucket(vals[i], buckets)]++] = vals[i];
+    }
+
+    /* sort the buckets by descending size, keeping bucket order within a size */
+    sizeStart.resize(maxsize+2);
+    bzero(sizeStart.begin(), sizeof(ub4)*(maxsize+2));
+    for (b = 0; b < buckets; b++) {
+        ++sizeStart[maxsize - (bucketStart[b+1] - bucketStart[b]) + 1];
+    }
+    for (i = 0; i <= maxsize; i++) {
+        sizeStart[i+1] += sizeStart[i];
+    }
+    order.resize(buckets);
+    for (b = 0; b < buckets; b++) {
+        order[sizeStart[maxsize - (bucketStart[b+1] - bucketStart[b])]++] = b;
+    }
+
+    /* find the first displacement that puts each bucket in free slots */
+    taken.resize(slots);
+    bzero(taken.begin(), slots);
+    trial.resize(maxsize);
+    bzero(displacements, sizeof(ub2)*buckets);
+    for (i = 0; i < buckets; i++) {
+        ub4 bucket = order[i];
+        ub4 size = bucketStart[bucket+1] - bucketStart[bucket];
+        ub4 d;
+        if (size == 0) break;                   /* only empty buckets are left */
+        const ub8 *bucketVals = &sorted[bucketStart[bucket]];
+
+        for (d = 0; d <= UB2MAXVAL; d++) {
+            ub4 k, j;
+            for (k = 0; k < size; k++) {
+                ub4 slot = objc_stringhash_t::displacementSlot(bucketVals[k], (ub2)d, slots);
+                if (taken[slot]) break;
+                for (j = 0; j < k; j++) {
+                    if (trial[j] == slot) break;
+                }
+                if (j < k) break;
+                trial[k] = slot;
+            }
+            if (k == size) break;
+        }
+        if (d > UB2MAXVAL) return FALSE;
+
+        for (ub4 k = 0; k < size; k++) {
+            taken[trial[k]] = 1;
+        }
+        displacements[bucket] = (ub2)d;
+    }
+    return TRUE;
+}
+
+static void
+make_displacement_hash(const string_map& strings, displacement_hash& result)
+{
+    static const double loads[] = { 0.99, 0.97, 0.94, 0.90 };
+    dyld3::OverflowSafeArray<key> keys;
+    dyld3::OverflowSafeArray<ub8> vals;          /* lookup8() of each key */
+    dyld3::OverflowSafeArray<ub8> grouped;       /* vals sorted by partition */
+    dyld3::OverflowSafeArray<ub4> partStart;     /* partition p has grouped[partStart[p]..partStart[p+1]-1] */
+    dyld3::OverflowSafeArray<ub4> partNext;
+    dyld3::OverflowSafeArray<ub4> bases;
+    dyld3::OverflowSafeArray<ub2> displacements;
+    dyld3::OverflowSafeArray<ub1> placed;        /* did each partition succeed */
+
+    /* read in the list of keywords */
+    keys.reserve(strings.size());
+    for (string_map::const_iterator s = strings.begin(); s != strings.end(); ++s) {
+        key mykey;
+        mykey.name_k = (ub1 *)s->first;
+        mykey.len_k  = (ub4)strlen(s->first);
+        keys.push_back(mykey);
+    }
+    const ub4 nkeys = (ub4)keys.count();
+    const ub4 npartitions = (nkeys + DISPLACEMENT_KEYS_PER_PARTITION - 1) / DISPLACEMENT_KEYS_PER_PARTITION;
+    ub4 buckets = (nkeys / npartitions) / DISPLACEMENT_KEYS_PER_BUCKET + 2;
+    buckets += buckets & 1;                      /* keeps checkbytes 4-byte aligned */
+
+    vals.resize(nkeys);
+    grouped.resize(nkeys);
+    partStart.resize(npartitions+1);
+    partNext.resize(npartitions);
+    bases.resize(npartitions+1);
+    displacements.resize(npartitions*buckets);
+    placed.resize(npartitions);
+    ub8 *valsPtr = vals.begin();
+    ub8 *groupedPtr = grouped.begin();
+    ub4 *partStartPtr = partStart.begin();
+    ub4 *basesPtr = bases.begin();
+    ub2 *displacementsPtr = displacements.begin();
+    ub1 *placedPtr = placed.begin();
+    key *keysPtr = keys.begin();
+
+    for (ub4 l = 0; l < sizeof(loads)/sizeof(loads[0]); l++) {
+        for (ub4 si = 1; si <= DISPLACEMENT_RETRY_SALT; si++) {
+            ub8 salt = (l*DISPLACEMENT_RETRY_SALT + si) * 0x9e3779b97f4a7c13LL; /* golden ratio (arbitrary value) */
+
+            /* hash every key */
+#if BUILDING_CACHE_BUILDER
+            dispatch_apply(nkeys, DISPATCH_APPLY_AUTO, ^(size_t index) {
+                valsPtr[index] = lookup8(keysPtr[index].name_k, keysPtr[index].len_k, salt);
+            });
+#else
+            for (size_t index = 0; index != nkeys; ++index) {
+                valsPtr[index] = lookup8(keysPtr[index].name_k, keysPtr[index].len_k, salt);
+            }
+#endif
+
+            /* sort them by partition, and give each partition its share of the slots */
+            bzero(partStartPtr, sizeof(ub4)*(npartitions+1));
+            for (ub4 i = 0; i < nkeys; i++) {
+                ++partStartPtr[objc_stringhash_t::displacementPartition(valsPtr[i], npartitions)+1];
+            }
+            basesPtr[0] = 0;
+            for (ub4 p = 0; p < npartitions; p++) {
+                ub4 slots = (ub4)((partStartPtr[p+1] / loads[l]) + 1);  /* never empty, see displacementHash() */
+                basesPtr[p+1] = basesPtr[p] + slots;
+                partStartPtr[p+1] += partStartPtr[p];
+                partNext[p] = partStartPtr[p];
+            }
+            for (ub4 i = 0; i < nkeys; i++) {
+                groupedPtr[partNext[objc_stringhash_t::displacementPartition(valsPtr[i], npartitions)]++] = valsPtr[i];
+            }
+
+            /* place each partition */
+#if BUILDING_CACHE_BUILDER
+            dispatch_apply(npartitions, DISPATCH_APPLY_AUTO, ^(size_t p) {
+                placedPtr[p] = place_partition(&groupedPtr[partStartPtr[p]], partStartPtr[p+1] - partStartPtr[p],
+                                               buckets, basesPtr[p+1] - basesPtr[p], &displacementsPtr[p*buckets]);
+            });
+#else
+            for (size_t p = 0; p != npartitions; ++p) {
+                placedPtr[p] = place_partition(&groupedPtr[partStartPtr[p]], partStartPtr[p+1] - partStartPtr[p],
+                                               buckets, basesPtr[p+1] - basesPtr[p], &displacementsPtr[p*buckets]);
+            }
+#endif
+            ub4 p;
+            for (p = 0; p < npartitions; p++) {
+                if (!placedPtr[p]) break;
+            }
+            if (p < npartitions) {
+#if SELOPT_DEBUG
+                fprintf(stderr, "displacement hash failed with load %f salt %llu\n", loads[l], salt);
+#endif
+                continue;
+            }
+
+            /* build the tables */
+            result.capacity = (basesPtr[npartitions] + 3) & ~3;  /* keeps offsets 4-byte aligned */
+            result.occupied = nkeys;
+            result.partitions = npartitions;
+            result.buckets = buckets;
+            result.salt = salt;
+            result.partitionBases = std::move(bases);
+            result.displacements = std::move(displacements);
+            return;
+        }
+    }
+
+    result.capacity = 0;
+    result.occupied = 0;
+    result.partitions = 0;
+    result.buckets = 0;
+    result.salt = 0;
+}
+
 // SELOPT_WRITE
 #endif
 
@@ -1617,6 +1981,7 @@ make_perfect(const dyld3::OverflowSafeArray<const char*>& strings, perfect_hash&
 // namespace objc_selopt
 };
 
+#undef S16
 #undef S32
 #undef S64
 
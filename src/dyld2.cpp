@@ -243,6 +243,7 @@ struct EnvironmentVariables {
 	bool						DYLD_PRINT_OPTS;
 	bool						DYLD_PRINT_ENV;
 	bool						DYLD_DISABLE_DOFS;
+	bool						DYLD_FLAT_SYMBOL_INDEX;
 	bool						hasOverride;
                             //  DYLD_SHARED_CACHE_DIR           ==> sSharedCacheOverrideDir
 							//	DYLD_ROOT_PATH					==> gLinkContext.rootPaths
@@ -411,18 +412,24 @@ enum CommPageFlags : uint64_t {
 };
 
 //
-// The MappedRanges structure is used for fast address->image lookups.
+// The MappedRanges table is used for fast address->image lookups.
 // The table is only updated when the dyld lock is held, so we don't
 // need to worry about multiple writers.  But readers may look at this
-// data without holding the lock. Therefore, all updates must be done
-// in an order that will never cause readers to see inconsistent data.
-// The general rule is that if the image field is non-NULL then
-// the other fields are valid.
+// data without holding the lock. Therefore the first count entries of
+// a table are never modified once published.  The table is sorted by
+// start address and has spare capacity, so an image loaded above every
+// existing range is appended: its entries are written past count, then
+// count is bumped after a barrier.  Any other change builds a new table
+// and swaps it in with a barrier.  Readers binary search the entries
+// below the count they loaded, and never wait or retry.  A replaced
+// table is kept on a retired list until a writer sees no readers in
+// findMappedRange() after the swap.
 //
 struct MappedRanges
 {
-	MappedRanges*		next;
-	unsigned long		count;
+	MappedRanges*			next;		// only used by retired tables
+	unsigned long			capacity;
+	volatile unsigned long	count;
 	struct {
 		ImageLoader*	image;
 		uintptr_t		start;
@@ -430,79 +437,173 @@ struct MappedRanges
 	} array[1];
 };
 
-static MappedRanges*	sMappedRangesStart;
+static MappedRanges* volatile	sMappedRanges;
+static MappedRanges*			sRetiredMappedRanges;
+static volatile int32_t			sMappedRangesReaders;
+
+static MappedRanges* allocMappedRanges(unsigned long capacity)
+{
+	size_t allocationSize = sizeof(MappedRanges) + (capacity-1)*3*sizeof(void*);
+	MappedRanges* newRanges = (MappedRanges*)malloc(allocationSize);
+	bzero(newRanges, allocationSize);
+	newRanges->capacity = capacity;
+	return newRanges;
+}
 
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wdeprecated-declarations"
-void addMappedRange(ImageLoader* image, uintptr_t start, uintptr_t end)
-{
-	//dyld::log("addMappedRange(0x%lX->0x%lX) for %s\n", start, end, image->getShortName());
-	for (MappedRanges* p = sMappedRangesStart; p != NULL; p = p->next) {
-		for (unsigned long i=0; i < p->count; ++i) {
-			if ( p->array[i].image == NULL ) {
-				p->array[i].start = start;
-				p->array[i].end = end;
-				// add image field last with a barrier so that any reader will see consistent records
-				OSMemoryBarrier();
-				p->array[i].image = image;
-				return;
-			}
+static void publishMappedRanges(MappedRanges* newRanges)
+{
+	// fill in the whole table before making it visible to readers
+	OSMemoryBarrier();
+	MappedRanges* oldRanges = sMappedRanges;
+	sMappedRanges = newRanges;
+	OSMemoryBarrier();
+	if ( oldRanges != NULL ) {
+		oldRanges->next = sRetiredMappedRanges;
+		sRetiredMappedRanges = oldRanges;
+	}
+	// Any reader that starts after this point will load the new table, so if there are
+	// no readers right now, nothing can still be using the retired tables.
+	if ( sMappedRangesReaders == 0 ) {
+		for (MappedRanges* p = sRetiredMappedRanges; p != NULL; ) {
+			MappedRanges* next = p->next;
+			free(p);
+			p = next;
 		}
+		sRetiredMappedRanges = NULL;
 	}
-	// table must be full, chain another
-#if SUPPORT_ACCELERATE_TABLES
-	unsigned count = (sAllCacheImagesProxy != NULL) ? 16 : 400;
-#else
-	unsigned count = 400;
-#endif
-	size_t allocationSize = sizeof(MappedRanges) + (count-1)*3*sizeof(void*);
-	MappedRanges* newRanges = (MappedRanges*)malloc(allocationSize);
-	bzero(newRanges, allocationSize);
-	newRanges->count = count;
-	newRanges->array[0].start = start;
-	newRanges->array[0].end = end;
-	newRanges->array[0].image = image;
-	OSMemoryBarrier();
-	if ( sMappedRangesStart == NULL ) {
-		sMappedRangesStart = newRanges;
+}
+
+void addMappedRanges(ImageLoader* image)
+{
+	// coalesce contiguous segments, and count how many ranges this image needs
+	unsigned long rangeCount = 0;
+	uintptr_t lowestStart = UINTPTR_MAX;
+	uintptr_t lastSegEnd = 0;
+	for(unsigned int i=0, e=image->segmentCount(); i < e; ++i) {
+		if ( image->segUnaccessible(i) )
+			continue;
+		if ( (lastSegEnd == 0) || (image->segActualLoadAddress(i) != lastSegEnd) )
+			++rangeCount;
+		lowestStart = std::min(lowestStart, image->segActualLoadAddress(i));
+		lastSegEnd = image->segActualEndAddress(i);
 	}
-	else {
-		for (MappedRanges* p = sMappedRangesStart; p != NULL; p = p->next) {
-			if ( p->next == NULL ) {
-				OSMemoryBarrier();
-				p->next = newRanges;
-				break;
+	if ( rangeCount == 0 )
+		return;
+
+	// Images are mostly loaded above every existing range, so if there is room the new
+	// ranges can be appended to the current table, where readers won't look until count changes
+	MappedRanges* oldRanges = sMappedRanges;
+	unsigned long oldCount = (oldRanges != NULL) ? oldRanges->count : 0;
+	MappedRanges* ranges = oldRanges;
+	bool append = (oldRanges != NULL) && (oldCount + rangeCount <= oldRanges->capacity)
+				  && ((oldCount == 0) || (oldRanges->array[oldCount-1].start < lowestStart));
+	if ( !append ) {
+		unsigned long capacity = (oldRanges != NULL) ? oldRanges->capacity : 256;
+		while ( capacity < oldCount + rangeCount )
+			capacity *= 2;
+		ranges = allocMappedRanges(capacity);
+		for (unsigned long i=0; i < oldCount; ++i)
+			ranges->array[i] = oldRanges->array[i];
+	}
+
+	unsigned long index = oldCount;
+	uintptr_t lastSegStart = 0;
+	lastSegEnd = 0;
+	for(unsigned int i=0, e=image->segmentCount(); i < e; ++i) {
+		if ( image->segUnaccessible(i) )
+			continue;
+		uintptr_t start = image->segActualLoadAddress(i);
+		uintptr_t end = image->segActualEndAddress(i);
+		if ( start == lastSegEnd ) {
+			// two segments are contiguous, just record combined segments
+			lastSegEnd = end;
+		}
+		else {
+			// non-contiguous segments, record last (if any)
+			if ( lastSegEnd != 0 ) {
+				//dyld::log("addMappedRange(0x%lX->0x%lX) for %s\n", lastSegStart, lastSegEnd, image->getShortName());
+				ranges->array[index].image = image;
+				ranges->array[index].start = lastSegStart;
+				ranges->array[index].end = lastSegEnd;
+				++index;
 			}
+			lastSegStart = start;
+			lastSegEnd = end;
 		}
 	}
+	ranges->array[index].image = image;
+	ranges->array[index].start = lastSegStart;
+	ranges->array[index].end = lastSegEnd;
+
+	// the image's own segments may not be in address order, and a new table may need them merged in
+	std::sort(&ranges->array[oldCount], &ranges->array[oldCount + rangeCount],
+			  [](const auto& a, const auto& b) { return a.start < b.start; });
+	if ( append ) {
+		// write the new entries before making them visible to readers
+		OSMemoryBarrier();
+		ranges->count = oldCount + rangeCount;
+		OSMemoryBarrier();
+	}
+	else {
+		std::inplace_merge(&ranges->array[0], &ranges->array[oldCount], &ranges->array[oldCount + rangeCount],
+						   [](const auto& a, const auto& b) { return a.start < b.start; });
+		ranges->count = oldCount + rangeCount;
+		publishMappedRanges(ranges);
+	}
 }
 
 void removedMappedRanges(ImageLoader* image)
 {
-	for (MappedRanges* p = sMappedRangesStart; p != NULL; p = p->next) {
-		for (unsigned long i=0; i < p->count; ++i) {
-			if ( p->array[i].image == image ) {
-				// clear with a barrier so that any reader will see consistent records
-				OSMemoryBarrier();
-				p->array[i].image = NULL;
-			}
-		}
+	MappedRanges* oldRanges = sMappedRanges;
+	if ( oldRanges == NULL )
+		return;
+	unsigned long removeCount = 0;
+	for (unsigned long i=0; i < oldRanges->count; ++i) {
+		if ( oldRanges->array[i].image == image )
+			++removeCount;
 	}
+	if ( removeCount == 0 )
+		return;
+
+	MappedRanges* newRanges = allocMappedRanges(oldRanges->capacity);
+	unsigned long index = 0;
+	for (unsigned long i=0; i < oldRanges->count; ++i) {
+		if ( oldRanges->array[i].image != image )
+			newRanges->array[index++] = oldRanges->array[i];
+	}
+	newRanges->count = index;
+	publishMappedRanges(newRanges);
 }
-#pragma clang diagnostic pop
 
 ImageLoader* findMappedRange(uintptr_t target)
 {
-	for (MappedRanges* p = sMappedRangesStart; p != NULL; p = p->next) {
-		for (unsigned long i=0; i < p->count; ++i) {
-			if ( p->array[i].image != NULL ) {
-				if ( (p->array[i].start <= target) && (target < p->array[i].end) )
-					return p->array[i].image;
-			}
+	ImageLoader* result = NULL;
+	OSAtomicIncrement32Barrier(&sMappedRangesReaders);
+	MappedRanges* ranges = sMappedRanges;
+	if ( ranges != NULL ) {
+		// entries below the count loaded here were all written before it was published
+		OSMemoryBarrier();
+		unsigned long count = ranges->count;
+		OSMemoryBarrier();
+		// find the last range starting at or before target
+		unsigned long low = 0;
+		unsigned long high = count;
+		while ( low < high ) {
+			unsigned long mid = low + (high - low)/2;
+			if ( ranges->array[mid].start <= target )
+				low = mid + 1;
+			else
+				high = mid;
 		}
+		if ( (low != 0) && (target < ranges->array[low-1].end) )
+			result = ranges->array[low-1].image;
 	}
-	return NULL;
+	OSAtomicDecrement32Barrier(&sMappedRangesReaders);
+	return result;
 }
+#pragma clang diagnostic pop
 
 
 
@@ -1519,6 +1620,82 @@ static void addDynamicReference(ImageLoader* from, ImageLoader* to) {
 #pragma clang diagnostic pop
 }
 
+//
+// When DYLD_FLAT_SYMBOL_INDEX is set, the result of each flat lookup is remembered
+// so that flat namespace images and -undefined dynamic_lookup bundles, which can do
+// thousands of flat lookups while binding, don't walk every image's trie each time.
+//
+// Entries are never removed from the map, just invalidated with generation counts.
+// A new image is appended to the search order, so it can only change a result which
+// was a weak definition or not found.  Anything else (unloading an image, hiding or
+// unhiding an image's exports with RTLD_LOCAL or private bundles, or images
+// that are searched before existing ones) invalidates every entry.
+//
+struct FlatSymbolIndexEntry
+{
+	const ImageLoader*			image;			// NULL if symbol was not found
+	const ImageLoader::Symbol*	sym;
+	uint32_t					generation;
+	uint32_t					addGeneration;
+	bool						isWeakDef;
+};
+typedef dyld3::Map<const char*, FlatSymbolIndexEntry, ImageLoader::HashCString, ImageLoader::EqualCString> FlatSymbolIndex;
+
+static FlatSymbolIndex*		sFlatSymbolIndex = NULL;
+static uint32_t				sFlatSymbolIndexGeneration = 1;
+static uint32_t				sFlatSymbolIndexAddGeneration = 1;
+
+static void flatSymbolIndexImageAdded()
+{
+	++sFlatSymbolIndexAddGeneration;
+}
+
+void flatSymbolIndexInvalidateAll()
+{
+	++sFlatSymbolIndexGeneration;
+}
+
+static bool flatSymbolIndexLookup(const char* name, const ImageLoader::Symbol** sym, const ImageLoader** image, bool* found)
+{
+	if ( sFlatSymbolIndex == NULL )
+		return false;
+	auto it = sFlatSymbolIndex->find(name);
+	if ( it == sFlatSymbolIndex->end() )
+		return false;
+	const FlatSymbolIndexEntry& entry = it->second;
+	if ( entry.generation != sFlatSymbolIndexGeneration )
+		return false;
+	// a later image could have a non-weak definition which would win
+	if ( ((entry.image == NULL) || entry.isWeakDef) && (entry.addGeneration != sFlatSymbolIndexAddGeneration) )
+		return false;
+	*found = (entry.image != NULL);
+	if ( *found ) {
+		*sym   = entry.sym;
+		*image = entry.image;
+	}
+	return true;
+}
+
+static void flatSymbolIndexRecord(const char* name, const ImageLoader::Symbol* sym, const ImageLoader* image)
+{
+	if ( sFlatSymbolIndex == NULL )
+		sFlatSymbolIndex = new FlatSymbolIndex();
+	FlatSymbolIndexEntry entry;
+	entry.image         = image;
+	entry.sym           = sym;
+	entry.generation    = sFlatSymbolIndexGeneration;
+	entry.addGeneration = sFlatSymbolIndexAddGeneration;
+	entry.isWeakDef     = (image != NULL) && ((image->getExportedSymbolInfo(sym) & ImageLoader::kWeakDefinition) != 0);
+	auto it = sFlatSymbolIndex->find(name);
+	if ( it != sFlatSymbolIndex->end() ) {
+		it->second = entry;
+	}
+	else {
+		// the name is owned by the caller, which may be unloaded before the index is
+		sFlatSymbolIndex->insert({ strdup(name), entry });
+	}
+}
+
 static void addImage(ImageLoader* image)
 {
 	// add to master list
@@ -1527,29 +1704,11 @@ static void addImage(ImageLoader* image)
     allImagesUnlock();
 	
 	// update mapped ranges
-	uintptr_t lastSegStart = 0;
-	uintptr_t lastSegEnd = 0;
-	for(unsigned int i=0, e=image->segmentCount(); i < e; ++i) {
-		if ( image->segUnaccessible(i) ) 
-			continue;
-		uintptr_t start = image->segActualLoadAddress(i);
-		uintptr_t end = image->segActualEndAddress(i);
-		if ( start == lastSegEnd ) {
-			// two segments are contiguous, just record combined segments
-			lastSegEnd = end;
-		}
-		else {
-			// non-contiguous segments, record last (if any)
-			if ( lastSegEnd != 0 )
-				addMappedRange(image, lastSegStart, lastSegEnd);
-			lastSegStart = start;
-			lastSegEnd = end;
-		}		
-	}
-	if ( lastSegEnd != 0 )
-		addMappedRange(image, lastSegStart, lastSegEnd);
+	addMappedRanges(image);
+
+	// new image is last in flat search order, so only weak or missing symbols could now resolve differently
+	flatSymbolIndexImageAdded();
 
-	
 	if ( gLinkContext.verboseLoading || (sEnv.DYLD_PRINT_LIBRARIES_POST_LAUNCH && (sMainExecutable!=NULL) && sMainExecutable->isLinked()) ) {
 		const char *imagePath = image->getPath();
 		uuid_t imageUUID;
@@ -1636,6 +1795,9 @@ void removeImage(ImageLoader* image)
 	if ( sLastImageByAddressCache == image )
 		sLastImageByAddressCache = NULL;
 
+	// any remembered flat lookup could have found this image
+	flatSymbolIndexInvalidateAll();
+
 	// if in root list, pull it out 
 	for (std::vector<ImageLoader*>::iterator it=sImageRoots.begin(); it != sImageRoots.end(); it++) {
 		if ( *it == image ) {
@@ -2224,6 +2386,9 @@ void processDyldEnvironmentVariable(const char* key, const char* value, const ch
 	else if ( strcmp(key, "DYLD_PRINT_CODE_SIGNATURES") == 0 ) {
 		gLinkContext.verboseCodeSignatures = true;
 	}
+	else if ( strcmp(key, "DYLD_FLAT_SYMBOL_INDEX") == 0 ) {
+		sEnv.DYLD_FLAT_SYMBOL_INDEX = true;
+	}
 	else if ( (strcmp(key, "DYLD_SHARED_REGION") == 0) && gLinkContext.allowEnvVarsSharedCache ) {
 		if ( strcmp(value, "private") == 0 ) {
 			gLinkContext.sharedRegionMode = ImageLoader::kUsePrivateSharedRegion;
@@ -4625,7 +4790,21 @@ static bool findExportedSymbol(const char* name, bool onlyInCoalesced, const Ima
 
 bool flatFindExportedSymbol(const char* name, const ImageLoader::Symbol** sym, const ImageLoader** image)
 {
-	return findExportedSymbol(name, false, sym, image);
+	// the accelerator table proxy loads images behind our back, so don't remember results when using it
+	bool useIndex = sEnv.DYLD_FLAT_SYMBOL_INDEX;
+#if SUPPORT_ACCELERATE_TABLES
+	if ( sAllCacheImagesProxy != NULL )
+		useIndex = false;
+#endif
+	if ( !useIndex )
+		return findExportedSymbol(name, false, sym, image);
+
+	bool found;
+	if ( flatSymbolIndexLookup(name, sym, image, &found) )
+		return found;
+	found = findExportedSymbol(name, false, sym, image);
+	flatSymbolIndexRecord(name, found ? *sym : NULL, found ? *image : NULL);
+	return found;
 }
 
 bool findCoalescedExportedSymbol(const char* name, const ImageLoader::Symbol** sym, const ImageLoader** image, ImageLoader::CoalesceNotifier notifier)
@@ -7227,6 +7406,8 @@ reloadAllImages:
 		// record count of inserted libraries so that a flat search will look at 
 		// inserted libraries, then main, then others.
 		sInsertedDylibCount = sAllImages.size()-1;
+		if ( sInsertedDylibCount > 0 )
+			flatSymbolIndexInvalidateAll();
 
 		// link main executable
 		gLinkContext.linkingMainExecutable = true;
@@ -7297,7 +7478,8 @@ reloadAllImages:
 			sAddBulkLoadImageCallbacks.clear();
 			sDisableAcceleratorTables = true;
 			sAllCacheImagesProxy = NULL;
-			sMappedRangesStart = NULL;
+			sMappedRanges = NULL;
+			flatSymbolIndexInvalidateAll();
 			mainExcutableAlreadyRebased = true;
 			gLinkContext.linkingMainExecutable = false;
 			resetAllImages();
@@ -1080,8 +1080,10 @@ NSModule NSLinkModule(NSObjectFileImage objectFileImage, const char* moduleName,
 		}
 
 		// support private bundles
-		if ( (options & NSLINKMODULE_OPTION_PRIVATE) != 0 )
+		if ( (options & NSLINKMODULE_OPTION_PRIVATE) != 0 ) {
 			objectFileImage->image->setHideExports();
+			dyld::flatSymbolIndexInvalidateAll();
+		}
 	
 		// set up linking options
 		bool forceLazysBound = ( (options & NSLINKMODULE_OPTION_BINDNOW) != 0 );
@@ -1126,8 +1128,10 @@ static NSModule _dyld_link_module(NSObjectFileImage object_addr, size_t object_s
 		
 		if ( image != NULL ) {		
 			// support private bundles
-			if ( (options & NSLINKMODULE_OPTION_PRIVATE) != 0 )
+			if ( (options & NSLINKMODULE_OPTION_PRIVATE) != 0 ) {
 				image->setHideExports();
+				dyld::flatSymbolIndexInvalidateAll();
+			}
 		
 			// set up linking options
 			bool forceLazysBound = ( (options & NSLINKMODULE_OPTION_BINDNOW) != 0 );
@@ -1315,6 +1319,7 @@ static bool NSMakePrivateModulePublic(NSModule module)
 	if ( image != NULL ) {
 		if ( image->hasHiddenExports() ) {
 			image->setHideExports(false);
+			dyld::flatSymbolIndexInvalidateAll();
 			return true;
 		}
 	}
@@ -1620,13 +1625,17 @@ void* dlopen_internal(const char* path, int mode, void* callerAddress)
 				dyld::link(image, forceLazysBound, false, callersRPaths, cacheIndex);
 				if ( alreadyLinked ) {
 					// upgrade
-					if ( ((mode & RTLD_LOCAL) == 0) && image->hasHiddenExports() )
+					if ( ((mode & RTLD_LOCAL) == 0) && image->hasHiddenExports() ) {
 						image->setHideExports(false);
+						dyld::flatSymbolIndexInvalidateAll();
+					}
 				}
 				else {
-					// only hide exports if image is not already in use
-					if ( (mode & RTLD_LOCAL) != 0 )
+					// only hide exports if image is not already in use.  Binding may already have found them
+					if ( (mode & RTLD_LOCAL) != 0 ) {
 						image->setHideExports(true);
+						dyld::flatSymbolIndexInvalidateAll();
+					}
 				}
 			}
 			
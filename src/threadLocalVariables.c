@@ -78,44 +78,75 @@ typedef struct TLVDescriptor  TLVDescriptor;
 // implemented in assembly
 extern void* tlv_get_addr(TLVDescriptor*);
 
+typedef void (*InitFunc)(void);
+
+struct TLVInitializers
+{
+	InitFunc*		funcs;
+	size_t			count;
+};
+typedef struct TLVInitializers	TLVInitializers;
+
+//
+// Everything needed to set up an image's TLV storage on a new thread.
+// Computed once when the image is loaded, then never changed or freed
+// (images with TLVs are never unloaded), so threads can use it without
+// taking any lock.
+//
 struct TLVImageInfo
 {
 	pthread_key_t				key;
 	const struct mach_header*	mh;
+	const uint8_t*				templateStart;
+	unsigned long				templateSize;
+	uint32_t					initializerSectionCount;
+	TLVInitializers				initializerSections[];
 };
 typedef struct TLVImageInfo		TLVImageInfo;
 
-static TLVImageInfo*	tlv_live_images = NULL;
+// Most keys are small, so they index straight into this table.  Any others
+// are found in tlv_live_images, which is guarded by tlv_live_image_lock.
+#define TLV_KEY_TABLE_SIZE		512
+static TLVImageInfo*	tlv_images_by_key[TLV_KEY_TABLE_SIZE];
+
+static TLVImageInfo**	tlv_live_images = NULL;
 static unsigned int		tlv_live_image_alloc_count = 0;
 static unsigned int		tlv_live_image_used_count = 0;
 static pthread_mutex_t	tlv_live_image_lock = PTHREAD_MUTEX_INITIALIZER;
 
-static void tlv_set_key_for_image(const struct mach_header* mh, pthread_key_t key)
+static void tlv_set_info_for_key(TLVImageInfo* info)
 {
+	if ( info->key < TLV_KEY_TABLE_SIZE ) {
+		// release so that any thread which sees the pointer also sees the fields
+		__atomic_store_n(&tlv_images_by_key[info->key], info, __ATOMIC_RELEASE);
+		return;
+	}
 	pthread_mutex_lock(&tlv_live_image_lock);
 		if ( tlv_live_image_used_count == tlv_live_image_alloc_count ) {
 			unsigned int newCount = (tlv_live_images == NULL) ? 8 : 2*tlv_live_image_alloc_count;
-			struct TLVImageInfo* newBuffer = malloc(sizeof(TLVImageInfo)*newCount);
+			TLVImageInfo** newBuffer = malloc(sizeof(TLVImageInfo*)*newCount);
 			if ( tlv_live_images != NULL ) {
-				memcpy(newBuffer, tlv_live_images, sizeof(TLVImageInfo)*tlv_live_image_used_count);
+				memcpy(newBuffer, tlv_live_images, sizeof(TLVImageInfo*)*tlv_live_image_used_count);
 				free(tlv_live_images);
 			}
 			tlv_live_images = newBuffer;
 			tlv_live_image_alloc_count = newCount;
 		}
-		tlv_live_images[tlv_live_image_used_count].key = key;
-		tlv_live_images[tlv_live_image_used_count].mh = mh;
+		tlv_live_images[tlv_live_image_used_count] = info;
 		++tlv_live_image_used_count;
 	pthread_mutex_unlock(&tlv_live_image_lock);
 }
 
-static const struct mach_header* tlv_get_image_for_key(pthread_key_t key)
+static const TLVImageInfo* tlv_get_info_for_key(pthread_key_t key)
 {
-	const struct mach_header* result = NULL;
+	if ( key < TLV_KEY_TABLE_SIZE )
+		return __atomic_load_n(&tlv_images_by_key[key], __ATOMIC_ACQUIRE);
+
+	const TLVImageInfo* result = NULL;
 	pthread_mutex_lock(&tlv_live_image_lock);
 		for(unsigned int i=0; i < tlv_live_image_used_count; ++i) {
-			if ( tlv_live_images[i].key == key ) {
-				result = tlv_live_images[i].mh;
+			if ( tlv_live_images[i]->key == key ) {
+				result = tlv_live_images[i];
 				break;
 			}
 		}
@@ -123,21 +154,15 @@ static const struct mach_header* tlv_get_image_for_key(pthread_key_t key)
 	return result;
 }
 
-
-// called lazily when TLV is first accessed
-__attribute__((visibility("hidden")))
-void* tlv_allocate_and_initialize_for_key(pthread_key_t key)
+// find the TLV template and initializers in an image, done once when the image is loaded
+static TLVImageInfo* tlv_make_info_for_image(const struct mach_header* mh, pthread_key_t key)
 {
-	const struct mach_header* mh = tlv_get_image_for_key(key);
-	if ( mh == NULL )
-		return NULL;	// if data structures are screwed up, don't crash
-	
-	// first pass, find size and template
+	// first pass, find size and template, and count initializer sections
 	uint8_t*		start = NULL;
 	unsigned long	size = 0;
 	intptr_t		slide = 0;
 	bool			slideComputed = false;
-	bool			hasInitializers = false;
+	uint32_t		initializerSectionCount = 0;
 	const uint32_t	cmd_count = mh->ncmds;
 	const struct load_command* const cmds = (struct load_command*)(((uint8_t*)mh) + sizeof(macho_header));
 	const struct load_command* cmd = cmds;
@@ -153,7 +178,7 @@ void* tlv_allocate_and_initialize_for_key(pthread_key_t key)
 			for (const macho_section* sect=sectionsStart; sect < sectionsEnd; ++sect) {
 				switch ( sect->flags & SECTION_TYPE ) {
 					case S_THREAD_LOCAL_INIT_FUNCTION_POINTERS:
-						hasInitializers = true;
+						++initializerSectionCount;
 						break;
 					case S_THREAD_LOCAL_ZEROFILL:
 					case S_THREAD_LOCAL_REGULAR:
@@ -173,19 +198,17 @@ void* tlv_allocate_and_initialize_for_key(pthread_key_t key)
 		}
 		cmd = (const struct load_command*)(((char*)cmd)+cmd->cmdsize);
 	}
-    // no thread local storage in image: should never happen
-    if ( size == 0 )
-        return NULL;
-	
-	// allocate buffer and fill with template
-	void* buffer = malloc(size);
-	memcpy(buffer, start, size);
-	
-	// set this thread's value for key to be the new buffer.
-	pthread_setspecific(key, buffer);
-	
-	// second pass, run initializers
-	if ( hasInitializers ) {
+
+	TLVImageInfo* info = malloc(offsetof(TLVImageInfo, initializerSections[initializerSectionCount]));
+	info->key                     = key;
+	info->mh                      = mh;
+	info->templateStart           = start;
+	info->templateSize            = size;
+	info->initializerSectionCount = initializerSectionCount;
+
+	// second pass, record initializers
+	if ( initializerSectionCount != 0 ) {
+		uint32_t index = 0;
 		cmd = cmds;
 		for (uint32_t i = 0; i < cmd_count; ++i) {
 			if ( cmd->cmd == LC_SEGMENT_COMMAND) {
@@ -194,19 +217,46 @@ void* tlv_allocate_and_initialize_for_key(pthread_key_t key)
 				const macho_section* const sectionsEnd = &sectionsStart[seg->nsects];
 				for (const macho_section* sect=sectionsStart; sect < sectionsEnd; ++sect) {
 					if ( (sect->flags & SECTION_TYPE) == S_THREAD_LOCAL_INIT_FUNCTION_POINTERS ) {
-						typedef void (*InitFunc)(void);
-						InitFunc* funcs = (InitFunc*)(sect->addr + slide);
-						const size_t count = sect->size / sizeof(uintptr_t);
-						for (size_t j=count; j > 0; --j) {
-							InitFunc func = funcs[j-1];
-							func();
-						}
+						info->initializerSections[index].funcs = (InitFunc*)(sect->addr + slide);
+						info->initializerSections[index].count = sect->size / sizeof(uintptr_t);
+						++index;
 					}
 				}
 			}
 			cmd = (const struct load_command*)(((char*)cmd)+cmd->cmdsize);
 		}
 	}
+	return info;
+}
+
+
+// called lazily when TLV is first accessed
+__attribute__((visibility("hidden")))
+void* tlv_allocate_and_initialize_for_key(pthread_key_t key)
+{
+	const TLVImageInfo* info = tlv_get_info_for_key(key);
+	if ( info == NULL )
+		return NULL;	// if data structures are screwed up, don't crash
+
+    // no thread local storage in image: should never happen
+    if ( info->templateSize == 0 )
+        return NULL;
+
+	// allocate buffer and fill with template
+	void* buffer = malloc(info->templateSize);
+	memcpy(buffer, info->templateStart, info->templateSize);
+
+	// set this thread's value for key to be the new buffer.
+	pthread_setspecific(key, buffer);
+
+	// run initializers
+	for (uint32_t i=0; i < info->initializerSectionCount; ++i) {
+		InitFunc* funcs = info->initializerSections[i].funcs;
+		for (size_t j=info->initializerSections[i].count; j > 0; --j) {
+			InitFunc func = funcs[j-1];
+			func();
+		}
+	}
 	return buffer;
 }
 
@@ -245,7 +295,7 @@ static void tlv_initialize_descriptors(const struct mach_header* mh)
 							int result = pthread_key_create(&key, &tlv_free);
 							if ( result != 0 )
 								abort();
-							tlv_set_key_for_image(mh, key);
+							tlv_set_info_for_key(tlv_make_info_for_image(mh, key));
 						}
 						// initialize each descriptor
 						TLVDescriptor* start = (TLVDescriptor*)(sect->addr + slide);
@@ -0,0 +1,75 @@
+
+// BUILD:  $CC main.c -o $BUILD_DIR/dyld_images_for_addresses-shared-cache.exe
+
+// RUN:  ./dyld_images_for_addresses-shared-cache.exe
+
+// Resolves a million random addresses in the TEXT of cached dylibs, checking each result and logging the cost per lookup
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <uuid/uuid.h>
+#include <mach/mach_time.h>
+#include <mach-o/dyld_priv.h>
+
+#include "test_support.h"
+
+#define kLookupCount    (1024*1024)
+#define kBatchSize      1024
+
+struct TextRange {
+    const void* start;
+    uint64_t    size;
+};
+
+int main(int argc, const char* argv[], const char* envp[], const char* apple[]) {
+    size_t cacheLen;
+    const uint8_t* cacheStart = (uint8_t*)_dyld_get_shared_cache_range(&cacheLen);
+    uuid_t cacheUuid;
+    if ( (cacheStart == NULL) || !_dyld_get_shared_cache_uuid(cacheUuid) )
+        PASS("no dyld shared cache");
+
+    __block struct TextRange* ranges = NULL;
+    __block unsigned          rangeCount = 0;
+    dyld_shared_cache_iterate_text(cacheUuid, ^(const dyld_shared_cache_dylib_text_info* info) {
+        ranges = (struct TextRange*)realloc(ranges, sizeof(struct TextRange) * (rangeCount+1));
+        ranges[rangeCount].start = cacheStart + info->textSegmentOffset;
+        ranges[rangeCount].size  = info->textSegmentSize;
+        ++rangeCount;
+    });
+    if ( rangeCount == 0 )
+        FAIL("no dylibs found in dyld shared cache");
+
+    const void**                   addresses = (const void**)malloc(sizeof(const void*) * kBatchSize);
+    const void**                   expected  = (const void**)malloc(sizeof(const void*) * kBatchSize);
+    struct dyld_image_uuid_offset* infos     = (struct dyld_image_uuid_offset*)malloc(sizeof(struct dyld_image_uuid_offset) * kBatchSize);
+
+    uint64_t elapsed = 0;
+    srandom(1);
+    for (unsigned batch=0; batch < kLookupCount/kBatchSize; ++batch) {
+        // random dylibs each time, so that the lookup of the previous address never helps
+        for (unsigned i=0; i < kBatchSize; ++i) {
+            const struct TextRange* range = &ranges[random() % rangeCount];
+            addresses[i] = (uint8_t*)range->start + (random() % range->size);
+            expected[i]  = range->start;
+        }
+
+        uint64_t start = mach_absolute_time();
+        _dyld_images_for_addresses(kBatchSize, addresses, infos);
+        elapsed += mach_absolute_time() - start;
+
+        for (unsigned i=0; i < kBatchSize; ++i) {
+            if ( infos[i].image != expected[i] )
+                FAIL("address %p resolved to image %p instead of %p", addresses[i], infos[i].image, expected[i]);
+            if ( infos[i].offsetInImage != (uint64_t)((uint8_t*)addresses[i] - (uint8_t*)expected[i]) )
+                FAIL("address %p has wrong offset 0x%llX in image %p", addresses[i], infos[i].offsetInImage, expected[i]);
+        }
+    }
+
+    mach_timebase_info_data_t timebase;
+    mach_timebase_info(&timebase);
+    uint64_t elapsedNs = elapsed * timebase.numer / timebase.denom;
+    LOG("%u lookups across %u cached dylibs: %lluns per lookup", kLookupCount, rangeCount, elapsedNs / kLookupCount);
+
+    PASS("Success");
+}
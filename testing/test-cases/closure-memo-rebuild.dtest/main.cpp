@@ -0,0 +1,165 @@
+// BUILD(macos):  $CXX main.cpp -std=c++17 -o $BUILD_DIR/closure-memo-rebuild.exe
+
+// BUILD(ios,tvos,watchos,bridgeos):
+
+// RUN_TIMEOUT: 3600
+// ./closure-memo-rebuild.exe
+
+// Builds a simulator shared cache twice with the same -closure_memo_dir, and checks that the first build
+// saves its launch closures in the memo directory and the second build reuses all of them
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <fts.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <mach-o/loader.h>
+#include <mach-o/fat.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "test_support.h"
+
+extern char** environ;
+
+static const char* const sInputDirs[] = {
+    "/usr/lib", "/usr/libexec", "/usr/bin", "/usr/sbin", "/System/Library/Frameworks", "/System/Library/PrivateFrameworks"
+};
+
+static std::string findSimulatorRuntimeRoot()
+{
+    std::string result;
+    glob_t globbed;
+    if ( glob("/Library/Developer/CoreSimulator/Profiles/Runtimes/iOS*.simruntime/Contents/Resources/RuntimeRoot", 0, nullptr, &globbed) == 0 ) {
+        if ( globbed.gl_pathc != 0 )
+            result = globbed.gl_pathv[globbed.gl_pathc - 1];
+    }
+    globfree(&globbed);
+    if ( result.empty() ) {
+        const char* xcodeRoot = "/Applications/Xcode.app/Contents/Developer/Platforms/iPhoneOS.platform/Library/Developer/CoreSimulator/Profiles/Runtimes/iOS.simruntime/Contents/Resources/RuntimeRoot";
+        if ( access(xcodeRoot, R_OK) == 0 )
+            result = xcodeRoot;
+    }
+    return result;
+}
+
+static bool isMachO(const char* path)
+{
+    int fd = open(path, O_RDONLY);
+    if ( fd == -1 )
+        return false;
+    uint32_t magic = 0;
+    bool result = (pread(fd, &magic, sizeof(magic), 0) == sizeof(magic))
+               && ((magic == MH_MAGIC_64) || (magic == FAT_CIGAM) || (magic == FAT_MAGIC));
+    close(fd);
+    return result;
+}
+
+// Writes a JSON manifest for the dyld_shared_cache_builder which lists every Mach-O under the input dirs of the root
+static void writeManifest(const std::string& root, const std::string& manifestPath)
+{
+    std::string files;
+    for (const char* inputDir : sInputDirs) {
+        std::string dirPath = root + inputDir;
+        char* const paths[] = { (char*)dirPath.c_str(), nullptr };
+        FTS* fts = fts_open(paths, FTS_PHYSICAL | FTS_NOCHDIR, nullptr);
+        if ( fts == nullptr )
+            continue;
+        while ( FTSENT* entry = fts_read(fts) ) {
+            if ( (entry->fts_info != FTS_F) || !isMachO(entry->fts_path) )
+                continue;
+            if ( !files.empty() )
+                files += ",\n";
+            files += "        { \"path\": \"" + std::string(entry->fts_path + root.size()) + "\", \"flags\": \"NoFlags\" }";
+        }
+        fts_close(fts);
+    }
+
+#if __arm64__
+    const char* arch = "arm64";
+#else
+    const char* arch = "x86_64";
+#endif
+    FILE* manifest = fopen(manifestPath.c_str(), "w");
+    if ( manifest == nullptr )
+        FAIL("could not create %s", manifestPath.c_str());
+    fprintf(manifest, "{\n");
+    fprintf(manifest, "    \"version\": 1,\n");
+    fprintf(manifest, "    \"buildOptions\": {\n");
+    fprintf(manifest, "        \"version\": 1,\n");
+    fprintf(manifest, "        \"updateName\": \"closure-memo-rebuild\",\n");
+    fprintf(manifest, "        \"deviceName\": \"closure-memo-rebuild\",\n");
+    fprintf(manifest, "        \"disposition\": \"Customer\",\n");
+    fprintf(manifest, "        \"platform\": \"iOS_simulator\",\n");
+    fprintf(manifest, "        \"archs\": [ \"%s\" ]\n", arch);
+    fprintf(manifest, "    },\n");
+    fprintf(manifest, "    \"files\": [\n%s\n    ]\n", files.c_str());
+    fprintf(manifest, "}\n");
+    fclose(manifest);
+}
+
+static void buildCache(const std::string& root, const std::string& manifestPath, const std::string& dstRoot, const std::string& memoDir)
+{
+    const char* args[] = { "dyld_shared_cache_builder", "-root", root.c_str(), "-dylib_cache", root.c_str(),
+                           "-json_manifest", manifestPath.c_str(), "-dst_root", dstRoot.c_str(),
+                           "-closure_memo_dir", memoDir.c_str(), nullptr };
+    pid_t pid;
+    if ( posix_spawn(&pid, "/usr/local/bin/dyld_shared_cache_builder", nullptr, nullptr, (char* const*)args, environ) != 0 )
+        FAIL("could not launch dyld_shared_cache_builder");
+    int status;
+    if ( (waitpid(pid, &status, 0) == -1) || !WIFEXITED(status) || (WEXITSTATUS(status) != 0) )
+        FAIL("dyld_shared_cache_builder failed");
+}
+
+// Each memo file's inode.  Saving a closure writes a new file and renames it over the old one, so the inode changes
+static std::map<std::string, ino_t> memoFiles(const std::string& memoDir)
+{
+    std::map<std::string, ino_t> result;
+    char* const paths[] = { (char*)memoDir.c_str(), nullptr };
+    FTS* fts = fts_open(paths, FTS_PHYSICAL | FTS_NOCHDIR, nullptr);
+    if ( fts == nullptr )
+        return result;
+    while ( FTSENT* entry = fts_read(fts) ) {
+        if ( entry->fts_info == FTS_F )
+            result[entry->fts_path] = entry->fts_statp->st_ino;
+    }
+    fts_close(fts);
+    return result;
+}
+
+int main(int argc, const char* argv[], const char* envp[], const char* apple[])
+{
+    std::string root = findSimulatorRuntimeRoot();
+    if ( root.empty() )
+        FAIL("no simulator runtime to build a cache from");
+
+    char tempDir[] = "/tmp/closure-memo-rebuild.XXXXXX";
+    if ( mkdtemp(tempDir) == nullptr )
+        FAIL("could not create temp dir");
+    std::string manifestPath = std::string(tempDir) + "/manifest.json";
+    std::string dstRoot      = std::string(tempDir) + "/dst";
+    std::string memoDir      = std::string(tempDir) + "/memo";
+    mkdir(dstRoot.c_str(), 0755);
+    writeManifest(root, manifestPath);
+
+    buildCache(root, manifestPath, dstRoot, memoDir);
+    std::map<std::string, ino_t> firstBuildMemos = memoFiles(memoDir);
+    if ( firstBuildMemos.empty() )
+        FAIL("first build did not save any launch closures");
+    LOG("first build saved %lu launch closures", firstBuildMemos.size());
+
+    // nothing changed, so the second build must take every closure from the memo without saving any
+    buildCache(root, manifestPath, dstRoot, memoDir);
+    std::map<std::string, ino_t> secondBuildMemos = memoFiles(memoDir);
+    if ( secondBuildMemos != firstBuildMemos )
+        FAIL("second build rebuilt launch closures instead of reusing the memo");
+
+    PASS("Success");
+}
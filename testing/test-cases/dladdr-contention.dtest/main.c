@@ -0,0 +1,76 @@
+
+// BUILD:  $CC foo.c -dynamiclib  -install_name $RUN_DIR/libfoo.dylib -o $BUILD_DIR/libfoo.dylib
+// BUILD:  $CC main.c -o $BUILD_DIR/dladdr-contention.exe -DRUN_DIR="$RUN_DIR"
+
+// RUN:  ./dladdr-contention.exe
+
+// Several threads call dladdr() and _dyld_get_image_name() while another thread keeps dlopen()ing and dlclose()ing
+// a dylib.  Checks every lookup is correct and logs the lookup throughput of the reader threads.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+#include <stdatomic.h>
+#include <mach/mach_time.h>
+#include <mach-o/dyld.h>
+#include <dispatch/dispatch.h>
+
+#include "test_support.h"
+
+#define kReaderThreads      4
+#define kReaderLookups      200000
+#define kDlopenIterations   2000
+
+int myfunc()
+{
+    return 3;
+}
+
+int main(int argc, const char* argv[], const char* envp[], const char* apple[]) {
+    Dl_info mainInfo;
+    if ( dladdr(&myfunc, &mainInfo) == 0 )
+        FAIL("dladdr(&myfunc) failed");
+
+    __block atomic_bool readersDone = false;
+    __block uint64_t    readerTime[kReaderThreads];
+    dispatch_group_t    group = dispatch_group_create();
+    dispatch_queue_t    queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+
+    // one thread constantly changes the image list
+    dispatch_group_async(group, queue, ^{
+        for (int i=0; (i < kDlopenIterations) || !atomic_load(&readersDone); ++i) {
+            void* handle = dlopen(RUN_DIR "/libfoo.dylib", RTLD_LAZY);
+            if ( handle == NULL )
+                FAIL("dlopen(libfoo.dylib) failed: %s", dlerror());
+            dlclose(handle);
+        }
+    });
+
+    // the rest just read it
+    dispatch_apply(kReaderThreads, queue, ^(size_t index) {
+        uint64_t start = mach_absolute_time();
+        for (int i=0; i < kReaderLookups; ++i) {
+            Dl_info info;
+            if ( dladdr(&myfunc, &info) == 0 )
+                FAIL("dladdr(&myfunc) failed");
+            if ( (info.dli_fbase != mainInfo.dli_fbase) || (info.dli_saddr != mainInfo.dli_saddr) )
+                FAIL("dladdr(&myfunc) returned %p/%p instead of %p/%p", info.dli_fbase, info.dli_saddr, mainInfo.dli_fbase, mainInfo.dli_saddr);
+            if ( _dyld_get_image_name(0) == NULL )
+                FAIL("_dyld_get_image_name(0) returned NULL");
+        }
+        readerTime[index] = mach_absolute_time() - start;
+    });
+    atomic_store(&readersDone, true);
+    dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+
+    mach_timebase_info_data_t timebase;
+    mach_timebase_info(&timebase);
+    uint64_t totalTime = 0;
+    for (int i=0; i < kReaderThreads; ++i)
+        totalTime += readerTime[i];
+    uint64_t totalNs = totalTime * timebase.numer / timebase.denom;
+    LOG("%d reader threads: %lluns per lookup while dlopen()ing", kReaderThreads, totalNs / (kReaderThreads * kReaderLookups));
+
+    PASS("Success");
+}
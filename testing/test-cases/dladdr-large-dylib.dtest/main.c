@@ -0,0 +1,138 @@
+
+// BUILD:  $CC foo.c -dynamiclib -install_name $RUN_DIR/libfoo.dylib -o $BUILD_DIR/libfoo.dylib
+// BUILD:  $CC main.c -DRUN_DIR="$RUN_DIR" -framework CoreFoundation -o $BUILD_DIR/dladdr-large-dylib.exe
+
+// RUN:  ./dladdr-large-dylib.exe
+
+// Calls dladdr() on random addresses in the largest loaded dylib, checking results are consistent and logging the cost per lookup.
+// Meanwhile other threads call dladdr() on the same dylib, and dlopen() and dlclose() another one, which dladdr() must not wait on
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <dlfcn.h>
+#include <dispatch/dispatch.h>
+#include <mach/mach_time.h>
+#include <mach-o/dyld.h>
+#include <mach-o/getsect.h>
+
+#include "test_support.h"
+
+#define kLookupCount    (256*1024)
+#define kThreadCount    4
+
+static atomic_bool sDone;
+
+// checks dladdr() finds the largest dylib and a symbol at or below each address
+static void checkLookups(const struct mach_header* mh, const uint8_t* text, unsigned long textSize, unsigned seed)
+{
+    while ( !atomic_load(&sDone) ) {
+        const void* addr = text + (rand_r(&seed) % textSize);
+        Dl_info info;
+        if ( dladdr(addr, &info) == 0 )
+            FAIL("dladdr(%p) failed on background thread", addr);
+        if ( info.dli_fbase != mh )
+            FAIL("dladdr(%p) found image %p instead of %p on background thread", addr, info.dli_fbase, mh);
+        if ( (info.dli_saddr != NULL) && (info.dli_saddr > addr) )
+            FAIL("dladdr(%p) found symbol %s at higher address %p on background thread", addr, info.dli_sname, info.dli_saddr);
+    }
+}
+
+// loads and unloads a dylib, which publishes a new image list each time, and looks up a symbol in it while loaded
+static void loadAndUnload()
+{
+    while ( !atomic_load(&sDone) ) {
+        void* handle = dlopen(RUN_DIR "/libfoo.dylib", RTLD_NOW);
+        if ( handle == NULL )
+            FAIL("dlopen(libfoo.dylib) failed: %s", dlerror());
+        const void* foo = dlsym(handle, "foo");
+        if ( foo == NULL )
+            FAIL("dlsym(foo) failed");
+        for (int i=0; i < 2; ++i) {
+            Dl_info info;
+            if ( (dladdr(foo, &info) == 0) || (info.dli_saddr != foo) || (info.dli_sname == NULL) || (strcmp(info.dli_sname, "foo") != 0) )
+                FAIL("dladdr(%p) did not find foo in libfoo.dylib", foo);
+        }
+        dlclose(handle);
+    }
+}
+
+int main(int argc, const char* argv[], const char* envp[], const char* apple[]) {
+    // find dylib with the most __TEXT
+    const struct mach_header* largestMh = NULL;
+    const char*               largestPath = NULL;
+    const uint8_t*            largestText = NULL;
+    unsigned long             largestTextSize = 0;
+    for (uint32_t i=0; i < _dyld_image_count(); ++i) {
+        const struct mach_header* mh = _dyld_get_image_header(i);
+        if ( mh->filetype != MH_DYLIB )
+            continue;
+        unsigned long textSize = 0;
+        const uint8_t* text = getsegmentdata((const struct mach_header_64*)mh, "__TEXT", &textSize);
+        if ( textSize > largestTextSize ) {
+            largestMh       = mh;
+            largestPath     = _dyld_get_image_name(i);
+            largestText     = text;
+            largestTextSize = textSize;
+        }
+    }
+    if ( largestMh == NULL )
+        FAIL("no dylibs loaded");
+    LOG("using %s with 0x%lX bytes of __TEXT", largestPath, largestTextSize);
+
+    // the first lookup in an image walks its symbol table, so remember it to compare against the indexed lookup
+    srandom(1);
+    const void* firstAddr = largestText + (random() % largestTextSize);
+    Dl_info firstInfo;
+    if ( dladdr(firstAddr, &firstInfo) == 0 )
+        FAIL("dladdr(%p) failed", firstAddr);
+
+    dispatch_group_t group = dispatch_group_create();
+    dispatch_queue_t queue = dispatch_get_global_queue(QOS_CLASS_DEFAULT, 0);
+    dispatch_group_async(group, queue, ^{
+        loadAndUnload();
+    });
+    for (unsigned t=0; t < kThreadCount; ++t) {
+        dispatch_group_async(group, queue, ^{
+            checkLookups(largestMh, largestText, largestTextSize, t + 2);
+        });
+    }
+
+    uint64_t elapsed = 0;
+    for (unsigned i=0; i < kLookupCount; ++i) {
+        const void* addr = largestText + (random() % largestTextSize);
+        Dl_info info;
+        uint64_t start = mach_absolute_time();
+        int result = dladdr(addr, &info);
+        elapsed += mach_absolute_time() - start;
+        if ( result == 0 )
+            FAIL("dladdr(%p) failed", addr);
+        if ( info.dli_fbase != largestMh )
+            FAIL("dladdr(%p) found image %p instead of %p", addr, info.dli_fbase, largestMh);
+        if ( info.dli_saddr == NULL )
+            continue;
+        if ( info.dli_saddr > addr )
+            FAIL("dladdr(%p) found symbol %s at higher address %p", addr, info.dli_sname, info.dli_saddr);
+        // the symbol found should be the closest one to its own address too
+        Dl_info symInfo;
+        if ( (dladdr(info.dli_saddr, &symInfo) == 0) || (symInfo.dli_saddr != info.dli_saddr) )
+            FAIL("dladdr(%p) found symbol %s at %p which does not look up to itself", addr, info.dli_sname, info.dli_saddr);
+    }
+
+    atomic_store(&sDone, true);
+    dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+
+    Dl_info againInfo;
+    if ( dladdr(firstAddr, &againInfo) == 0 )
+        FAIL("dladdr(%p) failed", firstAddr);
+    if ( (againInfo.dli_saddr != firstInfo.dli_saddr) || (againInfo.dli_sname != firstInfo.dli_sname) )
+        FAIL("dladdr(%p) returned %s/%p at first but %s/%p later", firstAddr, firstInfo.dli_sname, firstInfo.dli_saddr, againInfo.dli_sname, againInfo.dli_saddr);
+
+    mach_timebase_info_data_t timebase;
+    mach_timebase_info(&timebase);
+    uint64_t elapsedNs = elapsed * timebase.numer / timebase.denom;
+    LOG("%u dladdr() calls: %lluns per call", kLookupCount, elapsedNs / kLookupCount);
+
+    PASS("Success");
+}
@@ -0,0 +1,94 @@
+
+// BUILD:  $CC foo.c -bundle -DBUNDLE=1 -o $BUILD_DIR/test1.bundle
+// BUILD:  $CC foo.c -bundle -DBUNDLE=2 -o $BUILD_DIR/test2.bundle
+// BUILD:  $CC foo.c -bundle -DBUNDLE=3 -o $BUILD_DIR/test3.bundle
+// BUILD:  $CC foo.c -bundle -DBUNDLE=4 -o $BUILD_DIR/test4.bundle
+// BUILD:  $CC main.c -DRUN_DIR="$RUN_DIR" -o $BUILD_DIR/dlopen-bundle-address-stress.exe
+
+// RUN:  ./dlopen-bundle-address-stress.exe
+// RUN:  DYLD_USE_CLOSURES=0 ./dlopen-bundle-address-stress.exe
+
+// Loads and unloads bundles hundreds of times while other threads look up which image contains an address.
+// Addresses in images that stay loaded must always be found, and addresses not in any image must never be.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <dlfcn.h>
+#include <stdatomic.h>
+#include <mach-o/dyld.h>
+#include <dispatch/dispatch.h>
+
+#include "test_support.h"
+
+#define kBundleCount        4
+#define kLoadIterations     500
+#define kReaderThreads      4
+
+int myfunc()
+{
+    return 3;
+}
+
+int main(int argc, const char* argv[], const char* envp[], const char* apple[]) {
+    Dl_info mainInfo;
+    if ( dladdr(&myfunc, &mainInfo) == 0 )
+        FAIL("dladdr(&myfunc) failed");
+    Dl_info libSystemInfo;
+    if ( dladdr(&malloc, &libSystemInfo) == 0 )
+        FAIL("dladdr(&malloc) failed");
+
+    __block atomic_bool loadingDone = false;
+    dispatch_group_t    group = dispatch_group_create();
+    dispatch_queue_t    queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+
+    for (int r=0; r < kReaderThreads; ++r) {
+        dispatch_group_async(group, queue, ^{
+            while ( !atomic_load(&loadingDone) ) {
+                Dl_info info;
+                if ( dladdr(&myfunc, &info) == 0 )
+                    FAIL("dladdr(&myfunc) failed");
+                if ( info.dli_fbase != mainInfo.dli_fbase )
+                    FAIL("dladdr(&myfunc) found image %p instead of %p", info.dli_fbase, mainInfo.dli_fbase);
+                if ( dladdr(&malloc, &info) == 0 )
+                    FAIL("dladdr(&malloc) failed");
+                if ( info.dli_fbase != libSystemInfo.dli_fbase )
+                    FAIL("dladdr(&malloc) found image %p instead of %p", info.dli_fbase, libSystemInfo.dli_fbase);
+                if ( dladdr((void*)16, &info) != 0 )
+                    FAIL("dladdr(16) unexpectedly found %s", info.dli_fname);
+            }
+        });
+    }
+
+    // keep a few bundles loaded at any time, so lookups also search among changing images
+    void* handles[kBundleCount];
+    bzero(handles, sizeof(handles));
+    for (int i=0; i < kLoadIterations; ++i) {
+        int slot = i % kBundleCount;
+        if ( handles[slot] != NULL )
+            dlclose(handles[slot]);
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), RUN_DIR "/test%d.bundle", slot+1);
+        handles[slot] = dlopen(path, RTLD_LAZY);
+        if ( handles[slot] == NULL )
+            FAIL("dlopen(\"%s\") failed: %s", path, dlerror());
+        int (*fooPtr)(void) = (int (*)(void))dlsym(handles[slot], "foo");
+        if ( fooPtr == NULL )
+            FAIL("dlsym(foo) failed in %s", path);
+        Dl_info info;
+        if ( dladdr(fooPtr, &info) == 0 )
+            FAIL("dladdr(foo) failed in %s", path);
+        if ( strcmp(info.dli_fname, path) != 0 )
+            FAIL("dladdr(foo) returned %s instead of %s", info.dli_fname, path);
+        if ( fooPtr() != slot+1 )
+            FAIL("foo() in %s returned %d", path, fooPtr());
+    }
+    for (int i=0; i < kBundleCount; ++i)
+        dlclose(handles[i]);
+
+    atomic_store(&loadingDone, true);
+    dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+
+    PASS("Success");
+}
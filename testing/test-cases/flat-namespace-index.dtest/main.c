@@ -0,0 +1,66 @@
+
+// BUILD:  $CC weak.c   -dynamiclib -install_name $RUN_DIR/libweak.dylib   -o $BUILD_DIR/libweak.dylib
+// BUILD:  $CC strong.c -dynamiclib -install_name $RUN_DIR/libstrong.dylib -o $BUILD_DIR/libstrong.dylib
+// BUILD:  $CC plugin.c -bundle -undefined dynamic_lookup -o $BUILD_DIR/plugin1.bundle
+// BUILD:  $CC plugin.c -bundle -undefined dynamic_lookup -o $BUILD_DIR/plugin2.bundle
+// BUILD:  $CC plugin.c -bundle -undefined dynamic_lookup -o $BUILD_DIR/plugin3.bundle
+// BUILD:  $CC plugin.c -bundle -undefined dynamic_lookup -o $BUILD_DIR/plugin4.bundle
+// BUILD:  $CC plugin.c -bundle -undefined dynamic_lookup -o $BUILD_DIR/plugin5.bundle
+// BUILD:  $CC main.c -DRUN_DIR="$RUN_DIR" -o $BUILD_DIR/flat-namespace-index.exe
+
+// RUN:  DYLD_USE_CLOSURES=0 ./flat-namespace-index.exe
+// RUN:  DYLD_USE_CLOSURES=0 DYLD_FLAT_SYMBOL_INDEX=1 ./flat-namespace-index.exe
+
+// Checks flat lookups from dynamic_lookup bundles pick the first non-weak definition, or else the first weak one,
+// as images defining the symbol are loaded and unloaded, and as RTLD_LOCAL hides their exports.
+
+#include <stdio.h>
+#include <dlfcn.h>
+
+#include "test_support.h"
+
+static void* checkPlugin(const char* path, int expected)
+{
+    void* handle = dlopen(path, RTLD_NOW);
+    if ( handle == NULL )
+        FAIL("dlopen(\"%s\") failed: %s", path, dlerror());
+    int (*pluginValue)(void) = (int (*)(void))dlsym(handle, "pluginValue");
+    if ( pluginValue == NULL )
+        FAIL("dlsym(pluginValue) failed in %s", path);
+    int result = pluginValue();
+    if ( result != expected )
+        FAIL("%s bound value() returning %d, expected %d", path, result, expected);
+    return handle;
+}
+
+int main(int argc, const char* argv[], const char* envp[], const char* apple[]) {
+    void* weakHandle = dlopen(RUN_DIR "/libweak.dylib", RTLD_NOW | RTLD_GLOBAL);
+    if ( weakHandle == NULL )
+        FAIL("dlopen(libweak.dylib) failed: %s", dlerror());
+    checkPlugin(RUN_DIR "/plugin1.bundle", 1);
+
+    // a non-weak definition loaded later wins over the weak one
+    void* strongHandle = dlopen(RUN_DIR "/libstrong.dylib", RTLD_NOW | RTLD_GLOBAL);
+    if ( strongHandle == NULL )
+        FAIL("dlopen(libstrong.dylib) failed: %s", dlerror());
+    void* plugin2Handle = checkPlugin(RUN_DIR "/plugin2.bundle", 2);
+
+    // once the non-weak definition is unloaded, the weak one is used again
+    dlclose(plugin2Handle);
+    dlclose(strongHandle);
+    checkPlugin(RUN_DIR "/plugin3.bundle", 1);
+
+    // exports of an RTLD_LOCAL image are not found by flat lookups
+    void* localHandle = dlopen(RUN_DIR "/libstrong.dylib", RTLD_NOW | RTLD_LOCAL);
+    if ( localHandle == NULL )
+        FAIL("dlopen(libstrong.dylib, RTLD_LOCAL) failed: %s", dlerror());
+    checkPlugin(RUN_DIR "/plugin4.bundle", 1);
+
+    // until it is upgraded to RTLD_GLOBAL, which doesn't load any new image
+    void* globalHandle = dlopen(RUN_DIR "/libstrong.dylib", RTLD_NOW | RTLD_GLOBAL);
+    if ( globalHandle == NULL )
+        FAIL("dlopen(libstrong.dylib, RTLD_GLOBAL) failed: %s", dlerror());
+    checkPlugin(RUN_DIR "/plugin5.bundle", 2);
+
+    PASS("Success");
+}
@@ -0,0 +1,3 @@
+extern int value();
+
+int pluginValue() { return value(); }
@@ -0,0 +1 @@
+int value() { return 2; }
@@ -0,0 +1,2 @@
+__attribute__((weak))
+int value() { return 1; }
@@ -0,0 +1,44 @@
+#import <Foundation/Foundation.h>
+
+// AttachedClass and its categories are all in this dylib, so the shared cache builder
+// merges the categories in to the class when this dylib is in the cache
+
+@protocol AttachedProtocol
+- (int)protocolValue;
+@end
+
+@interface AttachedClass : NSObject
+- (int)value;
++ (int)classValue;
+- (int)classOnlyValue;
+@end
+
+@implementation AttachedClass
+- (int)value { return 1; }
++ (int)classValue { return 1; }
+- (int)classOnlyValue { return 1; }
+@end
+
+@interface AttachedClass (First)
+@end
+
+@implementation AttachedClass (First)
+- (int)value { return 2; }
++ (int)classValue { return 2; }
+- (int)firstOnlyValue { return 2; }
+@end
+
+@interface AttachedClass (Second) <AttachedProtocol>
+@property (readonly) int secondProperty;
+@end
+
+@implementation AttachedClass (Second)
+- (int)value { return 3; }
++ (int)classValue { return 3; }
+- (int)protocolValue { return 3; }
+- (int)secondProperty { return 3; }
+@end
+
+// Somewhere in this image, to find its mach_header
+void attachedImageAnchor() {
+}
@@ -0,0 +1,77 @@
+
+// BUILD:  $CC attached.m -dynamiclib -o $BUILD_DIR/libattached.dylib -install_name $RUN_DIR/libattached.dylib -lobjc -framework Foundation
+// BUILD:  $CC main.m -o $BUILD_DIR/objc-category-attach.exe $BUILD_DIR/libattached.dylib -lobjc -framework Foundation
+
+// RUN:  ./objc-category-attach.exe
+
+// Categories on a class in the same dylib are merged in to the class when the shared cache is built.
+// Whether they were merged by the cache builder or attached by libobjc, the methods must resolve
+// the same way: the last category in __objc_catlist wins, and every category wins over the class.
+
+#include <dlfcn.h>
+#include <string.h>
+#include <mach-o/dyld_priv.h>
+#include <mach-o/getsect.h>
+#include <objc/runtime.h>
+
+#import <Foundation/Foundation.h>
+
+#include "test_support.h"
+
+@interface AttachedClass : NSObject
+- (int)value;
++ (int)classValue;
+- (int)classOnlyValue;
+@end
+
+extern void attachedImageAnchor();
+
+static int callIntMethod(id obj, const char* selName)
+{
+    SEL sel = sel_registerName(selName);
+    if ( ![obj respondsToSelector:sel] )
+        FAIL("%s does not respond to %s", class_getName(object_getClass(obj)), selName);
+    IMP imp = class_getMethodImplementation(object_getClass(obj), sel);
+    return ((int (*)(id, SEL))imp)(obj, sel);
+}
+
+// Categories still in the image's __objc_catlist are the ones left for libobjc to attach
+static unsigned long catlistCount(const struct mach_header_64* mh)
+{
+    unsigned long size = 0;
+    if ( getsectiondata(mh, "__DATA_CONST", "__objc_catlist", &size) == NULL )
+        getsectiondata(mh, "__DATA", "__objc_catlist", &size);
+    return size / sizeof(void*);
+}
+
+int main(int argc, const char* argv[], const char* envp[], const char* apple[]) {
+    AttachedClass* obj = [AttachedClass new];
+
+    if ( [obj value] != 3 )
+        FAIL("-value should come from the last category, got %d", [obj value]);
+    if ( [AttachedClass classValue] != 3 )
+        FAIL("+classValue should come from the last category, got %d", [AttachedClass classValue]);
+    if ( [obj classOnlyValue] != 1 )
+        FAIL("-classOnlyValue should come from the class, got %d", [obj classOnlyValue]);
+    if ( callIntMethod(obj, "firstOnlyValue") != 2 )
+        FAIL("-firstOnlyValue should come from the first category");
+    if ( callIntMethod(obj, "protocolValue") != 3 )
+        FAIL("-protocolValue should come from the second category");
+
+    if ( !class_conformsToProtocol([AttachedClass class], objc_getProtocol("AttachedProtocol")) )
+        FAIL("AttachedClass should conform to the second category's protocol");
+    if ( class_getProperty([AttachedClass class], "secondProperty") == NULL )
+        FAIL("AttachedClass should have the second category's property");
+
+    // In the shared cache, the builder should have attached both categories
+    Dl_info info;
+    if ( dladdr((void*)&attachedImageAnchor, &info) == 0 )
+        FAIL("could not find libattached.dylib");
+    if ( _dyld_shared_cache_contains_path(info.dli_fname) ) {
+        unsigned long count = catlistCount((const struct mach_header_64*)info.dli_fbase);
+        if ( count != 0 )
+            FAIL("libattached.dylib in the shared cache still has %lu categories for libobjc to attach", count);
+    }
+
+    PASS("Success");
+}
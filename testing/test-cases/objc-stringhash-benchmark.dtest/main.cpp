@@ -0,0 +1,126 @@
+
+// BUILD:  $CXX main.cpp -std=c++17 -DSELOPT_WRITE=1 -DBUILDING_CACHE_BUILDER=1 -I$SRCROOT/include -I$SRCROOT/dyld3 -o $BUILD_DIR/objc-stringhash-benchmark.exe
+
+// RUN:  ./objc-stringhash-benchmark.exe
+
+// Builds the shared cache selector table over a million selector strings with both the Jenkins and the
+// displacement perfect hash, checking every lookup and logging the build time, lookup cost and bytes per key
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <dispatch/dispatch.h>
+#include <libkern/OSByteOrder.h>
+#include <mach/mach_time.h>
+
+#include "Array.h"
+#include "objc-shared-cache.h"
+
+#include "test_support.h"
+
+#define kSelectorCount  (1024*1024)
+#define kMissCount      (64*1024)
+
+static const char* const sWords[] = {
+    "init", "with", "object", "for", "key", "value", "string", "number", "array", "dictionary",
+    "set", "get", "index", "count", "data", "view", "controller", "did", "will", "should",
+    "load", "appear", "layout", "subviews", "frame", "bounds", "color", "image", "name", "path",
+    "url", "request", "response", "error", "handler", "completion", "block", "queue", "delegate", "source"
+};
+#define kWordCount  (sizeof(sWords)/sizeof(sWords[0]))
+
+// makes a selector like "didLoadViewForKey:withHandler:" from the digits of n
+static void makeSelector(uint32_t n, char* buffer, size_t bufferSize)
+{
+    buffer[0] = '\0';
+    uint32_t args = n % 4;
+    for (uint32_t part=0; (n != 0) || (part == 0); ++part) {
+        const char* word = sWords[n % kWordCount];
+        n /= kWordCount;
+        size_t len = strlen(buffer);
+        snprintf(&buffer[len], bufferSize - len, "%c%s", (part == 0) ? word[0] : (word[0] - 'a' + 'A'), &word[1]);
+        if ( part < args )
+            strlcat(buffer, ":", bufferSize);
+    }
+    if ( args != 0 )
+        strlcat(buffer, "Arg:", bufferSize);
+}
+
+static uint64_t nanoseconds(uint64_t machTime)
+{
+    static mach_timebase_info_data_t timebase;
+    if ( timebase.denom == 0 )
+        mach_timebase_info(&timebase);
+    return machTime * timebase.numer / timebase.denom;
+}
+
+int main(int argc, const char* argv[], const char* envp[], const char* apple[]) {
+    // lay the strings out the way the cache does, with the table after them
+    size_t stringsSize = kSelectorCount * 64;
+    size_t tableSize   = kSelectorCount * 16;
+    char* buffer = (char*)malloc(stringsSize + tableSize);
+    if ( buffer == NULL )
+        FAIL("could not allocate %lu bytes", stringsSize + tableSize);
+    char*  tableBuffer = buffer + stringsSize;
+    char** selectors   = (char**)malloc(kSelectorCount * sizeof(char*));
+    objc_opt::string_map strings;
+    size_t stringsUsed = 0;
+    for (uint32_t i=0; i < kSelectorCount; ++i) {
+        char selector[64];
+        makeSelector(i, selector, sizeof(selector));
+        selectors[i] = &buffer[stringsUsed];
+        strlcpy(selectors[i], selector, stringsSize - stringsUsed);
+        stringsUsed += strlen(selector) + 1;
+        strings[selectors[i]] = (uint64_t)selectors[i];
+    }
+    if ( strings.size() != kSelectorCount )
+        FAIL("generated %lu distinct selectors, expected %u", strings.size(), kSelectorCount);
+
+    const uint32_t kinds[] = { objc_opt::JenkinsHash, objc_opt::DisplacementHash };
+    for (uint32_t kind : kinds) {
+        const char* kindName = (kind == objc_opt::DisplacementHash) ? "displacement" : "Jenkins";
+        objc_opt::objc_selopt_t* selopt = new (tableBuffer) objc_opt::objc_selopt_t;
+
+        uint64_t buildStart = mach_absolute_time();
+        const char* err = selopt->write((uint64_t)tableBuffer, tableSize, strings, kind);
+        uint64_t buildTime = mach_absolute_time() - buildStart;
+        if ( err != NULL )
+            FAIL("%s table: %s", kindName, err);
+
+        // every selector must be found at a distinct index
+        uint8_t* used = (uint8_t*)calloc(selopt->capacity, 1);
+        for (uint32_t i=0; i < kSelectorCount; ++i) {
+            uint32_t index = selopt->getIndex(selectors[i]);
+            if ( index == INDEX_NOT_FOUND )
+                FAIL("%s table: %s not found", kindName, selectors[i]);
+            if ( used[index]++ )
+                FAIL("%s table: %s shares index %u", kindName, selectors[i], index);
+            if ( selopt->getEntryForIndex(index) != selectors[i] )
+                FAIL("%s table: %s maps to %s", kindName, selectors[i], selopt->getEntryForIndex(index));
+        }
+        free(used);
+
+        // and selectors that are not in the table must not be
+        for (uint32_t i=0; i < kMissCount; ++i) {
+            char missing[64];
+            makeSelector(i, missing, sizeof(missing));
+            strlcat(missing, "Missing", sizeof(missing));
+            if ( selopt->getIndex(missing) != INDEX_NOT_FOUND )
+                FAIL("%s table: found %s", kindName, missing);
+        }
+
+        uint32_t sink = 0;
+        uint64_t lookupStart = mach_absolute_time();
+        for (uint32_t i=0; i < kSelectorCount; ++i)
+            sink += selopt->getIndex(selectors[(i * 2654435761U) % kSelectorCount]);
+        uint64_t lookupTime = mach_absolute_time() - lookupStart;
+
+        LOG("%s table: built in %llums, %lluns per lookup, %u slots for %u keys, %.2f bytes per key (%u)",
+            kindName, nanoseconds(buildTime) / 1000000, nanoseconds(lookupTime) / kSelectorCount,
+            selopt->capacity, selopt->occupied, (double)selopt->size() / selopt->occupied, sink & 1);
+    }
+
+    PASS("Success");
+}
+
@@ -0,0 +1,7 @@
+static __thread int sValue = NUM;
+static __thread int sCounter;
+
+int touchTLVs()
+{
+    return sValue + sCounter++;
+}
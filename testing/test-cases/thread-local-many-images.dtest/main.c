@@ -0,0 +1,115 @@
+
+// BUILD:  $CC foo.c -dynamiclib -DNUM=1 -install_name $RUN_DIR/libtlv1.dylib -o $BUILD_DIR/libtlv1.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=2 -install_name $RUN_DIR/libtlv2.dylib -o $BUILD_DIR/libtlv2.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=3 -install_name $RUN_DIR/libtlv3.dylib -o $BUILD_DIR/libtlv3.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=4 -install_name $RUN_DIR/libtlv4.dylib -o $BUILD_DIR/libtlv4.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=5 -install_name $RUN_DIR/libtlv5.dylib -o $BUILD_DIR/libtlv5.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=6 -install_name $RUN_DIR/libtlv6.dylib -o $BUILD_DIR/libtlv6.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=7 -install_name $RUN_DIR/libtlv7.dylib -o $BUILD_DIR/libtlv7.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=8 -install_name $RUN_DIR/libtlv8.dylib -o $BUILD_DIR/libtlv8.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=9 -install_name $RUN_DIR/libtlv9.dylib -o $BUILD_DIR/libtlv9.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=10 -install_name $RUN_DIR/libtlv10.dylib -o $BUILD_DIR/libtlv10.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=11 -install_name $RUN_DIR/libtlv11.dylib -o $BUILD_DIR/libtlv11.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=12 -install_name $RUN_DIR/libtlv12.dylib -o $BUILD_DIR/libtlv12.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=13 -install_name $RUN_DIR/libtlv13.dylib -o $BUILD_DIR/libtlv13.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=14 -install_name $RUN_DIR/libtlv14.dylib -o $BUILD_DIR/libtlv14.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=15 -install_name $RUN_DIR/libtlv15.dylib -o $BUILD_DIR/libtlv15.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=16 -install_name $RUN_DIR/libtlv16.dylib -o $BUILD_DIR/libtlv16.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=17 -install_name $RUN_DIR/libtlv17.dylib -o $BUILD_DIR/libtlv17.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=18 -install_name $RUN_DIR/libtlv18.dylib -o $BUILD_DIR/libtlv18.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=19 -install_name $RUN_DIR/libtlv19.dylib -o $BUILD_DIR/libtlv19.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=20 -install_name $RUN_DIR/libtlv20.dylib -o $BUILD_DIR/libtlv20.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=21 -install_name $RUN_DIR/libtlv21.dylib -o $BUILD_DIR/libtlv21.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=22 -install_name $RUN_DIR/libtlv22.dylib -o $BUILD_DIR/libtlv22.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=23 -install_name $RUN_DIR/libtlv23.dylib -o $BUILD_DIR/libtlv23.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=24 -install_name $RUN_DIR/libtlv24.dylib -o $BUILD_DIR/libtlv24.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=25 -install_name $RUN_DIR/libtlv25.dylib -o $BUILD_DIR/libtlv25.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=26 -install_name $RUN_DIR/libtlv26.dylib -o $BUILD_DIR/libtlv26.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=27 -install_name $RUN_DIR/libtlv27.dylib -o $BUILD_DIR/libtlv27.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=28 -install_name $RUN_DIR/libtlv28.dylib -o $BUILD_DIR/libtlv28.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=29 -install_name $RUN_DIR/libtlv29.dylib -o $BUILD_DIR/libtlv29.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=30 -install_name $RUN_DIR/libtlv30.dylib -o $BUILD_DIR/libtlv30.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=31 -install_name $RUN_DIR/libtlv31.dylib -o $BUILD_DIR/libtlv31.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=32 -install_name $RUN_DIR/libtlv32.dylib -o $BUILD_DIR/libtlv32.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=33 -install_name $RUN_DIR/libtlv33.dylib -o $BUILD_DIR/libtlv33.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=34 -install_name $RUN_DIR/libtlv34.dylib -o $BUILD_DIR/libtlv34.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=35 -install_name $RUN_DIR/libtlv35.dylib -o $BUILD_DIR/libtlv35.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=36 -install_name $RUN_DIR/libtlv36.dylib -o $BUILD_DIR/libtlv36.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=37 -install_name $RUN_DIR/libtlv37.dylib -o $BUILD_DIR/libtlv37.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=38 -install_name $RUN_DIR/libtlv38.dylib -o $BUILD_DIR/libtlv38.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=39 -install_name $RUN_DIR/libtlv39.dylib -o $BUILD_DIR/libtlv39.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=40 -install_name $RUN_DIR/libtlv40.dylib -o $BUILD_DIR/libtlv40.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=41 -install_name $RUN_DIR/libtlv41.dylib -o $BUILD_DIR/libtlv41.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=42 -install_name $RUN_DIR/libtlv42.dylib -o $BUILD_DIR/libtlv42.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=43 -install_name $RUN_DIR/libtlv43.dylib -o $BUILD_DIR/libtlv43.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=44 -install_name $RUN_DIR/libtlv44.dylib -o $BUILD_DIR/libtlv44.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=45 -install_name $RUN_DIR/libtlv45.dylib -o $BUILD_DIR/libtlv45.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=46 -install_name $RUN_DIR/libtlv46.dylib -o $BUILD_DIR/libtlv46.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=47 -install_name $RUN_DIR/libtlv47.dylib -o $BUILD_DIR/libtlv47.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=48 -install_name $RUN_DIR/libtlv48.dylib -o $BUILD_DIR/libtlv48.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=49 -install_name $RUN_DIR/libtlv49.dylib -o $BUILD_DIR/libtlv49.dylib
+// BUILD:  $CC foo.c -dynamiclib -DNUM=50 -install_name $RUN_DIR/libtlv50.dylib -o $BUILD_DIR/libtlv50.dylib
+// BUILD:  $CC main.c -DRUN_DIR="$RUN_DIR" -o $BUILD_DIR/thread-local-many-images.exe
+
+// RUN:  ./thread-local-many-images.exe
+
+// Benchmark of first touch of thread local variables.  Repeatedly spawns short lived threads
+// which each touch the TLVs in 50 images, so every thread sets up TLV storage for every image.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <mach/mach_time.h>
+
+#include "test_support.h"
+
+#define kImageCount     50
+#define kThreadCount    200
+
+typedef int (*TouchFunc)(void);
+
+static TouchFunc sTouchFuncs[kImageCount];
+
+static void* worker(void* arg)
+{
+    for (int i=0; i < kImageCount; ++i) {
+        // first touch on this thread sees the template value and a zero filled counter
+        int value = sTouchFuncs[i]();
+        if ( value != i+1 )
+            FAIL("libtlv%d.dylib TLVs returned %d on first touch, expected %d", i+1, value, i+1);
+        value = sTouchFuncs[i]();
+        if ( value != i+2 )
+            FAIL("libtlv%d.dylib TLVs returned %d on second touch, expected %d", i+1, value, i+2);
+    }
+    return NULL;
+}
+
+int main(int argc, const char* argv[], const char* envp[], const char* apple[]) {
+    for (int i=0; i < kImageCount; ++i) {
+        char path[256];
+        snprintf(path, sizeof(path), RUN_DIR "/libtlv%d.dylib", i+1);
+        void* handle = dlopen(path, RTLD_LAZY);
+        if ( handle == NULL )
+            FAIL("dlopen(\"%s\") failed: %s", path, dlerror());
+        sTouchFuncs[i] = (TouchFunc)dlsym(handle, "touchTLVs");
+        if ( sTouchFuncs[i] == NULL )
+            FAIL("dlsym(touchTLVs) failed in %s", path);
+    }
+
+    uint64_t start = mach_absolute_time();
+    for (int i=0; i < kThreadCount; ++i) {
+        pthread_t thread;
+        if ( pthread_create(&thread, NULL, &worker, NULL) != 0 )
+            FAIL("pthread_create() failed");
+        pthread_join(thread, NULL);
+    }
+    uint64_t totalTime = mach_absolute_time() - start;
+
+    mach_timebase_info_data_t timebase;
+    mach_timebase_info(&timebase);
+    uint64_t totalNs = totalTime * timebase.numer / timebase.denom;
+    LOG("%d threads touching TLVs in %d images: %lluns per thread", kThreadCount, kImageCount, totalNs / kThreadCount);
+
+    PASS("Success");
+}